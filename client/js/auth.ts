@@ -1,9 +1,10 @@
 import storage from "./localStorage";
 import location from "./location";
+import historyCache from "./historyCache";
 
 export default class Auth {
 	static signout() {
 		storage.clear();
-		location.reload();
+		void historyCache.clear().finally(() => location.reload());
 	}
 }
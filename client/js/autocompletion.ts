@@ -7,12 +7,18 @@ import {TextareaEditor} from "@textcomplete/textarea";
 import fuzzy from "fuzzy";
 
 import emojiMap from "./helpers/simplemap.json";
+import {WordIndex, nickIndex} from "./helpers/completionIndex";
 import {store} from "./store";
 import {ChanType} from "../../shared/types/chan";
 
 export default enableAutocomplete;
 
-const emojiSearchTerms = Object.keys(emojiMap);
+// Matches shown in the dropdown, and nicks Tab cycles through
+const dropdownLimit = 50;
+const tabLimit = 100;
+
+let emojiIndex: WordIndex | null = null;
+
 const emojiStrategy: StrategyProps = {
 	id: "emoji",
 	match: /(^|\s):([-+\w:?]{2,}):?$/,
@@ -20,7 +26,8 @@ const emojiStrategy: StrategyProps = {
 		// Trim colon from the matched term,
 		// as we are unable to get a clean string from match regex
 		term = term.replace(/:$/, "");
-		callback(fuzzyGrep(term, emojiSearchTerms));
+		emojiIndex = emojiIndex || new WordIndex(Object.keys(emojiMap));
+		callback(emojiIndex.search(term, dropdownLimit));
 	},
 	template([string, original]: [string, string]) {
 		return `<span class="emoji">${String(emojiMap[original])}</span> ${string}`;
@@ -282,12 +289,6 @@ function rawNicks() {
 		return [];
 	}
 
-	if (store.state.activeChannel.channel.users.length > 0) {
-		const users = store.state.activeChannel.channel.users.slice();
-
-		return users.sort((a, b) => b.lastMessage - a.lastMessage).map((u) => u.nick);
-	}
-
 	const me = store.state.activeChannel.network.nick;
 	const otherUser = store.state.activeChannel.channel.name;
 
@@ -301,6 +302,14 @@ function rawNicks() {
 }
 
 function completeNicks(word: string, isFuzzy: boolean) {
+	const channel = store.state.activeChannel?.channel;
+
+	// Channel users come from their index, most recent speakers first
+	if (channel && channel.users.length > 0) {
+		const index = nickIndex(channel);
+		return isFuzzy ? index.search(word, dropdownLimit) : index.complete(word, tabLimit);
+	}
+
 	const users = rawNicks();
 	word = word.toLowerCase();
 
@@ -0,0 +1,425 @@
+import type {ClientChan, ClientUser} from "../types";
+
+/**
+ * Indexes behind autocompletion, so completing doesn't scan every nick or emoji on each key
+ *
+ * Words are kept sorted by their lowercase form for prefix lookups, and each of their
+ * trigrams points back at them for matches inside a word. The nick index of a channel
+ * follows its user list: names lists are applied as a diff, messages bump their sender.
+ * Only the newest speakers are kept in recency order, so completing never walks all of them.
+ */
+
+export type Match = [string, string]; // rendered with the matching part in bold, original
+
+const trigramLength = 3;
+
+// Bulk additions above this are sorted in once instead of inserted one by one
+const bulkThreshold = 16;
+
+// Speakers completed by recency, older ones are completed alphabetically like the others
+const maxSpeakers = 100;
+
+function lowerBound(sorted: string[], value: string) {
+	let low = 0;
+	let high = sorted.length;
+
+	while (low < high) {
+		const mid = (low + high) >>> 1;
+
+		if (sorted[mid] < value) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+function trigrams(key: string) {
+	const grams = new Set<string>();
+
+	for (let i = 0; i + trigramLength <= key.length; i++) {
+		grams.add(key.slice(i, i + trigramLength));
+	}
+
+	return grams;
+}
+
+function bold(word: string, start: number, length: number) {
+	if (length === 0) {
+		return word;
+	}
+
+	const end = start + length;
+	return `${word.slice(0, start)}<b>${word.slice(start, end)}</b>${word.slice(end)}`;
+}
+
+export class WordIndex {
+	private sorted: string[] = []; // lowercase
+	private words = new Map<string, string>(); // lowercase to original
+	private postings = new Map<string, Set<string>>(); // trigram to lowercase words
+
+	constructor(words: Iterable<string> = []) {
+		this.addAll(words);
+	}
+
+	has(key: string) {
+		return this.words.has(key);
+	}
+
+	keys() {
+		return this.words.keys();
+	}
+
+	addAll(words: Iterable<string>) {
+		const added: string[] = [];
+
+		for (const word of words) {
+			const key = word.toLowerCase();
+
+			if (!this.words.has(key)) {
+				added.push(key);
+
+				for (const gram of trigrams(key)) {
+					let posting = this.postings.get(gram);
+
+					if (!posting) {
+						posting = new Set();
+						this.postings.set(gram, posting);
+					}
+
+					posting.add(key);
+				}
+			}
+
+			this.words.set(key, word);
+		}
+
+		if (added.length > bulkThreshold) {
+			this.sorted.push(...added);
+			this.sorted.sort();
+			return;
+		}
+
+		for (const key of added) {
+			this.sorted.splice(lowerBound(this.sorted, key), 0, key);
+		}
+	}
+
+	delete(word: string) {
+		const key = word.toLowerCase();
+
+		if (!this.words.delete(key)) {
+			return;
+		}
+
+		this.sorted.splice(lowerBound(this.sorted, key), 1);
+
+		for (const gram of trigrams(key)) {
+			const posting = this.postings.get(gram);
+			posting?.delete(key);
+
+			if (posting?.size === 0) {
+				this.postings.delete(gram);
+			}
+		}
+	}
+
+	/**
+	 * Words starting with `term` in alphabetical order, as lowercase keys
+	 */
+	*prefixed(term: string): Generator<string> {
+		const prefix = term.toLowerCase();
+
+		for (let i = lowerBound(this.sorted, prefix); i < this.sorted.length; i++) {
+			if (!this.sorted[i].startsWith(prefix)) {
+				return;
+			}
+
+			yield this.sorted[i];
+		}
+	}
+
+	/**
+	 * Words that contain `term` further in, as lowercase keys
+	 * Only walks the words sharing the rarest trigram of the term, nothing for shorter terms
+	 */
+	*containing(term: string): Generator<string> {
+		const needle = term.toLowerCase();
+		let rarest: Set<string> | undefined;
+
+		if (needle.length < trigramLength) {
+			return;
+		}
+
+		for (const gram of trigrams(needle)) {
+			const posting = this.postings.get(gram);
+
+			if (!posting) {
+				return;
+			}
+
+			if (!rarest || posting.size < rarest.size) {
+				rarest = posting;
+			}
+		}
+
+		for (const key of rarest!) {
+			if (key.indexOf(needle) > 0) {
+				yield key;
+			}
+		}
+	}
+
+	original(key: string) {
+		return this.words.get(key) || key;
+	}
+
+	/**
+	 * Up to `limit` matches for a dropdown, words starting with the term first
+	 */
+	search(term: string, limit: number, first: string[] = []): Match[] {
+		const matches: Match[] = [];
+		const seen = new Set(first);
+		const render = (key: string) => {
+			const word = this.original(key);
+			matches.push([bold(word, key.indexOf(term.toLowerCase()), term.length), word]);
+			seen.add(key);
+		};
+
+		for (const key of first) {
+			render(key);
+		}
+
+		for (const source of [this.prefixed(term), this.containing(term)]) {
+			for (const key of source) {
+				if (matches.length >= limit) {
+					return matches;
+				}
+
+				if (!seen.has(key)) {
+					render(key);
+				}
+			}
+		}
+
+		return matches;
+	}
+}
+
+/**
+ * Most recent of the given [key, time] entries, newest first, through a heap of `limit`
+ */
+function mostRecent(entries: Iterable<[string, number]>, limit: number): string[] {
+	const heap: [string, number][] = []; // min-heap on time, the oldest kept entry on top
+	const swap = (i: number, j: number) => ([heap[i], heap[j]] = [heap[j], heap[i]]);
+
+	const down = (start: number) => {
+		for (let i = start; ; ) {
+			const left = 2 * i + 1;
+			const right = left + 1;
+			let smallest = i;
+
+			if (left < heap.length && heap[left][1] < heap[smallest][1]) {
+				smallest = left;
+			}
+
+			if (right < heap.length && heap[right][1] < heap[smallest][1]) {
+				smallest = right;
+			}
+
+			if (smallest === i) {
+				return;
+			}
+
+			swap(i, smallest);
+			i = smallest;
+		}
+	};
+
+	for (const entry of entries) {
+		if (heap.length < limit) {
+			heap.push(entry);
+
+			for (let i = heap.length - 1; i > 0 && heap[(i - 1) >> 1][1] > heap[i][1]; ) {
+				swap(i, (i - 1) >> 1);
+				i = (i - 1) >> 1;
+			}
+		} else if (limit > 0 && entry[1] > heap[0][1]) {
+			heap[0] = entry;
+			down(0);
+		}
+	}
+
+	const result: string[] = [];
+
+	while (heap.length > 0) {
+		result.push(heap[0][0]);
+		heap[0] = heap[heap.length - 1];
+		heap.pop();
+		down(0);
+	}
+
+	return result.reverse();
+}
+
+export class NickIndex {
+	users: ClientUser[] = []; // the user list the index was last synced with
+	private nicks = new WordIndex();
+	private recency = new Map<string, number>(); // lowercase nick to last message, speakers only
+	private speakers: string[] | null = []; // the newest `maxSpeakers` of them, null to rebuild
+
+	/**
+	 * Apply the difference to a new user list, nicks that stay keep their recency
+	 */
+	sync(users: ClientUser[]) {
+		if (users === this.users) {
+			return;
+		}
+
+		const next = new Map<string, ClientUser>();
+
+		for (const user of users) {
+			next.set(user.nick.toLowerCase(), user);
+		}
+
+		for (const key of [...this.nicks.keys()]) {
+			if (!next.has(key)) {
+				this.remove(key);
+			}
+		}
+
+		this.nicks.addAll([...next.values()].map((user) => user.nick));
+		this.speakers = null;
+
+		for (const [key, user] of next) {
+			this.touch(key, user.lastMessage);
+		}
+
+		this.users = users;
+	}
+
+	touch(nick: string, time: number) {
+		const key = nick.toLowerCase();
+
+		if (time > 0 && this.nicks.has(key) && time > (this.recency.get(key) || 0)) {
+			this.recency.set(key, time);
+			this.rank(key, time);
+		}
+	}
+
+	remove(nick: string) {
+		const key = nick.toLowerCase();
+		this.nicks.delete(nick);
+
+		if (this.recency.delete(key) && this.speakers?.includes(key)) {
+			// The next most recent speaker moves up, found on the next completion
+			this.speakers = null;
+		}
+	}
+
+	/**
+	 * Nicks starting with `term`, the ones that spoke last first, then alphabetically
+	 */
+	complete(term: string, limit: number): string[] {
+		return this.completeKeys(term, limit).map((key) => this.nicks.original(key));
+	}
+
+	/**
+	 * Up to `limit` matches for the dropdown, nicks that contain the term after the others
+	 */
+	search(term: string, limit: number): Match[] {
+		return this.nicks.search(term, limit, this.recent(term, limit));
+	}
+
+	/**
+	 * Move a speaker to its place among the newest ones, usually the front
+	 */
+	private rank(key: string, time: number) {
+		const speakers = this.speakers;
+
+		if (!speakers) {
+			return;
+		}
+
+		const at = speakers.indexOf(key);
+
+		if (at !== -1) {
+			speakers.splice(at, 1);
+		}
+
+		let i = 0;
+
+		while (i < speakers.length && this.recency.get(speakers[i])! >= time) {
+			i++;
+		}
+
+		if (i < maxSpeakers) {
+			speakers.splice(i, 0, key);
+			speakers.length = Math.min(speakers.length, maxSpeakers);
+		}
+	}
+
+	private recent(term: string, limit: number) {
+		const prefix = term.toLowerCase();
+		const keys: string[] = [];
+
+		if (!this.speakers) {
+			this.speakers = mostRecent(this.recency, maxSpeakers);
+		}
+
+		for (const key of this.speakers) {
+			if (keys.length >= limit) {
+				break;
+			}
+
+			if (key.startsWith(prefix)) {
+				keys.push(key);
+			}
+		}
+
+		return keys;
+	}
+
+	private completeKeys(term: string, limit: number) {
+		const keys = this.recent(term, limit);
+		const seen = new Set(keys);
+
+		for (const key of this.nicks.prefixed(term)) {
+			if (keys.length >= limit) {
+				break;
+			}
+
+			if (!seen.has(key)) {
+				keys.push(key);
+			}
+		}
+
+		return keys;
+	}
+}
+
+const nickIndexes = new WeakMap<ClientChan, NickIndex>();
+
+/**
+ * Index of the user list of a channel, built on first use and kept in step after that
+ */
+export function nickIndex(channel: ClientChan): NickIndex {
+	let index = nickIndexes.get(channel);
+
+	if (!index) {
+		index = new NickIndex();
+		nickIndexes.set(channel, index);
+	}
+
+	index.sync(channel.users);
+	return index;
+}
+
+/**
+ * The index of a channel if completion built one, for updating it along with the user list
+ */
+export function builtNickIndex(channel: ClientChan): NickIndex | undefined {
+	return nickIndexes.get(channel);
+}
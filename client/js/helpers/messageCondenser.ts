@@ -0,0 +1,219 @@
+import {condensedTypes} from "../../../shared/irc";
+import type {ClientMessage} from "../types";
+
+export type CondensedMessageContainer = {
+	type: "condensed";
+	time: Date;
+	messages: ClientMessage[];
+	id?: number;
+};
+
+export type CondensedEntry = ClientMessage | CondensedMessageContainer;
+
+// "shown" keeps status messages, "hidden" drops them and "condensed" groups them
+export type CondenseMode = "shown" | "hidden" | "condensed";
+
+export type CondensedList = {
+	entries: CondensedEntry[];
+	keys: string[]; // stable key of each entry, for rendering
+};
+
+/**
+ * Message list of a channel with status messages grouped, kept up to date incrementally
+ *
+ * Messages pushed to the end of the list and messages trimmed from its start are applied
+ * to the previous result, only the last group can still change. Anything else (a new list,
+ * history loaded in front, other settings) rebuilds it.
+ */
+class MessageCondenser {
+	private source: ClientMessage[] | null = null;
+	private mode: CondenseMode = "shown";
+	private firstUnread = 0;
+
+	private entries: CondensedEntry[] = [];
+	private keys: string[] = [];
+
+	// Messages are numbered in the order they were added, `base` is the number of source[0]
+	private positions = new WeakMap<ClientMessage, number>();
+	private base = 0;
+	private next = 0;
+	private last: ClientMessage | null = null;
+
+	// Range of message numbers of each entry, end excluded
+	private starts: number[] = [];
+	private ends: number[] = [];
+
+	// Ids of the messages in a group, where an unread boundary splits it
+	private grouped = new Set<number>();
+
+	// Last entry, if the next status message joins it
+	private tail: CondensedMessageContainer | null = null;
+
+	update(messages: ClientMessage[], mode: CondenseMode, firstUnread: number): CondensedList {
+		const boundaryMoved =
+			firstUnread !== this.firstUnread &&
+			(this.grouped.has(firstUnread) || this.grouped.has(this.firstUnread));
+
+		if (
+			messages !== this.source ||
+			mode !== this.mode ||
+			boundaryMoved ||
+			!this.trimTo(messages)
+		) {
+			this.reset(messages, mode);
+		}
+
+		this.firstUnread = firstUnread;
+
+		for (let i = this.next - this.base; i < messages.length; i++) {
+			this.append(messages[i]);
+		}
+
+		return {entries: this.entries, keys: this.keys};
+	}
+
+	private reset(messages: ClientMessage[], mode: CondenseMode) {
+		this.source = messages;
+		this.mode = mode;
+		this.entries = [];
+		this.keys = [];
+		this.positions = new WeakMap();
+		this.base = 0;
+		this.next = 0;
+		this.last = null;
+		this.starts = [];
+		this.ends = [];
+		this.grouped.clear();
+		this.tail = null;
+	}
+
+	/**
+	 * Drop the entries of messages that were removed from the start of the list
+	 *
+	 * @returns false if the list changed in some other way
+	 */
+	private trimTo(messages: ClientMessage[]) {
+		if (this.next === this.base) {
+			return true;
+		}
+
+		const head = messages.length > 0 ? this.positions.get(messages[0]) : undefined;
+
+		if (head === undefined || head < this.base) {
+			return false;
+		}
+
+		const kept = this.next - head;
+
+		if (messages.length < kept || messages[kept - 1] !== this.last) {
+			return false;
+		}
+
+		if (head === this.base) {
+			return true;
+		}
+
+		let drop = 0;
+
+		while (drop < this.entries.length && this.ends[drop] <= head) {
+			this.forget(this.entries[drop]);
+			drop++;
+		}
+
+		this.entries.splice(0, drop);
+		this.keys.splice(0, drop);
+		this.starts.splice(0, drop);
+		this.ends.splice(0, drop);
+
+		if (this.entries.length === 0) {
+			this.tail = null;
+		} else if (this.starts[0] < head) {
+			// Only a group spans more than one message, cut off its removed part
+			const group = this.entries[0] as CondensedMessageContainer;
+			const removed = group.messages.slice(0, head - this.starts[0]);
+			const rest = group.messages.slice(removed.length);
+			const trimmed = {...group, time: rest[0].time, messages: rest};
+
+			removed.forEach((message) => this.grouped.delete(message.id));
+
+			this.entries[0] = rest.length === 1 ? rest[0] : trimmed;
+			this.keys[0] = keyOf(this.entries[0]);
+			this.starts[0] = head;
+
+			if (this.tail === group) {
+				this.tail = trimmed;
+			}
+		}
+
+		this.base = head;
+		return true;
+	}
+
+	private append(message: ClientMessage) {
+		const position = this.next++;
+		const isStatus = condensedTypes.has(message.type || "");
+
+		this.positions.set(message, position);
+		this.last = message;
+
+		if (this.mode === "hidden" && isStatus) {
+			return;
+		}
+
+		// If this message is not condensable, or its an action affecting our user,
+		// then just append the message to container and be done with it
+		if (this.mode !== "condensed" || message.self || message.highlight || !isStatus) {
+			this.tail = null;
+			this.push(message, position);
+			return;
+		}
+
+		if (!this.tail) {
+			this.tail = {time: message.time, type: "condensed", messages: [message], id: message.id};
+
+			// Skip condensing single messages, it doesn't save any
+			// space but makes useful information harder to see
+			this.push(message, position);
+		} else {
+			// A new container, so the component showing it gets updated
+			this.tail = {
+				...this.tail,
+				messages: this.tail.messages.concat(message),
+				// Id of the last message, which is required for the unread marker to work correctly
+				id: message.id,
+			};
+
+			const last = this.entries.length - 1;
+			this.entries[last] = this.tail;
+			this.ends[last] = position + 1;
+		}
+
+		this.grouped.add(message.id);
+
+		// If this message is the unread boundary, create a split condensed container
+		if (message.id === this.firstUnread) {
+			this.tail = null;
+		}
+	}
+
+	private push(message: ClientMessage, position: number) {
+		this.entries.push(message);
+		this.keys.push(keyOf(message));
+		this.starts.push(position);
+		this.ends.push(position + 1);
+	}
+
+	private forget(entry: CondensedEntry) {
+		if (entry.type === "condensed") {
+			entry.messages.forEach((message) => this.grouped.delete(message.id));
+		} else {
+			this.grouped.delete(entry.id);
+		}
+	}
+}
+
+function keyOf(entry: CondensedEntry) {
+	return String(entry.type === "condensed" ? entry.messages[0].id : entry.id);
+}
+
+export default MessageCondenser;
@@ -96,9 +96,44 @@ function createFragment(fragment: StyledFragment): VNode | string | undefined {
 	return hasData ? createElement("span", data, fragment.text) : fragment.text;
 }
 
-// Transform an IRC message potentially filled with styling control codes, URLs,
-// nicknames, and channels into a string of HTML elements to display on the client.
-function parse(text: string, message?: ClientMessage, network?: ClientNetwork) {
+type CachedParts = {
+	text: string;
+	context: string;
+	parts: ReturnType<typeof merge>;
+};
+
+// Parts of message texts, so rendering a message again doesn't parse it again
+const partsCache = new WeakMap<ClientMessage, CachedParts>();
+
+// Find the styled parts of a text, reusing the ones of the message if nothing they
+// depend on changed. Only the parts are cached, elements are created on every render.
+function findParts(text: string, message?: ClientMessage, network?: ClientNetwork) {
+	const channelPrefixes = network ? network.serverOptions.CHANTYPES : ["#", "&"];
+	const userModes = network
+		? network.serverOptions.PREFIX?.prefix?.map((pref) => pref.symbol)
+		: ["!", "@", "%", "+"];
+	const users = message ? message.users || [] : [];
+
+	if (!message || typeof message !== "object") {
+		return tokenize(text, channelPrefixes, userModes, users);
+	}
+
+	const context = [channelPrefixes, userModes, users]
+		.map((list) => (list || []).join("\u0000"))
+		.join("\u0001");
+	const cached = partsCache.get(message);
+
+	if (cached && cached.text === text && cached.context === context) {
+		return cached.parts;
+	}
+
+	const parts = tokenize(text, channelPrefixes, userModes, users);
+	partsCache.set(message, {text, context, parts});
+
+	return parts;
+}
+
+function tokenize(text: string, channelPrefixes: string[], userModes: string[], users: string[]) {
 	// Extract the styling information and get the plain text version from it
 	const styleFragments = parseStyle(text);
 	const cleanText = styleFragments.map((fragment) => fragment.text).join("");
@@ -106,23 +141,25 @@ function parse(text: string, message?: ClientMessage, network?: ClientNetwork) {
 	// On the plain text, find channels and URLs, returned as "parts". Parts are
 	// arrays of objects containing start and end markers, as well as metadata
 	// depending on what was found (channel or link).
-	const channelPrefixes = network ? network.serverOptions.CHANTYPES : ["#", "&"];
-	const userModes = network
-		? network.serverOptions.PREFIX?.prefix?.map((pref) => pref.symbol)
-		: ["!", "@", "%", "+"];
 	const channelParts = findChannels(cleanText, channelPrefixes, userModes);
 	const linkParts = findLinks(cleanText);
 	const emojiParts = findEmoji(cleanText);
-	const nameParts = findNames(cleanText, message ? message.users || [] : []);
+	const nameParts = findNames(cleanText, users);
 
 	const parts = (channelParts as MergedParts)
 		.concat(linkParts)
 		.concat(emojiParts)
 		.concat(nameParts);
 
-	// Merge the styling information with the channels / URLs / nicks / text objects and
-	// generate HTML strings with the resulting fragments
-	return merge(parts, styleFragments, cleanText).map((textPart) => {
+	// Merge the styling information with the channels / URLs / nicks / text objects
+	return merge(parts, styleFragments, cleanText);
+}
+
+// Transform an IRC message potentially filled with styling control codes, URLs,
+// nicknames, and channels into a string of HTML elements to display on the client.
+function parse(text: string, message?: ClientMessage, network?: ClientNetwork) {
+	// Generate HTML strings with the fragments of each part
+	return findParts(text, message, network).map((textPart) => {
 		const fragments = textPart.fragments.map((fragment) => createFragment(fragment));
 
 		// Wrap these potentially styled fragments with links and channel buttons
@@ -0,0 +1,338 @@
+import {ClientChan, ClientMessage, ClientNetwork} from "./types";
+import {ChanType, HistoryMarks} from "../../shared/types/chan";
+
+/*
+ * Channel history kept in IndexedDB, so loading the page or reconnecting only fetches
+ * messages newer than the cached ones.
+ *
+ * At sign in the newest message time of every cached channel is sent as `historyMarks`.
+ * The server answers those channels with only newer messages and `cachedUntil`, which
+ * `apply` puts after the cached ones. Records are encrypted with AES-GCM using a
+ * non-extractable key kept in the same database, and the database is deleted on sign out.
+ * Record keys (network uuid and channel name) are stored in the clear.
+ */
+
+const databaseName = "thelounge-history";
+const maxCachedMessages = 200;
+const saveDelay = 5000;
+
+type CachedRecord = {
+	network: string;
+	channel: string;
+	until: number; // time of the newest message
+	iv: Uint8Array;
+	data: ArrayBuffer;
+};
+
+let database: Promise<IDBDatabase | null> | null = null;
+let cryptoKey: Promise<CryptoKey | null> | null = null;
+
+// Channels whose cache is kept until the server answers for them, by record key
+const sentMarks = new Map<string, number>();
+
+const dirty = new Map<string, {network: ClientNetwork; channel: ClientChan}>();
+let saveTimer: ReturnType<typeof setTimeout> | null = null;
+
+// Ids of cached messages are negative, the server only hands out positive ones
+let cachedIds = 0;
+
+function recordKey(networkUuid: string, channelName: string) {
+	return `${networkUuid}\0${channelName.toLowerCase()}`;
+}
+
+function timeOf(message: ClientMessage) {
+	return new Date(message.time).getTime();
+}
+
+function request<T>(req: IDBRequest<T>): Promise<T> {
+	return new Promise((resolve, reject) => {
+		req.onsuccess = () => resolve(req.result);
+		req.onerror = () => reject(req.error);
+	});
+}
+
+function openDatabase(): Promise<IDBDatabase | null> {
+	if (!database) {
+		database = new Promise((resolve) => {
+			if (!window.indexedDB || !window.crypto?.subtle) {
+				resolve(null);
+				return;
+			}
+
+			const req = window.indexedDB.open(databaseName, 1);
+
+			req.onupgradeneeded = () => {
+				req.result.createObjectStore("channels");
+				req.result.createObjectStore("keys");
+			};
+			req.onsuccess = () => resolve(req.result);
+			req.onerror = () => resolve(null);
+			req.onblocked = () => resolve(null);
+		});
+	}
+
+	return database;
+}
+
+function getKey(db: IDBDatabase): Promise<CryptoKey | null> {
+	if (!cryptoKey) {
+		cryptoKey = (async () => {
+			const read = () =>
+				request<CryptoKey | undefined>(
+					db.transaction("keys").objectStore("keys").get("history")
+				);
+			const existing = await read();
+
+			if (existing) {
+				return existing;
+			}
+
+			const key = await window.crypto.subtle.generateKey(
+				{name: "AES-GCM", length: 256},
+				false,
+				["encrypt", "decrypt"]
+			);
+
+			try {
+				await request(
+					db.transaction("keys", "readwrite").objectStore("keys").add(key, "history")
+				);
+				return key;
+			} catch (e) {
+				// Another tab stored its key first
+				return (await read()) || null;
+			}
+		})().catch(() => null);
+	}
+
+	return cryptoKey;
+}
+
+async function readRecord(db: IDBDatabase, key: string): Promise<ClientMessage[]> {
+	const record = await request<CachedRecord | undefined>(
+		db.transaction("channels").objectStore("channels").get(key)
+	);
+	const aesKey = await getKey(db);
+
+	if (!record || !aesKey) {
+		return [];
+	}
+
+	try {
+		const data = await window.crypto.subtle.decrypt(
+			{name: "AES-GCM", iv: record.iv},
+			aesKey,
+			record.data
+		);
+		return JSON.parse(new TextDecoder().decode(data)) as ClientMessage[];
+	} catch (e) {
+		// Written with a key that is gone
+		return [];
+	}
+}
+
+async function writeRecord(db: IDBDatabase, network: ClientNetwork, channel: ClientChan) {
+	const key = recordKey(network.uuid, channel.name);
+	const messages = channel.messages
+		.filter((message) => !message.showInActive)
+		.slice(-maxCachedMessages);
+
+	if (messages.length === 0) {
+		await request(db.transaction("channels", "readwrite").objectStore("channels").delete(key));
+		return;
+	}
+
+	const aesKey = await getKey(db);
+
+	if (!aesKey) {
+		return;
+	}
+
+	// Ids are handed out again when the messages are restored
+	const plain = JSON.stringify(messages.map(({id: _, ...message}) => message));
+	const iv = window.crypto.getRandomValues(new Uint8Array(12));
+	const data = await window.crypto.subtle.encrypt(
+		{name: "AES-GCM", iv},
+		aesKey,
+		new TextEncoder().encode(plain)
+	);
+	const record: CachedRecord = {
+		network: network.uuid,
+		channel: channel.name.toLowerCase(),
+		until: timeOf(messages[messages.length - 1]),
+		iv,
+		data,
+	};
+
+	await request(db.transaction("channels", "readwrite").objectStore("channels").put(record, key));
+}
+
+async function save() {
+	saveTimer = null;
+
+	const db = await openDatabase();
+	const channels = Array.from(dirty.entries());
+	dirty.clear();
+
+	if (!db) {
+		return;
+	}
+
+	for (const [key, {network, channel}] of channels) {
+		// Would overwrite the cache the server is still answering for
+		if (sentMarks.has(key)) {
+			continue;
+		}
+
+		try {
+			await writeRecord(db, network, channel);
+		} catch (e) {
+			// Storage full or blocked, the cache is only an optimization
+		}
+	}
+}
+
+// The page may not come back once it's hidden
+document.addEventListener("visibilitychange", () => {
+	if (document.visibilityState === "hidden" && saveTimer) {
+		clearTimeout(saveTimer);
+		void save();
+	}
+});
+
+function isCached(channel: ClientChan) {
+	return channel.type === ChanType.CHANNEL || channel.type === ChanType.QUERY;
+}
+
+export default {
+	/**
+	 * Newest message time of every channel, from memory when reconnecting
+	 * or from the cache, to send with `auth:perform`
+	 */
+	async marks(networks: ClientNetwork[]): Promise<HistoryMarks> {
+		const marks: HistoryMarks = {};
+		const db = await Promise.race([
+			openDatabase(),
+			new Promise<null>((resolve) => setTimeout(() => resolve(null), 1000)),
+		]);
+
+		sentMarks.clear();
+
+		if (db) {
+			try {
+				const records = await request<CachedRecord[]>(
+					db.transaction("channels").objectStore("channels").getAll()
+				);
+
+				for (const record of records) {
+					marks[record.network] = marks[record.network] || {};
+					marks[record.network][record.channel] = record.until;
+				}
+			} catch (e) {
+				// Sign in without the cache
+			}
+		}
+
+		for (const network of networks) {
+			for (const channel of network.channels) {
+				if (isCached(channel) && channel.messages.length > 0) {
+					const last = channel.messages[channel.messages.length - 1];
+					marks[network.uuid] = marks[network.uuid] || {};
+					marks[network.uuid][channel.name.toLowerCase()] = timeOf(last);
+				}
+			}
+		}
+
+		for (const [networkUuid, channels] of Object.entries(marks)) {
+			for (const [channelName, until] of Object.entries(channels)) {
+				sentMarks.set(recordKey(networkUuid, channelName), until);
+			}
+		}
+
+		return marks;
+	},
+
+	/**
+	 * Whether the history the server sends for a channel answers a mark sent at sign in
+	 */
+	isPending(network: ClientNetwork, channel: ClientChan) {
+		return sentMarks.has(recordKey(network.uuid, channel.name));
+	},
+
+	/**
+	 * Put history the server sent for a marked channel together with what is cached
+	 *
+	 * @param fresh - messages from the server
+	 * @param cachedUntil - set if they continue the cache, the cache is dropped otherwise
+	 */
+	async apply(
+		network: ClientNetwork,
+		channel: ClientChan,
+		fresh: ClientMessage[],
+		cachedUntil?: number
+	) {
+		const key = recordKey(network.uuid, channel.name);
+		const after = cachedUntil ?? sentMarks.get(key) ?? -Infinity;
+		const freshIds = new Set(fresh.map((message) => message.id));
+		let older: ClientMessage[] = [];
+
+		sentMarks.delete(key);
+
+		if (cachedUntil !== undefined) {
+			// Still in memory after a reconnect, otherwise from the cache
+			older = channel.messages.filter(
+				(message) => !freshIds.has(message.id) && timeOf(message) <= cachedUntil
+			);
+
+			if (older.length === 0) {
+				const db = await openDatabase();
+				older = db ? await readRecord(db, key).catch(() => []) : [];
+				older = older.filter((message) => timeOf(message) <= cachedUntil);
+
+				cachedIds -= older.length;
+				older.forEach((message, i) => (message.id = cachedIds + i));
+			}
+		}
+
+		// Messages that arrived live since init
+		const live = channel.messages.filter(
+			(message) => !freshIds.has(message.id) && timeOf(message) > after
+		);
+
+		channel.messages = older.concat(fresh, live);
+		this.touch(network, channel);
+	},
+
+	/**
+	 * Queue a channel to be written to the cache after its messages changed
+	 */
+	touch(network: ClientNetwork, channel: ClientChan) {
+		if (!isCached(channel)) {
+			return;
+		}
+
+		dirty.set(recordKey(network.uuid, channel.name), {network, channel});
+
+		if (!saveTimer) {
+			saveTimer = setTimeout(() => void save(), saveDelay);
+		}
+	},
+
+
+	/**
+	 * Delete the whole cache, it belongs to the user that signs out
+	 */
+	async clear() {
+		dirty.clear();
+		sentMarks.clear();
+
+		const db = await openDatabase();
+		db?.close();
+		database = null;
+		cryptoKey = null;
+
+		if (window.indexedDB) {
+			await request(window.indexedDB.deleteDatabase(databaseName)).catch(() => undefined);
+		}
+	},
+};
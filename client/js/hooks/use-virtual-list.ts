@@ -0,0 +1,198 @@
+import {computed, onBeforeUnmount, onMounted, ref, Ref} from "vue";
+
+// Height (px) of rows that were never rendered, until enough rows are measured to estimate it
+const defaultRowHeight = 24;
+const rowsToEstimate = 20;
+
+// Rows rendered past each edge of the viewport, in viewport heights
+const overscan = 1;
+
+/**
+ * Windowed rendering of a long list of rows with different heights
+ *
+ * Only the rows in and around the viewport are rendered, spacers of the same height stand in
+ * for the others. Rendered rows are measured with a ResizeObserver. When a row above the
+ * viewport changes height the scroll position is corrected, so the visible rows stay put,
+ * and `stickToBottom` keeps the list scrolled to the end while it returns true.
+ *
+ * @param keys - stable key of each row, in order
+ */
+export default function useVirtualList(
+	scroller: Ref<HTMLElement | null>,
+	keys: Ref<string[]>,
+	stickToBottom: () => boolean
+) {
+	const heights = new Map<string, number>();
+	const elements = new Map<string, Element>();
+	const rowKeys = new WeakMap<Element, string>();
+
+	// Bumped whenever a measured height changes, `heights` itself is not reactive
+	const measured = ref(0);
+	const scrollTop = ref(0);
+	const viewportHeight = ref(window.innerHeight);
+
+	// Fixed once enough rows are measured, so the spacers don't change under the reader
+	let estimate = defaultRowHeight;
+	let estimateFrom: number[] | null = [];
+
+	let resizeObserver: ResizeObserver | null = null;
+	let scrollFrame = 0;
+
+	// offsets[i] is the top of row i, offsets[length] the height of all rows
+	const offsets = computed(() => {
+		void measured.value;
+
+		const list = keys.value;
+		const result = new Float64Array(list.length + 1);
+
+		for (let i = 0; i < list.length; i++) {
+			result[i + 1] = result[i] + (heights.get(list[i]) ?? estimate);
+		}
+
+		return result;
+	});
+
+	const range = computed(() => {
+		const tops = offsets.value;
+		const count = keys.value.length;
+		const margin = viewportHeight.value * overscan;
+		const bottom = scrollTop.value + viewportHeight.value + margin;
+
+		return {
+			start: rowAt(tops, count, scrollTop.value - margin),
+			end: Math.min(count, rowAt(tops, count, bottom) + 1),
+		};
+	});
+
+	const paddingTop = computed(() => offsets.value[range.value.start]);
+	const paddingBottom = computed(
+		() => offsets.value[keys.value.length] - offsets.value[range.value.end]
+	);
+
+	const onScroll = () => {
+		if (scrollFrame) {
+			return;
+		}
+
+		scrollFrame = window.requestAnimationFrame(() => {
+			scrollFrame = 0;
+
+			if (scroller.value) {
+				scrollTop.value = scroller.value.scrollTop;
+				viewportHeight.value = scroller.value.clientHeight || window.innerHeight;
+			}
+		});
+	};
+
+	const onResize = (entries: ResizeObserverEntry[]) => {
+		const el = scroller.value;
+		const viewTop = el ? el.getBoundingClientRect().top : 0;
+		let shift = 0;
+		let changed = false;
+
+		for (const entry of entries) {
+			const key = rowKeys.get(entry.target);
+			const height = entry.borderBoxSize?.[0]?.blockSize ?? entry.contentRect.height;
+
+			// Hidden, along with the whole channel
+			if (key === undefined || height === 0) {
+				continue;
+			}
+
+			const old = heights.get(key) ?? estimate;
+
+			if (old === height && heights.has(key)) {
+				continue;
+			}
+
+			heights.set(key, height);
+			changed = true;
+
+			if (entry.target.getBoundingClientRect().top < viewTop) {
+				shift += height - old;
+			}
+
+			if (estimateFrom) {
+				estimateFrom.push(height);
+
+				if (estimateFrom.length >= rowsToEstimate) {
+					estimate = estimateFrom.reduce((sum, h) => sum + h, 0) / estimateFrom.length;
+					estimateFrom = null;
+				}
+			}
+		}
+
+		if (!changed || !el) {
+			return;
+		}
+
+		measured.value++;
+
+		if (stickToBottom()) {
+			el.scrollTop = el.scrollHeight;
+		} else if (shift !== 0) {
+			el.scrollTop += shift;
+		}
+	};
+
+	/**
+	 * Function ref for the element of a row
+	 */
+	const measureRow = (el: Element | null, key: string) => {
+		const old = elements.get(key);
+
+		if (old === el) {
+			return;
+		}
+
+		if (old) {
+			resizeObserver?.unobserve(old);
+			elements.delete(key);
+		}
+
+		if (el) {
+			elements.set(key, el);
+			rowKeys.set(el, key);
+			resizeObserver?.observe(el);
+		}
+	};
+
+	onMounted(() => {
+		if (window.ResizeObserver) {
+			resizeObserver = new window.ResizeObserver(onResize);
+			elements.forEach((el) => resizeObserver!.observe(el));
+		}
+
+		scroller.value?.addEventListener("scroll", onScroll, {passive: true});
+		onScroll();
+	});
+
+	onBeforeUnmount(() => {
+		scroller.value?.removeEventListener("scroll", onScroll);
+		resizeObserver?.disconnect();
+		window.cancelAnimationFrame(scrollFrame);
+	});
+
+	return {range, paddingTop, paddingBottom, measureRow, onScroll};
+}
+
+/**
+ * Index of the row at `y`, clamped to the list
+ */
+function rowAt(tops: Float64Array, count: number, y: number) {
+	let low = 0;
+	let high = count;
+
+	// Last row with top <= y
+	while (low < high) {
+		const mid = (low + high + 1) >>> 1;
+
+		if (tops[mid] <= y) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return Math.min(low, Math.max(0, count - 1));
+}
@@ -0,0 +1,46 @@
+import socket from "./socket";
+import {shardCookie} from "../../shared/shard";
+
+/*
+ * Servers with more than one shard route every request by the user in a cookie, see
+ * server/shard.ts. Once it names another user, the connection is made again so it ends up
+ * on the shard of that user.
+ */
+
+function isSharded() {
+	return Number(document.body.dataset.shards) > 1;
+}
+
+export default {
+	/**
+	 * Route requests to the shard of `user`
+	 *
+	 * @returns whether the current connection may be served by another shard
+	 */
+	route(user: string): boolean {
+		if (!isSharded()) {
+			return false;
+		}
+
+		const cookie = `${shardCookie}=${encodeURIComponent(user.toLowerCase())}`;
+
+		if (document.cookie.split("; ").includes(cookie)) {
+			return false;
+		}
+
+		document.cookie = `${cookie}; path=${window.location.pathname}; max-age=31536000; samesite=strict`;
+		return true;
+	},
+
+	/**
+	 * Connect again, `then` runs once the new connection is ready to authenticate
+	 */
+	reconnect(then?: () => void) {
+		if (then) {
+			socket.once("auth:start", then);
+		}
+
+		socket.disconnect();
+		socket.connect();
+	},
+};
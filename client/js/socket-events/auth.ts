@@ -3,6 +3,8 @@ import storage from "../localStorage";
 import {router, navigate} from "../router";
 import {store} from "../store";
 import location from "../location";
+import historyCache from "../historyCache";
+import shard from "../shard";
 let lastServerHash: number | null = null;
 
 declare global {
@@ -44,6 +46,12 @@ socket.on("auth:start", async function (serverHash) {
 		return reloadPage("Authentication failed, reloading…");
 	}
 
+	// Connected to the shard of another user, try again on the one of this user
+	if (user && token && shard.route(user)) {
+		shard.reconnect();
+		return;
+	}
+
 	// If we have user and token stored, perform auth without showing sign-in first
 	if (doFastAuth) {
 		store.commit("currentUserVisibleError", "Authorizing…");
@@ -65,6 +73,7 @@ socket.on("auth:start", async function (serverHash) {
 
 		const openChannel =
 			(store.state.activeChannel && store.state.activeChannel.channel.id) || null;
+		const historyMarks = await historyCache.marks(store.state.networks);
 
 		socket.emit("auth:perform", {
 			user,
@@ -72,6 +81,7 @@ socket.on("auth:start", async function (serverHash) {
 			lastMessage,
 			openChannel,
 			hasConfig: store.state.serverConfiguration !== null,
+			historyMarks,
 		});
 	} else {
 		await showSignIn();
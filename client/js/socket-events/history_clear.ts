@@ -1,5 +1,6 @@
 import socket from "../socket";
 import {store} from "../store";
+import historyCache from "../historyCache";
 
 socket.on("history:clear", function (data) {
 	const netChan = store.getters.findChannel(data.target);
@@ -10,5 +11,6 @@ socket.on("history:clear", function (data) {
 		netChan.channel.highlight = 0;
 		netChan.channel.firstUnread = 0;
 		netChan.channel.moreHistoryAvailable = false;
+		historyCache.touch(netChan.network, netChan.channel);
 	}
 });
@@ -6,6 +6,9 @@ import {store} from "../store";
 import parseIrcUri from "../helpers/parseIrcUri";
 import {ClientNetwork, ClientChan} from "../types";
 import {SharedNetwork, SharedNetworkChan} from "../../../shared/types/network";
+import {SharedMsg} from "../../../shared/types/msg";
+import {expandChannel} from "../../../shared/compactWire";
+import historyCache from "../historyCache";
 
 socket.on("init", async function (data) {
 	console.log("[INIT] Received init event");
@@ -25,10 +28,38 @@ socket.on("init", async function (data) {
 		console.log("[INIT] Token saved to localStorage");
 	}
 
+	// History sent along for channels the browser has cached, put together after the merge
+	const cachedHistory = new Map<number, {messages: SharedMsg[]; cachedUntil?: number}>();
+
+	for (const network of data.networks) {
+		network.channels.forEach(expandChannel);
+
+		for (const channel of network.channels) {
+			if (channel.cachedUntil !== undefined || channel.messages.length > 0) {
+				cachedHistory.set(channel.id, {
+					messages: channel.messages,
+					cachedUntil: channel.cachedUntil,
+				});
+			}
+
+			delete channel.cachedUntil;
+		}
+	}
+
 	const mergedNetworks = mergeNetworkData(data.networks);
 	console.log("[INIT] After merge, networks count:", mergedNetworks.length);
 
 	store.commit("networks", mergedNetworks);
+
+	for (const network of store.state.networks) {
+		for (const channel of network.channels) {
+			const history = cachedHistory.get(channel.id);
+
+			if (history && historyCache.isPending(network, channel)) {
+				void historyCache.apply(network, channel, history.messages, history.cachedUntil);
+			}
+		}
+	}
 	store.commit("isConnected", true);
 	store.commit("currentUserVisibleError", null);
 
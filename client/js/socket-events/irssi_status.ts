@@ -19,14 +19,26 @@ socket.on("irssi:status", function (data) {
 			}
 		}, 3000);
 
+		if (data.resuming) {
+			// Networks were kept and are up to date again
+			return;
+		}
+
 		// Request fresh state from server
 		// This will trigger init event with updated networks
 		console.log("[IRSSI_STATUS] Requesting fresh state from server (setting:get)");
 		socket.emit("setting:get");
 	} else {
-		// irssi WebSocket disconnected - CLEAR networks from UI
 		const errorMsg = data.error || "Lost connection to irssi WebSocket";
 
+		if (data.resuming) {
+			// Networks stay, the server catches up on them once irssi is back
+			store.commit("currentUserVisibleError", errorMsg + " - Reconnecting...");
+			return;
+		}
+
+		// irssi WebSocket disconnected - CLEAR networks from UI
+
 		console.log("[IRSSI_STATUS] ❌ Disconnected - CLEARING networks from UI");
 		console.log("[IRSSI_STATUS] Error message:", errorMsg);
 
@@ -7,6 +7,11 @@ socket.on("mentions:list", function (data) {
 	store.commit("mentions", data.map(sharedToClientMention));
 });
 
+// An older page, before the oldest mention in the list
+socket.on("mentions:more", function (data) {
+	store.commit("mentions", [...data.map(sharedToClientMention), ...store.state.mentions]);
+});
+
 function sharedToClientMention(shared: SharedMention): ClientMention {
 	const mention: ClientMention = {
 		...shared,
@@ -2,15 +2,23 @@ import {nextTick} from "vue";
 
 import socket from "../socket";
 import {store} from "../store";
+import historyCache from "../historyCache";
 import {MessageType} from "../../../shared/types/msg";
+import {decodeMessages} from "../../../shared/compactWire";
 
 socket.on("more", async (data) => {
-	const channel = store.getters.findChannel(data.chan)?.channel;
+	const netChan = store.getters.findChannel(data.chan);
 
-	if (!channel) {
+	if (!netChan) {
 		return;
 	}
 
+	const channel = netChan.channel;
+
+	if (data.compactMessages) {
+		data.messages = decodeMessages(data.compactMessages);
+	}
+
 	channel.inputHistory = channel.inputHistory.concat(
 		data.messages
 			.filter((m) => m.self && m.text && m.type === MessageType.MESSAGE)
@@ -20,9 +28,22 @@ socket.on("more", async (data) => {
 			.reverse()
 			.slice(0, 100 - channel.inputHistory.length)
 	);
-	channel.moreHistoryAvailable =
-		data.totalMessages > channel.messages.length + data.messages.length;
-	channel.messages.unshift(...data.messages);
+
+	// First history after sign in of a channel the browser has cached
+	if (!channel.historyLoading && historyCache.isPending(netChan.network, channel)) {
+		await historyCache.apply(netChan.network, channel, data.messages, data.cachedUntil);
+		channel.moreHistoryAvailable = data.totalMessages > channel.messages.length;
+	} else {
+		channel.moreHistoryAvailable =
+			data.totalMessages > channel.messages.length + data.messages.length;
+		channel.messages.unshift(...data.messages);
+		historyCache.touch(netChan.network, channel);
+	}
+
+	// History of channels that were sent empty in init comes with its unread marker
+	if (data.firstUnread !== undefined) {
+		channel.firstUnread = data.firstUnread;
+	}
 
 	await nextTick();
 	channel.historyLoading = false;
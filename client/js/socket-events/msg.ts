@@ -1,6 +1,8 @@
 import socket from "../socket";
 import {cleanIrcMessage} from "../../../shared/irc";
 import {store} from "../store";
+import historyCache from "../historyCache";
+import {builtNickIndex} from "../helpers/completionIndex";
 import {switchToChannel} from "../router";
 import {ClientChan, NetChan, ClientMessage} from "../types";
 import {SharedMsg, MessageType} from "../../../shared/types/msg";
@@ -90,6 +92,8 @@ socket.on("msg", function (data) {
 		channel.moreHistoryAvailable = true;
 	}
 
+	historyCache.touch(receivingChannel.network, channel);
+
 	if (channel.type === ChanType.CHANNEL) {
 		updateUserList(channel, data.msg);
 	}
@@ -207,6 +211,7 @@ function updateUserList(channel: ClientChan, msg: SharedMsg) {
 
 			if (user) {
 				user.lastMessage = new Date(msg.time).getTime() || Date.now();
+				builtNickIndex(channel)?.touch(user.nick, user.lastMessage);
 			}
 
 			break;
@@ -218,6 +223,7 @@ function updateUserList(channel: ClientChan, msg: SharedMsg) {
 			const idx = channel.users.findIndex((u) => u.nick === msg.from?.nick);
 
 			if (idx > -1) {
+				builtNickIndex(channel)?.remove(channel.users[idx].nick);
 				channel.users.splice(idx, 1);
 			}
 
@@ -228,6 +234,7 @@ function updateUserList(channel: ClientChan, msg: SharedMsg) {
 			const idx = channel.users.findIndex((u) => u.nick === msg.target?.nick);
 
 			if (idx > -1) {
+				builtNickIndex(channel)?.remove(channel.users[idx].nick);
 				channel.users.splice(idx, 1);
 			}
 
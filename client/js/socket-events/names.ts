@@ -1,10 +1,12 @@
 import socket from "../socket";
 import {store} from "../store";
+import {builtNickIndex} from "../helpers/completionIndex";
 
 socket.on("names", function (data) {
 	const netChan = store.getters.findChannel(data.id);
 
 	if (netChan) {
 		netChan.channel.users = data.users;
+		builtNickIndex(netChan.channel)?.sync(netChan.channel.users);
 	}
 });
@@ -24,5 +24,8 @@ socket.on("search:results", (response) => {
 		return;
 	}
 
-	store.commit("messageSearchResults", {results: response.results});
+	store.commit("messageSearchResults", {
+		results: response.results,
+		nextCursor: response.nextCursor,
+	});
 });
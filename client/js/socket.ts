@@ -1,5 +1,6 @@
 import io, {Socket as rawSocket} from "socket.io-client";
 import type {ServerToClientEvents, ClientToServerEvents} from "../../shared/types/socket-events";
+import {compactWireVersion} from "../../shared/compactWire";
 
 type Socket = rawSocket<ServerToClientEvents, ClientToServerEvents>;
 
@@ -8,6 +9,8 @@ const socket: Socket = io({
 	path: window.location.pathname + "socket.io/",
 	autoConnect: false,
 	reconnection: !document.body.classList.contains("public"),
+	// Servers that support it send init and history in the compact wire format
+	auth: {compactWire: compactWireVersion},
 });
 
 // Ease debugging socket during development
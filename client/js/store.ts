@@ -7,7 +7,7 @@ import type {ClientChan, ClientNetwork, NetChan, ClientMention, ClientMessage} f
 import type {InjectionKey} from "vue";
 
 import {SettingsState} from "./settings";
-import {SearchQuery} from "../../shared/types/storage";
+import {SearchQuery, SearchCursor} from "../../shared/types/storage";
 import {SharedConfiguration, LockedSharedConfiguration} from "../../shared/types/config";
 
 const appName = document.title;
@@ -78,6 +78,7 @@ export type State = {
 	serverHasSettings: boolean;
 	messageSearchResults: {
 		results: ClientMessage[];
+		nextCursor?: SearchCursor | null;
 	} | null;
 	messageSearchPendingQuery: SearchQuery | null;
 	searchEnabled: boolean;
@@ -325,6 +326,7 @@ const mutations: Mutations = {
 
 		state.messageSearchResults = {
 			results,
+			nextCursor: value.nextCursor,
 		};
 	},
 };
@@ -51,6 +51,70 @@ module.exports = {
 	// This value is set to `false` by default.
 	reverseProxy: false,
 
+	// ### `shards`
+	//
+	// Number of processes the users are spread over, so a server with many users
+	// can use more than one CPU core. Each user is always served by the same
+	// process. The process that is started forks the others, routes every request
+	// to the one of its user and handles `https`, it serves no users itself.
+	//
+	// Identd and oidentd are not available with more than one shard.
+	//
+	// Each shard has its own prefetch storage folder and link preview cache,
+	// those of shards that no longer exist after lowering this value are
+	// removed on start.
+	//
+	// This value is set to `0` by default, which serves everything from a single
+	// process.
+	shards: 0,
+
+	// ### `userActivation`
+	//
+	// Controls when users are connected to irssi and their message storage is
+	// opened. By default every user is, from startup on.
+	//
+	// The available keys for the `userActivation` object are:
+	//
+	// - `lazy`: When `true`, users are only connected when they first sign in
+	//   after startup, so startup time and memory use follow the users that are
+	//   actually active.
+	// - `alwaysOn`: Users that are still connected from startup on with `lazy`,
+	//   and never hibernate.
+	// - `hibernateAfterMinutes`: With `lazy`, a user is disconnected from irssi and
+	//   the message storage is closed once no browser was attached for this long.
+	//   `0` keeps users connected once they signed in, which is the default.
+	//
+	//   **Messages received while a user is hibernated are not stored**, they
+	//   are missing from the history in the browser after the next sign in and
+	//   only remain in the irssi scrollback and logs. Only enable hibernation
+	//   for users who don't need a complete history.
+	userActivation: {
+		lazy: false,
+		alwaysOn: [],
+		hibernateAfterMinutes: 0,
+	},
+
+	// ### `metrics`
+	//
+	// Runtime metrics in the Prometheus text format, served on `/metrics`. They
+	// cover the traffic from irssi, message storage, initial state sent to
+	// browsers, link prefetching, the event loop and memory use.
+	//
+	// The available keys for the `metrics` object are:
+	//
+	// - `enable`: When `true`, `/metrics` is served.
+	// - `token`: When set, requests have to send it in an
+	//   `Authorization: Bearer <token>` header. Without it, only requests from
+	//   the same machine that didn't come through a reverse proxy are allowed,
+	//   and none at all when `reverseProxy` is enabled.
+	// - `perUser`: When `true`, series of users are labeled with their name, to
+	//   find the users that use the most. Set it to `false` to only keep totals.
+	metrics: {
+		enable: false,
+		token: "",
+		perUser: true,
+	},
+
 	// ### `maxHistory`
 	//
 	// Defines the maximum number of history lines that will be kept in memory per
@@ -174,6 +238,34 @@ module.exports = {
 	// This value is set to `5000` milliseconds by default.
 	prefetchTimeout: 5000,
 
+	// ### `prefetchCacheSize`
+	//
+	// When `prefetch` is enabled, the previews of this many links are kept and
+	// shared between all users, so a link that is posted again is not fetched
+	// again. Links that failed to load or have no preview are remembered too,
+	// for a shorter time. Previews are kept as long as the site allows it
+	// (`Cache-Control` and `Expires`), and are saved to the
+	// `${THELOUNGE_HOME}/link-previews.json` file so they survive a restart.
+	//
+	// Set this to `0` to fetch every link again.
+	//
+	// This value is set to `1000` links by default.
+	prefetchCacheSize: 1000,
+
+	// ### `prefetchMaxConcurrency` and `prefetchMaxHostConcurrency`
+	//
+	// When `prefetch` is enabled, at most this many links are fetched at the
+	// same time, for all users together and from the same host. Other links
+	// wait for their turn, those in channels that are open in a browser go
+	// first. Links in messages that fall out of history (see `maxHistory`)
+	// before they are fetched are dropped.
+	//
+	// Set these to `0` for no limit.
+	//
+	// These values are set to `16` and `2` links by default.
+	prefetchMaxConcurrency: 16,
+	prefetchMaxHostConcurrency: 2,
+
 	// ### `fileUpload`
 	//
 	// Allow uploading files to the server hosting The Lounge.
@@ -209,6 +301,15 @@ module.exports = {
 	// This value is set to `["polling", "websocket"]` by default.
 	transports: ["polling", "websocket"],
 
+	// ### `perMessageDeflate`
+	//
+	// When set to `true`, WebSocket messages to the browsers are compressed.
+	// Chat lines are small, so only messages of 1 KiB or more (init, history,
+	// names) are compressed, at a fast compression level.
+	//
+	// This value is set to `false` by default.
+	perMessageDeflate: false,
+
 	// ### `leaveMessage`
 	//
 	// Set users' default `quit` and `part` messages if they are not providing
@@ -306,8 +407,9 @@ module.exports = {
 
 	// ### `storagePolicy`
 
-	// When the sqlite storage is in use, control the maximum storage duration.
-	// A background task will periodically clean up messages older than the limit.
+	// When the sqlite or the encrypted (irssi mode) storage is in use, control the
+	// maximum storage duration. A background task will periodically clean up messages
+	// older than the limit, and give the freed space back to the file system in small steps.
 
 	// The available keys for the `storagePolicy` object are:
 	//
@@ -324,6 +426,42 @@ module.exports = {
 		deletionPolicy: "statusOnly",
 	},
 
+	// ### `storageProfile`
+	//
+	// How the sqlite and encrypted message storages open their database files.
+	//
+	// The available keys for the `storageProfile` object are:
+	//
+	// - `journalMode`: `wal` lets history and search be read while new messages
+	//   are written. One of `wal`, `delete`, `truncate` or `persist`.
+	// - `synchronous`: `normal` only syncs to disk at checkpoints in `wal` mode,
+	//   the last messages may be lost on power failure but never corrupted.
+	//   One of `normal`, `full` or `off`.
+	// - `mmapSizeMB`: Up to this much of each database file is memory mapped,
+	//   `0` disables it.
+	// - `cacheSizeMB`: Size of the page cache of each connection.
+	// - `readConnection`: Whether history and search use a separate read only
+	//   connection, only in `wal` mode.
+	storageProfile: {
+		journalMode: "wal",
+		synchronous: "normal",
+		mmapSizeMB: 256,
+		cacheSizeMB: 16,
+		readConnection: true,
+	},
+
+	// ### `cryptoWorkers`
+	//
+	// Number of worker threads that encrypt and decrypt messages of the
+	// encrypted (irssi mode) storage and the frames of fe-web connections, so
+	// loading a long history does not hold up other users.
+	//
+	// Set this to `0` to do that work on the main thread.
+	//
+	// This value is set to `null` by default, one thread per CPU core except
+	// one (for the main thread), no more than `4`.
+	cryptoWorkers: null,
+
 	// ### `useHexIp`
 	//
 	// When set to `true`, users' IP addresses will be encoded as hex.
@@ -511,5 +649,23 @@ module.exports = {
 		// When set to `true`, this enables logging of raw IRC messages into each
 		// server window, displayed on the client.
 		raw: false,
+
+		// ### `debug.modules`
+		//
+		// Server modules whose debug output is written to the log, for example
+		// `["fe-web", "irssi"]`, or `["*"]` for all of them. Debug output of the
+		// other modules costs nothing.
+		//
+		// This value is set to `[]` by default.
+		modules: [],
+
+		// ### `debug.traceSampleRate`
+		//
+		// When set to a number `n` above 0, one in `n` messages received from
+		// irssi is traced through decryption, storage and broadcast to the
+		// browsers, and the latency of each stage is logged once a minute.
+		//
+		// This value is set to `0` (disabled) by default.
+		traceSampleRate: 0,
 	},
 };
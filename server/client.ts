@@ -1,7 +1,6 @@
 import _ from "lodash";
 import UAParser from "ua-parser-js";
 import {v4 as uuidv4} from "uuid";
-import escapeRegExp from "lodash/escapeRegExp";
 import crypto from "crypto";
 import colors from "chalk";
 
@@ -9,6 +8,7 @@ import log from "./log";
 import Chan, {ChanConfig} from "./models/chan";
 import Msg from "./models/msg";
 import Config from "./config";
+import {compileHighlightRegex} from "./highlight";
 import {condensedTypes} from "../shared/irc";
 import {MessageType} from "../shared/types/msg";
 import {SharedMention} from "../shared/types/mention";
@@ -539,29 +539,6 @@ class Client {
 	}
 
 	compileCustomHighlights() {
-		function compileHighlightRegex(customHighlightString: string) {
-			if (typeof customHighlightString !== "string") {
-				return null;
-			}
-
-			// Ensure we don't have empty strings in the list of highlights
-			const highlightsTokens = customHighlightString
-				.split(",")
-				.map((highlight) => escapeRegExp(highlight.trim()))
-				.filter((highlight) => highlight.length > 0);
-
-			if (highlightsTokens.length === 0) {
-				return null;
-			}
-
-			return new RegExp(
-				`(?:^|[ .,+!?|/:<>(){}'"@&~-])(?:${highlightsTokens.join(
-					"|"
-				)})(?:$|[ .,+!?|/:<>(){}'"-])`,
-				"i"
-			);
-		}
-
 		this.highlightRegex = compileHighlightRegex(this.config.clientSettings.highlights);
 		this.highlightExceptionRegex = compileHighlightRegex(
 			this.config.clientSettings.highlightExceptions
@@ -10,6 +10,8 @@ import {IrssiClient, IrssiUserConfig} from "./irssiClient";
 import Config from "./config";
 import WebPush from "./plugins/webpush";
 import log from "./log";
+import shard from "./shard";
+import metrics, {Family} from "./metrics";
 import {Server} from "./server";
 
 class ClientManager {
@@ -26,6 +28,7 @@ class ClientManager {
 		this.sockets = sockets;
 		this.identHandler = identHandler;
 		this.webPush = new WebPush();
+		metrics.collect(() => this.metricFamilies());
 
 		if (!Config.values.public) {
 			this.loadUsers();
@@ -106,12 +109,51 @@ class ClientManager {
 			if (client) {
 				client.quit(true);
 				this.clients = _.without(this.clients, client);
+				metrics.forget(client.name);
 				log.info(`User ${colors.bold(name)} disconnected and removed.`);
 			}
 		});
 	}
 
+	private metricFamilies(): Family[] {
+		const clients = this.clients.filter(
+			(client): client is IrssiClient => client instanceof IrssiClient
+		);
+		const active = clients.filter((client) => client.isActive).length;
+
+		return [
+			{
+				name: "thelounge_users",
+				help: "Loaded users, active ones are connected to irssi",
+				type: "gauge",
+				samples: [
+					{name: "thelounge_users", labels: {state: "active"}, value: active},
+					{
+						name: "thelounge_users",
+						labels: {state: "inactive"},
+						value: clients.length - active,
+					},
+				],
+			},
+			metrics.userGauge(
+				"thelounge_browsers",
+				"Attached browsers",
+				clients.map((client) => [client.name, client.attachedBrowsers.size])
+			),
+			metrics.userGauge(
+				"thelounge_storage_write_queue",
+				"Messages waiting to be written to storage",
+				clients.map((client) => [client.name, client.messageStorage?.writes.size || 0])
+			),
+		];
+	}
+
 	loadUser(name: string) {
+		// Served by another process, see shard.ts
+		if (!shard.ownsUser(name)) {
+			return;
+		}
+
 		const userConfig = this.readUserConfig(name);
 
 		if (!userConfig) {
@@ -152,7 +194,10 @@ class ClientManager {
 
 			// AUTOCONNECT: If irssi password is configured, connect immediately!
 			// This allows backend to connect to irssi BEFORE user logs in
-			if ((userConfig as IrssiUserConfig).irssiConnection?.passwordEncrypted) {
+			// With lazy activation only always on users do, the others on their first sign in
+			if (!this.isAlwaysOn(name)) {
+				log.info(`User ${colors.bold(name)} activates on sign in`);
+			} else if ((userConfig as IrssiUserConfig).irssiConnection?.passwordEncrypted) {
 				log.info(
 					`User ${colors.bold(name)} has irssi config - auto-connecting to irssi...`
 				);
@@ -169,6 +214,16 @@ class ClientManager {
 		return client;
 	}
 
+	/**
+	 * Whether a user is connected from startup on and never hibernates, see userActivation
+	 */
+	isAlwaysOn(name: string) {
+		const {lazy, alwaysOn} = Config.values.userActivation;
+		name = name.toLowerCase();
+
+		return !lazy || alwaysOn.some((user) => user.toLowerCase() === name);
+	}
+
 	/**
 	 * Login user - called after successful authentication
 	 * SINGLE MODE: All clients are IrssiClient
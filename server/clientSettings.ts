@@ -0,0 +1,46 @@
+import _ from "lodash";
+
+/**
+ * What `setting:set` needs from a user, both Client and IrssiClient provide it
+ */
+export type SettingsOwner = {
+	config: {clientSettings: Record<string, any>};
+	awayMessage: string;
+	emit(event: "setting:new", data: {name: string; value: any}): void;
+	save(): void;
+	compileCustomHighlights(): void;
+};
+
+/**
+ * Store a setting sent by a browser and pass it on to the other browsers of the user
+ *
+ * Objects and names starting with an underscore are ignored, those are not client settings.
+ */
+export function applyClientSetting(client: SettingsOwner, newSetting: unknown): void {
+	if (!_.isPlainObject(newSetting)) {
+		return;
+	}
+
+	const {name, value} = newSetting as {name: unknown; value: unknown};
+
+	if (typeof value === "object" || typeof name !== "string" || name[0] === "_") {
+		return;
+	}
+
+	// We do not need to do write operations and emit events if nothing changed.
+	if (client.config.clientSettings[name] === value) {
+		return;
+	}
+
+	client.config.clientSettings[name] = value;
+
+	// Pass the setting to all browsers of the user
+	client.emit("setting:new", {name, value});
+	client.save();
+
+	if (name === "highlights" || name === "highlightExceptions") {
+		client.compileCustomHighlights();
+	} else if (name === "awayMessage") {
+		client.awayMessage = typeof value === "string" ? value : "";
+	}
+}
@@ -7,9 +7,11 @@ import colors from "chalk";
 import {SearchOptions} from "ldapjs";
 
 import log from "./log";
+import trace from "./trace";
 import Helper from "./helper";
 import Utils from "./command-line/utils";
 import Network from "./models/network";
+import shard from "./shard";
 
 // TODO: Type this
 export type WebIRC = {
@@ -75,6 +77,8 @@ type TlsOptions = any;
 type Debug = {
 	ircFramework: boolean;
 	raw: boolean;
+	modules: string[];
+	traceSampleRate: number;
 };
 
 type StoragePolicy = {
@@ -83,6 +87,26 @@ type StoragePolicy = {
 	deletionPolicy: "statusOnly" | "everything";
 };
 
+type UserActivation = {
+	lazy: boolean;
+	alwaysOn: string[];
+	hibernateAfterMinutes: number;
+};
+
+type Metrics = {
+	enable: boolean;
+	token: string;
+	perUser: boolean;
+};
+
+type StorageProfile = {
+	journalMode: "wal" | "delete" | "truncate" | "persist";
+	synchronous: "normal" | "full" | "off";
+	mmapSizeMB: number;
+	cacheSizeMB: number;
+	readConnection: boolean;
+};
+
 export type ConfigType = {
 	public: boolean;
 	host: string | undefined;
@@ -98,13 +122,22 @@ export type ConfigType = {
 	prefetchMaxImageSize: number;
 	prefetchMaxSearchSize: number;
 	prefetchTimeout: number;
+	prefetchCacheSize: number;
+	prefetchMaxConcurrency: number;
+	prefetchMaxHostConcurrency: number;
 	fileUpload: FileUpload;
 	transports: string[];
+	perMessageDeflate: boolean;
 	leaveMessage: string;
 	defaults: Defaults;
 	lockNetwork: boolean;
 	messageStorage: string[];
 	storagePolicy: StoragePolicy;
+	storageProfile: StorageProfile;
+	cryptoWorkers: number | null;
+	shards: number;
+	userActivation: UserActivation;
+	metrics: Metrics;
 	useHexIp: boolean;
 	webirc?: WebIRC;
 	identd: Identd;
@@ -133,7 +166,8 @@ class Config {
 	}
 
 	getStoragePath() {
-		return path.join(this.#homePath, "storage");
+		// Files are reference counted in memory, so shards can't share them
+		return path.join(this.#homePath, shard.own("storage"));
 	}
 
 	getFileUploadPath() {
@@ -231,6 +265,9 @@ class Config {
 			this.merge(userConfig);
 		}
 
+		log.setDebugModules(this.values.debug.modules);
+		trace.configure(this.values.debug.traceSampleRate);
+
 		if (this.values.fileUpload.baseUrl) {
 			try {
 				new URL("test/file.png", this.values.fileUpload.baseUrl);
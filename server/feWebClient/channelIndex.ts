@@ -0,0 +1,71 @@
+/**
+ * Channel lookup tables for fe-web networks
+ *
+ * `network.channels` stays the ordered list the frontend gets, this only indexes it: by id
+ * across all networks, and by lowercase name within a network. Channel lists are only
+ * changed through FeWebAdapter (addChannelSorted / removeChannel), which keeps both in sync.
+ */
+
+import type Chan from "../models/chan";
+import type {NetworkData} from "./feWebAdapter";
+
+export type ChannelEntry = {network: NetworkData; channel: Chan};
+
+export class ChannelIndex {
+	private byId: Map<number, ChannelEntry> = new Map();
+	private byName: Map<NetworkData, Map<string, Chan>> = new Map();
+
+	add(network: NetworkData, channel: Chan): void {
+		let names = this.byName.get(network);
+
+		if (!names) {
+			names = new Map();
+			this.byName.set(network, names);
+		}
+
+		names.set(channel.name.toLowerCase(), channel);
+		this.byId.set(channel.id, {network, channel});
+	}
+
+	remove(network: NetworkData, channel: Chan): void {
+		const names = this.byName.get(network);
+		const key = channel.name.toLowerCase();
+
+		if (names && names.get(key) === channel) {
+			names.delete(key);
+		}
+
+		if (this.byId.get(channel.id)?.channel === channel) {
+			this.byId.delete(channel.id);
+		}
+	}
+
+	/**
+	 * Index `network.channels` again after the list was replaced as a whole
+	 */
+	reset(network: NetworkData): void {
+		const names = this.byName.get(network);
+
+		if (names) {
+			for (const channel of names.values()) {
+				this.byId.delete(channel.id);
+			}
+
+			names.clear();
+		}
+
+		for (const channel of network.channels) {
+			this.add(network, channel);
+		}
+	}
+
+	get(id: number): ChannelEntry | undefined {
+		return this.byId.get(id);
+	}
+
+	find(network: NetworkData, name: string): Chan | undefined {
+		return this.byName.get(network)?.get(name.toLowerCase());
+	}
+}
+
+export default ChannelIndex;
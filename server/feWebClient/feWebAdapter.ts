@@ -16,11 +16,17 @@ import Chan from "../models/chan";
 import Msg from "../models/msg";
 import User from "../models/user";
 import Prefix from "../models/prefix";
+import Nicklist from "../models/nicklist";
+import ChannelIndex, {ChannelEntry} from "./channelIndex";
 import {ChanType, ChanState} from "../../shared/types/chan";
 import {MessageType} from "../../shared/types/msg";
 import log from "../log";
+import trace from "../trace";
 import colors from "chalk";
 
+// Per event output, enabled with debug.modules: ["adapter"]
+const adapterLog = log.module("adapter");
+
 // Callback types for IrssiClient integration
 export type NetworkData = {
 	uuid: string;
@@ -41,7 +47,7 @@ export type FeWebAdapterCallbacks = {
 	onMessage: (networkUuid: string, channelId: number, msg: Msg) => void;
 	onChannelJoin: (networkUuid: string, channel: Chan) => Promise<void>;
 	onChannelPart: (networkUuid: string, channelId: number) => void;
-	onNicklistUpdate: (networkUuid: string, channelId: number, users: User[]) => void;
+	onNicklistUpdate: (networkUuid: string, channelId: number) => void;
 	onTopicUpdate: (networkUuid: string, channelId: number, topic: string) => void;
 	onNickChange: (networkUuid: string, newNick: string) => void;
 	onInit: (networks: NetworkData[]) => Promise<void>;
@@ -52,11 +58,15 @@ export class FeWebAdapter {
 	private socket: FeWebSocket;
 	private callbacks: FeWebAdapterCallbacks;
 	private serverTagToNetworkMap: Map<string, NetworkData> = new Map();
+	private channelIndex = new ChannelIndex();
 	private messageIdCounter = 1;
 	private channelIdCounter = 1;
 	private initEmitted = false;
 	private networkUuidMap: Map<string, string>; // server_tag -> UUID (persistent)
 	private stateDumpReceivedForNetwork: Map<string, number> = new Map(); // serverTag -> timestamp // Track if state_dump was already received for a network
+	// Channels with nicklist changes not sent yet, a netsplit becomes one update per channel
+	private pendingNicklists: Map<Chan, NetworkData> = new Map();
+	private nicklistTimer: NodeJS.Timeout | null = null;
 
 	constructor(
 		socket: FeWebSocket,
@@ -92,6 +102,20 @@ export class FeWebAdapter {
 		return this.channelIdCounter++;
 	}
 
+	/**
+	 * Network for an irssi server tag
+	 */
+	getNetwork(serverTag: string): NetworkData | undefined {
+		return this.serverTagToNetworkMap.get(serverTag);
+	}
+
+	/**
+	 * Find a channel and its network by channel id, across all networks
+	 */
+	findChannelById(id: number): ChannelEntry | undefined {
+		return this.channelIndex.get(id);
+	}
+
 	/**
 	 * Register all message handlers according to CLIENT-SPEC.md
 	 */
@@ -211,6 +235,8 @@ export class FeWebAdapter {
 			highlight: msg.is_highlight || false,
 		});
 		loungeMsg.id = this.messageIdCounter++;
+		trace.link(msg, loungeMsg);
+		trace.mark(loungeMsg, "adapted");
 
 		// Emit message event
 		this.callbacks.onMessage(network.uuid, channel.id, loungeMsg);
@@ -255,7 +281,7 @@ export class FeWebAdapter {
 		} else {
 			// Someone else joined
 			if (nick && nick !== network.nick) {
-				this.addUserToChannel(channel, nick);
+				this.addUserToChannel(network, channel, nick);
 				const joinMsg = new Msg({
 					type: MessageType.JOIN,
 					time: new Date(),
@@ -281,8 +307,8 @@ export class FeWebAdapter {
 
 		const nick = msg.nick!;
 
-		log.debug(
-			`[FeWebAdapter] handleChannelPart: nick="${nick}", network.nick="${
+		adapterLog.debug(
+			`handleChannelPart: nick="${nick}", network.nick="${
 				network.nick
 			}", match=${nick === network.nick}`
 		);
@@ -294,13 +320,13 @@ export class FeWebAdapter {
 			);
 			this.callbacks.onChannelPart(network.uuid, channel.id);
 			// Remove channel from network
-			network.channels = network.channels.filter((c) => c.id !== channel.id);
+			this.removeChannel(network, channel);
 		} else {
 			// Someone else parted
-			log.debug(
-				`[FeWebAdapter] Channel part (OTHER): ${nick} from ${channel.name} on ${network.name} - sending part message`
+			adapterLog.debug(
+				`Channel part (OTHER): ${nick} from ${channel.name} on ${network.name} - sending part message`
 			);
-			this.removeUserFromChannel(channel, nick);
+			this.removeUserFromChannel(network, channel, nick);
 			const partMsg = new Msg({
 				type: MessageType.PART,
 				time: new Date(),
@@ -330,9 +356,9 @@ export class FeWebAdapter {
 		// Check if we were kicked
 		if (kickedNick === network.nick) {
 			this.callbacks.onChannelPart(network.uuid, channel.id);
-			network.channels = network.channels.filter((c) => c.id !== channel.id);
+			this.removeChannel(network, channel);
 		} else {
-			this.removeUserFromChannel(channel, kickedNick);
+			this.removeUserFromChannel(network, channel, kickedNick);
 		}
 
 		const kickMsg = new Msg({
@@ -358,7 +384,7 @@ export class FeWebAdapter {
 
 		// Remove user from all channels
 		for (const channel of network.channels) {
-			if (this.removeUserFromChannel(channel, nick)) {
+			if (this.removeUserFromChannel(network, channel, nick)) {
 				const quitMsg = new Msg({
 					type: MessageType.QUIT,
 					time: new Date(),
@@ -431,8 +457,8 @@ export class FeWebAdapter {
 	 * text field contains JSON array: [{"nick":"alice","prefix":"@"}, ...]
 	 */
 	private handleNicklist(msg: FeWebMessage): void {
-		log.debug(
-			`[FeWebAdapter] handleNicklist: server=${msg.server}, channel=${
+		adapterLog.debug(
+			`handleNicklist: server=${msg.server}, channel=${
 				msg.channel
 			}, text.length=${msg.text?.length || 0}`
 		);
@@ -455,49 +481,30 @@ export class FeWebAdapter {
 
 		try {
 			const nicklist: Array<{nick: string; prefix: string}> = JSON.parse(msg.text || "[]");
-			log.debug(`[FeWebAdapter] Parsed ${nicklist.length} users from nicklist JSON`);
-
-			// Clear existing users
-			channel.users.clear();
+			adapterLog.debug(`Parsed ${nicklist.length} users from nicklist JSON`);
 
 			// Add all users with their modes
-			nicklist.forEach((userEntry) => {
+			const users = nicklist.map((userEntry) => {
 				// Convert prefix symbol (@, +, %, !) to mode character (o, v, h, Y)
 				// using network's PREFIX mapping
 				const modeChar = this.prefixToMode(userEntry.prefix, network);
 
 				// User constructor expects modes: string[] (mode characters)
 				// and will convert them to symbols using PREFIX.modeToSymbol
-				const user = new User(
+				return new User(
 					{
 						nick: userEntry.nick,
 						modes: modeChar ? [modeChar] : [], // Array of mode characters
 					},
 					network.serverOptions.PREFIX // Prefix for symbol conversion
 				);
-
-				channel.users.set(user.nick.toLowerCase(), user);
 			});
 
-			log.debug(`[FeWebAdapter] Added ${channel.users.size} users to channel.users Map`);
-
-			// Sort users by mode then nick
-			this.sortChannelUsers(channel);
+			// Replaces the existing users, sorted once the list is sent
+			this.nicklistOf(network, channel).load(users);
+			adapterLog.debug(`Added ${channel.users.size} users to channel.users Map`);
 
-			// Emit nicklist update (convert Map to Array)
-			const usersArray = Array.from(channel.users.values());
-			log.debug(
-				`[FeWebAdapter] Calling onNicklistUpdate with ${usersArray.length} users for channel ${channel.id}`
-			);
-			log.debug(
-				`[FeWebAdapter] First 3 users BEFORE callback: ${JSON.stringify(
-					usersArray
-						.slice(0, 3)
-						.map((u) => ({nick: u.nick, modes: u.modes, mode: u.mode}))
-				)}`
-			);
-			this.callbacks.onNicklistUpdate(network.uuid, channel.id, usersArray);
-			log.debug(`[FeWebAdapter] onNicklistUpdate callback COMPLETED`);
+			this.scheduleNicklistUpdate(network, channel);
 		} catch (error) {
 			log.error(`[FeWebAdapter] Failed to parse nicklist: ${error}`);
 		}
@@ -510,8 +517,8 @@ export class FeWebAdapter {
 	private handleNicklistUpdate(msg: FeWebMessage): void {
 		const task = msg.task;
 
-		log.debug(
-			`[FeWebAdapter] handleNicklistUpdate: server=${msg.server}, channel=${msg.channel}, nick=${msg.nick}, task=${task}`
+		adapterLog.debug(
+			`handleNicklistUpdate: server=${msg.server}, channel=${msg.channel}, nick=${msg.nick}, task=${task}`
 		);
 
 		const network = this.getOrCreateNetwork(msg.server!);
@@ -536,14 +543,14 @@ export class FeWebAdapter {
 		switch (task) {
 			case "add":
 				// Add user with no modes
-				this.addUserToChannel(channel, nick);
-				log.debug(`[FeWebAdapter] Added user ${nick} to ${msg.channel}`);
+				this.addUserToChannel(network, channel, nick);
+				adapterLog.debug(`Added user ${nick} to ${msg.channel}`);
 				break;
 
 			case "remove":
 				// Remove user from nicklist
-				channel.users.delete(nick.toLowerCase());
-				log.debug(`[FeWebAdapter] Removed user ${nick} from ${msg.channel}`);
+				this.removeUserFromChannel(network, channel, nick);
+				adapterLog.debug(`Removed user ${nick} from ${msg.channel}`);
 				break;
 
 			case "change":
@@ -576,28 +583,17 @@ export class FeWebAdapter {
 				// Update nick in ALL channels where this user exists
 				let updatedChannels = 0;
 				network.channels.forEach((ch) => {
-					const user = ch.users.get(nick.toLowerCase());
-					if (user) {
-						ch.users.delete(nick.toLowerCase());
-						user.nick = newNick;
-						ch.users.set(newNick.toLowerCase(), user);
-						this.sortChannelUsers(ch);
+					if (this.renameUserInChannel(network, ch, nick, newNick)) {
+						// Frontend needs to refresh the nicklist of every channel
+						this.scheduleNicklistUpdate(network, ch);
 						updatedChannels++;
 					}
 				});
 
-				log.debug(
-					`[FeWebAdapter] Renamed user ${nick} → ${newNick} in ${updatedChannels} channels on ${msg.server}`
+				adapterLog.debug(
+					`Renamed user ${nick} → ${newNick} in ${updatedChannels} channels on ${msg.server}`
 				);
 
-				// Emit update for ALL channels (frontend needs to refresh nicklist for all)
-				network.channels.forEach((ch) => {
-					if (ch.users.has(newNick.toLowerCase())) {
-						const usersArray = Array.from(ch.users.values());
-						this.callbacks.onNicklistUpdate(network.uuid, ch.id, usersArray);
-					}
-				});
-
 				// Don't continue to the single-channel update at the end
 				return;
 
@@ -634,10 +630,11 @@ export class FeWebAdapter {
 					targetUser.modes = targetUser.modes.filter((m) => m !== modeSymbol);
 				}
 
-				log.debug(
-					`[FeWebAdapter] Updated modes for ${nick} in ${
-						msg.channel
-					}: ${targetUser.modes.join("")}`
+				// Its rank in the nicklist may have changed
+				this.nicklistOf(network, channel).update(nick.toLowerCase());
+
+				adapterLog.debug(
+					`Updated modes for ${nick} in ${msg.channel}: ${targetUser.modes.join("")}`
 				);
 				break;
 
@@ -646,12 +643,8 @@ export class FeWebAdapter {
 				return;
 		}
 
-		// Re-sort users after any change
-		this.sortChannelUsers(channel);
-
 		// Emit update to frontend
-		const usersArray = Array.from(channel.users.values());
-		this.callbacks.onNicklistUpdate(network.uuid, channel.id, usersArray);
+		this.scheduleNicklistUpdate(network, channel);
 	}
 
 	/**
@@ -684,16 +677,8 @@ export class FeWebAdapter {
 
 		// Update nick in all channels
 		network.channels.forEach((channel) => {
-			const user = channel.users.get(oldNick.toLowerCase());
-			if (user) {
-				// Remove old entry and add new one
-				channel.users.delete(oldNick.toLowerCase());
-				user.nick = newNick;
-				channel.users.set(newNick.toLowerCase(), user);
-
-				// Sort users alphabetically (important for own nick change!)
-				this.sortChannelUsers(channel);
-
+			// Moves the user to its new place in the nicklist (important for own nick change!)
+			if (this.renameUserInChannel(network, channel, oldNick, newNick)) {
 				const nickMsg = new Msg({
 					type: MessageType.NICK,
 					time: new Date(),
@@ -705,8 +690,7 @@ export class FeWebAdapter {
 				this.callbacks.onMessage(network.uuid, channel.id, nickMsg);
 
 				// Emit nicklist update for this channel
-				const usersArray = Array.from(channel.users.values());
-				this.callbacks.onNicklistUpdate(network.uuid, channel.id, usersArray);
+				this.scheduleNicklistUpdate(network, channel);
 			}
 		});
 	}
@@ -831,6 +815,7 @@ export class FeWebAdapter {
 		// Clear existing channels (except lobby) to prepare for fresh state
 		const lobby = network.channels.find((ch) => ch.type === "lobby");
 		network.channels = lobby ? [lobby] : [];
+		this.channelIndex.reset(network);
 
 		// Mark network as connected
 		network.connected = true;
@@ -872,7 +857,7 @@ export class FeWebAdapter {
 		// Check if query already exists
 		let channel = this.findChannel(network, nick);
 		if (channel) {
-			log.debug(`[FeWebAdapter] Query ${nick} already exists`);
+			adapterLog.debug(`Query ${nick} already exists`);
 			return;
 		}
 
@@ -893,19 +878,14 @@ export class FeWebAdapter {
 		const nick = msg.nick!;
 
 		// Find and remove query channel
-		const channelIndex = network.channels.findIndex(
-			(ch) => ch.type === "query" && ch.name.toLowerCase() === nick.toLowerCase()
-		);
+		const channel = this.findChannel(network, nick);
 
-		if (channelIndex === -1) {
-			log.debug(`[FeWebAdapter] Query ${nick} not found`);
+		if (!channel || channel.type !== ChanType.QUERY) {
+			adapterLog.debug(`Query ${nick} not found`);
 			return;
 		}
 
-		const channel = network.channels[channelIndex];
-
-		// Remove from network
-		network.channels.splice(channelIndex, 1);
+		this.removeChannel(network, channel);
 
 		// Emit part event
 		this.callbacks.onChannelPart(network.uuid, channel.id);
@@ -922,7 +902,7 @@ export class FeWebAdapter {
 	 * 20. pong - Pong response
 	 */
 	private handlePong(msg: FeWebMessage): void {
-		log.debug("[FeWebAdapter] Received pong");
+		adapterLog.debug("Received pong");
 	}
 
 	/**
@@ -998,23 +978,22 @@ export class FeWebAdapter {
 			};
 
 			this.serverTagToNetworkMap.set(serverTag, network);
+			this.channelIndex.add(network, lobbyChannel);
 			log.info(
 				`[FeWebAdapter] Created network for server tag: ${serverTag} with lobby channel`
 			);
-			log.debug(
-				`[IrssiClient] Network ${serverTag} serverOptions: ${JSON.stringify(
-					network.serverOptions
-				)}`
-			);
+			if (adapterLog.enabled) {
+				adapterLog.debug(
+					`Network ${serverTag} serverOptions: ${JSON.stringify(network.serverOptions)}`
+				);
+			}
 		}
 
 		return network;
 	}
 
-	private findChannel(network: NetworkData, channelName: string): Chan | null {
-		return (
-			network.channels.find((c) => c.name.toLowerCase() === channelName.toLowerCase()) || null
-		);
+	findChannel(network: NetworkData, channelName: string): Chan | null {
+		return this.channelIndex.find(network, channelName) || null;
 	}
 
 	private createChannel(network: NetworkData, channelName: string): Chan {
@@ -1044,7 +1023,7 @@ export class FeWebAdapter {
 	 * Sort order: CHANNEL (alphabetically) → QUERY (alphabetically)
 	 * Lobby is always first (index 0)
 	 */
-	private addChannelSorted(network: NetworkData, newChan: Chan): void {
+	addChannelSorted(network: NetworkData, newChan: Chan): void {
 		let index = network.channels.length; // Default to putting as the last item
 
 		// Don't sort special channels in amongst channels/users.
@@ -1084,19 +1063,89 @@ export class FeWebAdapter {
 		}
 
 		network.channels.splice(index, 0, newChan);
+		this.channelIndex.add(network, newChan);
 	}
 
-	private addUserToChannel(channel: Chan, nick: string): void {
+	/**
+	 * Remove channel from network, does nothing if it's already gone
+	 */
+	removeChannel(network: NetworkData, channel: Chan): void {
+		const index = network.channels.indexOf(channel);
+
+		if (index !== -1) {
+			network.channels.splice(index, 1);
+		}
+
+		this.channelIndex.remove(network, channel);
+		this.pendingNicklists.delete(channel);
+	}
+
+	private addUserToChannel(network: NetworkData, channel: Chan, nick: string): void {
+		const users = this.nicklistOf(network, channel);
+
 		// Check if user already exists
-		const existingUser = channel.users.get(nick.toLowerCase());
-		if (!existingUser) {
-			const user = new User({nick});
-			channel.users.set(nick.toLowerCase(), user);
+		if (!users.has(nick.toLowerCase())) {
+			users.set(nick.toLowerCase(), new User({nick}));
 		}
 	}
 
-	private removeUserFromChannel(channel: Chan, nick: string): boolean {
-		return channel.users.delete(nick.toLowerCase());
+	private removeUserFromChannel(network: NetworkData, channel: Chan, nick: string): boolean {
+		return this.nicklistOf(network, channel).delete(nick.toLowerCase());
+	}
+
+	private renameUserInChannel(
+		network: NetworkData,
+		channel: Chan,
+		oldNick: string,
+		newNick: string
+	): boolean {
+		const users = this.nicklistOf(network, channel);
+		const user = users.get(oldNick.toLowerCase());
+
+		if (!user) {
+			return false;
+		}
+
+		users.delete(oldNick.toLowerCase());
+		user.nick = newNick;
+		users.set(newNick.toLowerCase(), user);
+		return true;
+	}
+
+	/**
+	 * Users of a channel, kept in nicklist order
+	 */
+	private nicklistOf(network: NetworkData, channel: Chan): Nicklist {
+		if (!(channel.users instanceof Nicklist)) {
+			const users = new Nicklist(network.serverOptions.PREFIX);
+			users.load(Array.from(channel.users.values()));
+			channel.users = users;
+		}
+
+		return channel.users;
+	}
+
+	/**
+	 * Tell the frontend the nicklist of a channel changed, after the current burst of changes
+	 * The list itself is only built for browsers that ask for it
+	 */
+	private scheduleNicklistUpdate(network: NetworkData, channel: Chan): void {
+		this.pendingNicklists.set(channel, network);
+
+		if (this.nicklistTimer) {
+			return;
+		}
+
+		this.nicklistTimer = setTimeout(() => {
+			this.nicklistTimer = null;
+
+			const pending = this.pendingNicklists;
+			this.pendingNicklists = new Map();
+
+			for (const [ch, net] of pending) {
+				this.callbacks.onNicklistUpdate(net.uuid, ch.id);
+			}
+		}, 50);
 	}
 
 	/**
@@ -1139,32 +1188,4 @@ export class FeWebAdapter {
 
 		return "";
 	}
-
-	/**
-	 * Sort channel users by mode then nick
-	 * Order: owner (~), admin (&), op (@), halfop (%), voice (+), normal
-	 */
-	private sortChannelUsers(channel: Chan): void {
-		const modeOrder = ["q", "a", "o", "h", "v", ""];
-
-		// Convert Map to Array, sort, then recreate Map
-		const usersArray = Array.from(channel.users.values());
-		usersArray.sort((a, b) => {
-			const aModeIndex = modeOrder.indexOf(a.mode);
-			const bModeIndex = modeOrder.indexOf(b.mode);
-
-			if (aModeIndex !== bModeIndex) {
-				return aModeIndex - bModeIndex;
-			}
-
-			// Same mode - sort by nick (case insensitive)
-			return a.nick.toLowerCase().localeCompare(b.nick.toLowerCase());
-		});
-
-		// Recreate Map with sorted users
-		channel.users.clear();
-		usersArray.forEach((user) => {
-			channel.users.set(user.nick.toLowerCase(), user);
-		});
-	}
 }
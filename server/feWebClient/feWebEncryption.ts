@@ -12,6 +12,7 @@
  */
 
 import crypto from "crypto";
+import cryptoPool from "../plugins/crypto/pool";
 
 /**
  * FIXED salt for fe-web v1.5 protocol
@@ -19,6 +20,9 @@ import crypto from "crypto";
  */
 const FE_WEB_SALT = "irssi-fe-web-v1";
 
+// Pins every connection to one crypto worker, so its frames keep their order
+let nextAffinity = 0;
+
 /**
  * Encryption helper for fe-web messages
  *
@@ -35,11 +39,14 @@ const FE_WEB_SALT = "irssi-fe-web-v1";
  *
  * Message Format:
  * [IV (12 bytes)] [Ciphertext (variable)] [Auth Tag (16 bytes)]
+ *
+ * Encryption runs on the shared crypto worker pool, off the main thread.
  */
 export class FeWebEncryption {
 	private password: string;
 	private key: Buffer | null = null;
 	private enabled: boolean;
+	private affinity: number = nextAffinity++;
 
 	/**
 	 * @param password - WebSocket password (used for key derivation with FIXED salt)
@@ -96,25 +103,8 @@ export class FeWebEncryption {
 			return Buffer.from(plaintext, "utf8");
 		}
 
-		// Generate random IV (12 bytes for GCM)
-		const iv = crypto.randomBytes(12);
-
-		// Create cipher
-		const cipher = crypto.createCipheriv("aes-256-gcm", this.key, iv);
-
-		// Encrypt plaintext
-		const encrypted = Buffer.concat([
-			cipher.update(plaintext, "utf8"),
-			cipher.final(),
-		]);
-
-		// Get authentication tag
-		const tag = cipher.getAuthTag();
-
-		// Build message: IV + ciphertext + tag
-		const message = Buffer.concat([iv, encrypted, tag]);
-
-		return message;
+		// Random IV per message, output is IV + ciphertext + tag
+		return cryptoPool.encrypt(this.key, plaintext, this.affinity);
 	}
 
 	/**
@@ -129,30 +119,34 @@ export class FeWebEncryption {
 			return data.toString("utf8");
 		}
 
-		// Extract IV, ciphertext, and tag
-		const iv = data.slice(0, 12);
-		const tag = data.slice(-16);
-		const ciphertext = data.slice(12, -16);
-
 		try {
-			// Create decipher
-			const decipher = crypto.createDecipheriv("aes-256-gcm", this.key, iv);
-			decipher.setAuthTag(tag);
-
 			// Decrypt and verify auth tag
-			const plaintext = Buffer.concat([
-				decipher.update(ciphertext),
-				decipher.final(),
-			]);
-
-			// Decode to string
-			return plaintext.toString("utf8");
+			return await cryptoPool.decrypt(this.key, data, this.affinity);
 		} catch (error) {
 			console.error("[FeWebEncryption] Decryption failed:", error);
 			throw new Error("Decryption failed - invalid key or corrupted data");
 		}
 	}
 
+	/**
+	 * Decrypt and parse a batch of JSON frames, spread over the crypto workers
+	 *
+	 * @returns Parsed messages in the same order, null for frames that fail to decrypt or parse
+	 */
+	async decryptFrames(frames: Buffer[]): Promise<any[]> {
+		if (!this.enabled || !this.key) {
+			return frames.map((data) => {
+				try {
+					return JSON.parse(data.toString("utf8"));
+				} catch {
+					return null;
+				}
+			});
+		}
+
+		return cryptoPool.frames(this.key, frames);
+	}
+
 	/**
 	 * Check if encryption is enabled and key is derived
 	 */
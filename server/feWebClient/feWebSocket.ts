@@ -9,7 +9,26 @@
 
 import WebSocket from "ws";
 import {EventEmitter} from "events";
+import {performance} from "perf_hooks";
 import {FeWebEncryption} from "./feWebEncryption";
+import log from "../log";
+import trace from "../trace";
+import metrics, {CounterSeries, HistogramSeries} from "../metrics";
+
+// Per frame output, enabled with debug.modules: ["fe-web"]
+const frameLog = log.module("fe-web");
+
+const framesReceived = metrics.counter(
+	"thelounge_feweb_frames_received_total",
+	"Frames from irssi"
+);
+const bytesReceived = metrics.counter("thelounge_feweb_received_bytes_total", "Bytes from irssi");
+const framesSent = metrics.counter("thelounge_feweb_frames_sent_total", "Frames sent to irssi");
+const bytesSent = metrics.counter("thelounge_feweb_sent_bytes_total", "Bytes sent to irssi");
+const decryptTime = metrics.histogram(
+	"thelounge_feweb_decrypt_seconds",
+	"Time to decrypt a batch of frames from irssi"
+);
 
 // Message types from CLIENT-SPEC.md
 export interface FeWebMessage {
@@ -35,11 +54,15 @@ export interface FeWebMessage {
 	error_code?: string; // For command_result
 	networks?: any[]; // For network_list_response
 	servers?: any[]; // For server_list_response
+	// Resume (delta resync)
+	seq?: number; // Event sequence number, set on every server → client event
+	session?: string; // For auth_ok: identifies the server's event log
 }
 
 // Client → Server message types
 export type ClientMessageType =
 	| "sync_server"
+	| "resume"
 	| "command"
 	| "ping"
 	| "close_query"
@@ -78,7 +101,9 @@ export type ServerMessageType =
 	| "pong"
 	| "network_list_response"
 	| "server_list_response"
-	| "command_result";
+	| "command_result"
+	| "resume_ok" // Events after the requested seq follow
+	| "resume_failed"; // Requested seq is no longer in the event log, sync_server instead
 
 export interface FeWebConfig {
 	host: string;
@@ -100,14 +125,28 @@ export interface FeWebConfig {
 	maxReconnectDelay?: number;
 	pingInterval?: number;
 
+	user?: string; // The Lounge user of the connection, labels its metrics
+
 	// Callback for disconnect event (for IrssiClient reconnect handling)
 	onDisconnect?: (code: number, reason: string) => void;
 }
 
-type MessageHandler = (message: FeWebMessage) => void;
+type MessageHandler = (message: FeWebMessage) => void | Promise<void>;
+
+type InboundFrame = {data: WebSocket.Data; binary: boolean};
+
+// Frames waiting to be handled are decoded together, up to this many at a time
+const maxFrameBatch = 1024;
+// Reading from the socket pauses while this many frames are waiting
+const maxQueuedFrames = 4096;
+
+// Messages with a seq that isn't the position of an event in the log
+const controlMessages = new Set(["auth_ok", "resume_ok", "resume_failed"]);
 
 // Internal config type with all required fields
-type InternalFeWebConfig = Required<Omit<FeWebConfig, "ca" | "cert" | "key" | "onDisconnect">> & {
+type InternalFeWebConfig = Required<
+	Omit<FeWebConfig, "ca" | "cert" | "key" | "onDisconnect" | "user">
+> & {
 	ca?: Buffer;
 	cert?: Buffer;
 	key?: Buffer;
@@ -126,6 +165,25 @@ export class FeWebSocket extends EventEmitter {
 	private messageIdCounter = 0;
 	private encryption: FeWebEncryption | null = null;
 
+	// Position in the server's event log, to resume from after a reconnect
+	private session: string | null = null;
+	private lastSeq = 0;
+	private resuming = false;
+	private resumeTimer: NodeJS.Timeout | null = null;
+
+	// Received frames, decoded in batches but always handled in the order they arrived
+	private inbound: InboundFrame[] = [];
+	private draining = false;
+	private pausedSocket: WebSocket | null = null;
+
+	private meters: {
+		framesReceived: CounterSeries;
+		bytesReceived: CounterSeries;
+		framesSent: CounterSeries;
+		bytesSent: CounterSeries;
+		decryptTime: HistogramSeries;
+	};
+
 	/**
 	 * Check if WebSocket is connected
 	 */
@@ -158,6 +216,18 @@ export class FeWebSocket extends EventEmitter {
 
 		this.currentReconnectDelay = this.config.reconnectDelay;
 
+		const labels = metrics.userLabels(config.user);
+		this.meters = {
+			framesReceived: framesReceived.with(labels),
+			bytesReceived: bytesReceived.with(labels),
+			framesSent: framesSent.with(labels),
+			bytesSent: bytesSent.with(labels),
+			decryptTime: decryptTime.with(labels),
+		};
+
+		this.onMessage("resume_ok", () => this.finishResume(true));
+		this.onMessage("resume_failed", () => this.finishResume(false));
+
 		// Initialize encryption (REQUIRED for fe-web v1.5)
 		if (this.config.encryption && this.config.password) {
 			this.encryption = new FeWebEncryption(
@@ -249,9 +319,22 @@ export class FeWebSocket extends EventEmitter {
 				// Start keepalive ping
 				this.startPing();
 
-				// Auto sync to default server
-				if (this.config.defaultServer) {
-					this.syncServer(this.config.defaultServer);
+				// Same event log as before the reconnect, only ask for what we missed
+				if (msg.session && msg.session === this.session && this.lastSeq > 0) {
+					this.resume();
+				} else {
+					if (this.canResume()) {
+						// irssi was restarted, the state we kept is gone
+						this.emit("resync");
+					}
+
+					this.session = msg.session ?? null;
+					this.lastSeq = 0;
+
+					// Auto sync to default server
+					if (this.config.defaultServer) {
+						this.syncServer(this.config.defaultServer);
+					}
 				}
 
 				console.log("[FeWebSocket] Calling resolve()");
@@ -274,8 +357,8 @@ export class FeWebSocket extends EventEmitter {
 			});
 
 			// Message received
-			this.ws.on("message", (data: WebSocket.Data) => {
-				this.handleMessage(data);
+			this.ws.on("message", (data: WebSocket.Data, isBinary: boolean) => {
+				this.enqueueFrame(data, isBinary);
 			});
 
 			// Connection error
@@ -291,6 +374,8 @@ export class FeWebSocket extends EventEmitter {
 				this._isConnected = false;
 				this.isAuthenticated = false;
 				this.stopPing();
+				this.resuming = false;
+				this.stopResumeTimer();
 
 				// Emit 'disconnected' event for EventEmitter listeners
 				this.emit("disconnected", code, reasonStr);
@@ -331,6 +416,8 @@ export class FeWebSocket extends EventEmitter {
 		}
 
 		this.stopPing();
+		this.resuming = false;
+		this.stopResumeTimer();
 
 		if (this.ws) {
 			this.ws.close(1000, "Client disconnect");
@@ -366,17 +453,23 @@ export class FeWebSocket extends EventEmitter {
 		}
 
 		const json = JSON.stringify(message);
-		console.log("[FeWebSocket] Sending:", json);
+		if (frameLog.enabled) {
+			frameLog.debug("Sending", {type: message.type, bytes: json.length});
+		}
 
 		try {
 			if (this.encryption) {
 				// Encrypt and send as binary frame
 				const encrypted = await this.encryption.encrypt(json);
 				this.ws.send(encrypted);
+				this.meters.bytesSent.inc(encrypted.length);
 			} else {
 				// Send as text frame (plain)
 				this.ws.send(json);
+				this.meters.bytesSent.inc(Buffer.byteLength(json));
 			}
+
+			this.meters.framesSent.inc();
 		} catch (error) {
 			console.error("[FeWebSocket] Encryption failed:", error);
 			throw error;
@@ -420,6 +513,62 @@ export class FeWebSocket extends EventEmitter {
 		});
 	}
 
+	/**
+	 * Whether a reconnect can resume from the event log instead of a full state_dump
+	 * (the server sends sequence numbers and we have seen some)
+	 */
+	canResume(): boolean {
+		return this.session !== null && this.lastSeq > 0;
+	}
+
+	/**
+	 * Ask for the events after the last one seen (CLIENT-SPEC.md: resume)
+	 * Emits "resumed" once the server replays them, or "resync" when it can't and a full
+	 * sync_server follows instead
+	 */
+	private resume(): void {
+		console.log(`[FeWebSocket] Resuming session ${this.session} after seq ${this.lastSeq}`);
+
+		this.resuming = true;
+
+		// Fall back to a full sync if the server never answers
+		this.resumeTimer = setTimeout(() => this.finishResume(false), 10000);
+
+		this.send({
+			type: "resume",
+			seq: this.lastSeq,
+		});
+	}
+
+	private finishResume(resumed: boolean): void {
+		if (!this.resuming) {
+			return;
+		}
+
+		this.resuming = false;
+		this.stopResumeTimer();
+
+		if (resumed) {
+			this.emit("resumed");
+			return;
+		}
+
+		console.log("[FeWebSocket] Resume not possible, requesting a full state_dump");
+		this.lastSeq = 0;
+		this.emit("resync");
+
+		if (this.config.defaultServer) {
+			this.syncServer(this.config.defaultServer);
+		}
+	}
+
+	private stopResumeTimer(): void {
+		if (this.resumeTimer !== null) {
+			clearTimeout(this.resumeTimer);
+			this.resumeTimer = null;
+		}
+	}
+
 	/**
 	 * Execute IRC command (CLIENT-SPEC.md: command)
 	 *
@@ -484,67 +633,164 @@ export class FeWebSocket extends EventEmitter {
 	}
 
 	/**
-	 * Handle incoming WebSocket message
+	 * Queue an incoming frame, reading stops while too many of them are waiting
+	 */
+	private enqueueFrame(data: WebSocket.Data, isBinary: boolean): void {
+		const frame = {data, binary: isBinary && typeof data !== "string"};
+		trace.start(frame);
+		this.inbound.push(frame);
+
+		if (this.inbound.length >= maxQueuedFrames && this.ws && this.pausedSocket !== this.ws) {
+			console.warn(`[FeWebSocket] ${this.inbound.length} frames waiting, pausing reads`);
+			this.pausedSocket = this.ws;
+			this.ws.pause();
+		}
+
+		void this.drainInbound();
+	}
+
+	/**
+	 * Decode and dispatch queued frames, one batch at a time so their order is kept
 	 */
-	private async handleMessage(data: WebSocket.Data): Promise<void> {
+	private async drainInbound(): Promise<void> {
+		if (this.draining) {
+			return;
+		}
+
+		this.draining = true;
+
 		try {
-			console.log(
-				`[FeWebSocket] Received message, type: ${
-					Buffer.isBuffer(data) ? "binary" : typeof data
-				}, length: ${Buffer.isBuffer(data) ? data.length : (data as string).length}`
-			);
+			while (this.inbound.length > 0) {
+				const frames = this.inbound.splice(0, maxFrameBatch);
 
-			let json: string;
+				if (this.pausedSocket && this.inbound.length < maxQueuedFrames / 2) {
+					this.pausedSocket.resume();
+					this.pausedSocket = null;
+				}
 
-			// Check if message is binary (encrypted) or text (plain)
-			if (Buffer.isBuffer(data)) {
-				// Binary frame - decrypt
-				if (!this.encryption) {
-					console.error(
-						"[FeWebSocket] Received encrypted message but encryption is disabled"
-					);
-					return;
+				const messages = await this.decodeFrames(frames);
+
+				// Checked one at a time, auth_ok resets the position when the session changed
+				for (const message of coalesceMessages(messages)) {
+					if (!this.alreadySeen(message)) {
+						await this.dispatchMessage(message);
+					}
+				}
+			}
+		} catch (error) {
+			console.error("[FeWebSocket] Failed to handle messages:", error);
+		} finally {
+			this.draining = false;
+		}
+
+		// Frames that arrived after a failed batch
+		if (this.inbound.length > 0) {
+			void this.drainInbound();
+		}
+	}
+
+	/**
+	 * Parse a batch of frames, binary ones are decrypted on the crypto workers
+	 * Frames that can't be decrypted or parsed are logged and dropped
+	 */
+	private async decodeFrames(frames: InboundFrame[]): Promise<FeWebMessage[]> {
+		const messages: (FeWebMessage | null)[] = new Array(frames.length).fill(null);
+		const encrypted: Buffer[] = [];
+		const slots: number[] = [];
+
+		this.meters.framesReceived.inc(frames.length);
+
+		frames.forEach((frame, i) => {
+			const data = frameBuffer(frame.data);
+			this.meters.bytesReceived.inc(data.length);
+
+			if (!frame.binary) {
+				try {
+					messages[i] = JSON.parse(data.toString("utf8"));
+					trace.link(frame, messages[i]!);
+				} catch (error) {
+					console.error("[FeWebSocket] Failed to parse message:", error);
 				}
 
-				console.log(`[FeWebSocket] Decrypting binary message (${data.length} bytes)...`);
-				json = await this.encryption.decrypt(data);
-				console.log(`[FeWebSocket] Decrypted message: ${json}`);
-			} else if (typeof data === "string") {
-				// Text frame - plain JSON
-				json = data;
-				console.log(`[FeWebSocket] Plain text message: ${json}`);
-			} else {
-				console.error("[FeWebSocket] Unexpected message type:", typeof data);
 				return;
 			}
 
-			const message: FeWebMessage = JSON.parse(json);
-			console.log("[FeWebSocket] Received:", message);
+			if (!this.encryption) {
+				console.error("[FeWebSocket] Received encrypted message but encryption is disabled");
+				return;
+			}
 
-			// Emit event for EventEmitter listeners (used in connect() Promise)
-			this.emit(message.type, message);
+			encrypted.push(data);
+			slots.push(i);
+		});
 
-			// Dispatch to registered handlers
-			const handlers = this.messageHandlers.get(message.type as ServerMessageType);
+		if (encrypted.length > 0) {
+			const started = performance.now();
+			const decrypted = await this.encryption!.decryptFrames(encrypted);
+			this.meters.decryptTime.observe((performance.now() - started) / 1000);
 
-			if (handlers) {
-				console.log(
-					`[FeWebSocket] Calling ${handlers.length} handler(s) for type: ${message.type}`
-				);
-				handlers.forEach((handler) => {
-					try {
-						handler(message);
-					} catch (error) {
-						console.error(`[FeWebSocket] Error in handler for ${message.type}:`, error);
-					}
-				});
-			} else {
-				console.warn(
-					`[FeWebSocket] No handlers registered for message type: ${message.type}`
-				);
+			decrypted.forEach((message, j) => {
+				if (message) {
+					messages[slots[j]] = message;
+					trace.link(frames[slots[j]], message);
+				} else {
+					console.error(
+						`[FeWebSocket] Failed to decrypt message (${encrypted[j].length} bytes)`
+					);
+				}
+			});
+		}
+
+		const decoded = messages.filter((message): message is FeWebMessage => message !== null);
+		decoded.forEach((message) => trace.mark(message, "decrypted"));
+
+		return decoded;
+	}
+
+	/**
+	 * Whether an event was seen already, replayed events can overlap with what arrived
+	 * before a disconnect. Control messages carry the server's seq or the one asked to
+	 * resume from, they are never dropped and don't move the position.
+	 */
+	private alreadySeen(message: FeWebMessage): boolean {
+		if (typeof message.seq !== "number" || controlMessages.has(message.type)) {
+			return false;
+		}
+
+		if (message.seq <= this.lastSeq) {
+			frameLog.debug("Skipping already seen event", {seq: message.seq});
+			return true;
+		}
+
+		this.lastSeq = message.seq;
+		return false;
+	}
+
+	/**
+	 * Hand a message to its listeners and registered handlers
+	 * Handlers run one after another, the next message waits until async ones have settled
+	 */
+	private async dispatchMessage(message: FeWebMessage): Promise<void> {
+		if (frameLog.enabled) {
+			frameLog.debug("Received", {type: message.type, seq: message.seq});
+		}
+
+		// Emit event for EventEmitter listeners (used in connect() Promise)
+		this.emit(message.type, message);
+
+		// Dispatch to registered handlers
+		const handlers = this.messageHandlers.get(message.type as ServerMessageType);
+
+		if (handlers) {
+			for (const handler of handlers) {
+				try {
+					await handler(message);
+				} catch (error) {
+					console.error(`[FeWebSocket] Error in handler for ${message.type}:`, error);
+				}
 			}
-		} catch (error) {
-			console.error("[FeWebSocket] Failed to parse message:", error);
+		} else {
+			console.warn(`[FeWebSocket] No handlers registered for message type: ${message.type}`);
 		}
 	}
 
@@ -603,3 +849,56 @@ export class FeWebSocket extends EventEmitter {
 		return `msg-${Date.now()}-${++this.messageIdCounter}`;
 	}
 }
+
+function frameBuffer(data: WebSocket.Data): Buffer {
+	if (Buffer.isBuffer(data)) {
+		return data;
+	}
+
+	if (Array.isArray(data)) {
+		return Buffer.concat(data);
+	}
+
+	if (typeof data === "string") {
+		return Buffer.from(data, "utf8");
+	}
+
+	return Buffer.from(data);
+}
+
+/**
+ * Drop the messages of a batch a later one makes redundant
+ *
+ * A full nicklist replaces every nicklist and nicklist update before it for the same channel.
+ * Quits and nick changes look at the nicklists, so nothing before them is dropped.
+ */
+export function coalesceMessages(messages: FeWebMessage[]): FeWebMessage[] {
+	const replaced = new Set<string>();
+	const keep = new Array<boolean>(messages.length);
+
+	for (let i = messages.length - 1; i >= 0; i--) {
+		const message = messages[i];
+
+		if (
+			message.type === "user_quit" ||
+			message.type === "nick_change" ||
+			(message.type === "nicklist_update" && message.task === "change")
+		) {
+			replaced.clear();
+		}
+
+		if (message.type !== "nicklist" && message.type !== "nicklist_update") {
+			keep[i] = true;
+			continue;
+		}
+
+		const key = `${message.server}\0${(message.channel || "").toLowerCase()}`;
+		keep[i] = message.task === "change" || !replaced.has(key);
+
+		if (message.type === "nicklist") {
+			replaced.add(key);
+		}
+	}
+
+	return messages.filter((_, i) => keep[i]);
+}
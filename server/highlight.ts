@@ -0,0 +1,64 @@
+import escapeRegExp from "lodash/escapeRegExp";
+
+import {cleanIrcMessage} from "../shared/irc";
+
+// Characters around highlight words, the nick has to stand apart from letters and digits
+const wordStart = `(?:^|[ .,+!?|/:<>(){}'"@&~-])`;
+const wordEnd = `(?:$|[ .,+!?|/:<>(){}'"-])`;
+
+function alternatives(list: string) {
+	// Ensure we don't have empty strings in the list of highlights
+	return list
+		.split(",")
+		.map((highlight) => escapeRegExp(highlight.trim()))
+		.filter((highlight) => highlight.length > 0);
+}
+
+/**
+ * Regex of a comma separated list of highlight words, like the `highlights` setting
+ */
+export function compileHighlightRegex(list: unknown): RegExp | null {
+	if (typeof list !== "string") {
+		return null;
+	}
+
+	const words = alternatives(list);
+
+	if (words.length === 0) {
+		return null;
+	}
+
+	return new RegExp(`${wordStart}(?:${words.join("|")})${wordEnd}`, "i");
+}
+
+/**
+ * Whether a message highlights the user, for one nick and the highlight settings
+ *
+ * Nick and highlight words are compiled into one regex up front, so testing a message is a
+ * single match of its text without formatting, however long the highlight list is.
+ */
+export class HighlightMatcher {
+	private highlight: RegExp | null;
+	private exception: RegExp | null;
+
+	constructor(readonly nick: string, highlights: unknown, exceptions: unknown) {
+		const words = typeof highlights === "string" ? alternatives(highlights) : [];
+		const parts = words.length > 0 ? [`${wordStart}(?:${words.join("|")})${wordEnd}`] : [];
+
+		if (nick) {
+			parts.unshift(`(?:^|[^a-z0-9])${escapeRegExp(nick)}(?:[^a-z0-9]|$)`);
+		}
+
+		this.highlight = parts.length > 0 ? new RegExp(parts.join("|"), "i") : null;
+		this.exception = compileHighlightRegex(exceptions);
+	}
+
+	test(text: string): boolean {
+		if (!this.highlight) {
+			return false;
+		}
+
+		const clean = cleanIrcMessage(text);
+		return this.highlight.test(clean) && !this.exception?.test(clean);
+	}
+}
@@ -14,18 +14,25 @@ import _ from "lodash";
 import {v4 as uuidv4} from "uuid";
 import crypto from "crypto";
 import colors from "chalk";
+import {performance} from "perf_hooks";
 import type {Socket} from "socket.io";
 
 import log from "./log";
+import trace from "./trace";
+import metrics, {CounterSeries, HistogramSeries, bytesBuckets} from "./metrics";
 import Chan from "./models/chan";
 import Msg from "./models/msg";
-import User from "./models/user";
 import Network from "./models/network";
 import Config from "./config";
-import {SharedMention} from "../shared/types/mention";
+import {HighlightMatcher} from "./highlight";
+import {SharedMention, mentionsPageSize} from "../shared/types/mention";
 import ClientManager from "./clientManager";
 import {EncryptedMessageStorage} from "./plugins/messageStorage/encrypted";
+import type {ChannelHistory} from "./plugins/messageStorage/types";
+import {StorageCleaner} from "./storageCleaner";
+import {ChanType, HistoryMarks} from "../shared/types/chan";
 import {ServerToClientEvents} from "../shared/types/socket-events";
+import {compactChannel, compactWireVersion, encodeMessages} from "../shared/compactWire";
 import {FeWebSocket, FeWebConfig, FeWebMessage} from "./feWebClient/feWebSocket";
 import {FeWebEncryption} from "./feWebClient/feWebEncryption";
 import {FeWebAdapter, FeWebAdapterCallbacks, NetworkData} from "./feWebClient/feWebAdapter";
@@ -41,6 +48,24 @@ import {
 } from "./types/irssi-network";
 import UAParser from "ua-parser-js";
 
+// Per message output, enabled with debug.modules: ["irssi"]
+const irssiLog = log.module("irssi");
+
+const broadcasts = metrics.counter("thelounge_socketio_broadcasts_total", "Events to all browsers");
+const deliveries = metrics.counter(
+	"thelounge_socketio_deliveries_total",
+	"Events sent to browsers by broadcasts, one per attached browser"
+);
+const initBuildTime = metrics.histogram(
+	"thelounge_init_build_seconds",
+	"Time from a browser attaching to its init being sent"
+);
+const initSize = metrics.histogram(
+	"thelounge_init_bytes",
+	"Size of init sent to browsers, as JSON",
+	bytesBuckets
+);
+
 // irssi connection config (stored in user.json)
 export type IrssiConnectionConfig = {
 	host: string;
@@ -81,6 +106,17 @@ export type IrssiUserConfig = {
 type BrowserSession = {
 	socket: Socket;
 	openChannel: number;
+	historyMarks?: HistoryMarks; // newest message the browser has cached, per channel
+};
+
+// A channel whose history is loaded, only messages newer than afterTime if it's set
+type HistoryRequest = {network: NetworkData; channel: Chan; afterTime?: number};
+
+type ChannelHistoryResult = {
+	messages: Msg[];
+	totalMessages: number;
+	firstUnread?: number;
+	cachedUntil?: number; // set when messages continue the browser's cache up to this time
 };
 
 // Unread marker (activity tracking)
@@ -122,6 +158,7 @@ export class IrssiClient {
 
 	// Message storage (encrypted)
 	messageStorage: EncryptedMessageStorage | null = null;
+	private storageCleaner: StorageCleaner | null = null;
 
 	// Unread markers (activity tracking) - in-memory only!
 	private unreadMarkers: Map<string, UnreadMarker> = new Map();
@@ -150,16 +187,30 @@ export class IrssiClient {
 		}
 	> = new Map();
 
+	// Lazy activation, see userActivation in the config
+	private activation: Promise<void> | null = null;
+	private hibernation: Promise<void> | null = null;
+	private hibernateTimer: NodeJS.Timeout | null = null;
+
+	// Per network uuid, compiled for the nick it was built with
+	private highlighters = new Map<string, HighlightMatcher>();
+
 	// State
 	awayMessage: string = "";
 	lastActiveChannel: number = -1;
-	mentions: SharedMention[] = [];
 	fileHash: string = "";
 
 	// ID generators
 	idMsg: number = 1;
 	idChan: number = 1;
 
+	private meters: {
+		broadcasts: CounterSeries;
+		deliveries: CounterSeries;
+		initBuildTime: HistogramSeries;
+		initSize: HistogramSeries;
+	};
+
 	constructor(manager: ClientManager, name: string, config: IrssiUserConfig) {
 		this.id = uuidv4();
 		this.name = name;
@@ -186,6 +237,14 @@ export class IrssiClient {
 			this.awayMessage = this.config.clientSettings.awayMessage;
 		}
 
+		const labels = metrics.userLabels(name);
+		this.meters = {
+			broadcasts: broadcasts.with(labels),
+			deliveries: deliveries.with(labels),
+			initBuildTime: initBuildTime.with(labels),
+			initSize: initSize.with(labels),
+		};
+
 		log.info(`irssi client created for user ${colors.bold(this.name)}`);
 	}
 
@@ -199,6 +258,8 @@ export class IrssiClient {
 	async login(userPassword: string): Promise<void> {
 		log.info(`User ${colors.bold(this.name)} logging in...`);
 
+		await this.hibernation;
+
 		// Store user password in memory (for message storage encryption)
 		this.userPassword = userPassword;
 
@@ -241,9 +302,7 @@ export class IrssiClient {
 
 		// Step 3: Initialize encrypted message storage (if not already enabled by autoconnect)
 		if (this.config.log && !Config.values.public && !this.messageStorage) {
-			this.messageStorage = new EncryptedMessageStorage(this.name, this.encryptionKey);
-			await this.messageStorage.enable();
-			log.info(`Encrypted message storage enabled for user ${colors.bold(this.name)}`);
+			await this.enableMessageStorage();
 		} else if (this.messageStorage) {
 			log.info(`Message storage already enabled (from autoconnect)`);
 		}
@@ -267,6 +326,89 @@ export class IrssiClient {
 	async autoConnectToIrssi(): Promise<void> {
 		log.info(`User ${colors.bold(this.name)} auto-connecting to irssi...`);
 
+		if (!(await this.unlockWithIrssiPassword())) {
+			return;
+		}
+
+		// Connect to irssi (with message storage enabled!)
+		await this.connectToIrssiInternal();
+	}
+
+	/**
+	 * Whether the keys are derived and storage is open, false until the first sign in of a
+	 * lazily loaded user and again once it hibernated
+	 */
+	get isActive(): boolean {
+		return this.encryptionKey !== null;
+	}
+
+	/**
+	 * Bring a lazily loaded or hibernated user back when a browser signs in with a token
+	 *
+	 * Resolves once message storage is open, irssi connects in the background like at login.
+	 */
+	async activate(): Promise<void> {
+		// Would close what gets opened here otherwise
+		await this.hibernation;
+
+		if (this.isActive || !this.config.irssiConnection.passwordEncrypted) {
+			return;
+		}
+
+		if (!this.activation) {
+			this.activation = (async () => {
+				log.info(`Activating user ${colors.bold(this.name)}`);
+
+				if (await this.unlockWithIrssiPassword()) {
+					this.connectToIrssiInternal().catch((error) => {
+						log.error(
+							`Failed to connect to irssi for user ${colors.bold(this.name)}: ${error}`
+						);
+					});
+				}
+			})().finally(() => (this.activation = null));
+		}
+
+		return this.activation;
+	}
+
+	/**
+	 * Release the irssi connection, message storage and keys of a user without browsers
+	 *
+	 * The user stays loaded and is activated again on the next sign in. Messages in between
+	 * are not stored, they are only kept by irssi, so this is off unless configured.
+	 */
+	async hibernate(): Promise<void> {
+		if (this.attachedBrowsers.size > 0 || !this.isActive || this.hibernation) {
+			return;
+		}
+
+		log.info(`User ${colors.bold(this.name)} is idle, hibernating`);
+
+		this.hibernation = this.deactivate().finally(() => (this.hibernation = null));
+		await this.hibernation;
+	}
+
+	private scheduleHibernation(): void {
+		const minutes = Config.values.userActivation.hibernateAfterMinutes;
+
+		if (minutes <= 0 || this.manager.isAlwaysOn(this.name) || this.hibernateTimer) {
+			return;
+		}
+
+		this.hibernateTimer = setTimeout(() => {
+			this.hibernateTimer = null;
+			void this.hibernate();
+		}, minutes * 60 * 1000);
+		this.hibernateTimer.unref();
+	}
+
+	/**
+	 * Decrypt the irssi password, derive the storage key from it and open storage
+	 *
+	 * @returns false if there is no irssi password configured yet
+	 */
+	private async unlockWithIrssiPassword(): Promise<boolean> {
 		// Check if irssi password is configured
 		if (!this.config.irssiConnection.passwordEncrypted) {
 			log.warn(
@@ -274,7 +416,7 @@ export class IrssiClient {
 					this.name
 				)} has no irssi password configured - skipping autoconnect`
 			);
-			return;
+			return false;
 		}
 
 		// Decrypt irssi password using IP+PORT salt
@@ -301,14 +443,28 @@ export class IrssiClient {
 		log.info(`Message storage encryption key derived for user ${colors.bold(this.name)}`);
 
 		// Initialize encrypted message storage
-		if (this.config.log && !Config.values.public) {
-			this.messageStorage = new EncryptedMessageStorage(this.name, this.encryptionKey);
-			await this.messageStorage.enable();
-			log.info(`Encrypted message storage enabled for user ${colors.bold(this.name)}`);
+		if (this.config.log && !Config.values.public && !this.messageStorage) {
+			await this.enableMessageStorage();
 		}
 
-		// Connect to irssi (with message storage enabled!)
-		await this.connectToIrssiInternal();
+		return true;
+	}
+
+	/**
+	 * Open encrypted message storage with the derived key, and clean it up by storagePolicy
+	 */
+	private async enableMessageStorage(): Promise<void> {
+		this.messageStorage = new EncryptedMessageStorage(this.name, this.encryptionKey!);
+		await this.messageStorage.enable();
+		log.info(`Encrypted message storage enabled for user ${colors.bold(this.name)}`);
+
+		if (Config.values.storagePolicy.enabled) {
+			log.info(
+				`Activating storage cleaner. Policy: ${Config.values.storagePolicy.deletionPolicy}. MaxAge: ${Config.values.storagePolicy.maxAgeDays} days`
+			);
+			this.storageCleaner = new StorageCleaner(this.messageStorage);
+			this.storageCleaner.start();
+		}
 	}
 
 	/**
@@ -354,6 +510,8 @@ export class IrssiClient {
 			reconnectDelay: 1000,
 			maxReconnectDelay: 30000,
 
+			user: this.name,
+
 			// Note: disconnect is handled via EventEmitter in setupIrssiEventHandlers()
 		};
 
@@ -367,8 +525,8 @@ export class IrssiClient {
 			onChannelJoin: (networkUuid, channel) => this.handleChannelJoin(networkUuid, channel),
 			onChannelPart: (networkUuid, channelId) =>
 				this.handleChannelPart(networkUuid, channelId),
-			onNicklistUpdate: (networkUuid, channelId, users) =>
-				this.handleNicklistUpdate(networkUuid, channelId, users),
+			onNicklistUpdate: (networkUuid, channelId) =>
+				this.handleNicklistUpdate(networkUuid, channelId),
 			onTopicUpdate: (networkUuid, channelId, topic) =>
 				this.handleTopicUpdate(networkUuid, channelId, topic),
 			onNickChange: (networkUuid, newNick) => this.handleNickChange(networkUuid, newNick),
@@ -427,41 +585,31 @@ export class IrssiClient {
 				`User ${colors.bold(this.name)}: irssi WebSocket disconnected (code: ${code})`
 			);
 
-			log.info(`[DISCONNECT] ===============================================`);
-			log.info(`[DISCONNECT] BEFORE: this.networks.length = ${this.networks.length}`);
+			const resuming = this.irssiConnection?.canResume() ?? false;
 
-			// CLEAR networks on disconnect
-			const clearedCount = this.networks.length;
-			this.networks = [];
-			this.lastActiveChannel = -1;
-
-			// Reset state_dump tracking in FeWebAdapter (allow fresh state_dump on reconnect)
-			if (this.feWebAdapter) {
-				this.feWebAdapter.resetStateDumpTracking();
-			}
-
-			log.info(`[DISCONNECT] AFTER: this.networks.length = ${this.networks.length}`);
-			log.info(`[DISCONNECT] Broadcasting to ${this.attachedBrowsers.size} browsers`);
-
-			// Broadcast disconnect status to all browsers
-			log.info(`[DISCONNECT] 1. Sending irssi:status {connected: false}`);
-			this.broadcastToAllBrowsers("irssi:status" as any, {
+			log.info(`[DISCONNECT] Sending irssi:status {connected: false, resuming: ${resuming}}`);
+			this.broadcastToAllBrowsers("irssi:status", {
 				connected: false,
+				resuming,
 				error: `Lost connection to irssi WebSocket (code: ${code})`,
 			});
 
-			// Also send empty init to clear UI networks
-			log.info(`[DISCONNECT] 2. Sending init {networks: []}`);
-			this.broadcastToAllBrowsers("init", {
-				networks: [],
-				active: -1,
-			});
+			// Keep the networks, the reconnect only replays what was missed
+			if (!resuming) {
+				this.clearIrssiState();
+			}
+		});
 
-			log.info(
-				`User ${colors.bold(
-					this.name
-				)}: cleared ${clearedCount} networks after irssi disconnect`
-			);
+		// Reconnected and caught up through the event log
+		(this.irssiConnection as any).on("resumed", () => {
+			log.info(`User ${colors.bold(this.name)}: resumed irssi session, no state_dump needed`);
+			this.broadcastToAllBrowsers("irssi:status", {connected: true, resuming: true});
+		});
+
+		// Resuming wasn't possible, a full state_dump follows
+		(this.irssiConnection as any).on("resync", () => {
+			log.info(`User ${colors.bold(this.name)}: irssi session not resumable, full resync`);
+			this.clearIrssiState();
 		});
 
 		this.irssiConnection.on("error", (msg: FeWebMessage) => {
@@ -497,9 +645,38 @@ export class IrssiClient {
 	}
 
 	/**
-	 * Handle NAMES request from browser (refresh nicklist)
+	 * Forget all networks until the next state_dump, and clear them in every browser
+	 */
+	private clearIrssiState(): void {
+		log.info(`[DISCONNECT] BEFORE: this.networks.length = ${this.networks.length}`);
+
+		const clearedCount = this.networks.length;
+		this.networks = [];
+		this.lastActiveChannel = -1;
+
+		// Reset state_dump tracking in FeWebAdapter (allow fresh state_dump on reconnect)
+		if (this.feWebAdapter) {
+			this.feWebAdapter.resetStateDumpTracking();
+		}
+
+		// Send empty init to clear UI networks
+		log.info(
+			`[DISCONNECT] Sending init {networks: []} to ${this.attachedBrowsers.size} browsers`
+		);
+		this.broadcastToAllBrowsers("init", {
+			networks: [],
+			active: -1,
+		});
+
+		log.info(
+			`User ${colors.bold(this.name)}: cleared ${clearedCount} irssi networks`
+		);
+	}
+
+	/**
+	 * Handle NAMES request from browser, sends it the current nicklist of the channel
 	 */
-	async handleNamesRequest(socketId: string, data: {target: number}): Promise<void> {
+	handleNamesRequest(socketId: string, data: {target: number}): void {
 		if (!this.irssiConnection) {
 			log.error(
 				`User ${colors.bold(this.name)}: cannot request names, not connected to irssi`
@@ -508,16 +685,9 @@ export class IrssiClient {
 		}
 
 		// Find channel in ALL networks
-		let channel: Chan | undefined;
-		let network: NetworkData | undefined;
-
-		for (const net of this.networks) {
-			channel = net.channels.find((c) => c.id === data.target);
-			if (channel) {
-				network = net;
-				break;
-			}
-		}
+		const found = this.findChannelById(data.target);
+		const network = found?.network;
+		const channel = found?.channel;
 
 		if (!channel || !network) {
 			log.warn(
@@ -526,18 +696,12 @@ export class IrssiClient {
 			return;
 		}
 
-		// Execute /NAMES command in irssi to refresh internal state
-		const command = `names ${channel.name}`;
-		await this.irssiConnection.executeCommand(command, network.serverTag);
-
-		log.info(
-			`User ${colors.bold(this.name)}: requested NAMES for ${channel.name} on ${
-				network.serverTag
-			}`
-		);
-
-		// fe-web will send nicklist message after executing NAMES
-		// We don't need to do anything else here - the nicklist handler will take care of it
+		// fe-web keeps the nicklist up to date, so it's answered from memory. Asking irssi
+		// for /NAMES would only send the same list again and notify every browser once more
+		this.attachedBrowsers.get(socketId)?.socket.emit("names", {
+			id: channel.id,
+			users: Array.from(channel.users.values()),
+		});
 	}
 
 	/**
@@ -548,7 +712,7 @@ export class IrssiClient {
 	private sendWindowCommand(serverTag?: string): void {
 		// Only send if at least one browser is connected
 		if (this.attachedBrowsers.size === 0) {
-			log.debug(`[IrssiClient] Skipping /window 1 - no browsers connected (terminal usage)`);
+			irssiLog.debug(`Skipping /window 1 - no browsers connected (terminal usage)`);
 			return;
 		}
 
@@ -558,8 +722,8 @@ export class IrssiClient {
 
 		// Send /window 1 to switch to lobby (window 1 is always the first window)
 		this.irssiConnection.executeCommand("window 1", serverTag);
-		log.debug(
-			`[IrssiClient] Sent /window 1 to irssi (browsers connected: ${this.attachedBrowsers.size})`
+		irssiLog.debug(
+			`Sent /window 1 to irssi (browsers connected: ${this.attachedBrowsers.size})`
 		);
 	}
 
@@ -587,16 +751,9 @@ export class IrssiClient {
 			// Check if it's a command (starts with /)
 			if (line.charAt(0) === "/" && line.charAt(1) !== "/") {
 				// Find channel and network for this target
-				let channel: Chan | undefined;
-				let network: NetworkData | undefined;
-
-				for (const net of this.networks) {
-					channel = net.channels.find((c) => c.id === data.target);
-					if (channel) {
-						network = net;
-						break;
-					}
-				}
+				const found = this.findChannelById(data.target);
+				const network = found?.network;
+				const channel = found?.channel;
 
 				if (!channel || !network) {
 					log.warn(
@@ -624,7 +781,7 @@ export class IrssiClient {
 				const finalCommand = translated || line.substring(1);
 
 				await this.irssiConnection.executeCommand(finalCommand, network.serverTag);
-				log.debug(
+				irssiLog.debug(
 					`User ${colors.bold(this.name)}: sent command: /${finalCommand} on ${
 						network.serverTag
 					}`
@@ -646,16 +803,9 @@ export class IrssiClient {
 				}
 			} else {
 				// Regular message - find channel in ALL networks
-				let channel: Chan | undefined;
-				let network: NetworkData | undefined;
-
-				for (const net of this.networks) {
-					channel = net.channels.find((c) => c.id === data.target);
-					if (channel) {
-						network = net;
-						break;
-					}
-				}
+				const found = this.findChannelById(data.target);
+				const network = found?.network;
+				const channel = found?.channel;
 
 				if (!channel || !network) {
 					log.warn(
@@ -673,7 +823,7 @@ export class IrssiClient {
 				// Send message to channel with server tag
 				const command = `msg ${channel.name} ${messageText}`;
 				await this.irssiConnection.executeCommand(command, network.serverTag);
-				log.debug(
+				irssiLog.debug(
 					`User ${colors.bold(this.name)}: sent message to ${channel.name} on ${
 						network.serverTag
 					}`
@@ -696,8 +846,6 @@ export class IrssiClient {
 		channel: Chan,
 		network: NetworkData
 	): Promise<string | false | null> {
-		const {ChanType} = await import("../shared/types/chan");
-
 		switch (command) {
 			case "close":
 				// /close → translate based on channel type
@@ -847,12 +995,8 @@ export class IrssiClient {
 					const targetNick = args[0];
 					const message = args.slice(1).join(" ");
 
-					// Check if query window already exists
-					let queryChannel = network.channels.find(
-						(c) =>
-							c.type === ChanType.QUERY &&
-							c.name.toLowerCase() === targetNick.toLowerCase()
-					);
+					// Check if query window (or a channel with that name) already exists
+					let queryChannel = this.findChannelByName(network, targetNick);
 
 					// If query doesn't exist, create it
 					if (!queryChannel) {
@@ -871,13 +1015,7 @@ export class IrssiClient {
 						queryChannel.id = this.feWebAdapter.getNextChannelId();
 
 						// Add to network using sorted insertion
-						const Network = (await import("./models/network")).default;
-						if (network instanceof Network) {
-							network.addChannel(queryChannel);
-						} else {
-							// For NetworkData, just push (sorting is handled in feWebAdapter)
-							network.channels.push(queryChannel);
-						}
+						this.feWebAdapter.addChannelSorted(network, queryChannel);
 
 						// Broadcast to all browsers
 						this.broadcastToAllBrowsers("join", {
@@ -963,17 +1101,9 @@ export class IrssiClient {
 		totalMessages: number;
 	} | null> {
 		// Find channel by ID across all networks
-		let targetChannel: Chan | null = null;
-		let targetNetwork: NetworkData | null = null;
-
-		for (const network of this.networks) {
-			const channel = network.channels.find((c) => c.id === data.target);
-			if (channel) {
-				targetChannel = channel;
-				targetNetwork = network;
-				break;
-			}
-		}
+		const found = this.findChannelById(data.target);
+		const targetChannel = found?.channel;
+		const targetNetwork = found?.network;
 
 		if (!targetChannel || !targetNetwork) {
 			log.warn(`User ${colors.bold(this.name)}: channel ${data.target} not found for more`);
@@ -1023,7 +1153,7 @@ export class IrssiClient {
 				targetChannel.name
 			);
 
-			log.debug(
+			irssiLog.debug(
 				`User ${colors.bold(this.name)}: loaded ${messages.length} messages for channel ${
 					data.target
 				} (total: ${totalMessages})`
@@ -1049,13 +1179,25 @@ export class IrssiClient {
 	/**
 	 * Attach a browser session
 	 */
-	attachBrowser(socket: Socket, openChannel: number = -1, token?: string): void {
+	attachBrowser(
+		socket: Socket,
+		openChannel: number = -1,
+		token?: string,
+		historyMarks?: HistoryMarks
+	): void {
 		const socketId = socket.id;
 
+		if (this.hibernateTimer) {
+			clearTimeout(this.hibernateTimer);
+			this.hibernateTimer = null;
+		}
+
 		this.attachedBrowsers.set(socketId, {
 			socket,
 			openChannel,
+			historyMarks,
 		});
+		void socket.join(this.browserRoom);
 
 		log.info(
 			`User ${colors.bold(this.name)}: browser attached (${socketId}), total: ${
@@ -1106,6 +1248,7 @@ export class IrssiClient {
 	 * Detach a browser session
 	 */
 	detachBrowser(socketId: string): void {
+		void this.attachedBrowsers.get(socketId)?.socket.leave(this.browserRoom);
 		this.attachedBrowsers.delete(socketId);
 
 		log.info(
@@ -1116,6 +1259,10 @@ export class IrssiClient {
 
 		// Note: We keep the irssi connection alive even if no browsers are attached
 		// This is the key feature - persistent connection!
+		// Unless lazy activation lets idle users hibernate
+		if (this.attachedBrowsers.size === 0) {
+			this.scheduleHibernation();
+		}
 	}
 
 	/**
@@ -1124,6 +1271,8 @@ export class IrssiClient {
 	 * LOADS 100 LAST MESSAGES from storage for each channel/query
 	 */
 	private async sendInitialState(socket: Socket, token?: string): Promise<void> {
+		const started = performance.now();
+
 		try {
 			log.info(`[IrssiClient] ⏰ TIMING: sendInitialState() START for socket ${socket.id}`);
 
@@ -1154,84 +1303,44 @@ export class IrssiClient {
 				}
 			}
 
-			// STEP 1: Load messages from storage for each channel/query
-			if (this.messageStorage) {
-				log.info(
-					`[IrssiClient] Loading messages from storage for ${this.networks.length} networks...`
-				);
+			// STEP 1: Load messages of the active channel, so init can be sent right away
+			// Every other channel is sent empty and filled in after init (STEP 6)
+			const session = this.attachedBrowsers.get(socket.id);
+			const activeId =
+				session && session.openChannel >= 0 ? session.openChannel : this.lastActiveChannel;
+			const pending: HistoryRequest[] = [];
 
-				for (const network of this.networks) {
-					for (const channel of network.channels) {
-						try {
-							// Get total message count from storage
-							const totalCount = await this.messageStorage.getMessageCount(
-								network.uuid,
-								channel.name
-							);
-
-							// Load last 100 messages from encrypted storage
-							const messages = await this.messageStorage.getLastMessages(
-								network.uuid,
-								channel.name,
-								100
-							);
-
-							// Assign IDs to messages
-							for (const msg of messages) {
-								msg.id = this.nextMessageId();
-							}
+			for (const network of this.networks) {
+				for (const channel of network.channels) {
+					if (channel.id === activeId) {
+						continue;
+					}
 
-							// TEMPORARILY add to channel.messages (only for this init!)
-							channel.messages = messages;
+					// History follows with STEP 6, anything sent now would be duplicated
+					channel.messages = [];
+					channel.totalMessagesInStorage = 0;
 
-							// Store total count for getFilteredClone to use
-							channel.totalMessagesInStorage = totalCount;
+					if (this.messageStorage) {
+						const afterTime = this.historyMarkOf(session, network, channel);
+						pending.push({network, channel, afterTime});
+					}
+				}
+			}
 
-							// Set firstUnread based on lastReadTime from unread markers
-							const key = this.getMarkerKey(network.uuid, channel.name);
-							const marker = this.unreadMarkers.get(key);
+			const active = this.findChannelById(activeId);
+			let activeCachedUntil: number | undefined;
 
-							if (marker && marker.lastReadTime > 0 && messages.length > 0) {
-								// Find first message AFTER lastReadTime
-								const firstUnreadMsg = messages.find(
-									(msg) => msg.time.getTime() > marker.lastReadTime
-								);
+			if (this.messageStorage && active) {
+				const afterTime = this.historyMarkOf(session, active.network, active.channel);
+				const [history] = await this.loadChannelHistories([{...active, afterTime}], 100);
+				activeCachedUntil = history.cachedUntil;
 
-								if (firstUnreadMsg) {
-									channel.firstUnread = firstUnreadMsg.id;
-									log.debug(
-										`[IrssiClient] Set firstUnread=${firstUnreadMsg.id} for ${
-											network.name
-										}/${channel.name} (lastReadTime=${new Date(
-											marker.lastReadTime
-										).toISOString()})`
-									);
-								} else {
-									// All messages are read, set to last message
-									channel.firstUnread = messages[messages.length - 1].id;
-									log.debug(
-										`[IrssiClient] All messages read for ${network.name}/${channel.name}, set firstUnread to last message`
-									);
-								}
-							} else if (messages.length > 0) {
-								// No marker or marker is 0 - set to last message (all unread)
-								channel.firstUnread = messages[0].id;
-								log.debug(
-									`[IrssiClient] No marker for ${network.name}/${channel.name}, set firstUnread to first message`
-								);
-							}
+				// TEMPORARILY add to channel.messages (only for this init!)
+				active.channel.messages = history.messages;
+				active.channel.totalMessagesInStorage = history.totalMessages;
 
-							log.debug(
-								`[IrssiClient] Loaded ${messages.length}/${totalCount} messages for ${network.name}/${channel.name}`
-							);
-						} catch (err) {
-							log.error(
-								`Failed to load messages for ${network.name}/${channel.name}: ${err}`
-							);
-							channel.messages = [];
-							channel.totalMessagesInStorage = 0;
-						}
-					}
+				if (history.firstUnread !== undefined) {
+					active.channel.firstUnread = history.firstUnread;
 				}
 			}
 
@@ -1257,10 +1366,24 @@ export class IrssiClient {
 						connected: net.connected,
 						secure: true,
 					},
-					channels: net.channels.map((ch) => ch.getFilteredClone(true)), // Contains messages!
+					channels: net.channels.map((ch) => {
+						const clone = ch.getFilteredClone(true); // Contains messages!
+
+						if (ch === active?.channel && activeCachedUntil !== undefined) {
+							clone.cachedUntil = activeCachedUntil;
+						}
+
+						return clone;
+					}),
 				};
 			}) as any[];
 
+			if (this.usesCompactWire(socket)) {
+				for (const net of sharedNetworks) {
+					net.channels.forEach(compactChannel);
+				}
+			}
+
 			// STEP 3: Clear messages from cache (we don't keep them in memory!)
 			for (const network of this.networks) {
 				for (const channel of network.channels) {
@@ -1270,11 +1393,20 @@ export class IrssiClient {
 			}
 
 			// STEP 4: Send init event to browser
-			socket.emit("init", {
+			// Anything newer than this reaches the browser live, STEP 6 only loads older messages
+			const initTime = Date.now();
+			const init = {
 				networks: sharedNetworks,
 				token: token,
 				active: this.lastActiveChannel || -1,
-			});
+			};
+			socket.emit("init", init);
+			this.meters.initBuildTime.observe((performance.now() - started) / 1000);
+
+			// Only worth encoding once more when someone looks
+			if (metrics.enabled) {
+				this.meters.initSize.observe(Buffer.byteLength(JSON.stringify(init)));
+			}
 
 			log.info(
 				`[IrssiClient] ⏰ TIMING: sendInitialState() SENT init event for socket ${socket.id} with ${sharedNetworks.length} networks`
@@ -1290,8 +1422,8 @@ export class IrssiClient {
 							id: channel.id,
 							users: usersArray,
 						});
-						log.debug(
-							`[IrssiClient] Sent names for channel ${channel.id} (${usersArray.length} users) in init`
+						irssiLog.debug(
+							`Sent names for channel ${channel.id} (${usersArray.length} users) in init`
 						);
 					}
 				}
@@ -1329,27 +1461,332 @@ export class IrssiClient {
 							unread: unreadCount,
 							highlight: marker.dataLevel === DataLevel.HILIGHT ? unreadCount : 0,
 						});
-						log.debug(
-							`[IrssiClient] Sent activity_update for channel ${channel.id} (unread=${unreadCount}, level=${marker.dataLevel}) in init`
+						irssiLog.debug(
+							`Sent activity_update for channel ${channel.id} (unread=${unreadCount}, level=${marker.dataLevel}) in init`
 						);
 					}
 				}
 			}
 
+			// STEP 6: Fill in the history of the remaining channels, batch by batch
+			await this.sendPendingHistory(socket, pending, initTime);
+
 			log.info(`User ${colors.bold(this.name)}: sent initial state to browser ${socket.id}`);
 		} catch (error) {
 			log.error(`Failed to send initial state to browser ${socket.id}: ${error}`);
 		}
 	}
 
+	/**
+	 * Whether a browser asked for the compact wire format (shared/compactWire.ts)
+	 */
+	private usesCompactWire(socket: Socket): boolean {
+		return socket.handshake.auth?.compactWire === compactWireVersion;
+	}
+
+	/**
+	 * Send a "more" event in the format the browser understands
+	 */
+	sendMore(
+		socket: Socket,
+		history: {
+			chan: number;
+			messages: Msg[];
+			totalMessages: number;
+			firstUnread?: number;
+			cachedUntil?: number;
+		}
+	): void {
+		if (this.usesCompactWire(socket) && history.messages.length > 0) {
+			socket.emit("more", {
+				...history,
+				messages: [],
+				compactMessages: encodeMessages(history.messages),
+			});
+			return;
+		}
+
+		socket.emit("more", history);
+	}
+
+	/**
+	 * Send the last messages of channels that were left empty in init, as "more" events
+	 * Loads a batch of channels per storage query, with a couple of batches in flight
+	 */
+	private async sendPendingHistory(
+		socket: Socket,
+		pending: HistoryRequest[],
+		beforeTime: number
+	): Promise<void> {
+		const batchSize = 25;
+		const concurrency = 2;
+		const batches: HistoryRequest[][] = [];
+
+		for (let i = 0; i < pending.length; i += batchSize) {
+			batches.push(pending.slice(i, i + batchSize));
+		}
+
+		const sendBatches = async () => {
+			let batch: HistoryRequest[] | undefined;
+
+			while (socket.connected && (batch = batches.shift())) {
+				try {
+					const histories = await this.loadChannelHistories(batch, 100, beforeTime);
+
+					batch.forEach(({channel}, i) => {
+						const history = histories[i];
+
+						// Browsers with a cache wait for an answer, even when there is nothing new
+						if (history.totalMessages === 0 && history.cachedUntil === undefined) {
+							return;
+						}
+
+						this.sendMore(socket, {
+							chan: channel.id,
+							messages: history.messages,
+							totalMessages: history.totalMessages,
+							firstUnread: history.firstUnread,
+							cachedUntil: history.cachedUntil,
+						});
+					});
+				} catch (err) {
+					log.error(`Failed to load channel history for ${socket.id}: ${err}`);
+				}
+			}
+		};
+
+		await Promise.all(Array.from({length: concurrency}, sendBatches));
+
+		irssiLog.debug(`Sent history of ${pending.length} channels to ${socket.id}`);
+	}
+
+	/**
+	 * Load the last messages and total count of many channels with batched storage queries
+	 * Assigns message ids and works out firstUnread from the unread markers
+	 *
+	 * Channels with an afterTime only get the messages newer than it. If there are `limit` of
+	 * them or more there may be a gap to the browser's cache, so they're sent as a fresh history.
+	 */
+	private async loadChannelHistories(
+		channels: HistoryRequest[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistoryResult[]> {
+		const storage = this.messageStorage;
+
+		if (!storage) {
+			return channels.map(() => ({messages: [], totalMessages: 0}));
+		}
+
+		const refs = channels.map(({network, channel}) => ({
+			networkUuid: network.uuid,
+			channelName: channel.name,
+		}));
+		const fresh: number[] = [];
+		const marked: number[] = [];
+
+		channels.forEach(({afterTime}, i) => (afterTime === undefined ? fresh : marked).push(i));
+
+		const results: ChannelHistoryResult[] = [];
+
+		if (fresh.length > 0) {
+			const histories = await storage.getLastMessagesBatch(
+				fresh.map((i) => refs[i]),
+				limit,
+				beforeTime
+			);
+
+			fresh.forEach((i, k) => {
+				results[i] = this.toChannelHistory(channels[i], histories[k]);
+			});
+		}
+
+		if (marked.length > 0) {
+			const histories = await storage.getNewMessagesBatch(
+				marked.map((i) => ({...refs[i], afterTime: channels[i].afterTime!})),
+				limit,
+				beforeTime
+			);
+
+			marked.forEach((i, k) => {
+				results[i] = this.toChannelHistory(channels[i], histories[k]);
+
+				if (histories[k].messages.length < limit) {
+					results[i].cachedUntil = channels[i].afterTime;
+				}
+			});
+		}
+
+		return results;
+	}
+
+	/**
+	 * Assign ids to loaded messages and find the first unread one
+	 */
+	private toChannelHistory(
+		request: HistoryRequest,
+		history: ChannelHistory
+	): ChannelHistoryResult {
+		const messages = history.messages as Msg[];
+
+		for (const msg of messages) {
+			msg.id = this.nextMessageId();
+		}
+
+		return {
+			messages,
+			totalMessages: history.totalMessages,
+			firstUnread: this.getFirstUnread(request.network, request.channel, messages),
+		};
+	}
+
+	/**
+	 * Time of the newest message a browser has cached of a channel
+	 */
+	private historyMarkOf(
+		session: BrowserSession | undefined,
+		network: NetworkData,
+		channel: Chan
+	): number | undefined {
+		const marks = session?.historyMarks?.[network.uuid];
+		const mark =
+			marks && typeof marks === "object" ? marks[channel.name.toLowerCase()] : undefined;
+
+		return typeof mark === "number" && Number.isFinite(mark) && mark > 0 ? mark : undefined;
+	}
+
+	/**
+	 * First unread message of freshly loaded history, based on lastReadTime from unread markers
+	 */
+	private getFirstUnread(
+		network: NetworkData,
+		channel: Chan,
+		messages: Msg[]
+	): number | undefined {
+		if (messages.length === 0) {
+			return undefined;
+		}
+
+		const marker = this.unreadMarkers.get(this.getMarkerKey(network.uuid, channel.name));
+
+		if (!marker || marker.lastReadTime <= 0) {
+			// No marker or marker is 0 - set to first message (all unread)
+			return messages[0].id;
+		}
+
+		// Find first message AFTER lastReadTime, all messages are read if there is none
+		const firstUnreadMsg = messages.find((msg) => msg.time.getTime() > marker.lastReadTime);
+
+		return firstUnreadMsg ? firstUnreadMsg.id : messages[messages.length - 1].id;
+	}
+
+	/**
+	 * Find a channel and its network by channel id
+	 */
+	private findChannelById(id: number): {network: NetworkData; channel: Chan} | undefined {
+		const found = this.feWebAdapter?.findChannelById(id);
+
+		// The adapter keeps networks across a disconnect, until the next state_dump
+		if (!found || !this.networks.includes(found.network)) {
+			return undefined;
+		}
+
+		return found;
+	}
+
+	/**
+	 * Find a channel of a network by name (case-insensitive)
+	 */
+	private findChannelByName(network: NetworkData, name: string): Chan | undefined {
+		return this.feWebAdapter?.findChannel(network, name) || undefined;
+	}
+
+	/**
+	 * Matcher of the nick of a network and the highlight settings, compiled once per nick
+	 */
+	private highlighter(network: NetworkData): HighlightMatcher {
+		let matcher = this.highlighters.get(network.uuid);
+
+		if (!matcher || matcher.nick !== network.nick) {
+			const {highlights, highlightExceptions} = this.config.clientSettings;
+			matcher = new HighlightMatcher(network.nick, highlights, highlightExceptions);
+			this.highlighters.set(network.uuid, matcher);
+		}
+
+		return matcher;
+	}
+
+	/**
+	 * Recompile highlight matchers after the highlight settings changed
+	 */
+	compileCustomHighlights(): void {
+		this.highlighters.clear();
+	}
+
+	/**
+	 * A page of stored mentions, the newest ones or those before the mention `before`
+	 * Mentions in channels that are not open anymore have no channel id (-1)
+	 */
+	async getMentions(before?: number): Promise<SharedMention[]> {
+		if (!this.messageStorage) {
+			return [];
+		}
+
+		const stored = await this.messageStorage.getMentions(before ?? null, mentionsPageSize);
+
+		return stored.map(({id, network, channel, msg}) => {
+			const found = this.networks.find((n) => n.uuid === network);
+			const chan = found ? this.findChannelByName(found, channel) : undefined;
+
+			return {
+				chanId: chan ? chan.id : -1,
+				msgId: id,
+				type: msg.type,
+				time: msg.time,
+				text: msg.text,
+				from: msg.from,
+			};
+		});
+	}
+
+	/**
+	 * Dismiss a stored mention, or all of them without an id
+	 */
+	dismissMentions(msgId?: number): void {
+		this.messageStorage?.dismissMentions(msgId).catch((err) => {
+			log.error(`Failed to dismiss mentions of ${colors.bold(this.name)}: ${err}`);
+		});
+	}
+
+	/**
+	 * Socket.IO room of the attached browsers
+	 */
+	private get browserRoom(): string {
+		return `browsers:${this.id}`;
+	}
+
 	/**
 	 * Broadcast event to all attached browsers
+	 *
+	 * Emitting to the room encodes the packet once for all of them, instead of once per socket.
 	 */
 	private broadcastToAllBrowsers<Ev extends keyof ServerToClientEvents>(
 		event: Ev,
 		...args: Parameters<ServerToClientEvents[Ev]>
 	): void {
-		for (const [socketId, session] of this.attachedBrowsers) {
+		if (this.attachedBrowsers.size === 0) {
+			return;
+		}
+
+		this.meters.broadcasts.inc();
+		this.meters.deliveries.inc(this.attachedBrowsers.size);
+
+		if (this.manager.sockets) {
+			this.manager.sockets.to(this.browserRoom).emit(event, ...args);
+			return;
+		}
+
+		for (const session of this.attachedBrowsers.values()) {
 			session.socket.emit(event, ...args);
 		}
 	}
@@ -1376,13 +1813,39 @@ export class IrssiClient {
 		}
 		this.attachedBrowsers.clear();
 
+		if (this.hibernateTimer) {
+			clearTimeout(this.hibernateTimer);
+			this.hibernateTimer = null;
+		}
+
+		await this.deactivate();
+
+		if (shouldSave) {
+			this.manager.saveUser(this as any); // IrssiClient is compatible with Client interface
+		}
+
+		log.info(`User ${colors.bold(this.name)} quit successfully`);
+	}
+
+	/**
+	 * Disconnect from irssi, close storage and wipe the keys
+	 */
+	private async deactivate(): Promise<void> {
 		// Disconnect from irssi
 		if (this.irssiConnection) {
 			await this.irssiConnection.disconnect();
 			this.irssiConnection = null;
 		}
 
+		// Rebuilt from the state_dump and storage on the next connect
+		this.feWebAdapter = null;
+		this.networks = [];
+		this.unreadMarkers.clear();
+
 		// Close message storage
+		this.storageCleaner?.stop();
+		this.storageCleaner = null;
+
 		if (this.messageStorage) {
 			await this.messageStorage.close();
 			this.messageStorage = null;
@@ -1396,12 +1859,6 @@ export class IrssiClient {
 
 		this.irssiPassword = null;
 		this.userPassword = null;
-
-		if (shouldSave) {
-			this.manager.saveUser(this as any); // IrssiClient is compatible with Client interface
-		}
-
-		log.info(`User ${colors.bold(this.name)} quit successfully`);
 	}
 
 	/**
@@ -1529,9 +1986,7 @@ export class IrssiClient {
 		}
 
 		// Find channel by name
-		const channel = network.channels.find(
-			(c) => c.name.toLowerCase() === channelName.toLowerCase()
-		);
+		const channel = this.findChannelByName(network, channelName);
 		if (!channel) {
 			log.warn(
 				`[IrssiClient] ACTIVITY_UPDATE for unknown channel: ${channelName} on ${serverTag}`
@@ -1543,8 +1998,8 @@ export class IrssiClient {
 		// If channel is open anywhere, ignore activity_update from irssi
 		const isChannelOpen = this.isChannelOpenInAnyBrowser(channel.id);
 		if (isChannelOpen) {
-			log.debug(
-				`[IrssiClient] Ignoring activity_update for ${network.name}/${channel.name} (channel is open in browser)`
+			irssiLog.debug(
+				`Ignoring activity_update for ${network.name}/${channel.name} (channel is open in browser)`
 			);
 			return;
 		}
@@ -1578,8 +2033,8 @@ export class IrssiClient {
 			// Update activeWindowInIrssi (user switched to this window in irssi)
 			this.activeWindowInIrssi = key;
 
-			log.debug(
-				`[IrssiClient] Activity cleared: ${network.name}/${channel.name} level=0 unread=0 (active in irssi)`
+			irssiLog.debug(
+				`Activity cleared: ${network.name}/${channel.name} level=0 unread=0 (active in irssi)`
 			);
 
 			// Broadcast to all browsers - clear activity
@@ -1593,8 +2048,8 @@ export class IrssiClient {
 			// New activity (level > 0) - this channel is NO LONGER active in irssi!
 			// Clear activeWindowInIrssi if it was pointing to this channel
 			if (this.activeWindowInIrssi === key) {
-				log.debug(
-					`[IrssiClient] Channel ${network.name}/${channel.name} is no longer active in irssi (got activity level=${dataLevel})`
+				irssiLog.debug(
+					`Channel ${network.name}/${channel.name} is no longer active in irssi (got activity level=${dataLevel})`
 				);
 				this.activeWindowInIrssi = null;
 			}
@@ -1606,8 +2061,8 @@ export class IrssiClient {
 						marker.unreadCount = count;
 						this.unreadMarkers.set(key, marker);
 
-						log.debug(
-							`[IrssiClient] Activity update: ${network.name}/${channel.name} level=${dataLevel} unread=${count} (from DB)`
+						irssiLog.debug(
+							`Activity update: ${network.name}/${channel.name} level=${dataLevel} unread=${count} (from DB)`
 						);
 
 						// Broadcast to all browsers with actual count from DB
@@ -1640,8 +2095,8 @@ export class IrssiClient {
 
 		this.unreadMarkers.set(key, marker);
 
-		log.debug(
-			`[IrssiClient] Activity update: ${network.name}/${channel.name} level=${dataLevel} unread=${marker.unreadCount}`
+		irssiLog.debug(
+			`Activity update: ${network.name}/${channel.name} level=${dataLevel} unread=${marker.unreadCount}`
 		);
 
 		// Broadcast to all browsers
@@ -1658,7 +2113,7 @@ export class IrssiClient {
 	private isChannelOpenInAnyBrowser(channelId: number): boolean {
 		for (const [socketId, session] of this.attachedBrowsers) {
 			if (session.openChannel === channelId) {
-				log.debug(`[IrssiClient] Channel ${channelId} is open in browser ${socketId}`);
+				irssiLog.debug(`Channel ${channelId} is open in browser ${socketId}`);
 				return true;
 			}
 		}
@@ -1679,19 +2134,18 @@ export class IrssiClient {
 		// Update openChannel for this browser
 		session.openChannel = channelId;
 
-		log.debug(`[IrssiClient] Browser ${socketId} opened channel ${channelId}`);
+		irssiLog.debug(`Browser ${socketId} opened channel ${channelId}`);
 
 		// Find network and channel by channel ID
-		for (const network of this.networks) {
-			const channel = network.channels.find((c) => c.id === channelId);
-			if (channel) {
-				log.debug(
-					`[IrssiClient] Found channel ${network.name}/${channel.name} for ID ${channelId}, calling markAsRead()`
-				);
-				// Mark as read (this will broadcast to all browsers and send to irssi)
-				this.markAsRead(network.uuid, channel.name);
-				return;
-			}
+		const found = this.findChannelById(channelId);
+		if (found) {
+			const {network, channel} = found;
+			irssiLog.debug(
+				`Found channel ${network.name}/${channel.name} for ID ${channelId}, calling markAsRead()`
+			);
+			// Mark as read (this will broadcast to all browsers and send to irssi)
+			this.markAsRead(network.uuid, channel.name);
+			return;
 		}
 
 		log.warn(`[IrssiClient] Channel ${channelId} not found in any network!`);
@@ -1704,9 +2158,7 @@ export class IrssiClient {
 	 * @param fromIrssi - true if mark_read came from irssi (window switch), false if from browser
 	 */
 	markAsRead(network: string, channel: string, fromIrssi: boolean = false): void {
-		log.debug(
-			`[IrssiClient] markAsRead() called: ${network}/${channel} (fromIrssi=${fromIrssi})`
-		);
+		irssiLog.debug(`markAsRead() called: ${network}/${channel} (fromIrssi=${fromIrssi})`);
 
 		const key = this.getMarkerKey(network, channel);
 		const marker = this.unreadMarkers.get(key);
@@ -1726,21 +2178,21 @@ export class IrssiClient {
 					});
 			}
 		} else {
-			log.debug(`[IrssiClient] No marker found for ${network}/${channel}, creating new one`);
+			irssiLog.debug(`No marker found for ${network}/${channel}, creating new one`);
 		}
 
-		log.debug(`[IrssiClient] Marked as read: ${network}/${channel} (fromIrssi=${fromIrssi})`);
+		irssiLog.debug(`Marked as read: ${network}/${channel} (fromIrssi=${fromIrssi})`);
 
 		// If mark_read came from irssi, update activeWindowInIrssi
 		if (fromIrssi) {
 			this.activeWindowInIrssi = key;
-			log.debug(`[IrssiClient] Active window in irssi: ${key}`);
+			irssiLog.debug(`Active window in irssi: ${key}`);
 		}
 
 		// Find network and channel IDs for broadcast
 		const net = this.networks.find((n) => n.uuid === network);
 		if (net) {
-			const chan = net.channels.find((c) => c.name.toLowerCase() === channel.toLowerCase());
+			const chan = this.findChannelByName(net, channel);
 			if (chan) {
 				// Broadcast to all browsers
 				this.broadcastToAllBrowsers("activity_update" as any, {
@@ -1752,8 +2204,8 @@ export class IrssiClient {
 				// Send mark_read to irssi ONLY if NOT from irssi
 				// This prevents infinite loop and unnecessary window switches
 				if (this.irssiConnection && !fromIrssi) {
-					log.debug(
-						`[IrssiClient] Preparing to send mark_read to irssi (connection exists, fromIrssi=${fromIrssi})`
+					irssiLog.debug(
+						`Preparing to send mark_read to irssi (connection exists, fromIrssi=${fromIrssi})`
 					);
 					// Check if actually connected before sending
 					if (this.irssiConnection.isConnected()) {
@@ -1762,17 +2214,17 @@ export class IrssiClient {
 							server: net.serverTag,
 							target: chan.name,
 						});
-						log.debug(
-							`[IrssiClient] ✅ Sent mark_read to irssi for ${net.serverTag}/${chan.name}`
+						irssiLog.debug(
+							`✅ Sent mark_read to irssi for ${net.serverTag}/${chan.name}`
 						);
 					} else {
-						log.debug(
-							`[IrssiClient] ❌ Skipping mark_read for ${net.serverTag}/${chan.name} (not connected)`
+						irssiLog.debug(
+							`❌ Skipping mark_read for ${net.serverTag}/${chan.name} (not connected)`
 						);
 					}
 				} else {
-					log.debug(
-						`[IrssiClient] ❌ NOT sending mark_read to irssi (connection=${!!this
+					irssiLog.debug(
+						`❌ NOT sending mark_read to irssi (connection=${!!this
 							.irssiConnection}, fromIrssi=${fromIrssi})`
 					);
 				}
@@ -1821,11 +2273,9 @@ export class IrssiClient {
 		const {ChanType} = await import("../shared/types/chan");
 
 		// Find query by nick
-		const query = network.channels.find(
-			(c) => c.type === ChanType.QUERY && c.name.toLowerCase() === nick.toLowerCase()
-		);
+		const query = this.findChannelByName(network, nick);
 
-		if (!query) {
+		if (!query || query.type !== ChanType.QUERY) {
 			log.warn(`[IrssiClient] query_closed for unknown query: ${nick} on ${serverTag}`);
 			return;
 		}
@@ -1833,25 +2283,20 @@ export class IrssiClient {
 		log.info(`[IrssiClient] Query closed in irssi: ${nick} on ${serverTag}`);
 
 		// Remove query from network
-		const index = network.channels.indexOf(query);
-		if (index !== -1) {
-			network.channels.splice(index, 1);
-		}
+		this.feWebAdapter?.removeChannel(network, query);
 
 		// Broadcast to all browsers (close query window in frontend)
 		this.broadcastToAllBrowsers("part", {
 			chan: query.id,
 		});
 
-		log.debug(`[IrssiClient] Broadcasted part for query ${query.id} (${nick}) to all browsers`);
+		irssiLog.debug(`Broadcasted part for query ${query.id} (${nick}) to all browsers`);
 	}
 
 	// FeWebAdapter callback handlers
 
 	private handleNetworkUpdate(network: NetworkData): void {
-		log.debug(
-			`[IrssiClient] Network update: ${network.name} (connected: ${network.connected})`
-		);
+		irssiLog.debug(`Network update: ${network.name} (connected: ${network.connected})`);
 
 		// Update networks array
 		const index = this.networks.findIndex((n) => n.uuid === network.uuid);
@@ -1894,10 +2339,16 @@ export class IrssiClient {
 	}
 
 	private handleMessage(networkUuid: string, channelId: number, msg: Msg): void {
-		log.debug(`[IrssiClient] Message: ${msg.text?.substring(0, 50)}`);
+		irssiLog.debug(`Message: ${msg.text?.substring(0, 50)}`);
+
+		const found = this.findChannelById(channelId);
+		const network = found?.network.uuid === networkUuid ? found.network : undefined;
+		const channel = network ? found?.channel : undefined;
 
-		const network = this.networks.find((n) => n.uuid === networkUuid);
-		const channel = network?.channels.find((c) => c.id === channelId);
+		// irssi flags highlights of its own /hilight list, add the nick and highlight settings
+		if (network && msg.text && !msg.self && !msg.highlight) {
+			msg.highlight = this.highlighter(network).test(msg.text);
+		}
 
 		// Save to encrypted storage (ASYNC - don't block!)
 		// Only save loggable messages (skip TOPIC without nick, MODE_CHANNEL, etc.)
@@ -1913,20 +2364,21 @@ export class IrssiClient {
 				name: channel.name,
 			} as Chan;
 
+			// Highlights in channels are kept as mentions, like in the classic client
+			const mention = Boolean(msg.highlight) && channel.type === ChanType.CHANNEL;
+
 			// Save encrypted to SQLite (async - don't await!)
-			this.messageStorage.index(networkForStorage, channelForStorage, msg).catch((err) => {
-				log.error(
-					`Failed to save message to storage for ${network.name}/${channel.name}: ${err}`
-				);
-			});
+			// index() settles once the batch holding the message is committed, or failed to
+			this.messageStorage
+				.index(networkForStorage, channelForStorage, msg, mention)
+				.then(() => trace.mark(msg, "stored"))
+				.catch((err) => {
+					log.error(
+						`Failed to save message to storage for ${network.name}/${channel.name}: ${err}`
+					);
+				});
 		}
 
-		// Detect highlight (mention of user's nick)
-		const isHighlight =
-			network && msg.text
-				? msg.text.toLowerCase().includes(network.nick.toLowerCase())
-				: false;
-
 		// Check if channel is open in any browser OR active in irssi
 		// If channel is open anywhere (browser or irssi), treat as read for ALL clients
 		const isChannelOpenInBrowser = this.isChannelOpenInAnyBrowser(channelId);
@@ -1939,16 +2391,15 @@ export class IrssiClient {
 			chan: channelId,
 			msg: msg,
 			unread: msg.self || isChannelOpen ? 0 : 1, // If open anywhere (browser OR irssi), unread=0
-			highlight: isHighlight && !msg.self ? 1 : 0,
+			highlight: msg.highlight && !msg.self ? 1 : 0,
 		});
+		trace.mark(msg, "broadcast");
 
 		// If channel is open in browser (NOT irssi), mark as read in irssi immediately
 		// This prevents irssi from sending activity_update
 		// DON'T send mark_read if channel is already active in irssi!
 		if (isChannelOpenInBrowser && !isChannelActiveInIrssi && network && channel && !msg.self) {
-			log.debug(
-				`[IrssiClient] Channel ${channelId} is open in browser, marking as read in irssi`
-			);
+			irssiLog.debug(`Channel ${channelId} is open in browser, marking as read in irssi`);
 			this.markAsRead(network.uuid, channel.name, false); // fromIrssi=false
 		}
 	}
@@ -1966,7 +2417,7 @@ export class IrssiClient {
 			try {
 				const count = await this.messageStorage.getMessageCount(networkUuid, channel.name);
 				channel.totalMessagesInStorage = count;
-				log.debug(`[IrssiClient] Channel ${channel.name} has ${count} messages in storage`);
+				irssiLog.debug(`Channel ${channel.name} has ${count} messages in storage`);
 			} catch (err) {
 				log.error(`Failed to get message count for ${channel.name}: ${err}`);
 				channel.totalMessagesInStorage = 0;
@@ -2005,9 +2456,10 @@ export class IrssiClient {
 			return;
 		}
 
-		const channel = network.channels.find((c) => c.id === data.channelId);
+		const found = this.findChannelById(data.channelId);
+		const channel = found?.network === network ? found.channel : undefined;
 		if (!channel) {
-			log.debug(
+			irssiLog.debug(
 				`User ${colors.bold(this.name)}: Channel ${
 					data.channelId
 				} already removed (idempotent)`
@@ -2024,10 +2476,7 @@ export class IrssiClient {
 		);
 
 		// STEP 1: Remove from cache IMMEDIATELY
-		const index = network.channels.indexOf(channel);
-		if (index !== -1) {
-			network.channels.splice(index, 1);
-		}
+		this.feWebAdapter?.removeChannel(network, channel);
 
 		// STEP 2: Broadcast to ALL browsers IMMEDIATELY (including initiator - idempotent!)
 		this.broadcastToAllBrowsers("part", {
@@ -2039,7 +2488,7 @@ export class IrssiClient {
 			if (channel.type === ChanType.CHANNEL) {
 				// Send /part for channels (executeCommand returns void)
 				this.irssiConnection.executeCommand(`part ${channel.name}`, network.serverTag);
-				log.debug(
+				irssiLog.debug(
 					`User ${colors.bold(this.name)}: Sent /part ${
 						channel.name
 					} to irssi in background`
@@ -2051,7 +2500,7 @@ export class IrssiClient {
 					server: network.serverTag,
 					nick: channel.name,
 				});
-				log.debug(
+				irssiLog.debug(
 					`User ${colors.bold(this.name)}: Sent close_query for ${
 						channel.name
 					} to irssi in background`
@@ -2072,20 +2521,16 @@ export class IrssiClient {
 		});
 	}
 
-	private handleNicklistUpdate(networkUuid: string, channelId: number, users: User[]): void {
-		log.debug(`[IrssiClient] Nicklist update: ${channelId} (${users.length} users)`);
-
-		// DON'T send 'users' event - it triggers frontend to request /names which is wasteful!
-		// In irssi mode we already have the data, just send 'names' event directly
+	private handleNicklistUpdate(networkUuid: string, channelId: number): void {
+		irssiLog.debug(`Nicklist update: ${channelId}`);
 
-		this.broadcastToAllBrowsers("names", {
-			id: channelId,
-			users: users,
-		});
+		// Browsers showing the channel ask for the list (answered from memory by
+		// handleNamesRequest), the others mark theirs outdated until it's opened
+		this.broadcastToAllBrowsers("users", {chan: channelId});
 	}
 
 	private handleTopicUpdate(networkUuid: string, channelId: number, topic: string): void {
-		log.debug(`[IrssiClient] Topic update: ${channelId}`);
+		irssiLog.debug(`Topic update: ${channelId}`);
 
 		// Broadcast to all browsers
 		this.broadcastToAllBrowsers("topic", {
@@ -2146,74 +2591,36 @@ export class IrssiClient {
 				`[IrssiClient] Loading messages from storage for ${networks.length} networks...`
 			);
 
+			const {ChanType} = await import("../shared/types/chan");
+			const toLoad: {network: NetworkData; channel: Chan}[] = [];
+
 			for (const network of networks) {
 				for (const channel of network.channels) {
-					try {
-						const {ChanType} = await import("../shared/types/chan");
+					// Don't load messages for lobby
+					if (channel.type !== ChanType.LOBBY) {
+						toLoad.push({network, channel});
+					}
+				}
+			}
 
-						// Don't load messages for lobby
-						if (channel.type === ChanType.LOBBY) {
-							continue;
-						}
+			try {
+				// Last 100 messages of every channel, in batched queries
+				const histories = await this.loadChannelHistories(toLoad, 100);
 
-						// Load last 100 messages from encrypted storage
-						const messages = await this.messageStorage.getLastMessages(
-							network.uuid,
-							channel.name,
-							100
-						);
+				toLoad.forEach(({channel}, i) => {
+					channel.messages = histories[i].messages;
 
-						// Assign IDs to messages
-						for (const msg of messages) {
-							msg.id = this.nextMessageId();
-						}
+					if (histories[i].firstUnread !== undefined) {
+						channel.firstUnread = histories[i].firstUnread!;
+					}
+				});
 
-						// Add to channel.messages
-						channel.messages = messages;
-
-						// Set firstUnread based on lastReadTime from unread markers
-						const key = this.getMarkerKey(network.uuid, channel.name);
-						const marker = this.unreadMarkers.get(key);
-
-						if (marker && marker.lastReadTime > 0 && messages.length > 0) {
-							// Find first message AFTER lastReadTime
-							const firstUnreadMsg = messages.find(
-								(msg) => msg.time.getTime() > marker.lastReadTime
-							);
-
-							if (firstUnreadMsg) {
-								channel.firstUnread = firstUnreadMsg.id;
-								log.debug(
-									`[IrssiClient] Set firstUnread=${firstUnreadMsg.id} for ${
-										network.name
-									}/${channel.name} (lastReadTime=${new Date(
-										marker.lastReadTime
-									).toISOString()})`
-								);
-							} else {
-								// All messages are read, set to last message
-								channel.firstUnread = messages[messages.length - 1].id;
-								log.debug(
-									`[IrssiClient] All messages read for ${network.name}/${channel.name}, set firstUnread to last message`
-								);
-							}
-						} else if (messages.length > 0) {
-							// No marker or marker is 0 - set to first message (all unread)
-							channel.firstUnread = messages[0].id;
-							log.debug(
-								`[IrssiClient] No marker for ${network.name}/${channel.name}, set firstUnread to first message`
-							);
-						}
+				log.info(`[IrssiClient] Loaded messages for ${toLoad.length} channels from storage`);
+			} catch (err) {
+				log.error(`Failed to load messages from storage: ${err}`);
 
-						log.info(
-							`[IrssiClient] Loaded ${messages.length} messages for ${network.name}/${channel.name} from storage`
-						);
-					} catch (err) {
-						log.error(
-							`Failed to load messages for ${network.name}/${channel.name}: ${err}`
-						);
-						channel.messages = [];
-					}
+				for (const {channel} of toLoad) {
+					channel.messages = [];
 				}
 			}
 		}
@@ -2231,10 +2638,11 @@ export class IrssiClient {
 				NETWORK: net.serverOptions.NETWORK,
 			};
 
-			log.debug(
-				`[IrssiClient] Network ${net.name} serverOptions:`,
-				JSON.stringify(serverOptions)
-			);
+			if (irssiLog.enabled) {
+				irssiLog.debug(`Network ${net.name}`, {
+					serverOptions: JSON.stringify(serverOptions),
+				});
+			}
 
 			return {
 				uuid: net.uuid,
@@ -2250,12 +2658,14 @@ export class IrssiClient {
 		}) as any[];
 
 		// Log structure for debugging
-		log.debug(
-			`[IrssiClient] Init event structure: ${sharedNetworks.length} networks, ` +
-				`channels: ${sharedNetworks
-					.map((n) => `${n.name}(${n.channels.length})`)
-					.join(", ")}`
-		);
+		if (irssiLog.enabled) {
+			irssiLog.debug(
+				`Init event structure: ${sharedNetworks.length} networks, ` +
+					`channels: ${sharedNetworks
+						.map((n) => `${n.name}(${n.channels.length})`)
+						.join(", ")}`
+			);
+		}
 
 		// Broadcast to all browsers
 		log.info(
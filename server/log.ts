@@ -1,6 +1,24 @@
 import colors from "chalk";
 import read from "read";
 
+/**
+ * Logger of one module, its debug output is off unless the module is listed in
+ * `debug.modules`. Disabled calls are no-ops, check `enabled` before building expensive
+ * arguments on hot paths.
+ */
+export type ModuleLog = {
+	readonly name: string;
+	enabled: boolean;
+	debug: (message: string, fields?: Record<string, unknown>) => void;
+};
+
+const modules = new Map<string, ModuleLog>();
+let debugModules: string[] = [];
+
+function noop() {
+	// Disabled debug output
+}
+
 function timestamp() {
 	const datetime = new Date().toISOString().split(".")[0].replace("T", " ");
 
@@ -26,6 +44,29 @@ const log = {
 	},
 	/* eslint-enable no-console */
 
+	/**
+	 * Logger for a module, the same object for every call with the same name
+	 */
+	module(name: string): ModuleLog {
+		let moduleLog = modules.get(name);
+
+		if (!moduleLog) {
+			moduleLog = {name, enabled: false, debug: noop};
+			modules.set(name, moduleLog);
+			setEnabled(moduleLog);
+		}
+
+		return moduleLog;
+	},
+
+	/**
+	 * Modules with debug output, "*" enables all of them
+	 */
+	setDebugModules(names: string[]) {
+		debugModules = names || [];
+		modules.forEach(setEnabled);
+	},
+
 	prompt(
 		options: {prompt?: string; default?: string; text: string; silent?: boolean},
 		callback: (error, result, isDefault) => void
@@ -35,4 +76,31 @@ const log = {
 	},
 };
 
+function setEnabled(moduleLog: ModuleLog) {
+	moduleLog.enabled = debugModules.includes("*") || debugModules.includes(moduleLog.name);
+	moduleLog.debug = moduleLog.enabled
+		? (message, fields) => log.debug(`[${moduleLog.name}]`, message + formatFields(fields))
+		: noop;
+}
+
+/**
+ * Render fields as ` key=value`, strings are quoted when they contain spaces
+ */
+function formatFields(fields?: Record<string, unknown>) {
+	if (!fields) {
+		return "";
+	}
+
+	let result = "";
+
+	for (const [key, value] of Object.entries(fields)) {
+		const text = typeof value === "string" ? value : JSON.stringify(value);
+		const quoted = typeof value === "string" && /\s/.test(value);
+
+		result += ` ${key}=${quoted ? JSON.stringify(text) : text}`;
+	}
+
+	return result;
+}
+
 export default log;
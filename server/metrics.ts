@@ -0,0 +1,440 @@
+import crypto from "crypto";
+import type {IncomingMessage, ServerResponse} from "http";
+import {monitorEventLoopDelay, IntervalHistogram} from "perf_hooks";
+
+import Config from "./config";
+import shard from "./shard";
+import trace, {StageStats, traceBuckets} from "./trace";
+
+/**
+ * Runtime metrics, served in the Prometheus text format on /metrics, see `metrics` in the config
+ *
+ * Counters and histograms are kept by the code they measure, through series it looks up once
+ * and keeps, so counting costs an addition. Gauges are read when scraped. Per user series
+ * carry a `user` label, `metrics.perUser` leaves it out so every user adds to the same series.
+ */
+
+export type Labels = Record<string, string>;
+
+type Sample = {name: string; labels: Labels; value: number};
+
+export type Family = {
+	name: string;
+	help: string;
+	type: "counter" | "gauge" | "histogram";
+	samples: Sample[];
+};
+
+// Upper bounds of latency histograms, the trace buckets in seconds
+export const secondsBuckets = traceBuckets.map((ms) => ms / 1000);
+
+export const bytesBuckets = [1e3, 1e4, 1e5, 1e6, 1e7, 1e8];
+
+function labelKey(labels: Labels) {
+	return Object.keys(labels)
+		.sort()
+		.map((name) => `${name}=${labels[name]}`)
+		.join(",");
+}
+
+export class CounterSeries {
+	value = 0;
+
+	constructor(readonly labels: Labels) {}
+
+	inc(amount = 1) {
+		this.value += amount;
+	}
+}
+
+export class HistogramSeries {
+	count = 0;
+	sum = 0;
+	buckets: number[]; // per bound, not cumulative, the last one has no bound
+
+	constructor(readonly labels: Labels, private bounds: number[]) {
+		this.buckets = new Array(bounds.length + 1).fill(0);
+	}
+
+	observe(value: number) {
+		this.count++;
+		this.sum += value;
+
+		const bucket = this.bounds.findIndex((bound) => value <= bound);
+		this.buckets[bucket === -1 ? this.bounds.length : bucket]++;
+	}
+}
+
+function histogramSamples(
+	name: string,
+	labels: Labels,
+	bounds: number[],
+	buckets: number[],
+	sum: number,
+	count: number
+): Sample[] {
+	let cumulative = 0;
+	const samples = bounds.map((bound, i) => {
+		cumulative += buckets[i];
+		return {name: `${name}_bucket`, labels: {...labels, le: String(bound)}, value: cumulative};
+	});
+
+	samples.push(
+		{name: `${name}_bucket`, labels: {...labels, le: "+Inf"}, value: count},
+		{name: `${name}_sum`, labels, value: sum},
+		{name: `${name}_count`, labels, value: count}
+	);
+
+	return samples;
+}
+
+/**
+ * Family of one value without labels
+ */
+export function single(name: string, help: string, type: Family["type"], value: number): Family {
+	return {name, help, type, samples: [{name, labels: {}, value}]};
+}
+
+/**
+ * Histogram samples of latencies kept as StageStats, in milliseconds
+ */
+export function stageSamples(name: string, labels: Labels, stats: StageStats): Sample[] {
+	return histogramSamples(
+		name,
+		labels,
+		secondsBuckets,
+		stats.buckets,
+		stats.totalMs / 1000,
+		stats.count
+	);
+}
+
+abstract class Metric<T extends {labels: Labels}> {
+	protected series = new Map<string, T>();
+
+	constructor(readonly name: string, readonly help: string) {}
+
+	/**
+	 * The series with these labels, to keep and count through
+	 */
+	with(labels: Labels = {}): T {
+		const key = labelKey(labels);
+		let series = this.series.get(key);
+
+		if (!series) {
+			series = this.create(labels);
+			this.series.set(key, series);
+		}
+
+		return series;
+	}
+
+	forget(user: string) {
+		for (const [key, series] of this.series) {
+			if (series.labels.user === user) {
+				this.series.delete(key);
+			}
+		}
+	}
+
+	abstract collect(): Family;
+	protected abstract create(labels: Labels): T;
+}
+
+class Counter extends Metric<CounterSeries> {
+	collect(): Family {
+		return {
+			name: this.name,
+			help: this.help,
+			type: "counter",
+			samples: [...this.series.values()].map(({labels, value}) => ({
+				name: this.name,
+				labels,
+				value,
+			})),
+		};
+	}
+
+	protected create(labels: Labels) {
+		return new CounterSeries(labels);
+	}
+}
+
+class Histogram extends Metric<HistogramSeries> {
+	constructor(name: string, help: string, private bounds: number[]) {
+		super(name, help);
+	}
+
+	collect(): Family {
+		return {
+			name: this.name,
+			help: this.help,
+			type: "histogram",
+			samples: [...this.series.values()].flatMap((s) =>
+				histogramSamples(this.name, s.labels, this.bounds, s.buckets, s.sum, s.count)
+			),
+		};
+	}
+
+	protected create(labels: Labels) {
+		return new HistogramSeries(labels, this.bounds);
+	}
+}
+
+function escapeLabel(value: string) {
+	return value.replace(/\\/g, "\\\\").replace(/"/g, '\\"').replace(/\n/g, "\\n");
+}
+
+// Headers that reverse proxies add, a local request with any of them was forwarded
+const proxyHeaders = ["x-forwarded-for", "forwarded", "x-real-ip"];
+
+function isLoopback(address: string | undefined) {
+	return address === "127.0.0.1" || address === "::1" || address === "::ffff:127.0.0.1";
+}
+
+class Metrics {
+	private metrics: Metric<any>[] = [];
+	private collectors: (() => Family[])[] = [];
+	private eventLoop: IntervalHistogram | null = null;
+
+	constructor() {
+		this.collect(() => this.processFamilies());
+		this.collect(() => [
+			{
+				name: "thelounge_trace_stage_seconds",
+				help: "Time from receiving a sampled fe-web frame to reaching each stage",
+				type: "histogram",
+				samples: [...trace.stats()].flatMap(([stage, stats]) =>
+					stageSamples("thelounge_trace_stage_seconds", {stage}, stats)
+				),
+			},
+		]);
+	}
+
+	get enabled() {
+		return Config.values.metrics.enable;
+	}
+
+	counter(name: string, help: string) {
+		const counter = new Counter(name, help);
+		this.metrics.push(counter);
+		return counter;
+	}
+
+	histogram(name: string, help: string, bounds = secondsBuckets) {
+		const histogram = new Histogram(name, help, bounds);
+		this.metrics.push(histogram);
+		return histogram;
+	}
+
+	/**
+	 * Families read when scraped, for gauges and stats kept elsewhere
+	 */
+	collect(collector: () => Family[]) {
+		this.collectors.push(collector);
+	}
+
+	/**
+	 * Labels of the series of a user
+	 */
+	userLabels(user: string | undefined): Labels {
+		return user && Config.values.metrics.perUser ? {user} : {};
+	}
+
+	/**
+	 * Gauge of a value of each user, summed up into one series without `metrics.perUser`
+	 */
+	userGauge(name: string, help: string, values: [string, number][]): Family {
+		const samples = new Map<string, Sample>();
+
+		for (const [user, value] of values) {
+			const labels = this.userLabels(user);
+			const key = labelKey(labels);
+			const sample = samples.get(key);
+
+			if (sample) {
+				sample.value += value;
+			} else {
+				samples.set(key, {name, labels, value});
+			}
+		}
+
+		return {name, help, type: "gauge", samples: [...samples.values()]};
+	}
+
+	/**
+	 * Drop the series of a user that is removed
+	 */
+	forget(user: string) {
+		this.metrics.forEach((metric) => metric.forget(user));
+	}
+
+	/**
+	 * Start measuring what is only measured while metrics are enabled
+	 */
+	start() {
+		if (this.enabled && !this.eventLoop) {
+			this.eventLoop = monitorEventLoopDelay({resolution: 20});
+			this.eventLoop.enable();
+		}
+	}
+
+	families(): Family[] {
+		return [
+			...this.metrics.map((metric) => metric.collect()),
+			...this.collectors.flatMap((collector) => collector()),
+		];
+	}
+
+	/**
+	 * Families of several processes in one list, told apart by their labels
+	 */
+	merge(sources: {labels: Labels; families: Family[]}[]): Family[] {
+		const merged = new Map<string, Family>();
+
+		for (const {labels, families} of sources) {
+			for (const family of families) {
+				let target = merged.get(family.name);
+
+				if (!target) {
+					target = {...family, samples: []};
+					merged.set(family.name, target);
+				}
+
+				for (const sample of family.samples) {
+					target.samples.push({...sample, labels: {...labels, ...sample.labels}});
+				}
+			}
+		}
+
+		return [...merged.values()];
+	}
+
+	render(families: Family[]): string {
+		const lines: string[] = [];
+
+		for (const family of families) {
+			lines.push(`# HELP ${family.name} ${family.help}`);
+			lines.push(`# TYPE ${family.name} ${family.type}`);
+
+			for (const {name, labels, value} of family.samples) {
+				const pairs = Object.entries(labels).map(([k, v]) => `${k}="${escapeLabel(v)}"`);
+				lines.push(`${name}${pairs.length > 0 ? `{${pairs.join(",")}}` : ""} ${value}`);
+			}
+		}
+
+		return lines.join("\n") + "\n";
+	}
+
+	/**
+	 * Whether a request may read the metrics
+	 *
+	 * With a token it has to be sent as bearer token, without one only local requests that
+	 * didn't come through a reverse proxy are allowed. Behind a reverse proxy (the
+	 * `reverseProxy` option) every request looks local, so the token is required then.
+	 * Shards are only reached by the router.
+	 */
+	authorize(req: IncomingMessage) {
+		const {token} = Config.values.metrics;
+
+		if (shard.isShard) {
+			return true;
+		}
+
+		if (token) {
+			const digest = (value: string) => crypto.createHash("sha256").update(value).digest();
+			return crypto.timingSafeEqual(
+				digest(req.headers.authorization || ""),
+				digest(`Bearer ${token}`)
+			);
+		}
+
+		if (Config.values.reverseProxy) {
+			return false;
+		}
+
+		return isLoopback(req.socket.remoteAddress) && !proxyHeaders.some((h) => req.headers[h]);
+	}
+
+	/**
+	 * Handler of /metrics, shards answer with JSON that the router merges
+	 */
+	request = (req: IncomingMessage, res: ServerResponse) => {
+		if (!this.allowed(req, res)) {
+			return;
+		}
+
+		if (shard.isShard) {
+			res.writeHead(200, {"Content-Type": "application/json"});
+			res.end(JSON.stringify(this.families()));
+			return;
+		}
+
+		this.respond(res, this.families());
+	};
+
+	/**
+	 * Turn away requests that may not read the metrics
+	 *
+	 * @returns false if the request was answered
+	 */
+	allowed(req: IncomingMessage, res: ServerResponse) {
+		if (!this.enabled) {
+			res.writeHead(404).end("Not found");
+			return false;
+		}
+
+		if (!this.authorize(req)) {
+			res.writeHead(403).end("Forbidden");
+			return false;
+		}
+
+		return true;
+	}
+
+	respond(res: ServerResponse, families: Family[]) {
+		res.writeHead(200, {"Content-Type": "text/plain; version=0.0.4; charset=utf-8"});
+		res.end(this.render(families));
+	}
+
+	private processFamilies(): Family[] {
+		const memory = process.memoryUsage();
+		const families: Family[] = [
+			{
+				name: "thelounge_process_memory_bytes",
+				help: "Memory use of the process by kind",
+				type: "gauge",
+				samples: (["rss", "heapTotal", "heapUsed", "external"] as const).map((kind) => ({
+					name: "thelounge_process_memory_bytes",
+					labels: {kind},
+					value: memory[kind],
+				})),
+			},
+		];
+
+		if (this.eventLoop) {
+			const quantiles = [0.5, 0.9, 0.99];
+			families.push({
+				name: "thelounge_event_loop_delay_seconds",
+				help: "Event loop delay since the previous scrape",
+				type: "gauge",
+				samples: quantiles
+					.map((q) => ({
+						name: "thelounge_event_loop_delay_seconds",
+						labels: {quantile: String(q)},
+						value: this.eventLoop!.percentile(q * 100) / 1e9,
+					}))
+					.concat({
+						name: "thelounge_event_loop_delay_seconds",
+						labels: {quantile: "1"},
+						value: this.eventLoop.max / 1e9,
+					}),
+			});
+			this.eventLoop.reset();
+		}
+
+		return families;
+	}
+}
+
+export default new Metrics();
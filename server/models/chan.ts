@@ -4,6 +4,7 @@ import Config from "../config";
 import User from "./user";
 import Msg from "./msg";
 import storage from "../plugins/storage";
+import prefetchQueue from "../plugins/prefetchQueue";
 import Client from "../client";
 import Network from "./network";
 import Prefix from "./prefix";
@@ -117,7 +118,14 @@ class Chan {
 	}
 
 	dereferencePreviews(messages: Msg[]) {
-		if (!Config.values.prefetch || !Config.values.prefetchStorage) {
+		if (!Config.values.prefetch) {
+			return;
+		}
+
+		// Previews still loading for these messages are no longer needed
+		prefetchQueue.cancel(messages);
+
+		if (!Config.values.prefetchStorage) {
 			return;
 		}
 
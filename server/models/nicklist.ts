@@ -0,0 +1,181 @@
+import User from "./user";
+import Prefix from "./prefix";
+
+type Entry = {
+	key: string; // lowercase nick
+	rank: number; // position of the user's mode in PREFIX, modeless users last
+	user: User;
+};
+
+/**
+ * Channel users keyed by lowercase nick, iterated in nicklist order (mode, then nick)
+ *
+ * The sort key of a user is computed once when it's set. Single changes keep the order
+ * up to date with a binary search, after a full reload it's only sorted on the next read.
+ * Placing an entry still shifts the array behind it, O(n) but a single memmove, which
+ * beats the pointer chasing of a balanced tree at the sizes of even the largest channels.
+ * Mode changes mutate the user, call `update` afterwards to move it. Iterating walks the
+ * order in place, take a copy first to change the list while going through it.
+ */
+class Nicklist extends Map<string, User> {
+	private prefix: Prefix;
+	private ranked: Map<string, Entry>;
+	private order: Entry[] | null;
+
+	constructor(prefix?: Prefix) {
+		super();
+		this.prefix = prefix || new Prefix([]);
+		this.ranked = new Map();
+		this.order = [];
+	}
+
+	set(key: string, user: User): this {
+		const existing = this.ranked.get(key);
+
+		if (existing) {
+			this.unlink(existing);
+		}
+
+		const entry: Entry = {key, rank: this.rankOf(user), user};
+		this.ranked.set(key, entry);
+
+		if (this.order) {
+			this.order.splice(this.lowerBound(entry), 0, entry);
+		}
+
+		return super.set(key, user);
+	}
+
+	delete(key: string): boolean {
+		const existing = this.ranked.get(key);
+
+		if (existing) {
+			this.unlink(existing);
+			this.ranked.delete(key);
+		}
+
+		return super.delete(key);
+	}
+
+	clear() {
+		super.clear();
+		this.ranked.clear();
+		this.order = [];
+	}
+
+	/**
+	 * Replace all users at once, sorting is left to the next read
+	 */
+	load(users: User[]) {
+		this.clear();
+		this.order = null;
+
+		for (const user of users) {
+			const key = user.nick.toLowerCase();
+			this.ranked.set(key, {key, rank: this.rankOf(user), user});
+			super.set(key, user);
+		}
+	}
+
+	/**
+	 * Move a user after its modes changed
+	 */
+	update(key: string) {
+		const user = this.get(key);
+
+		if (user) {
+			this.set(key, user);
+		}
+	}
+
+	/**
+	 * Users in nicklist order
+	 */
+	*values(): IterableIterator<User> {
+		for (const entry of this.sortedEntries()) {
+			yield entry.user;
+		}
+	}
+
+	*keys(): IterableIterator<string> {
+		for (const entry of this.sortedEntries()) {
+			yield entry.key;
+		}
+	}
+
+	*entries(): IterableIterator<[string, User]> {
+		for (const entry of this.sortedEntries()) {
+			yield [entry.key, entry.user];
+		}
+	}
+
+	[Symbol.iterator](): IterableIterator<[string, User]> {
+		return this.entries();
+	}
+
+	forEach(callback: (user: User, key: string, map: Map<string, User>) => void, thisArg?: any) {
+		for (const entry of this.sortedEntries()) {
+			callback.call(thisArg, entry.user, entry.key, this);
+		}
+	}
+
+	private sortedEntries(): Entry[] {
+		if (!this.order) {
+			this.order = Array.from(this.ranked.values()).sort(compare);
+		}
+
+		return this.order;
+	}
+
+	private rankOf(user: User) {
+		const rank = this.prefix.symbols.indexOf(user.mode);
+		return rank === -1 ? this.prefix.symbols.length : rank;
+	}
+
+	private unlink(entry: Entry) {
+		if (!this.order) {
+			return;
+		}
+
+		const index = this.lowerBound(entry);
+
+		if (this.order[index] === entry) {
+			this.order.splice(index, 1);
+		}
+	}
+
+	/**
+	 * Index of the first entry in `order` that doesn't sort before `entry`
+	 */
+	private lowerBound(entry: Entry) {
+		const order = this.order!;
+		let low = 0;
+		let high = order.length;
+
+		while (low < high) {
+			const mid = (low + high) >>> 1;
+
+			if (compare(order[mid], entry) < 0) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+
+		return low;
+	}
+}
+
+// Nicks sort like they always did (localeCompare), without a new collator per comparison
+const collator = new Intl.Collator();
+
+function compare(a: Entry, b: Entry) {
+	if (a.rank !== b.rank) {
+		return a.rank - b.rank;
+	}
+
+	// Distinct keys never tie, or binary searches could land on the wrong entry
+	return collator.compare(a.key, b.key) || (a.key < b.key ? -1 : a.key > b.key ? 1 : 0);
+}
+
+export default Nicklist;
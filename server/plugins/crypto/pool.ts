@@ -0,0 +1,284 @@
+/**
+ * Worker thread pool for AES-256-GCM work
+ *
+ * Decrypting a long history or re-encrypting a whole database would otherwise block
+ * the event loop, and with it every other user on the instance.
+ *
+ * Each worker handles its tasks in order, so tasks sent with the same `affinity`
+ * complete in the order they were submitted (fe-web frames rely on that).
+ */
+
+import os from "os";
+import path from "path";
+import {Worker} from "worker_threads";
+import log from "../../log";
+import Config from "../../config";
+import {runTask, toBuffer, CryptoTask, SealedMessage} from "./tasks";
+
+type PendingTask = {
+	resolve: (result: any) => void;
+	reject: (err: Error) => void;
+};
+
+type PoolWorker = {
+	worker: Worker;
+	pending: Map<number, PendingTask>;
+};
+
+// Rows per task when a large batch is spread over several workers
+const rowsPerTask = 256;
+
+export class CryptoPool {
+	private size: number | null;
+	private workers: (PoolWorker | null)[];
+	private nextId: number;
+
+	/**
+	 * @param size - number of worker threads, 0 runs every task inline on the main thread,
+	 * null takes the `cryptoWorkers` setting when the first task runs
+	 */
+	constructor(size: number | null) {
+		this.size = size;
+		this.workers = [];
+		this.nextId = 0;
+	}
+
+	/**
+	 * Run a task on a worker. Tasks with the same affinity run on the same worker, in order.
+	 */
+	run(task: CryptoTask, affinity?: number): Promise<any> {
+		const poolWorker = this.pickWorker(affinity);
+
+		if (!poolWorker) {
+			try {
+				return Promise.resolve(runTask(task));
+			} catch (err: any) {
+				return Promise.reject(err);
+			}
+		}
+
+		const id = this.nextId++;
+
+		return new Promise((resolve, reject) => {
+			if (poolWorker.pending.size === 0) {
+				poolWorker.worker.ref();
+			}
+
+			poolWorker.pending.set(id, {resolve, reject});
+			poolWorker.worker.postMessage({id, task});
+		});
+	}
+
+	async encrypt(key: Buffer, plaintext: string, affinity?: number): Promise<Buffer> {
+		return toBuffer(await this.run({op: "encrypt", key, plaintext}, affinity));
+	}
+
+	decrypt(key: Buffer, data: Buffer, affinity?: number): Promise<string> {
+		return this.run({op: "decrypt", key, data}, affinity);
+	}
+
+	/**
+	 * Encrypt messages and compute their search tokens
+	 */
+	async seal(
+		key: Buffer,
+		searchKey: Buffer,
+		items: {plaintext: string; text: string}[]
+	): Promise<SealedMessage[]> {
+		const sealed = await this.spread(items, (chunk) =>
+			this.run({op: "seal", key, searchKey, items: chunk})
+		);
+
+		return sealed.map(toSealedMessage);
+	}
+
+	/**
+	 * Decrypt and parse fe-web frames, null for frames that fail to decrypt or parse
+	 */
+	frames(key: Buffer, items: Buffer[]): Promise<(any | null)[]> {
+		return this.spread(items, (chunk) => this.run({op: "frames", key, items: chunk}));
+	}
+
+	/**
+	 * Decrypt and parse stored messages, null for rows that fail to decrypt
+	 */
+	open(key: Buffer, items: Buffer[]): Promise<(any | null)[]> {
+		return this.spread(items, (chunk) => this.run({op: "open", key, items: chunk}));
+	}
+
+	/**
+	 * Search tokens of stored messages, null for rows that fail to decrypt
+	 */
+	async tokenize(key: Buffer, searchKey: Buffer, items: Buffer[]): Promise<(Buffer[] | null)[]> {
+		const tokens: (Uint8Array[] | null)[] = await this.spread(items, (chunk) =>
+			this.run({op: "tokenize", key, searchKey, items: chunk})
+		);
+
+		return tokens.map((rowTokens) => (rowTokens ? rowTokens.map(toBuffer) : null));
+	}
+
+	/**
+	 * Re-encrypt stored messages with a new key, fails if any row can't be decrypted
+	 */
+	async reseal(
+		oldKey: Buffer,
+		key: Buffer,
+		searchKey: Buffer,
+		items: Buffer[]
+	): Promise<SealedMessage[]> {
+		const sealed = await this.spread(items, (chunk) =>
+			this.run({op: "reseal", oldKey, key, searchKey, items: chunk})
+		);
+
+		return sealed.map(toSealedMessage);
+	}
+
+	/**
+	 * Stop all workers, pending tasks are rejected
+	 */
+	async terminate() {
+		const workers = this.workers;
+		this.workers = [];
+
+		await Promise.all(
+			workers.map((poolWorker) => (poolWorker ? poolWorker.worker.terminate() : undefined))
+		);
+	}
+
+	/**
+	 * Split a batch into tasks that run in parallel, results keep the input order
+	 */
+	private async spread<T, R>(items: T[], run: (chunk: T[]) => Promise<R[]>): Promise<R[]> {
+		const tasks: Promise<R[]>[] = [];
+
+		for (let i = 0; i < items.length; i += rowsPerTask) {
+			tasks.push(run(items.slice(i, i + rowsPerTask)));
+		}
+
+		return ([] as R[]).concat(...(await Promise.all(tasks)));
+	}
+
+	private pickWorker(affinity?: number): PoolWorker | null {
+		if (this.size === null) {
+			this.size = configuredSize();
+		}
+
+		if (this.size <= 0) {
+			return null;
+		}
+
+		let slot: number;
+
+		if (affinity !== undefined) {
+			slot = affinity % this.size;
+		} else {
+			// An idle or not yet started worker, otherwise the least busy one
+			slot = 0;
+
+			for (let i = 0; i < this.size; i++) {
+				const poolWorker = this.workers[i];
+
+				if (!poolWorker || poolWorker.pending.size === 0) {
+					slot = i;
+					break;
+				}
+
+				if (poolWorker.pending.size < this.workers[slot]!.pending.size) {
+					slot = i;
+				}
+			}
+		}
+
+		return this.workers[slot] || this.spawn(slot);
+	}
+
+	private spawn(slot: number): PoolWorker | null {
+		let worker: Worker;
+
+		try {
+			// Under ts-node (development, tests) the worker has to register it as well
+			if (path.extname(__filename) === ".ts") {
+				worker = new Worker(
+					`require("ts-node/register/transpile-only"); require(${JSON.stringify(
+						path.join(__dirname, "worker.ts")
+					)});`,
+					{eval: true}
+				);
+			} else {
+				worker = new Worker(path.join(__dirname, "worker.js"));
+			}
+		} catch (err: any) {
+			log.error(`Unable to start crypto worker, running crypto inline: ${err}`);
+			this.size = 0;
+			return null;
+		}
+
+		const poolWorker: PoolWorker = {worker, pending: new Map()};
+
+		// Idle workers must not keep the process alive
+		worker.unref();
+
+		worker.on("message", ({id, result, error}: {id: number; result?: any; error?: string}) => {
+			const task = poolWorker.pending.get(id);
+
+			if (!task) {
+				return;
+			}
+
+			poolWorker.pending.delete(id);
+
+			if (poolWorker.pending.size === 0) {
+				worker.unref();
+			}
+
+			if (error !== undefined) {
+				task.reject(new Error(error));
+			} else {
+				task.resolve(result);
+			}
+		});
+
+		const fail = (err: Error) => {
+			// Gets replaced by a fresh worker on the next task
+			if (this.workers[slot] === poolWorker) {
+				this.workers[slot] = null;
+			}
+
+			for (const task of poolWorker.pending.values()) {
+				task.reject(err);
+			}
+
+			poolWorker.pending.clear();
+		};
+
+		worker.on("error", (err) => {
+			log.error(`Crypto worker failed: ${err}`);
+			fail(err);
+		});
+
+		worker.on("exit", (code) => fail(new Error(`Crypto worker exited with code ${code}`)));
+
+		this.workers[slot] = poolWorker;
+
+		return poolWorker;
+	}
+}
+
+function toSealedMessage(sealed: {data: Uint8Array; tokens: Uint8Array[]}): SealedMessage {
+	return {data: toBuffer(sealed.data), tokens: sealed.tokens.map(toBuffer)};
+}
+
+function configuredSize() {
+	const size = Config.values.cryptoWorkers;
+
+	if (typeof size === "number" && size >= 0) {
+		return Math.floor(size);
+	}
+
+	// Leave a core for the event loop
+	return Math.max(1, Math.min(4, os.cpus().length - 1));
+}
+
+const cryptoPool = new CryptoPool(null);
+
+export default cryptoPool;
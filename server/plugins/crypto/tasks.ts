@@ -0,0 +1,211 @@
+/**
+ * AES-256-GCM primitives and the batch tasks run by the crypto worker pool
+ *
+ * Everything in here is synchronous and free of state, so it can run both inside a
+ * worker thread and inline on the main thread.
+ *
+ * Encrypted format: [IV 12B][Ciphertext][Auth Tag 16B]
+ *
+ * Stored messages are encoded as a record before they're encrypted, see encodeRecord.
+ */
+
+import crypto from "crypto";
+import zlib from "zlib";
+
+// Number of bytes of the HMAC kept per search token
+export const searchTokenLength = 8;
+
+export type SealedMessage = {data: Buffer; tokens: Buffer[]};
+
+export type CryptoTask =
+	// fe-web wire frames
+	| {op: "encrypt"; key: Uint8Array; plaintext: string}
+	| {op: "decrypt"; key: Uint8Array; data: Uint8Array}
+	| {op: "frames"; key: Uint8Array; items: Uint8Array[]}
+	// stored messages, as [{plaintext, text}] or encrypted rows
+	| {
+			op: "seal";
+			key: Uint8Array;
+			searchKey: Uint8Array;
+			items: {plaintext: string; text: string}[];
+	  }
+	| {op: "open"; key: Uint8Array; items: Uint8Array[]}
+	| {op: "tokenize"; key: Uint8Array; searchKey: Uint8Array; items: Uint8Array[]}
+	| {
+			op: "reseal";
+			oldKey: Uint8Array;
+			key: Uint8Array;
+			searchKey: Uint8Array;
+			items: Uint8Array[];
+	  };
+
+/**
+ * Buffers lose their prototype when posted between threads, wrap them again without copying
+ */
+export function toBuffer(data: Uint8Array): Buffer {
+	if (Buffer.isBuffer(data)) {
+		return data;
+	}
+
+	return Buffer.from(data.buffer, data.byteOffset, data.byteLength);
+}
+
+export function encrypt(key: Uint8Array, plaintext: string | Uint8Array): Buffer {
+	const iv = crypto.randomBytes(12);
+	const cipher = crypto.createCipheriv("aes-256-gcm", key, iv);
+
+	const encrypted = Buffer.concat([
+		typeof plaintext === "string" ? cipher.update(plaintext, "utf8") : cipher.update(plaintext),
+		cipher.final(),
+	]);
+
+	return Buffer.concat([iv, encrypted, cipher.getAuthTag()]);
+}
+
+export function decryptBuffer(key: Uint8Array, data: Uint8Array): Buffer {
+	const buffer = toBuffer(data);
+	const iv = buffer.subarray(0, 12);
+	const tag = buffer.subarray(-16);
+	const ciphertext = buffer.subarray(12, -16);
+
+	const decipher = crypto.createDecipheriv("aes-256-gcm", key, iv);
+	decipher.setAuthTag(tag);
+
+	return Buffer.concat([decipher.update(ciphertext), decipher.final()]);
+}
+
+export function decrypt(key: Uint8Array, data: Uint8Array): string {
+	return decryptBuffer(key, data).toString("utf8");
+}
+
+// First byte of a record in a format other than plain JSON, which always starts with "{".
+// A new dictionary needs a new format, so older rows still decode.
+const recordDeflateV1 = 1;
+
+// Preset deflate dictionary of what most stored messages share, the most common parts last
+const recordDictionaryV1 = Buffer.from(
+	'"new_nick":"","new_ident":"","new_host":"","reason":"","ctcpMessage":"","gecos":"",' +
+		'"account":false,"invitedYou":false,"statusmsgGroup":"","target":{"mode":"","nick":""},' +
+		'"hostmask":"","showInActive":true,"users":[],"highlight":true,"self":true,' +
+		'{"from":{"mode":"@","nick":""},"text":"","self":false,"highlight":false,"users":["',
+	"utf8"
+);
+
+/**
+ * Encode the JSON of a stored message, deflated with a preset dictionary unless that
+ * doesn't make it smaller
+ */
+export function encodeRecord(json: string): Buffer {
+	const plain = Buffer.from(json, "utf8");
+	const deflated = zlib.deflateRawSync(plain, {dictionary: recordDictionaryV1});
+
+	if (deflated.length + 1 >= plain.length) {
+		return plain;
+	}
+
+	return Buffer.concat([Buffer.of(recordDeflateV1), deflated]);
+}
+
+export function decodeRecord(record: Buffer): string {
+	if (record[0] === recordDeflateV1) {
+		return zlib
+			.inflateRawSync(record.subarray(1), {dictionary: recordDictionaryV1})
+			.toString("utf8");
+	}
+
+	return record.toString("utf8");
+}
+
+function openRecord(key: Uint8Array, data: Uint8Array): string {
+	return decodeRecord(decryptBuffer(key, data));
+}
+
+/**
+ * Split text into the distinct trigrams used by the search index.
+ * Text is lowercased first, matching the case-insensitive substring search.
+ */
+export function searchTrigrams(text: string): string[] {
+	const chars = Array.from(text.toLowerCase());
+	const trigrams = new Set<string>();
+
+	for (let i = 0; i + 3 <= chars.length; i++) {
+		trigrams.add(chars[i] + chars[i + 1] + chars[i + 2]);
+	}
+
+	return Array.from(trigrams);
+}
+
+/**
+ * Blind search tokens for a piece of text (keyed, so the index leaks no plaintext)
+ */
+export function searchTokens(key: Uint8Array, text: string): Buffer[] {
+	return searchTrigrams(text).map((trigram) =>
+		crypto
+			.createHmac("sha256", key)
+			.update(trigram, "utf8")
+			.digest()
+			.subarray(0, searchTokenLength)
+	);
+}
+
+/**
+ * Run a single task. Failures of individual rows in `frames`, `open` and `tokenize` yield null,
+ * so one corrupted message doesn't fail the whole batch.
+ */
+export function runTask(task: CryptoTask): any {
+	switch (task.op) {
+		case "encrypt":
+			return encrypt(task.key, task.plaintext);
+
+		case "decrypt":
+			return decrypt(task.key, task.data);
+
+		case "frames":
+			return task.items.map((data) => {
+				try {
+					return JSON.parse(decrypt(task.key, data));
+				} catch {
+					return null;
+				}
+			});
+
+		case "seal":
+			return task.items.map(
+				(item): SealedMessage => ({
+					data: encrypt(task.key, encodeRecord(item.plaintext)),
+					tokens: item.text ? searchTokens(task.searchKey, item.text) : [],
+				})
+			);
+
+		case "open":
+			return task.items.map((data) => {
+				try {
+					return JSON.parse(openRecord(task.key, data));
+				} catch {
+					return null;
+				}
+			});
+
+		case "tokenize":
+			return task.items.map((data) => {
+				try {
+					const text = JSON.parse(openRecord(task.key, data)).text;
+					return text ? searchTokens(task.searchKey, text) : [];
+				} catch {
+					return null;
+				}
+			});
+
+		case "reseal":
+			return task.items.map((data): SealedMessage => {
+				// Rows from before records were compressed get compressed here
+				const plaintext = openRecord(task.oldKey, data);
+				const text = JSON.parse(plaintext).text;
+
+				return {
+					data: encrypt(task.key, encodeRecord(plaintext)),
+					tokens: text ? searchTokens(task.searchKey, text) : [],
+				};
+			});
+	}
+}
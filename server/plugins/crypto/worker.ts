@@ -0,0 +1,14 @@
+/**
+ * Crypto pool worker thread, runs tasks in the order they arrive
+ */
+
+import {parentPort} from "worker_threads";
+import {runTask, CryptoTask} from "./tasks";
+
+parentPort!.on("message", ({id, task}: {id: number; task: CryptoTask}) => {
+	try {
+		parentPort!.postMessage({id, result: runTask(task)});
+	} catch (error: any) {
+		parentPort!.postMessage({id, error: error?.message || String(error)});
+	}
+});
@@ -7,7 +7,14 @@ import log from "../../log";
 import Config from "../../config";
 import {findLinksWithSchema} from "../../../shared/linkify";
 import {LinkPreview} from "../../../shared/types/msg";
-import storage from "../storage";
+import storage, {StorageUpload} from "../storage";
+import linkPreviewCache, {
+	CachedPreview,
+	errorPreviewTtl,
+	previewCacheKey,
+	responseTtl,
+} from "../linkPreviewCache";
+import prefetchQueue, {PrefetchCancelledError, PrefetchJob} from "../prefetchQueue";
 import Client from "../../client";
 import Chan from "../../models/chan";
 import Msg from "../../models/msg";
@@ -16,8 +23,16 @@ type FetchRequest = {
 	data: Buffer;
 	type: string;
 	size: number;
+	ttl: number; // how long the response may be cached, in ms
+	file?: string; // storage url of a downloaded image, not referenced yet
 };
-const currentFetchPromises = new Map<string, Promise<FetchRequest>>();
+const currentFetchPromises = new Map<string, PrefetchJob<FetchRequest>>();
+
+// Message a request is for, and whether its channel is open in a browser
+type FetchOwner = {msg: Msg; open: boolean};
+
+// Where the result of a preview that is still loading goes in the link preview cache
+const pendingPreviews = new WeakMap<LinkPreview, {key: string; ttl: number}>();
 const imageTypeRegex = /^image\/.+/;
 const mediaTypeRegex = /^(audio|video)\/.+/;
 
@@ -26,6 +41,8 @@ export default function (client: Client, chan: Chan, msg: Msg, cleanText: string
 		return;
 	}
 
+	const owner = ownerOf(client, chan, msg);
+
 	msg.previews = findLinksWithSchema(cleanText).reduce((cleanLinks: LinkPreview[], link) => {
 		const url = normalizeURL(link.link);
 
@@ -44,6 +61,20 @@ export default function (client: Client, chan: Chan, msg: Msg, cleanText: string
 			return cleanLinks;
 		}
 
+		const language = client.config.browser?.language || "";
+		const cacheKey = previewCacheKey(url, language);
+		const cached = linkPreviewCache.get(cacheKey);
+
+		// Fetched before and found to have no preview
+		if (cached === null) {
+			return cleanLinks;
+		}
+
+		if (cached && reuseThumb(cached)) {
+			cleanLinks.push({...cached, link: link.link, shown: null});
+			return cleanLinks;
+		}
+
 		const preview: LinkPreview = {
 			type: "loading",
 			head: "",
@@ -56,14 +87,20 @@ export default function (client: Client, chan: Chan, msg: Msg, cleanText: string
 
 		cleanLinks.push(preview);
 
-		fetch(url, {
-			accept: "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
-			language: client.config.browser?.language || "",
-		})
+		fetch(
+			url,
+			{
+				accept: "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+				language,
+			},
+			owner
+		)
 			.then((res) => {
+				pendingPreviews.set(preview, {key: cacheKey, ttl: res.ttl});
 				parse(msg, chan, preview, res, client);
 			})
 			.catch((err) => {
+				pendingPreviews.set(preview, {key: cacheKey, ttl: errorPreviewTtl});
 				preview.type = "error";
 				preview.error = "message";
 				preview.message = err.message;
@@ -74,13 +111,21 @@ export default function (client: Client, chan: Chan, msg: Msg, cleanText: string
 	}, []);
 }
 
-function parseHtml(preview, res, client: Client) {
+function ownerOf(client: Client, chan: Chan, msg: Msg): FetchOwner {
+	const open = Object.values(client.attachedClients || {}).some(
+		(attached) => attached.openChannel === chan.id
+	);
+
+	return {msg, open};
+}
+
+function parseHtml(preview, res, client: Client, owner: FetchOwner) {
 	// TODO:
 	// eslint-disable-next-line @typescript-eslint/no-misused-promises
 	return new Promise((resolve: (preview: FetchRequest | null) => void) => {
 		const $ = cheerio.load(res.data);
 
-		return parseHtmlMedia($, preview, client)
+		return parseHtmlMedia($, preview, client, owner)
 			.then((newRes) => resolve(newRes))
 			.catch(() => {
 				preview.type = "link";
@@ -119,7 +164,7 @@ function parseHtml(preview, res, client: Client) {
 
 				// Verify that thumbnail pic exists and is under allowed size
 				if (thumb.length) {
-					fetch(thumb, {language: client.config.browser?.language || ""})
+					fetch(thumb, {language: client.config.browser?.language || ""}, owner)
 						.then((resThumb) => {
 							if (
 								resThumb !== null &&
@@ -140,7 +185,12 @@ function parseHtml(preview, res, client: Client) {
 }
 
 // TODO: type $
-function parseHtmlMedia($: any, preview, client: Client): Promise<FetchRequest> {
+function parseHtmlMedia(
+	$: any,
+	preview,
+	client: Client,
+	owner: FetchOwner
+): Promise<FetchRequest> {
 	return new Promise((resolve, reject) => {
 		if (Config.values.disableMediaPreview) {
 			reject();
@@ -192,13 +242,17 @@ function parseHtmlMedia($: any, preview, client: Client): Promise<FetchRequest>
 
 					foundMedia = true;
 
-					fetch(mediaUrl, {
-						accept:
-							type === "video"
-								? "video/webm,video/ogg,video/*;q=0.9,application/ogg;q=0.7,audio/*;q=0.6,*/*;q=0.5"
-								: "audio/webm, audio/ogg, audio/wav, audio/*;q=0.9, application/ogg;q=0.7, video/*;q=0.6; */*;q=0.5",
-						language: client.config.browser?.language || "",
-					})
+					fetch(
+						mediaUrl,
+						{
+							accept:
+								type === "video"
+									? "video/webm,video/ogg,video/*;q=0.9,application/ogg;q=0.7,audio/*;q=0.6,*/*;q=0.5"
+									: "audio/webm, audio/ogg, audio/wav, audio/*;q=0.9, application/ogg;q=0.7, video/*;q=0.6; */*;q=0.5",
+							language: client.config.browser?.language || "",
+						},
+						owner
+					)
 						.then((resMedia) => {
 							if (resMedia === null || !mediaTypeRegex.test(resMedia.type)) {
 								return reject();
@@ -231,7 +285,7 @@ function parse(msg: Msg, chan: Chan, preview: LinkPreview, res: FetchRequest, cl
 	switch (res.type) {
 		case "text/html":
 			preview.size = -1;
-			promise = parseHtml(preview, res, client);
+			promise = parseHtml(preview, res, client, ownerOf(client, chan, msg));
 			break;
 
 		case "text/plain":
@@ -326,11 +380,8 @@ function handlePreview(client: Client, chan: Chan, msg: Msg, preview: LinkPrevie
 		return emitPreview(client, chan, msg, preview);
 	}
 
-	// Get the correct file extension for the provided content-type
-	// This is done to prevent user-input being stored in the file name (extension)
-	const extension = mime.extension(res.type);
-
-	if (!extension) {
+	// The image could not be stored, or its content-type has no known file extension
+	if (!res?.file) {
 		// For link previews, drop the thumbnail
 		// For other types, do not display preview at all
 		if (preview.type !== "link") {
@@ -340,14 +391,23 @@ function handlePreview(client: Client, chan: Chan, msg: Msg, preview: LinkPrevie
 		return emitPreview(client, chan, msg, preview);
 	}
 
-	storage.store(res.data, extension, (uri) => {
-		preview.thumb = uri;
+	// Left unreferenced, storage deletes it again
+	if (prefetchQueue.isCancelled(msg)) {
+		return;
+	}
 
-		emitPreview(client, chan, msg, preview);
-	});
+	storage.claim(res.file);
+	preview.thumb = res.file;
+
+	emitPreview(client, chan, msg, preview);
 }
 
 function emitPreview(client: Client, chan: Chan, msg: Msg, preview: LinkPreview) {
+	// Fell out of history while loading
+	if (prefetchQueue.isCancelled(msg)) {
+		return;
+	}
+
 	// If there is no title but there is preview or description, set title
 	// otherwise bail out and show no preview
 	if (!preview.head.length && preview.type === "link") {
@@ -358,6 +418,9 @@ function emitPreview(client: Client, chan: Chan, msg: Msg, preview: LinkPreview)
 		}
 	}
 
+	const {link: _link, shown: _shown, ...cached} = preview;
+	cachePreview(preview, cached);
+
 	client.emit("msg:preview", {
 		id: msg.id,
 		chan: chan.id,
@@ -366,6 +429,12 @@ function emitPreview(client: Client, chan: Chan, msg: Msg, preview: LinkPreview)
 }
 
 function removePreview(msg: Msg, preview: LinkPreview) {
+	if (prefetchQueue.isCancelled(msg)) {
+		return;
+	}
+
+	cachePreview(preview, null);
+
 	// If a preview fails to load, remove the link from msg object
 	// So that client doesn't attempt to display an preview on page reload
 	const index = msg.previews.indexOf(preview);
@@ -375,6 +444,28 @@ function removePreview(msg: Msg, preview: LinkPreview) {
 	}
 }
 
+function cachePreview(preview: LinkPreview, cached: CachedPreview) {
+	const pending = pendingPreviews.get(preview);
+
+	if (pending) {
+		pendingPreviews.delete(preview);
+		linkPreviewCache.set(pending.key, cached, pending.ttl);
+	}
+}
+
+/**
+ * Whether the thumbnail of a cached preview can still be shown, taking a reference to it
+ *
+ * Stored thumbnails are deleted once no message refers to them, and on restart.
+ */
+function reuseThumb(cached: NonNullable<CachedPreview>) {
+	if (!cached.thumb.startsWith("storage/")) {
+		return true;
+	}
+
+	return Config.values.prefetchStorage && storage.reference(cached.thumb);
+}
+
 function getRequestHeaders(headers: Record<string, string>) {
 	const formattedHeaders = {
 		// Certain websites like Amazon only add <meta> tags to known bots,
@@ -393,13 +484,14 @@ function getRequestHeaders(headers: Record<string, string>) {
 	return formattedHeaders;
 }
 
-function fetch(uri: string, headers: Record<string, string>) {
+function fetch(uri: string, headers: Record<string, string>, owner: FetchOwner) {
 	// Stringify the object otherwise the objects won't compute to the same value
 	const cacheKey = JSON.stringify([uri, headers]);
-	let promise = currentFetchPromises.get(cacheKey);
+	const pending = currentFetchPromises.get(cacheKey);
 
-	if (promise) {
-		return promise;
+	if (pending) {
+		pending.join(owner.msg, owner.open);
+		return pending.promise;
 	}
 
 	const prefetchTimeout = Config.values.prefetchTimeout;
@@ -410,82 +502,118 @@ function fetch(uri: string, headers: Record<string, string>) {
 		);
 	}
 
-	promise = new Promise<FetchRequest>((resolve, reject) => {
-		let buffer = Buffer.from("");
-		let contentLength = 0;
-		let contentType: string | undefined;
-		let limit = Config.values.prefetchMaxImageSize * 1024;
-
-		try {
-			const gotStream = got.stream(uri, {
-				retry: 0,
-				timeout: prefetchTimeout || 5000, // milliseconds
-				headers: getRequestHeaders(headers),
-				localAddress: Config.values.bind,
-			});
+	const task = (onAbort: (abort: () => void) => void) =>
+		new Promise<FetchRequest>((resolve, reject) => {
+			let buffer = Buffer.from("");
+			let contentLength = 0;
+			let contentType: string | undefined;
+			let ttl = 0;
+			let upload: StorageUpload | null = null;
+			let ended = false;
+			let limit = Config.values.prefetchMaxImageSize * 1024;
+
+			try {
+				const gotStream = got.stream(uri, {
+					retry: 0,
+					timeout: prefetchTimeout || 5000, // milliseconds
+					headers: getRequestHeaders(headers),
+					localAddress: Config.values.bind,
+				});
 
-			gotStream
-				.on("response", function (res) {
-					contentLength = parseInt(res.headers["content-length"], 10) || 0;
-					contentType = res.headers["content-type"];
+				onAbort(() => gotStream.destroy(new PrefetchCancelledError()));
+
+				gotStream
+					.on("response", function (res) {
+						contentLength = parseInt(res.headers["content-length"], 10) || 0;
+						contentType = res.headers["content-type"];
+						ttl = responseTtl(res.headers);
+
+						if (contentType && imageTypeRegex.test(contentType)) {
+							// response is an image
+							// if Content-Length header reports a size exceeding the prefetch limit, abort fetch
+							// and if file is not to be stored we don't need to download further either
+							if (contentLength > limit || !Config.values.prefetchStorage) {
+								gotStream.destroy();
+							} else {
+								// Written to storage while it downloads, instead of kept in memory
+								upload = storage.upload();
+							}
+						} else if (contentType && mediaTypeRegex.test(contentType)) {
+							// We don't need to download the file any further after we received content-type header
+							gotStream.destroy();
+						} else {
+							// if not image, limit download to the max search size, since we need only meta tags
+							// twitter.com sends opengraph meta tags within ~20kb of data for individual tweets, the default is set to 50.
+							// for sites like Youtube the og tags are in the first 300K and hence this is configurable by the admin
+							limit =
+								"prefetchMaxSearchSize" in Config.values
+									? Config.values.prefetchMaxSearchSize * 1024
+									: // set to the previous size if config option is unset
+									  50 * 1024;
+						}
+					})
+					.on("error", (e) => reject(e))
+					.on("data", (data: Buffer) => {
+						if (upload) {
+							// Don't read faster than the file is written
+							if (!upload.write(data)) {
+								gotStream.pause();
+								upload.drain(() => gotStream.resume());
+							}
+						} else {
+							buffer = Buffer.concat([buffer, data], buffer.length + data.length);
+						}
 
-					if (contentType && imageTypeRegex.test(contentType)) {
-						// response is an image
-						// if Content-Length header reports a size exceeding the prefetch limit, abort fetch
-						// and if file is not to be stored we don't need to download further either
-						if (contentLength > limit || !Config.values.prefetchStorage) {
+						if ((upload ? upload.size : buffer.length) >= limit) {
 							gotStream.destroy();
 						}
-					} else if (contentType && mediaTypeRegex.test(contentType)) {
-						// We don't need to download the file any further after we received content-type header
-						gotStream.destroy();
-					} else {
-						// if not image, limit download to the max search size, since we need only meta tags
-						// twitter.com sends opengraph meta tags within ~20kb of data for individual tweets, the default is set to 50.
-						// for sites like Youtube the og tags are in the first 300K and hence this is configurable by the admin
-						limit =
-							"prefetchMaxSearchSize" in Config.values
-								? Config.values.prefetchMaxSearchSize * 1024
-								: // set to the previous size if config option is unset
-								  50 * 1024;
-					}
-				})
-				.on("error", (e) => reject(e))
-				.on("data", (data) => {
-					buffer = Buffer.concat(
-						[buffer, data],
-						buffer.length + (data as Array<any>).length
-					);
-
-					if (buffer.length >= limit) {
+					})
+					.on("end", () => {
+						ended = true;
 						gotStream.destroy();
-					}
-				})
-				.on("end", () => gotStream.destroy())
-				.on("close", () => {
-					let type = "";
+					})
+					.on("close", () => {
+						let type = "";
+						const received = upload ? upload.size : buffer.length;
 
-					// If we downloaded more data then specified in Content-Length, use real data size
-					const size = contentLength > buffer.length ? contentLength : buffer.length;
+						// If we downloaded more data then specified in Content-Length, use real data size
+						const size = contentLength > received ? contentLength : received;
 
-					if (contentType) {
-						type = contentType.split(/ *; */).shift() || "";
-					}
+						if (contentType) {
+							type = contentType.split(/ *; */).shift() || "";
+						}
 
-					resolve({data: buffer, type, size});
-				});
-		} catch (e: any) {
-			return reject(e);
-		}
-	});
+						const result: FetchRequest = {data: buffer, type, size, ttl};
+
+						if (!upload) {
+							return resolve(result);
+						}
+
+						// Get the correct file extension for the provided content-type
+						// This is done to prevent user-input being stored in the file name (extension)
+						const extension = mime.extension(type);
+
+						// Only complete downloads are stored
+						if (!ended || !extension) {
+							upload.discard();
+							return resolve(result);
+						}
+
+						void upload.commit(extension).then((file) => resolve({...result, file}));
+					});
+			} catch (e: any) {
+				return reject(e);
+			}
+		});
 
+	const job = prefetchQueue.run(new URL(uri).host, owner.msg, owner.open, task);
 	const removeCache = () => currentFetchPromises.delete(cacheKey);
 
-	promise.then(removeCache).catch(removeCache);
+	job.promise.then(removeCache).catch(removeCache);
 
-	currentFetchPromises.set(cacheKey, promise);
+	currentFetchPromises.set(cacheKey, job);
 
-	return promise;
+	return job.promise;
 }
 
 function normalizeURL(link: string, baseLink?: string, disallowHttp = false) {
@@ -0,0 +1,230 @@
+import fs from "fs";
+import path from "path";
+
+import log from "../log";
+import Config from "../config";
+import shard from "../shard";
+import metrics, {single} from "../metrics";
+import {LinkPreview} from "../../shared/types/msg";
+
+// Preview of a link without the per message fields, null when the link has no preview
+export type CachedPreview = Omit<LinkPreview, "link" | "shown"> | null;
+
+type Entry = {
+	preview: CachedPreview;
+	expires: number; // ms since epoch
+};
+
+// Lifetime (ms) of results without caching headers, and the bounds of those with them
+export const defaultPreviewTtl = 60 * 60 * 1000;
+export const errorPreviewTtl = 5 * 60 * 1000;
+const minPreviewTtl = 60 * 1000;
+const maxPreviewTtl = 24 * 60 * 60 * 1000;
+
+const saveDelay = 60 * 1000;
+
+const lookups = metrics.counter(
+	"thelounge_link_preview_cache_lookups_total",
+	"Link preview cache lookups by result, hit or miss"
+);
+const hits = lookups.with({result: "hit"});
+const misses = lookups.with({result: "miss"});
+
+/**
+ * Cache key of a normalized url, previews are fetched in the language of the browser
+ */
+export function previewCacheKey(url: string, language: string) {
+	return `${language}\0${url}`;
+}
+
+/**
+ * Link previews of every user, keyed by normalized url and requested language
+ *
+ * Failed fetches and links without a preview are cached as well, for a shorter time.
+ * Entries are evicted least recently used first once there are `prefetchCacheSize` of them,
+ * and written to link-previews.json in the home directory a while after changing.
+ */
+class LinkPreviewCache {
+	private entries: Map<string, Entry> = new Map();
+	private loaded = false;
+	private saveTimer: NodeJS.Timeout | null = null;
+
+	constructor() {
+		metrics.collect(() => [
+			single("thelounge_link_preview_cache_entries", "Cached previews", "gauge", this.size),
+		]);
+	}
+
+	get filePath() {
+		// Thumbnails are only reused from the storage of this process
+		return path.join(Config.getHomePath(), shard.own("link-previews.json"));
+	}
+
+	get size() {
+		return this.entries.size;
+	}
+
+	/**
+	 * Cached preview of a link, undefined if there is none or it expired
+	 */
+	get(key: string): CachedPreview | undefined {
+		this.load();
+
+		const entry = this.entries.get(key);
+
+		if (!entry) {
+			misses.inc();
+			return undefined;
+		}
+
+		if (entry.expires <= Date.now()) {
+			this.entries.delete(key);
+			misses.inc();
+			return undefined;
+		}
+
+		hits.inc();
+
+		// Most recently used links are evicted last
+		this.entries.delete(key);
+		this.entries.set(key, entry);
+
+		return entry.preview;
+	}
+
+	set(key: string, preview: CachedPreview, ttl: number) {
+		const maxEntries = Config.values.prefetchCacheSize ?? 0;
+
+		if (ttl <= 0 || maxEntries <= 0) {
+			return;
+		}
+
+		this.load();
+		this.entries.delete(key);
+		this.entries.set(key, {preview: preview && {...preview}, expires: Date.now() + ttl});
+
+		for (const oldest of this.entries.keys()) {
+			if (this.entries.size <= maxEntries) {
+				break;
+			}
+
+			this.entries.delete(oldest);
+		}
+
+		this.scheduleSave();
+	}
+
+	delete(key: string) {
+		this.entries.delete(key);
+	}
+
+	clear() {
+		this.entries.clear();
+	}
+
+	/**
+	 * Write the cache now, pending changes are lost otherwise when exiting
+	 */
+	saveSync() {
+		if (!this.saveTimer) {
+			return;
+		}
+
+		clearTimeout(this.saveTimer);
+		this.saveTimer = null;
+
+		try {
+			fs.writeFileSync(this.filePath, this.serialize());
+		} catch (e: any) {
+			log.error(`Failed to write link preview cache: ${e.message}`);
+		}
+	}
+
+	private scheduleSave() {
+		if (this.saveTimer || !Config.getHomePath()) {
+			return;
+		}
+
+		this.saveTimer = setTimeout(() => {
+			this.saveTimer = null;
+
+			fs.writeFile(this.filePath, this.serialize(), (err) => {
+				if (err) {
+					log.error(`Failed to write link preview cache: ${err.message}`);
+				}
+			});
+		}, saveDelay);
+		this.saveTimer.unref();
+	}
+
+	private serialize() {
+		const now = Date.now();
+		const live = Array.from(this.entries).filter(([, entry]) => entry.expires > now);
+
+		return JSON.stringify(live);
+	}
+
+	private load() {
+		if (this.loaded || !Config.getHomePath()) {
+			return;
+		}
+
+		this.loaded = true;
+
+		let data: string;
+
+		try {
+			data = fs.readFileSync(this.filePath, "utf-8");
+		} catch (e: any) {
+			return;
+		}
+
+		try {
+			const now = Date.now();
+
+			for (const [key, entry] of JSON.parse(data) as [string, Entry][]) {
+				if (entry.expires > now && !this.entries.has(key)) {
+					this.entries.set(key, entry);
+				}
+			}
+		} catch (e: any) {
+			log.warn(`Ignoring unreadable link preview cache: ${e.message}`);
+		}
+	}
+}
+
+/**
+ * How long a response may be cached according to its Cache-Control and Expires headers
+ */
+export function responseTtl(headers: Record<string, string | string[] | undefined>): number {
+	const cacheControl = String(headers["cache-control"] || "").toLowerCase();
+
+	if (/(^|,)\s*(no-store|no-cache|private)\s*(,|$)/.test(cacheControl)) {
+		return 0;
+	}
+
+	const maxAge = /(?:^|,)\s*(?:s-maxage|max-age)\s*=\s*"?(\d+)/.exec(cacheControl);
+	let ttl: number | undefined;
+
+	if (maxAge) {
+		ttl = parseInt(maxAge[1], 10) * 1000;
+	} else if (headers.expires) {
+		const date = Date.parse(String(headers.date || "")) || Date.now();
+		const expires = Date.parse(String(headers.expires));
+
+		// Invalid dates, like "0", mean already expired
+		ttl = Number.isNaN(expires) ? 0 : expires - date;
+	}
+
+	if (ttl === undefined) {
+		return defaultPreviewTtl;
+	}
+
+	if (ttl <= 0) {
+		return 0;
+	}
+
+	return Math.min(maxPreviewTtl, Math.max(minPreviewTtl, ttl));
+}
+
+export default new LinkPreviewCache();
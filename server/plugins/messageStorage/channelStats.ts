@@ -0,0 +1,59 @@
+/**
+ * Per channel message counters, shared by the sqlite backends
+ *
+ * Every write and delete updates `channel_stats` in the same transaction as `messages`,
+ * so message counts are a primary key lookup instead of a COUNT(*) over the channel.
+ */
+
+export const channelStatsTable =
+	"CREATE TABLE channel_stats (network TEXT NOT NULL, channel TEXT NOT NULL, count INTEGER NOT NULL, min_time INTEGER, max_time INTEGER, last_id INTEGER, PRIMARY KEY (network, channel))";
+
+// Fills the table from the messages already stored, when it gets added by a migration
+export const channelStatsBackfill =
+	"INSERT INTO channel_stats (network, channel, count, min_time, max_time, last_id) SELECT network, channel, COUNT(*), MIN(time), MAX(time), MAX(id) FROM messages GROUP BY network, channel";
+
+// Adds the messages of one channel from a written batch, see `channelStatsRows`
+export const channelStatsUpsert =
+	"INSERT INTO channel_stats (network, channel, count, min_time, max_time, last_id) VALUES (?, ?, ?, ?, ?, ?) ON CONFLICT (network, channel) DO UPDATE SET count = count + excluded.count, min_time = MIN(IFNULL(min_time, excluded.min_time), excluded.min_time), max_time = MAX(IFNULL(max_time, excluded.max_time), excluded.max_time), last_id = MAX(IFNULL(last_id, 0), excluded.last_id)";
+
+// Rows about to be deleted are collected in here first, so the counters can be adjusted
+export const deletedMessagesTable = [
+	"CREATE TEMP TABLE IF NOT EXISTS deleted_messages (id INTEGER PRIMARY KEY, network TEXT, channel TEXT, time INTEGER)",
+	"DELETE FROM temp.deleted_messages",
+];
+
+// Run after the rows listed in `deleted_messages` are gone from `messages`
+export const channelStatsAfterDelete = [
+	"UPDATE channel_stats SET count = channel_stats.count - deleted.count FROM (SELECT network, channel, COUNT(*) AS count FROM temp.deleted_messages GROUP BY network, channel) AS deleted WHERE channel_stats.network = deleted.network AND channel_stats.channel = deleted.channel",
+	"UPDATE channel_stats SET min_time = (SELECT MIN(time) FROM messages WHERE messages.network = channel_stats.network AND messages.channel = channel_stats.channel), max_time = (SELECT MAX(time) FROM messages WHERE messages.network = channel_stats.network AND messages.channel = channel_stats.channel), last_id = (SELECT MAX(id) FROM messages WHERE messages.network = channel_stats.network AND messages.channel = channel_stats.channel) WHERE (network, channel) IN (SELECT network, channel FROM temp.deleted_messages)",
+	"DELETE FROM channel_stats WHERE count <= 0",
+];
+
+/**
+ * Parameters of `channelStatsUpsert` for a batch of written rows, one entry per channel
+ *
+ * @param ids - row id of each of the written rows
+ */
+export function channelStatsRows(
+	rows: {network: string; channel: string; time: number}[],
+	ids: number[]
+): [string, string, number, number, number, number][] {
+	const stats = new Map<string, [string, string, number, number, number, number]>();
+
+	rows.forEach((row, i) => {
+		const key = `${row.network}\0${row.channel}`;
+		const entry = stats.get(key);
+
+		if (!entry) {
+			stats.set(key, [row.network, row.channel, 1, row.time, row.time, ids[i]]);
+			return;
+		}
+
+		entry[2]++;
+		entry[3] = Math.min(entry[3], row.time);
+		entry[4] = Math.max(entry[4], row.time);
+		entry[5] = Math.max(entry[5], ids[i]);
+	});
+
+	return Array.from(stats.values());
+}
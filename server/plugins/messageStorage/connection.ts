@@ -0,0 +1,142 @@
+import type {Database} from "sqlite3";
+import log from "../../log";
+import Config from "../../config";
+
+/**
+ * How the sqlite backends open their database, see `storageProfile` in the config
+ *
+ * Writes go through one connection. In WAL mode history and search use a second, read only
+ * connection, which sees the last committed state without queuing behind the writer.
+ */
+
+const journalModes = ["wal", "delete", "truncate", "persist"];
+const synchronousModes = ["normal", "full", "off"];
+
+// Waits out the short locks a WAL checkpoint takes, instead of failing the read
+const readerBusyTimeout = 5000;
+
+function run(db: Database, stmt: string): Promise<void> {
+	return new Promise((resolve, reject) => {
+		db.run(stmt, (err: Error | null) => (err ? reject(err) : resolve()));
+	});
+}
+
+function get(db: Database, stmt: string): Promise<any> {
+	return new Promise((resolve, reject) => {
+		db.get(stmt, (err: Error | null, row: any) => (err ? reject(err) : resolve(row)));
+	});
+}
+
+export function fetchAll(db: Database, stmt: string, params: any[]): Promise<any[]> {
+	return new Promise((resolve, reject) => {
+		db.all(stmt, params, (err: Error | null, rows: any[]) =>
+			err ? reject(err) : resolve(rows)
+		);
+	});
+}
+
+export function fetchOne(db: Database, stmt: string, params: any[]): Promise<any> {
+	return new Promise((resolve, reject) => {
+		db.get(stmt, params, (err: Error | null, row: any) => (err ? reject(err) : resolve(row)));
+	});
+}
+
+function megabytes(value: number) {
+	return Number.isFinite(value) && value > 0 ? value : 0;
+}
+
+// Memory settings apply to each connection on its own
+function memoryPragmas(): string[] {
+	const {mmapSizeMB, cacheSizeMB} = Config.values.storageProfile;
+	const stmts = [`PRAGMA mmap_size = ${Math.floor(megabytes(mmapSizeMB) * 1024 * 1024)}`];
+
+	if (megabytes(cacheSizeMB) > 0) {
+		// negative sizes are in KiB instead of pages
+		stmts.push(`PRAGMA cache_size = -${Math.floor(megabytes(cacheSizeMB) * 1024)}`);
+	}
+
+	return stmts;
+}
+
+/**
+ * Apply the profile to the writing connection, outside of a transaction
+ *
+ * Has to come after pragmas that only take effect on an empty file, such as auto_vacuum,
+ * as switching to WAL writes the file header.
+ *
+ * @returns the journal mode in use, `memory` for in-memory databases
+ */
+export async function applyProfile(db: Database): Promise<string> {
+	const {journalMode, synchronous} = Config.values.storageProfile;
+
+	if (synchronousModes.includes(synchronous)) {
+		await run(db, `PRAGMA synchronous = ${synchronous.toUpperCase()}`);
+	} else {
+		log.warn(`Ignoring unknown storageProfile.synchronous value: ${String(synchronous)}`);
+	}
+
+	for (const stmt of memoryPragmas()) {
+		await run(db, stmt);
+	}
+
+	if (!journalModes.includes(journalMode)) {
+		log.warn(`Ignoring unknown storageProfile.journalMode value: ${String(journalMode)}`);
+		return (await get(db, "PRAGMA journal_mode")).journal_mode;
+	}
+
+	const row = await get(db, `PRAGMA journal_mode = ${journalMode.toUpperCase()}`);
+	return row.journal_mode;
+}
+
+/**
+ * Open the read only connection, null if reads stay on the writing one
+ *
+ * Outside of WAL mode readers and the writer lock each other out, so only a WAL database
+ * gets one. It's opened after migrations, once the schema exists.
+ *
+ * @param journalMode - as returned by applyProfile
+ */
+export async function openReader(
+	sqlite3: any,
+	file: string,
+	journalMode: string
+): Promise<Database | null> {
+	if (!Config.values.storageProfile.readConnection || journalMode !== "wal") {
+		return null;
+	}
+
+	try {
+		const reader: Database = await new Promise((resolve, reject) => {
+			const db = new sqlite3.Database(file, sqlite3.OPEN_READONLY, (err: Error | null) =>
+				err ? reject(err) : resolve(db)
+			);
+		});
+
+		reader.configure("busyTimeout", readerBusyTimeout);
+
+		for (const stmt of memoryPragmas()) {
+			await run(reader, stmt);
+		}
+
+		return reader;
+	} catch (e: any) {
+		log.warn(`Unable to open read connection to ${file}, reading through the writer: ${e}`);
+		return null;
+	}
+}
+
+export function closeReader(reader: Database | null): Promise<void> {
+	if (!reader) {
+		return Promise.resolve();
+	}
+
+	return new Promise((resolve) => {
+		reader.close((err) => {
+			if (err) {
+				log.error(`Failed to close sqlite read connection: ${err.message}`);
+			}
+
+			resolve();
+		});
+	});
+}
@@ -2,14 +2,20 @@
  * Encrypted Message Storage
  *
  * SQLite-based message storage with AES-256-GCM encryption.
- * Each user has their own database with messages encrypted using their encryption key.
+ * Each user has their own database with messages encrypted using a random data key.
+ * The data key is stored in the options table, encrypted (wrapped) with the key derived
+ * from the user's password, so a password change only has to wrap it again.
  *
  * Database schema:
  * - messages table: stores encrypted message data
  * - Each message is encrypted as: [IV 12B][Ciphertext][Auth Tag 16B]
+ * - The plaintext is its JSON, deflated with a preset dictionary when that makes it smaller
+ * - search_index table: keyed (HMAC) trigram postings of message text, so search
+ *   only has to decrypt candidate rows instead of the whole history
+ * - mentions table: ids of the stored messages that highlighted the user
  */
 
-import type {Database} from "sqlite3";
+import type {Database, Statement} from "sqlite3";
 import log from "../../log";
 import path from "path";
 import fs from "fs/promises";
@@ -17,46 +23,42 @@ import Config from "../../config";
 import Msg, {Message} from "../../models/msg";
 import Chan, {Channel} from "../../models/chan";
 import Helper from "../../helper";
-import type {SearchableMessageStorage, DeletionRequest} from "./types";
+import type {
+	SearchableMessageStorage,
+	DeletionRequest,
+	ChannelRef,
+	ChannelHistory,
+	NewMessagesRef,
+} from "./types";
 import Network from "../../models/network";
-import {SearchQuery, SearchResponse} from "../../../shared/types/storage";
+import {SearchQuery, SearchResponse, SearchCursor} from "../../../shared/types/storage";
 import {MessageType} from "../../../shared/types/msg";
 import crypto from "crypto";
-
-// LRU Cache for decrypted messages (performance optimization)
-class LRUCache<K, V> {
-	private cache: Map<K, V>;
-	private maxSize: number;
-
-	constructor(maxSize: number = 1000) {
-		this.cache = new Map();
-		this.maxSize = maxSize;
-	}
-
-	get(key: K): V | undefined {
-		const value = this.cache.get(key);
-		if (value !== undefined) {
-			// Move to end (most recently used)
-			this.cache.delete(key);
-			this.cache.set(key, value);
-		}
-		return value;
-	}
-
-	set(key: K, value: V): void {
-		// Remove oldest if at capacity
-		if (this.cache.size >= this.maxSize) {
-			const firstKey = this.cache.keys().next().value;
-			this.cache.delete(firstKey);
-		}
-
-		this.cache.set(key, value);
-	}
-
-	clear(): void {
-		this.cache.clear();
-	}
-}
+import {performance} from "perf_hooks";
+import metrics, {CounterSeries, HistogramSeries} from "../../metrics";
+import WriteBatcher from "./writeBatcher";
+import HistoryCache from "./historyCache";
+import {
+	lastMessagesBatchSize,
+	lastMessagesQuery,
+	lastMessagesBatchQuery,
+	newMessagesBatchQuery,
+	messageCountsQuery,
+	groupLastMessagesBatch,
+} from "./historyBatch";
+import {
+	channelStatsTable,
+	channelStatsBackfill,
+	channelStatsUpsert,
+	channelStatsRows,
+	deletedMessagesTable,
+	channelStatsAfterDelete,
+} from "./channelStats";
+import {applyProfile, openReader, closeReader, fetchAll, fetchOne} from "./connection";
+import cryptoPool from "../crypto/pool";
+import {SealedMessage, searchTokens, encrypt, decrypt} from "../crypto/tasks";
+
+export {searchTrigrams} from "../crypto/tasks";
 
 let sqlite3: any;
 
@@ -68,16 +70,39 @@ try {
 	);
 }
 
-export const currentSchemaVersion = 1760689200000; // 2025-10-17 (added unread_markers table)
+type Migration = {version: number; stmts: string[]};
+
+const writeTime = metrics.histogram(
+	"thelounge_storage_write_seconds",
+	"Time to encrypt and commit a batch of indexed messages"
+);
+const messagesWritten = metrics.counter(
+	"thelounge_storage_messages_written_total",
+	"Messages written to storage"
+);
+const readTime = metrics.histogram(
+	"thelounge_storage_read_seconds",
+	"Time of history, search and count queries"
+);
+
+export const currentSchemaVersion = 1762560000000; // 2025-11-08 (mentions table)
+
+// Oldest schema that can be upgraded in place, anything older is dropped and recreated
+const oldestMigratableVersion = 1760689200000; // 2025-10-17 (added unread_markers table)
+
+// Highlights of the user, until dismissed, go away together with the message
+const mentionsTable =
+	"CREATE TABLE mentions (message_id INTEGER PRIMARY KEY REFERENCES messages (id) ON DELETE CASCADE)";
 
 // Schema for encrypted message storage
 const schema = [
 	"CREATE TABLE options (name TEXT, value TEXT, CONSTRAINT name_unique UNIQUE (name))",
 	// Encrypted messages table
 	// - network, channel, time, type are plaintext for indexing/sorting/filtering
-	// - encrypted_data contains: [IV 12B][Encrypted JSON][Tag 16B]
+	// - encrypted_data contains: [IV 12B][Encrypted record][Tag 16B], see encodeRecord
 	"CREATE TABLE messages (id INTEGER PRIMARY KEY AUTOINCREMENT, network TEXT, channel TEXT, time INTEGER, type TEXT, encrypted_data BLOB)",
-	"CREATE INDEX network_channel ON messages (network, channel)",
+	// History pages and search cursors walk (network, channel, time), the id comes with it
+	"CREATE INDEX network_channel_time ON messages (network, channel, time)",
 	"CREATE INDEX time ON messages (time)",
 	"CREATE INDEX type ON messages (type)",
 	// Unread markers table - stores last read timestamp per network+channel/query
@@ -85,8 +110,57 @@ const schema = [
 	// - channel: channel name (e.g. "#linux") or query nick (e.g. "JohnDoe")
 	// - last_read_time: Unix timestamp (milliseconds) when channel was last marked as read
 	"CREATE TABLE unread_markers (network TEXT NOT NULL, channel TEXT NOT NULL, last_read_time INTEGER NOT NULL, PRIMARY KEY (network, channel))",
+	// Blind search index - one row per distinct trigram of the lowercased message text
+	// - token: truncated HMAC-SHA256 of the trigram, keyed with a key derived from the
+	//   encryption key
+	// - message_id: messages.id, postings go away together with the message
+	"CREATE TABLE search_index (token BLOB NOT NULL, message_id INTEGER NOT NULL REFERENCES messages (id) ON DELETE CASCADE, PRIMARY KEY (token, message_id)) WITHOUT ROWID",
+	"CREATE INDEX search_index_message ON search_index (message_id)",
+	// Message count, time range and newest id per network+channel, kept in sync by every
+	// write and delete
+	channelStatsTable,
+	mentionsTable,
+];
+
+// Migrations for databases at or above oldestMigratableVersion
+// add new migrations to the end, with the version being the new 'currentSchemaVersion'
+export const migrations: Migration[] = [
+	{
+		version: 1761004800000,
+		stmts: [
+			"CREATE TABLE search_index (token BLOB NOT NULL, message_id INTEGER NOT NULL REFERENCES messages (id) ON DELETE CASCADE, PRIMARY KEY (token, message_id)) WITHOUT ROWID",
+			"CREATE INDEX search_index_message ON search_index (message_id)",
+			// rows up to this id predate the index and get backfilled in the background
+			"INSERT OR REPLACE INTO options (name, value) SELECT 'search_index_backfill_id', COALESCE(MAX(id), 0) FROM messages",
+		],
+	},
+	{
+		version: 1761523200000,
+		stmts: [channelStatsTable, channelStatsBackfill],
+	},
+	{
+		version: 1761609600000,
+		stmts: [
+			"CREATE INDEX network_channel_time ON messages (network, channel, time)",
+			"DROP INDEX network_channel", // a prefix of the new one
+		],
+	},
+	{
+		// auto_vacuum is set by run_pragmas, a one time VACUUM after migrating applies it
+		version: 1761955200000,
+		stmts: [],
+	},
+	{
+		version: 1762560000000,
+		stmts: [mentionsTable],
+	},
 ];
 
+// Free pages handed back to the file system per reclaimSpace call
+const reclaimPagesPerStep = 256;
+// Value of PRAGMA auto_vacuum once it is INCREMENTAL
+const autoVacuumIncremental = 2;
+
 class Deferred {
 	resolve!: () => void;
 	promise: Promise<void>;
@@ -98,66 +172,220 @@ class Deferred {
 	}
 }
 
+// A message waiting in the write queue, encrypted only when the batch is written
+// so that a key change in between can't leave rows encrypted with the old key
+type PendingRow = {
+	network: string;
+	channel: string;
+	time: number;
+	type: string;
+	plaintext: string;
+	text: string;
+	mention: boolean;
+};
+
+export type StoredMention = {
+	id: number; // messages.id, stays the same across restarts
+	network: string;
+	channel: string; // lowercased
+	msg: Message;
+};
+
 export class EncryptedMessageStorage implements SearchableMessageStorage {
 	isEnabled: boolean;
 	database!: Database;
+	reader: Database | null = null; // read only connection in WAL mode, see ./connection
 	initDone: Deferred;
 	userName: string;
-	private encryptionKey: Buffer;
-	private cache: LRUCache<string, Message[]>;
+	writes: WriteBatcher<PendingRow>;
+	private wrappingKey: Buffer; // derived from the password, only encrypts the data key
+	private encryptionKey: Buffer; // the data key
+	private searchKey: Buffer;
+	// Data key being rotated away from, rows up to rotationId are still encrypted with it
+	private previousKey: Buffer | null;
+	private rotationId: number;
+	private rotation: Promise<void> | null;
+	private legacyDataKey: boolean; // the data key is still the password derived key
+	private cache: HistoryCache;
+	private insertStmt: Statement | null;
+	private insertTokenStmt: Statement | null;
+	private statsStmt: Statement | null;
+	private mentionStmt: Statement | null;
+	private journalMode = "";
+	private meters: {
+		writeTime: HistogramSeries;
+		messagesWritten: CounterSeries;
+		readTime: HistogramSeries;
+	};
 
 	constructor(userName: string, encryptionKey: Buffer) {
 		this.userName = userName;
-		this.encryptionKey = encryptionKey;
+		// The caller wipes its copy on logout
+		this.wrappingKey = Buffer.from(encryptionKey);
+		this.encryptionKey = this.wrappingKey;
+		this.searchKey = deriveSearchKey(encryptionKey);
+		this.previousKey = null;
+		this.rotationId = 0;
+		this.rotation = null;
+		this.legacyDataKey = false;
 		this.isEnabled = false;
 		this.initDone = new Deferred();
-		this.cache = new LRUCache(1000); // Cache up to 1000 channel histories
+		this.cache = new HistoryCache(); // Recent decrypted messages of each channel
+		this.insertStmt = null;
+		this.insertTokenStmt = null;
+		this.statsStmt = null;
+		this.mentionStmt = null;
+		this.writes = new WriteBatcher((rows) => this.writeRows(rows));
+
+		const labels = metrics.userLabels(userName);
+		this.meters = {
+			writeTime: writeTime.with(labels),
+			messagesWritten: messagesWritten.with(labels),
+			readTime: readTime.with(labels),
+		};
+	}
+
+	private useDataKey(dataKey: Buffer) {
+		this.encryptionKey = dataKey;
+		this.searchKey = deriveSearchKey(dataKey);
+	}
+
+	private async getOption(name: string): Promise<string | undefined> {
+		const row = await this.serialize_get("SELECT value FROM options WHERE name = ?", name);
+		return row?.value;
+	}
+
+	private setOption(name: string, value: string): Promise<void> {
+		return this.serialize_run(
+			"INSERT OR REPLACE INTO options (name, value) VALUES (?, ?)",
+			name,
+			value
+		);
 	}
 
 	/**
-	 * Update encryption key (used when password changes)
+	 * Unwrap the data key, or create it for a database that has none
+	 *
+	 * Databases from before data keys existed are encrypted with the password derived key,
+	 * which then becomes their data key so they open right away. They are flagged, and
+	 * rotated to a random data key in the background, see rotateLegacyDataKey.
 	 */
-	updateEncryptionKey(newKey: Buffer): void {
-		this.encryptionKey = newKey;
-		this.cache.clear(); // Clear cache as old decrypted data is invalid
+	private async loadDataKey() {
+		const wrapped = await this.getOption("data_key");
+
+		if (wrapped === undefined) {
+			const hasMessages = await this.serialize_get("SELECT 1 FROM messages LIMIT 1");
+			const dataKey = hasMessages ? Buffer.from(this.wrappingKey) : crypto.randomBytes(32);
+
+			await this.setOption("data_key", wrapKey(this.wrappingKey, dataKey));
+
+			if (hasMessages) {
+				await this.setOption("legacy_data_key", "1");
+			}
+
+			this.legacyDataKey = Boolean(hasMessages);
+			this.useDataKey(dataKey);
+			return;
+		}
+
+		const dataKey = unwrapKey(this.wrappingKey, wrapped);
+		this.useDataKey(dataKey);
+
+		// Databases upgraded before the flag was kept have the password derived key as data key
+		this.legacyDataKey =
+			(await this.getOption("legacy_data_key")) === "1" || dataKey.equals(this.wrappingKey);
+
+		const previous = await this.getOption("previous_data_key");
+
+		if (previous !== undefined) {
+			this.previousKey = unwrapKey(this.wrappingKey, previous);
+			this.rotationId = parseInt((await this.getOption("key_rotation_id")) || "0", 10);
+		}
 	}
 
 	/**
-	 * Check if storage can provide messages
+	 * Store search index postings for a message
 	 */
-	canProvideMessages(): boolean {
-		return this.isEnabled;
+	private async insertSearchTokens(messageId: number, tokens: Buffer[]) {
+		// Keep well below SQLITE_MAX_VARIABLE_NUMBER
+		const chunkSize = 200;
+
+		for (let i = 0; i < tokens.length; i += chunkSize) {
+			const chunk = tokens.slice(i, i + chunkSize);
+			const params: any[] = [];
+
+			for (const token of chunk) {
+				params.push(token, messageId);
+			}
+
+			await this.serialize_run(
+				`INSERT OR IGNORE INTO search_index (token, message_id) VALUES ${chunk
+					.map(() => "(?, ?)")
+					.join(", ")}`,
+				...params
+			);
+		}
 	}
 
 	/**
-	 * Encrypt message data
+	 * Decrypt and parse rows on the crypto pool, null for rows that failed to decrypt
 	 */
-	private encrypt(plaintext: string): Buffer {
-		const iv = crypto.randomBytes(12);
-		const cipher = crypto.createCipheriv("aes-256-gcm", this.encryptionKey, iv);
+	private async openRows(rows: {encrypted_data: Buffer}[]): Promise<any[]> {
+		const data = rows.map((row) => row.encrypted_data);
+		const decrypted = await cryptoPool.open(this.encryptionKey, data);
+
+		// Rows the key rotation did not get to yet
+		if (this.previousKey) {
+			const pending = decrypted.flatMap((msg, i) => (msg ? [] : [i]));
+
+			if (pending.length > 0) {
+				const retried = await cryptoPool.open(
+					this.previousKey,
+					pending.map((i) => data[i])
+				);
+				pending.forEach((index, i) => (decrypted[index] = retried[i]));
+			}
+		}
 
-		const encrypted = Buffer.concat([cipher.update(plaintext, "utf8"), cipher.final()]);
+		const failed = decrypted.filter((msg) => !msg).length;
 
-		const tag = cipher.getAuthTag();
+		if (failed > 0) {
+			log.error(`Failed to decrypt ${failed} messages for user ${this.userName}`);
+		}
 
-		// Return: [IV 12B][Ciphertext][Tag 16B]
-		return Buffer.concat([iv, encrypted, tag]);
+		return decrypted;
 	}
 
 	/**
-	 * Decrypt message data
+	 * Turn (chronologically ordered) rows into messages, the caller assigns ids
 	 */
-	private decrypt(ciphertext: Buffer): string {
-		const iv = ciphertext.slice(0, 12);
-		const tag = ciphertext.slice(-16);
-		const encrypted = ciphertext.slice(12, -16);
+	private async rowsToMessages(rows: any[]): Promise<Message[]> {
+		const decrypted = await this.openRows(rows);
+
+		return rows.map((row, i): Message => {
+			const msg = decrypted[i];
+
+			if (!msg) {
+				// Return error message placeholder
+				return new Msg({
+					type: MessageType.UNHANDLED,
+					text: "[Decryption failed]",
+					time: new Date(row.time),
+				});
+			}
 
-		const decipher = crypto.createDecipheriv("aes-256-gcm", this.encryptionKey, iv);
-		decipher.setAuthTag(tag);
+			msg.time = new Date(row.time);
+			msg.type = row.type; // Restore type from column
 
-		const decrypted = Buffer.concat([decipher.update(encrypted), decipher.final()]);
+			return new Msg(msg);
+		});
+	}
 
-		return decrypted.toString("utf8");
+	/**
+	 * Check if storage can provide messages
+	 */
+	canProvideMessages(): boolean {
+		return this.isEnabled;
 	}
 
 	async _enable(connection_string: string) {
@@ -171,7 +399,28 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			throw Helper.catch_to_error("Migration failed", e);
 		}
 
+		try {
+			await this.loadDataKey();
+		} catch (e) {
+			throw Helper.catch_to_error("Unable to unlock message storage", e);
+		}
+
+		this.reader = await openReader(sqlite3, connection_string, this.journalMode);
 		this.isEnabled = true;
+
+		// A key rotation that was interrupted by a restart
+		if (this.previousKey) {
+			this.continueKeyRotation().catch((err) => {
+				log.error(`Failed to rotate message key for ${this.userName}: ${err}`);
+			});
+		} else if (this.legacyDataKey) {
+			this.rotateLegacyDataKey();
+		}
+
+		// Index rows written before the search index existed, without blocking startup
+		this.backfillSearchIndex().catch((err) => {
+			log.error(`Failed to backfill search index for ${this.userName}: ${err}`);
+		});
 	}
 
 	async enable() {
@@ -232,6 +481,9 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 
 	async run_pragmas() {
 		await this.serialize_run("PRAGMA foreign_keys = ON;");
+		// Pages freed by the storage cleaner are given back in steps, see reclaimSpace
+		await this.serialize_run("PRAGMA auto_vacuum = INCREMENTAL;");
+		this.journalMode = await applyProfile(this.database);
 	}
 
 	async run_migrations() {
@@ -248,6 +500,18 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 		try {
 			if (version === 0) {
 				await this.setup_new_db();
+			} else if (version >= oldestMigratableVersion) {
+				log.info(
+					`Encrypted message storage schema version is out of date (${version} < ${currentSchemaVersion}). Running migrations.`
+				);
+
+				const to_execute = migrations.filter((m) => m.version > version);
+
+				for (const stmt of to_execute.map((m) => m.stmts).flat()) {
+					await this.serialize_run(stmt);
+				}
+
+				await this.update_version_in_db();
 			} else {
 				// Schema is outdated - drop old tables and recreate
 				log.warn(
@@ -255,6 +519,9 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 				);
 
 				// Drop old tables
+				await this.serialize_run("DROP TABLE IF EXISTS channel_stats");
+				await this.serialize_run("DROP TABLE IF EXISTS search_index");
+				await this.serialize_run("DROP TABLE IF EXISTS unread_markers");
 				await this.serialize_run("DROP TABLE IF EXISTS messages");
 				await this.serialize_run("DROP TABLE IF EXISTS options");
 
@@ -267,7 +534,15 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 		}
 
 		await this.serialize_run("COMMIT");
-		await this.serialize_run("VACUUM");
+
+		// Files from before incremental auto_vacuum only switch over with a full VACUUM, once.
+		// Space is given back with incremental_vacuum after that, see reclaimSpace
+		const pragma = await this.serialize_get("PRAGMA auto_vacuum");
+
+		if (pragma?.auto_vacuum !== autoVacuumIncremental) {
+			log.info(`Converting encrypted message storage of ${this.userName} to auto_vacuum`);
+			await this.serialize_run("VACUUM");
+		}
 	}
 
 	async close() {
@@ -275,8 +550,28 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return;
 		}
 
+		// Write out whatever is still queued before the handle goes away
+		await this.writes.flush();
+
 		this.isEnabled = false;
 
+		const stmts = [this.insertStmt, this.insertTokenStmt, this.statsStmt, this.mentionStmt];
+
+		for (const stmt of stmts) {
+			if (stmt) {
+				await new Promise<void>((resolve) => stmt.finalize(() => resolve()));
+			}
+		}
+
+		this.insertStmt = null;
+		this.insertTokenStmt = null;
+		this.statsStmt = null;
+		this.mentionStmt = null;
+
+		// The writer checkpoints the WAL when the last connection closes
+		await closeReader(this.reader);
+		this.reader = null;
+
 		return new Promise<void>((resolve, reject) => {
 			this.database.close((err) => {
 				if (err) {
@@ -307,6 +602,19 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 		});
 	}
 
+	statement_run(stmt: Statement, ...params: any[]): Promise<number> {
+		return new Promise((resolve, reject) => {
+			stmt.run(params, function (err: Error | null) {
+				if (err) {
+					reject(err);
+					return;
+				}
+
+				resolve(this.lastID); // rowid of the inserted row, `this` is re-bound by sqlite3
+			});
+		});
+	}
+
 	serialize_get(stmt: string, ...params: any[]): Promise<any> {
 		return new Promise((resolve, reject) => {
 			this.database.serialize(() => {
@@ -338,9 +646,37 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 	}
 
 	/**
-	 * Index a message (store encrypted)
+	 * Like serialize_fetchall, on the read only connection if there is one
+	 * Only for reads outside of transactions, after flushing the writes they have to see
 	 */
-	async index(network: Network, channel: Channel, msg: Message) {
+	read_fetchall(stmt: string, ...params: any[]): Promise<any[]> {
+		return this.timeRead(
+			this.reader
+				? fetchAll(this.reader, stmt, params)
+				: this.serialize_fetchall(stmt, ...params)
+		);
+	}
+
+	read_get(stmt: string, ...params: any[]): Promise<any> {
+		return this.timeRead(
+			this.reader ? fetchOne(this.reader, stmt, params) : this.serialize_get(stmt, ...params)
+		);
+	}
+
+	private timeRead<T>(query: Promise<T>): Promise<T> {
+		const started = performance.now();
+
+		return query.finally(() =>
+			this.meters.readTime.observe((performance.now() - started) / 1000)
+		);
+	}
+
+	/**
+	 * Index a message (store encrypted), resolves once it has been committed
+	 *
+	 * @param mention - also list it in the mentions, see getMentions
+	 */
+	async index(network: Network, channel: Channel, msg: Message, mention = false) {
 		await this.initDone.promise;
 
 		if (!this.isEnabled) {
@@ -359,22 +695,107 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return newMsg;
 		}, {});
 
-		// Encrypt message data
-		const plaintext = JSON.stringify(clonedMsg);
-		const encrypted = this.encrypt(plaintext);
+		const row: PendingRow = {
+			network: network.uuid,
+			channel: channel.name.toLowerCase(),
+			time: msg.time.getTime(),
+			type: msg.type || MessageType.MESSAGE,
+			plaintext: JSON.stringify(clonedMsg),
+			text: msg.text || "",
+			mention,
+		};
 
-		await this.serialize_run(
-			"INSERT INTO messages(network, channel, time, type, encrypted_data) VALUES(?, ?, ?, ?, ?)",
-			network.uuid,
-			channel.name.toLowerCase(),
-			msg.time.getTime(),
-			msg.type || MessageType.MESSAGE,
-			encrypted
+		// Queued and written in a batch together with other messages
+		// Reads flush the queue first, so they always see every indexed message
+		const written = this.writes.push(row);
+
+		// Same message as a read would return it
+		this.cache.append(
+			`${row.network}:${row.channel}`,
+			row.time,
+			row.plaintext.length,
+			() => new Msg({...JSON.parse(row.plaintext), time: new Date(row.time), type: row.type})
 		);
 
-		// Invalidate cache for this channel
-		const cacheKey = `${network.uuid}:${channel.name.toLowerCase()}`;
-		this.cache.set(cacheKey, []); // Clear cache entry
+		return written;
+	}
+
+	/**
+	 * Encrypt and write a batch of queued messages (and their search tokens) in one transaction
+	 */
+	private async writeRows(rows: PendingRow[]) {
+		const started = performance.now();
+
+		if (!this.insertStmt || !this.insertTokenStmt || !this.statsStmt || !this.mentionStmt) {
+			this.insertStmt = this.database.prepare(
+				"INSERT INTO messages(network, channel, time, type, encrypted_data) VALUES(?, ?, ?, ?, ?)"
+			);
+			this.insertTokenStmt = this.database.prepare(
+				"INSERT OR IGNORE INTO search_index (token, message_id) VALUES (?, ?)"
+			);
+			this.statsStmt = this.database.prepare(channelStatsUpsert);
+			this.mentionStmt = this.database.prepare(
+				"INSERT INTO mentions (message_id) VALUES (?)"
+			);
+		}
+
+		// Encrypted on the crypto pool before the transaction starts
+		const sealed = await cryptoPool
+			.seal(this.encryptionKey, this.searchKey, rows)
+			.catch((err) => {
+				this.evictRows(rows);
+				throw err;
+			});
+
+		await this.serialize_run("BEGIN TRANSACTION");
+
+		try {
+			const ids: number[] = [];
+
+			for (const [i, row] of rows.entries()) {
+				const messageId = await this.statement_run(
+					this.insertStmt,
+					row.network,
+					row.channel,
+					row.time,
+					row.type,
+					sealed[i].data
+				);
+
+				for (const token of sealed[i].tokens) {
+					await this.statement_run(this.insertTokenStmt, token, messageId);
+				}
+
+				if (row.mention) {
+					await this.statement_run(this.mentionStmt, messageId);
+				}
+
+				ids.push(messageId);
+			}
+
+			for (const stats of channelStatsRows(rows, ids)) {
+				await this.statement_run(this.statsStmt, ...stats);
+			}
+		} catch (err) {
+			await this.serialize_run("ROLLBACK");
+			this.evictRows(rows);
+			throw err;
+		}
+
+		await this.serialize_run("COMMIT");
+
+		this.meters.writeTime.observe((performance.now() - started) / 1000);
+		this.meters.messagesWritten.inc(rows.length);
+	}
+
+	/**
+	 * Drop the cached windows of rows that never made it to the database
+	 * They were cached when indexed, later reads load those channels from disk again
+	 */
+	private evictRows(rows: PendingRow[]) {
+		for (const key of new Set(rows.map((row) => `${row.network}:${row.channel}`))) {
+			this.cache.delete(key);
+		}
 	}
 
 	/**
@@ -387,15 +808,27 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return;
 		}
 
-		await this.serialize_run(
-			"DELETE FROM messages WHERE network = ? AND channel = ?",
-			network.uuid,
-			channel.name.toLowerCase()
-		);
+		await this.writes.exclusive(async () => {
+			await this.serialize_run("BEGIN TRANSACTION");
+
+			try {
+				for (const table of ["messages", "channel_stats"]) {
+					await this.serialize_run(
+						`DELETE FROM ${table} WHERE network = ? AND channel = ?`,
+						network.uuid,
+						channel.name.toLowerCase()
+					);
+				}
+			} catch (err) {
+				await this.serialize_run("ROLLBACK");
+				throw err;
+			}
+
+			await this.serialize_run("COMMIT");
+		});
 
 		// Invalidate cache
-		const cacheKey = `${network.uuid}:${channel.name.toLowerCase()}`;
-		this.cache.set(cacheKey, []);
+		this.cache.delete(`${network.uuid}:${channel.name.toLowerCase()}`);
 	}
 
 	/**
@@ -412,60 +845,23 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
-		const cacheKey = `${network.uuid}:${channel.name.toLowerCase()}`;
-
-		// Check cache first
-		const cached = this.cache.get(cacheKey);
-		if (cached && cached.length > 0) {
-			// Regenerate IDs
-			return cached.map((msg) => {
-				const newMsg = new Msg(msg);
-				newMsg.id = nextID();
-				return newMsg;
-			});
-		}
-
 		// If unlimited history is specified, load 100k messages
 		const limit = Config.values.maxHistory < 0 ? 100000 : Config.values.maxHistory;
+		const messages = await this.lastMessages(network.uuid, channel.name, limit);
 
-		const rows = await this.serialize_fetchall(
-			"SELECT encrypted_data, time, type FROM messages WHERE network = ? AND channel = ? ORDER BY time DESC LIMIT ?",
-			network.uuid,
-			channel.name.toLowerCase(),
-			limit
-		);
-
-		// Decrypt messages
-		const messages = rows.reverse().map((row: any): Message => {
-			try {
-				const decrypted = this.decrypt(row.encrypted_data);
-				const msg = JSON.parse(decrypted);
-				msg.time = row.time;
-				msg.type = row.type; // Restore type from column
-
-				const newMsg = new Msg(msg);
-				newMsg.id = nextID();
-
-				return newMsg;
-			} catch (error) {
-				log.error(`Failed to decrypt message: ${error}`);
-				// Return error message placeholder
-				return new Msg({
-					type: MessageType.UNHANDLED,
-					text: "[Decryption failed]",
-					time: row.time,
-				});
-			}
-		});
-
-		// Cache decrypted messages
-		this.cache.set(cacheKey, messages);
+		for (const msg of messages) {
+			msg.id = nextID();
+		}
 
 		return messages;
 	}
 
 	/**
-	 * Search messages (requires decrypting all matching messages)
+	 * Search messages
+	 *
+	 * Candidate rows are looked up in the blind trigram index, only those get decrypted
+	 * and checked against the search term. Terms shorter than a trigram and rows that
+	 * still await backfill can't use the index and are scanned instead.
 	 */
 	async search(query: SearchQuery): Promise<SearchResponse> {
 		await this.initDone.promise;
@@ -476,42 +872,78 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			);
 		}
 
-		// For encrypted storage, we need to decrypt all messages to search
-		// This is a performance limitation of encryption
-		let select = "SELECT encrypted_data, time, network, channel FROM messages";
+		await this.writes.flush();
+
+		const searchTerm = query.searchTerm.toLowerCase();
+		const tokens = searchTokens(this.searchKey, searchTerm);
+
+		let select = "SELECT id FROM messages WHERE 1";
 		const params: any[] = [];
 
+		if (tokens.length > 0) {
+			// Rows that still await the key rotation have tokens of the previous key
+			const backfillId = Math.max(
+				await this.getSearchBackfillId(),
+				this.previousKey ? this.rotationId : 0
+			);
+
+			// Every trigram of the term has to be present, intersect their postings
+			const postings = tokens
+				.slice(0, 16)
+				.map(() => "SELECT message_id FROM search_index WHERE token = ?")
+				.join(" INTERSECT ");
+
+			select += ` AND (id IN (${postings}) OR id <= ?)`;
+			params.push(...tokens.slice(0, 16), backfillId);
+		}
+
 		if (query.networkUuid) {
-			select += " WHERE network = ?";
+			select += " AND network = ?";
 			params.push(query.networkUuid);
 		}
 
 		if (query.channelName) {
-			select += query.networkUuid ? " AND" : " WHERE";
-			select += " channel = ?";
+			select += " AND channel = ?";
 			params.push(query.channelName.toLowerCase());
 		}
 
-		select += " ORDER BY time DESC";
+		// Keyset pagination, the offset is only still used by older clients
+		if (query.cursor) {
+			select += " AND (time, id) < (?, ?)";
+			params.push(query.cursor.time, query.cursor.id);
+		}
+
+		select += " ORDER BY time DESC, id DESC";
 
-		const rows = await this.serialize_fetchall(select, ...params);
+		const candidates = await this.read_fetchall(select, ...params);
 
-		// Decrypt and filter messages
+		// Decrypt and filter candidates in chunks, stopping once we have enough results
 		const results: Message[] = [];
-		let skipped = 0;
+		let nextCursor: SearchCursor | null = null;
+		let skipped = query.cursor ? query.offset : 0;
 		const maxResults = 100;
+		const chunkSize = 200;
+
+		for (let i = 0; i < candidates.length && results.length < maxResults; i += chunkSize) {
+			const ids = candidates.slice(i, i + chunkSize).map((row) => row.id);
+			const rows = await this.read_fetchall(
+				`SELECT id, encrypted_data, time, network, channel FROM messages WHERE id IN (${ids
+					.map(() => "?")
+					.join(", ")}) ORDER BY time DESC, id DESC`,
+				...ids
+			);
 
-		for (const row of rows) {
-			if (results.length >= maxResults) {
-				break;
-			}
+			const decrypted = await this.openRows(rows);
 
-			try {
-				const decrypted = this.decrypt(row.encrypted_data);
-				const msg = JSON.parse(decrypted);
+			for (const [j, row] of rows.entries()) {
+				if (results.length >= maxResults) {
+					break;
+				}
+
+				const msg = decrypted[j];
 
 				// Check if message matches search term
-				if (msg.text && msg.text.toLowerCase().includes(query.searchTerm.toLowerCase())) {
+				if (msg && msg.text && msg.text.toLowerCase().includes(searchTerm)) {
 					if (skipped < query.offset) {
 						skipped++;
 						continue;
@@ -525,20 +957,103 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 					newMsg.id = results.length; // Temporary ID
 
 					results.push(newMsg);
+
+					if (results.length === maxResults) {
+						nextCursor = {time: row.time, id: row.id};
+					}
 				}
-			} catch (error) {
-				log.error(`Failed to decrypt message during search: ${error}`);
 			}
 		}
 
 		return {
 			...query,
 			results: results.reverse(),
+			nextCursor,
 		};
 	}
 
 	/**
-	 * Delete messages (not implemented for encrypted storage)
+	 * Highest message id that is not covered by the search index yet (0 when fully indexed)
+	 */
+	private async getSearchBackfillId(): Promise<number> {
+		const row = await this.serialize_get(
+			"SELECT value FROM options WHERE name = 'search_index_backfill_id'"
+		);
+
+		return row ? parseInt(row.value, 10) : 0;
+	}
+
+	/**
+	 * Index messages stored before the search index existed
+	 * Works from newest to oldest in small transactions, so recent history becomes
+	 * searchable first and normal writes are never blocked for long
+	 */
+	async backfillSearchIndex(): Promise<void> {
+		const chunkSize = 500;
+		let backfillId = await this.getSearchBackfillId();
+
+		if (backfillId > 0) {
+			log.info(`Building search index for ${this.userName} (up to message ${backfillId})...`);
+		}
+
+		// A key rotation indexes every row again, see rotateRows
+		while (backfillId > 0 && this.isEnabled && !this.previousKey) {
+			const rows = await this.serialize_fetchall(
+				"SELECT id, encrypted_data FROM messages WHERE id <= ? ORDER BY id DESC LIMIT ?",
+				backfillId,
+				chunkSize
+			);
+
+			const nextId = rows.length < chunkSize ? 0 : rows[rows.length - 1].id - 1;
+			const tokens = await cryptoPool.tokenize(
+				this.encryptionKey,
+				this.searchKey,
+				rows.map((row) => row.encrypted_data)
+			);
+
+			// Don't interleave with a batch of new messages, both use a transaction
+			await this.writes.exclusive(async () => {
+				if (this.previousKey) {
+					return;
+				}
+
+				await this.serialize_run("BEGIN TRANSACTION");
+
+				try {
+					for (const [i, row] of rows.entries()) {
+						const rowTokens = tokens[i];
+
+						if (rowTokens) {
+							await this.insertSearchTokens(row.id, rowTokens);
+						} else {
+							log.error(`Failed to decrypt message ${row.id} during search backfill`);
+						}
+					}
+
+					await this.serialize_run(
+						"UPDATE options SET value = ? WHERE name = 'search_index_backfill_id'",
+						nextId.toString()
+					);
+				} catch (error) {
+					await this.serialize_run("ROLLBACK");
+					throw error;
+				}
+
+				await this.serialize_run("COMMIT");
+			});
+
+			backfillId = nextId;
+
+			// give queued queries a chance to run between chunks
+			await new Promise((resolve) => setImmediate(resolve));
+		}
+	}
+
+	/**
+	 * Delete messages by age and type, used by the storage cleaner
+	 *
+	 * Only the plaintext columns are looked at, nothing gets decrypted. Search postings
+	 * go with their message.
 	 */
 	async deleteMessages(req: DeletionRequest): Promise<number> {
 		await this.initDone.promise;
@@ -547,23 +1062,90 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return 0;
 		}
 
-		// TODO: Implement if needed
-		log.warn("deleteMessages not implemented for encrypted storage");
-		return 0;
+		// We roughly get a timestamp from N days before, like the sqlite storage
+		const millisecondsInDay = 24 * 60 * 60 * 1000;
+		const params: (string | number)[] = [Date.now() - req.olderThanDays * millisecondsInDay];
+		let sql =
+			"INSERT INTO temp.deleted_messages SELECT id, network, channel, time FROM messages WHERE time <= ?";
+
+		if (req.messageTypes !== null) {
+			sql += ` AND type IN (${req.messageTypes.map(() => "?").join(", ")})`;
+			params.push(...req.messageTypes);
+		}
+
+		sql += " ORDER BY time ASC LIMIT ?";
+		params.push(req.limit);
+
+		const {count, channels} = await this.writes.exclusive(async () => {
+			let deleted: {network: string; channel: string; count: number}[];
+
+			await this.serialize_run("BEGIN TRANSACTION");
+
+			try {
+				for (const stmt of deletedMessagesTable) {
+					await this.serialize_run(stmt);
+				}
+
+				await this.serialize_run(sql, ...params);
+				deleted = await this.serialize_fetchall(
+					"SELECT network, channel, COUNT(*) AS count FROM temp.deleted_messages GROUP BY network, channel"
+				);
+				await this.serialize_run(
+					"DELETE FROM messages WHERE id IN (SELECT id FROM temp.deleted_messages)"
+				);
+
+				for (const stmt of channelStatsAfterDelete) {
+					await this.serialize_run(stmt);
+				}
+			} catch (err) {
+				await this.serialize_run("ROLLBACK");
+				throw err;
+			}
+
+			await this.serialize_run("COMMIT");
+
+			return {
+				count: deleted.reduce((sum, row) => sum + row.count, 0),
+				channels: deleted,
+			};
+		});
+
+		// Cached windows may hold deleted messages
+		for (const {network, channel} of channels) {
+			this.cache.delete(`${network}:${channel}`);
+		}
+
+		return count;
 	}
 
 	/**
-	 * Get message count (for cleanup)
+	 * Give some of the pages freed by deleteMessages back to the file system
+	 *
+	 * A step at a time instead of a VACUUM, which rewrites the whole database and blocks it
+	 * for as long. Skipped while messages wait to be written.
+	 *
+	 * @returns whether free pages are left
 	 */
-	async getMessagesForCleanup(req: DeletionRequest): Promise<Message[]> {
+	async reclaimSpace(): Promise<boolean> {
 		await this.initDone.promise;
 
 		if (!this.isEnabled) {
-			return [];
+			return false;
+		}
+
+		if (this.writes.size > 0) {
+			return true;
 		}
 
-		// TODO: Implement if needed
-		return [];
+		return this.writes.exclusive(async () => {
+			// Frees a page per step, so all of the statement's rows have to be fetched
+			await this.serialize_fetchall(`PRAGMA incremental_vacuum(${reclaimPagesPerStep})`);
+			// In WAL mode the file is only truncated once the log is copied back
+			await this.serialize_fetchall("PRAGMA wal_checkpoint(PASSIVE)");
+
+			const row = await this.serialize_get("PRAGMA freelist_count");
+			return row.freelist_count > 0;
+		});
 	}
 
 	/**
@@ -581,37 +1163,219 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
-		const rows = await this.serialize_fetchall(
-			"SELECT encrypted_data, time, type FROM messages WHERE network = ? AND channel = ? ORDER BY time DESC LIMIT ?",
-			networkUuid,
-			channelName.toLowerCase(),
-			limit
-		);
+		return this.lastMessages(networkUuid, channelName, limit);
+	}
 
-		// Decrypt messages (reverse to get chronological order)
-		const messages = rows.reverse().map((row: any): Message => {
-			try {
-				const decrypted = this.decrypt(row.encrypted_data);
-				const msg = JSON.parse(decrypted);
-				msg.time = new Date(row.time);
-				msg.type = row.type; // Restore type from column
+	/**
+	 * Get last N messages and total count of many channels, one query per chunk of channels
+	 * Used to hydrate every channel of the initial state without 2 queries per channel
+	 */
+	async getLastMessagesBatch(
+		channels: ChannelRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]> {
+		await this.initDone.promise;
 
-				const newMsg = new Msg(msg);
-				// ID will be assigned by caller (nextMessageId())
+		if (!this.isEnabled) {
+			return channels.map(() => ({messages: [], totalMessages: 0}));
+		}
 
-				return newMsg;
-			} catch (error) {
-				log.error(`Failed to decrypt message: ${error}`);
-				// Return error message placeholder
-				return new Msg({
-					type: MessageType.UNHANDLED,
-					text: "[Decryption failed]",
-					time: new Date(row.time),
-				});
+		const keys = channels.map((c) => `${c.networkUuid}:${c.channelName.toLowerCase()}`);
+
+		// Taken before the flush, so a load that raced a new message isn't cached
+		const stamps = keys.map((key) => this.cache.stamp(key));
+
+		await this.writes.flush();
+
+		const results: ChannelHistory[] = [];
+		const cached: number[] = [];
+		const uncached: number[] = [];
+
+		keys.forEach((key, i) => {
+			const messages = this.cache.window(key, limit, beforeTime);
+
+			if (messages) {
+				// Windows end on a time boundary, batches at the newest `limit` like the query
+				results[i] = {messages: messages.slice(-limit), totalMessages: 0};
+				cached.push(i);
+			} else {
+				uncached.push(i);
 			}
 		});
 
-		return messages;
+		for (let i = 0; i < uncached.length; i += lastMessagesBatchSize) {
+			const chunk = uncached.slice(i, i + lastMessagesBatchSize);
+			const refs = chunk.map((j) => channels[j]);
+			const columns = "encrypted_data, type, time";
+			const query = lastMessagesBatchQuery(columns, refs, limit, beforeTime);
+			const rows = await this.read_fetchall(query.sql, ...query.params);
+			const messages = await this.rowsToMessages(rows);
+			const sizes = new Map<Message, number>();
+
+			const histories = groupLastMessagesBatch(refs, rows, (row, index) => {
+				sizes.set(messages[index], row.encrypted_data.length);
+				return messages[index];
+			});
+
+			histories.forEach((history, k) => {
+				const j = chunk[k];
+				const complete = history.messages.length >= history.totalMessages;
+				let resident = history.messages;
+
+				// The limit can split the messages of the oldest time, those aren't cached
+				if (!complete) {
+					const oldest = resident[0].time.getTime();
+					resident = resident.filter((msg) => msg.time.getTime() > oldest);
+				}
+
+				this.cache.merge(
+					keys[j],
+					stamps[j],
+					resident,
+					resident.map((msg) => sizes.get(msg)!),
+					complete ? -Infinity : history.messages[0].time.getTime() + 1,
+					beforeTime
+				);
+
+				results[j] = {
+					messages: history.messages.map((msg) => new Msg(msg)),
+					totalMessages: history.totalMessages,
+				};
+			});
+		}
+
+		// Messages came from the cache, only the totals are left to query
+		for (let i = 0; i < cached.length; i += lastMessagesBatchSize) {
+			const chunk = cached.slice(i, i + lastMessagesBatchSize);
+			const query = messageCountsQuery(chunk.map((j) => channels[j]), beforeTime);
+			const totals = new Map<string, number>();
+
+			for (const row of await this.read_fetchall(query.sql, ...query.params)) {
+				totals.set(`${row.network}:${row.channel}`, row.total);
+			}
+
+			for (const j of chunk) {
+				results[j].totalMessages = totals.get(keys[j]) || 0;
+			}
+		}
+
+		return results;
+	}
+
+	/**
+	 * Get the messages of many channels that are newer than what a browser already has
+	 * Channels with nothing new are answered from the cache or by an index lookup,
+	 * only new messages are decrypted
+	 */
+	async getNewMessagesBatch(
+		channels: NewMessagesRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return channels.map(() => ({messages: [], totalMessages: 0}));
+		}
+
+		const keys = channels.map((c) => `${c.networkUuid}:${c.channelName.toLowerCase()}`);
+
+		await this.writes.flush();
+
+		const results: ChannelHistory[] = [];
+		const cached: number[] = [];
+		const uncached: number[] = [];
+
+		keys.forEach((key, i) => {
+			const messages = this.cache.since(key, channels[i].afterTime, limit, beforeTime);
+
+			if (messages) {
+				results[i] = {messages, totalMessages: 0};
+				cached.push(i);
+			} else {
+				uncached.push(i);
+			}
+		});
+
+		for (let i = 0; i < uncached.length; i += lastMessagesBatchSize) {
+			const chunk = uncached.slice(i, i + lastMessagesBatchSize);
+			const refs = chunk.map((j) => channels[j]);
+			const columns = "encrypted_data, type, time";
+			const query = newMessagesBatchQuery(columns, refs, limit, beforeTime);
+			const rows = await this.read_fetchall(query.sql, ...query.params);
+			const messages = await this.rowsToMessages(rows);
+
+			groupLastMessagesBatch(refs, rows, (row, index) => messages[index]).forEach(
+				(history, k) => {
+					results[chunk[k]] = history;
+				}
+			);
+		}
+
+		for (let i = 0; i < cached.length; i += lastMessagesBatchSize) {
+			const chunk = cached.slice(i, i + lastMessagesBatchSize);
+			const query = messageCountsQuery(chunk.map((j) => channels[j]));
+			const totals = new Map<string, number>();
+
+			for (const row of await this.read_fetchall(query.sql, ...query.params)) {
+				totals.set(`${row.network}:${row.channel}`, row.total);
+			}
+
+			for (const j of chunk) {
+				results[j].totalMessages = totals.get(keys[j]) || 0;
+			}
+		}
+
+		return results;
+	}
+
+	/**
+	 * Newest `limit` messages of a channel and any more sharing the oldest time, older than
+	 * `beforeTime` if set. Served from the cache when the whole window is resident, loaded into it otherwise
+	 */
+	private async lastMessages(
+		networkUuid: string,
+		channelName: string,
+		limit: number,
+		beforeTime?: number
+	): Promise<Message[]> {
+		const channel = channelName.toLowerCase();
+		const key = `${networkUuid}:${channel}`;
+		const cached = this.cache.window(key, limit, beforeTime);
+
+		if (cached) {
+			return cached;
+		}
+
+		if (limit <= 0) {
+			return [];
+		}
+
+		// Taken before the flush, so a load that raced a new message isn't cached
+		const stamp = this.cache.stamp(key);
+
+		await this.writes.flush();
+
+		// Every message sharing the time of the oldest one is loaded as well,
+		// so the cache knows exactly which part of the history it holds
+		const columns = "encrypted_data, time, type";
+		const query = lastMessagesQuery(columns, networkUuid, channel, limit, beforeTime);
+		const rows = await this.read_fetchall(query.sql, ...query.params);
+
+		const messages = await this.rowsToMessages(rows);
+
+		this.cache.merge(
+			key,
+			stamp,
+			messages,
+			rows.map((row) => row.encrypted_data.length),
+			rows.length < limit ? -Infinity : rows[0].time,
+			beforeTime
+		);
+
+		// The cache keeps the originals
+		return messages.map((msg) => new Msg(msg));
 	}
 
 	/**
@@ -630,38 +1394,7 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
-		const rows = await this.serialize_fetchall(
-			"SELECT encrypted_data, time, type FROM messages WHERE network = ? AND channel = ? AND time < ? ORDER BY time DESC LIMIT ?",
-			networkUuid,
-			channelName.toLowerCase(),
-			beforeTime,
-			limit
-		);
-
-		// Decrypt messages (reverse to get chronological order)
-		const messages = rows.reverse().map((row: any): Message => {
-			try {
-				const decrypted = this.decrypt(row.encrypted_data);
-				const msg = JSON.parse(decrypted);
-				msg.time = new Date(row.time);
-				msg.type = row.type; // Restore type from column
-
-				const newMsg = new Msg(msg);
-				// ID will be assigned by caller (nextMessageId())
-
-				return newMsg;
-			} catch (error) {
-				log.error(`Failed to decrypt message: ${error}`);
-				// Return error message placeholder
-				return new Msg({
-					type: MessageType.UNHANDLED,
-					text: "[Decryption failed]",
-					time: new Date(row.time),
-				});
-			}
-		});
-
-		return messages;
+		return this.lastMessages(networkUuid, channelName, limit, beforeTime);
 	}
 
 	/**
@@ -679,7 +1412,9 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return 0;
 		}
 
-		const row = await this.serialize_get(
+		await this.writes.flush();
+
+		const row = await this.read_get(
 			"SELECT COUNT(*) as count FROM messages WHERE network = ? AND channel = ? AND time > ?",
 			networkUuid,
 			channelName.toLowerCase(),
@@ -700,8 +1435,10 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return 0;
 		}
 
-		const row = await this.serialize_get(
-			"SELECT COUNT(*) as count FROM messages WHERE network = ? AND channel = ?",
+		await this.writes.flush();
+
+		const row = await this.read_get(
+			"SELECT count FROM channel_stats WHERE network = ? AND channel = ?",
 			networkUuid,
 			channelName.toLowerCase()
 		);
@@ -710,69 +1447,270 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 	}
 
 	/**
-	 * Re-encrypt all messages with new encryption key
-	 * Used when user changes password
+	 * Switch to a new password derived key, used when the password changes
+	 *
+	 * Only the data key is wrapped again, messages stay as they are.
 	 */
-	async reEncrypt(oldKey: Buffer, newKey: Buffer): Promise<void> {
+	async changeEncryptionKey(oldKey: Buffer, newKey: Buffer): Promise<void> {
 		await this.initDone.promise;
 
 		if (!this.isEnabled) {
 			return;
 		}
 
-		log.info(`Re-encrypting messages for user ${this.userName}...`);
+		if (
+			oldKey.length !== this.wrappingKey.length ||
+			!crypto.timingSafeEqual(oldKey, this.wrappingKey)
+		) {
+			throw new Error("Old encryption key does not match message storage");
+		}
 
-		// Fetch all encrypted messages
-		const rows = await this.serialize_fetchall("SELECT id, encrypted_data FROM messages");
+		const wrappingKey = Buffer.from(newKey);
 
-		await this.serialize_run("BEGIN TRANSACTION");
+		await this.writes.exclusive(async () => {
+			await this.serialize_run("BEGIN TRANSACTION");
 
-		try {
-			for (const row of rows) {
-				// Decrypt with old key
-				const iv = row.encrypted_data.slice(0, 12);
-				const tag = row.encrypted_data.slice(-16);
-				const encrypted = row.encrypted_data.slice(12, -16);
+			try {
+				await this.setOption("data_key", wrapKey(wrappingKey, this.encryptionKey));
 
-				const decipher = crypto.createDecipheriv("aes-256-gcm", oldKey, iv);
-				decipher.setAuthTag(tag);
+				if (this.previousKey) {
+					await this.setOption("previous_data_key", wrapKey(wrappingKey, this.previousKey));
+				}
+			} catch (error) {
+				await this.serialize_run("ROLLBACK");
+				throw error;
+			}
 
-				const decrypted = Buffer.concat([decipher.update(encrypted), decipher.final()]);
-				const plaintext = decrypted.toString("utf8");
+			await this.serialize_run("COMMIT");
+			this.wrappingKey = wrappingKey;
+		});
 
-				// Encrypt with new key
-				const newIv = crypto.randomBytes(12);
-				const cipher = crypto.createCipheriv("aes-256-gcm", newKey, newIv);
+		log.info(`Message storage key changed for user ${this.userName}`);
 
-				const newEncrypted = Buffer.concat([
-					cipher.update(plaintext, "utf8"),
-					cipher.final(),
-				]);
+		// The old password must not keep opening the history
+		if (this.legacyDataKey) {
+			this.rotateLegacyDataKey();
+		}
+	}
 
-				const newTag = cipher.getAuthTag();
-				const newCiphertext = Buffer.concat([newIv, newEncrypted, newTag]);
+	/**
+	 * Move a database off the password derived key it was upgraded with, in the background
+	 */
+	private rotateLegacyDataKey() {
+		this.rotateDataKey().catch((err) => {
+			log.error(`Failed to rotate legacy message key for ${this.userName}: ${err}`);
+		});
+	}
 
-				// Update database
-				await this.serialize_run(
-					"UPDATE messages SET encrypted_data = ? WHERE id = ?",
-					newCiphertext,
-					row.id
+	/**
+	 * Encrypt the whole history with a new random data key
+	 *
+	 * New messages use the new key right away. Older rows are rewritten in the background,
+	 * newest first and in small transactions, and the rotation continues after a restart.
+	 */
+	async rotateDataKey(): Promise<void> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return;
+		}
+
+		if (!this.previousKey) {
+			const dataKey = crypto.randomBytes(32);
+
+			// Queued messages are written first (with the old key), new ones get the new key
+			await this.writes.exclusive(async () => {
+				// Another rotation started while this one waited
+				if (this.previousKey) {
+					return;
+				}
+
+				const row = await this.serialize_get(
+					"SELECT COALESCE(MAX(id), 0) AS id FROM messages"
 				);
+
+				await this.serialize_run("BEGIN TRANSACTION");
+
+				try {
+					await this.setOption(
+						"previous_data_key",
+						wrapKey(this.wrappingKey, this.encryptionKey)
+					);
+					await this.setOption("data_key", wrapKey(this.wrappingKey, dataKey));
+					await this.setOption("key_rotation_id", String(row.id));
+					// Rows awaiting backfill are indexed by the rotation too
+					await this.setOption("search_index_backfill_id", "0");
+					await this.serialize_run("DELETE FROM options WHERE name = 'legacy_data_key'");
+				} catch (error) {
+					await this.serialize_run("ROLLBACK");
+					throw error;
+				}
+
+				await this.serialize_run("COMMIT");
+
+				this.previousKey = this.encryptionKey;
+				this.rotationId = row.id;
+				this.legacyDataKey = false;
+				this.useDataKey(dataKey);
+			});
+		}
+
+		return this.continueKeyRotation();
+	}
+
+	private continueKeyRotation(): Promise<void> {
+		if (!this.rotation) {
+			this.rotation = this.rotateRows().finally(() => (this.rotation = null));
+		}
+
+		return this.rotation;
+	}
+
+	private async rotateRows(): Promise<void> {
+		const chunkSize = 500;
+		const total = this.rotationId;
+		let chunks = 0;
+
+		log.info(`Rotating message key for ${this.userName} (up to message ${total})...`);
+
+		while (this.previousKey && this.rotationId > 0 && this.isEnabled) {
+			const rows = await this.serialize_fetchall(
+				"SELECT id, encrypted_data FROM messages WHERE id <= ? ORDER BY id DESC LIMIT ?",
+				this.rotationId,
+				chunkSize
+			);
+
+			const nextId = rows.length < chunkSize ? 0 : rows[rows.length - 1].id - 1;
+			const sealed = await this.resealRows(this.previousKey, rows);
+
+			await this.writes.exclusive(async () => {
+				await this.serialize_run("BEGIN TRANSACTION");
+
+				try {
+					for (const [i, row] of rows.entries()) {
+						const rowSealed = sealed[i];
+
+						if (!rowSealed) {
+							log.error(`Failed to decrypt message ${row.id} during key rotation`);
+							continue;
+						}
+
+						await this.serialize_run(
+							"UPDATE messages SET encrypted_data = ? WHERE id = ?",
+							rowSealed.data,
+							row.id
+						);
+
+						// Search tokens are keyed as well, replace them
+						await this.serialize_run(
+							"DELETE FROM search_index WHERE message_id = ?",
+							row.id
+						);
+						await this.insertSearchTokens(row.id, rowSealed.tokens);
+					}
+
+					await this.setOption("key_rotation_id", nextId.toString());
+				} catch (error) {
+					await this.serialize_run("ROLLBACK");
+					throw error;
+				}
+
+				await this.serialize_run("COMMIT");
+			});
+
+			this.rotationId = nextId;
+
+			if (++chunks % 20 === 0) {
+				const done = Math.round(((total - nextId) / total) * 100);
+				log.info(`Rotating message key for ${this.userName}: ${done}% done`);
 			}
 
-			await this.serialize_run("COMMIT");
+			// give queued queries a chance to run between chunks
+			await new Promise((resolve) => setImmediate(resolve));
+		}
 
-			// Update encryption key
-			this.encryptionKey = newKey;
-			this.cache.clear();
+		if (this.previousKey && this.rotationId === 0 && this.isEnabled) {
+			await this.writes.exclusive(() =>
+				this.serialize_run(
+					"DELETE FROM options WHERE name IN ('previous_data_key', 'key_rotation_id')"
+				)
+			);
 
-			log.info(`Re-encryption complete for user ${this.userName}`);
-		} catch (error) {
-			await this.serialize_run("ROLLBACK");
-			throw error;
+			this.previousKey = null;
+			log.info(`Key rotation complete for user ${this.userName}`);
+		}
+	}
+
+	/**
+	 * Encrypt rows with the current data key, null for rows that failed to decrypt
+	 */
+	private async resealRows(
+		oldKey: Buffer,
+		rows: {encrypted_data: Buffer}[]
+	): Promise<(SealedMessage | null)[]> {
+		const data = rows.map((row) => row.encrypted_data);
+
+		try {
+			return await cryptoPool.reseal(oldKey, this.encryptionKey, this.searchKey, data);
+		} catch (e) {
+			// One bad row fails its whole task, find it
+			return Promise.all(
+				data.map((item) =>
+					cryptoPool
+						.reseal(oldKey, this.encryptionKey, this.searchKey, [item])
+						.then(([sealed]) => sealed, () => null)
+				)
+			);
 		}
 	}
 
+	/**
+	 * A page of mentions in chronological order, the newest ones or those before `before`
+	 */
+	async getMentions(before: number | null, limit: number): Promise<StoredMention[]> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return [];
+		}
+
+		await this.writes.flush();
+
+		const rows = await this.read_fetchall(
+			"SELECT messages.id, network, channel, time, type, encrypted_data FROM mentions JOIN messages ON messages.id = mentions.message_id WHERE mentions.message_id < ? ORDER BY mentions.message_id DESC LIMIT ?",
+			before ?? Number.MAX_SAFE_INTEGER,
+			limit
+		);
+
+		rows.reverse();
+
+		const messages = await this.rowsToMessages(rows);
+
+		return rows.map((row, i) => ({
+			id: row.id,
+			network: row.network,
+			channel: row.channel,
+			msg: messages[i],
+		}));
+	}
+
+	/**
+	 * Remove a mention, or all of them without an id, the messages stay
+	 */
+	async dismissMentions(id?: number): Promise<void> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return;
+		}
+
+		await this.writes.exclusive(() =>
+			id === undefined
+				? this.serialize_run("DELETE FROM mentions")
+				: this.serialize_run("DELETE FROM mentions WHERE message_id = ?", id)
+		);
+	}
+
 	/**
 	 * Save unread marker for a channel
 	 * Used to persist when user marks a channel as read
@@ -788,11 +1726,13 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 			return;
 		}
 
-		await this.serialize_run(
-			"INSERT OR REPLACE INTO unread_markers (network, channel, last_read_time) VALUES (?, ?, ?)",
-			networkUuid,
-			channelName.toLowerCase(),
-			lastReadTime
+		await this.writes.exclusive(() =>
+			this.serialize_run(
+				"INSERT OR REPLACE INTO unread_markers (network, channel, last_read_time) VALUES (?, ?, ?)",
+				networkUuid,
+				channelName.toLowerCase(),
+				lastReadTime
+			)
 		);
 	}
 
@@ -839,4 +1779,26 @@ export class EncryptedMessageStorage implements SearchableMessageStorage {
 	}
 }
 
+/**
+ * Encrypt a data key with a password derived key, for the options table
+ */
+function wrapKey(wrappingKey: Buffer, dataKey: Buffer): string {
+	return encrypt(wrappingKey, dataKey.toString("base64")).toString("base64");
+}
+
+function unwrapKey(wrappingKey: Buffer, wrapped: string): Buffer {
+	try {
+		return Buffer.from(decrypt(wrappingKey, Buffer.from(wrapped, "base64")), "base64");
+	} catch (e) {
+		throw new Error("the data key does not decrypt with this password");
+	}
+}
+
+/**
+ * Derive the search index key from the message encryption key
+ */
+function deriveSearchKey(encryptionKey: Buffer): Buffer {
+	return crypto.createHmac("sha256", encryptionKey).update("irssi-search-index-v1").digest();
+}
+
 export default EncryptedMessageStorage;
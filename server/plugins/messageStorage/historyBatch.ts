@@ -0,0 +1,178 @@
+import type {Message} from "../../models/msg";
+import type {ChannelRef, ChannelHistory, NewMessagesRef} from "./types";
+
+// Channels per query, keeps the bound parameters well below SQLITE_MAX_VARIABLE_NUMBER
+export const lastMessagesBatchSize = 100;
+
+/**
+ * Last `limit` messages of a channel, older than `beforeTime` if set
+ *
+ * Pages end on a time boundary: messages that share the time of the oldest one are all
+ * included, so a page can have more than `limit` and the next one can start right before
+ * that time without skipping any. Both parts walk the (network, channel, time) index.
+ */
+export function lastMessagesQuery(
+	columns: string,
+	networkUuid: string,
+	channelName: string,
+	limit: number,
+	beforeTime?: number
+) {
+	const channel = channelName.toLowerCase();
+	const before = beforeTime === undefined ? "" : " AND time < ?";
+	const params = beforeTime === undefined ? [] : [beforeTime];
+
+	const sql =
+		`SELECT ${columns} FROM messages WHERE network = ? AND channel = ?${before} ` +
+		"AND time >= IFNULL((" +
+		`SELECT time FROM messages WHERE network = ? AND channel = ?${before} ` +
+		"ORDER BY time DESC LIMIT 1 OFFSET ?), 0) ORDER BY time ASC, id ASC";
+
+	return {
+		sql,
+		params: [networkUuid, channel, ...params, networkUuid, channel, ...params, limit - 1],
+	};
+}
+
+/**
+ * Last `limit` messages and the message count of every channel in `channels`, in one pass
+ * Rows come back oldest first, each with the `total` count of its channel. Messages with
+ * the same time are ordered by id, a channel never has more than `limit`.
+ */
+export function lastMessagesBatchQuery(
+	columns: string,
+	channels: ChannelRef[],
+	limit: number,
+	beforeTime?: number
+) {
+	const params: any[] = [];
+
+	for (const channel of channels) {
+		params.push(channel.networkUuid, channel.channelName.toLowerCase());
+	}
+
+	let where = `(network, channel) IN (VALUES ${channels.map(() => "(?, ?)").join(", ")})`;
+
+	if (beforeTime !== undefined) {
+		where += " AND time < ?";
+		params.push(beforeTime);
+	}
+
+	params.push(limit);
+
+	if (beforeTime === undefined) {
+		// The whole channel is counted, channel_stats has that already
+		const sql =
+			`SELECT network, channel, ${columns}, IFNULL(stats.count, 0) AS total FROM (` +
+			`SELECT network, channel, ${columns}, ` +
+			"ROW_NUMBER() OVER (PARTITION BY network, channel ORDER BY time DESC, id DESC) " +
+			`AS row_rank, id FROM messages WHERE ${where}` +
+			") LEFT JOIN channel_stats AS stats USING (network, channel) " +
+			"WHERE row_rank <= ? ORDER BY time ASC, id ASC";
+
+		return {sql, params};
+	}
+
+	const sql =
+		`SELECT network, channel, ${columns}, total FROM (` +
+		`SELECT network, channel, ${columns}, ` +
+		"ROW_NUMBER() OVER (PARTITION BY network, channel ORDER BY time DESC, id DESC) " +
+		"AS row_rank, COUNT(*) OVER (PARTITION BY network, channel) AS total, id " +
+		`FROM messages WHERE ${where}` +
+		") WHERE row_rank <= ? ORDER BY time ASC, id ASC";
+
+	return {sql, params};
+}
+
+/**
+ * Newest `limit` messages of every channel in `channels` that are newer than its
+ * `afterTime`, and older than `beforeTime` if set. Rows come back oldest first, each
+ * with the `total` count of its whole channel.
+ */
+export function newMessagesBatchQuery(
+	columns: string,
+	channels: NewMessagesRef[],
+	limit: number,
+	beforeTime?: number
+) {
+	const params: any[] = [];
+	const terms = channels.map((channel) => {
+		params.push(channel.networkUuid, channel.channelName.toLowerCase(), channel.afterTime);
+		return "(network = ? AND channel = ? AND time > ?)";
+	});
+
+	let where = `(${terms.join(" OR ")})`;
+
+	if (beforeTime !== undefined) {
+		where += " AND time < ?";
+		params.push(beforeTime);
+	}
+
+	params.push(limit);
+
+	const sql =
+		`SELECT network, channel, ${columns}, IFNULL(stats.count, 0) AS total FROM (` +
+		`SELECT network, channel, ${columns}, ` +
+		"ROW_NUMBER() OVER (PARTITION BY network, channel ORDER BY time DESC, id DESC) " +
+		`AS row_rank, id FROM messages WHERE ${where}` +
+		") LEFT JOIN channel_stats AS stats USING (network, channel) " +
+		"WHERE row_rank <= ? ORDER BY time ASC, id ASC";
+
+	return {sql, params};
+}
+
+/**
+ * Message count of every channel in `channels`, rows have `network`, `channel` and `total`
+ */
+export function messageCountsQuery(channels: ChannelRef[], beforeTime?: number) {
+	const params: any[] = [];
+
+	for (const channel of channels) {
+		params.push(channel.networkUuid, channel.channelName.toLowerCase());
+	}
+
+	let where = `(network, channel) IN (VALUES ${channels.map(() => "(?, ?)").join(", ")})`;
+
+	if (beforeTime === undefined) {
+		const sql = `SELECT network, channel, count AS total FROM channel_stats WHERE ${where}`;
+		return {sql, params};
+	}
+
+	where += " AND time < ?";
+	params.push(beforeTime);
+
+	const sql = `SELECT network, channel, COUNT(*) AS total FROM messages WHERE ${where} GROUP BY network, channel`;
+
+	return {sql, params};
+}
+
+/**
+ * Split the rows of a batch query back into per channel histories, in the order of `channels`
+ */
+export function groupLastMessagesBatch(
+	channels: ChannelRef[],
+	rows: any[],
+	toMessage: (row: any, index: number) => Message
+): ChannelHistory[] {
+	const histories = new Map<string, ChannelHistory>();
+
+	rows.forEach((row, index) => {
+		const key = `${row.network}\0${row.channel}`;
+		let history = histories.get(key);
+
+		if (!history) {
+			history = {messages: [], totalMessages: row.total};
+			histories.set(key, history);
+		}
+
+		history.messages.push(toMessage(row, index));
+	});
+
+	return channels.map(
+		(channel) =>
+			histories.get(`${channel.networkUuid}\0${channel.channelName.toLowerCase()}`) || {
+				messages: [],
+				totalMessages: 0,
+			}
+	);
+}
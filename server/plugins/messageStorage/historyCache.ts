@@ -0,0 +1,290 @@
+import Msg, {Message} from "../../models/msg";
+
+type ChannelRing = {
+	messages: Message[]; // oldest first
+	sizes: number[];
+	bytes: number;
+	// Every stored message with time >= floor is in `messages`, -Infinity when all of them are
+	floor: number;
+};
+
+/**
+ * Recent decrypted messages per channel, bounded by their (encoded) size in bytes
+ *
+ * A ring holds a contiguous tail of the channel history, so a window of it can stand in
+ * for a database query. New messages are appended, the oldest ones (and whole least
+ * recently used channels) are dropped once a byte budget is exceeded.
+ */
+export class HistoryCache {
+	private rings: Map<string, ChannelRing>;
+	private versions: Map<string, number>;
+	private generation: number;
+	private bytes: number;
+	private maxBytes: number;
+	private maxChannelBytes: number;
+
+	constructor(maxBytes = 8 * 1024 * 1024, maxChannelBytes = 1024 * 1024) {
+		this.rings = new Map();
+		this.versions = new Map();
+		this.generation = 0;
+		this.bytes = 0;
+		this.maxBytes = maxBytes;
+		this.maxChannelBytes = maxChannelBytes;
+	}
+
+	get size() {
+		return this.bytes;
+	}
+
+	/**
+	 * Changes whenever the channel is modified, pass it to `merge` to drop loads that raced a write
+	 */
+	stamp(key: string): string {
+		return `${this.generation}/${this.versions.get(key) || 0}`;
+	}
+
+	/**
+	 * Newest `limit` messages and any more sharing the oldest time, older than `beforeTime`
+	 * if set. Returns undefined unless all of them are resident
+	 */
+	window(key: string, limit: number, beforeTime?: number): Message[] | undefined {
+		const ring = this.rings.get(key);
+
+		if (!ring) {
+			return undefined;
+		}
+
+		const end = beforeTime === undefined ? ring.messages.length : lowerBound(ring, beforeTime);
+
+		if (end < limit && ring.floor !== -Infinity) {
+			return undefined;
+		}
+
+		// Most recently used channels are evicted last
+		this.rings.delete(key);
+		this.rings.set(key, ring);
+
+		let start = Math.max(0, end - limit);
+
+		// Always resident, the floor never splits messages with the same time
+		while (
+			start > 0 &&
+			start < end &&
+			ring.messages[start - 1].time.getTime() === ring.messages[start].time.getTime()
+		) {
+			start--;
+		}
+
+		return ring.messages.slice(start, end).map((msg) => new Msg(msg));
+	}
+
+	/**
+	 * Newest `limit` messages newer than `afterTime`, older than `beforeTime` if set
+	 * Returns undefined unless every message newer than `afterTime` is resident
+	 */
+	since(
+		key: string,
+		afterTime: number,
+		limit: number,
+		beforeTime?: number
+	): Message[] | undefined {
+		const ring = this.rings.get(key);
+
+		if (!ring || ring.floor > afterTime) {
+			return undefined;
+		}
+
+		this.rings.delete(key);
+		this.rings.set(key, ring);
+
+		const start = lowerBound(ring, afterTime + 1);
+		const end = beforeTime === undefined ? ring.messages.length : lowerBound(ring, beforeTime);
+
+		return ring.messages
+			.slice(Math.max(start, end - limit), end)
+			.map((msg) => new Msg(msg));
+	}
+
+	/**
+	 * Add messages loaded from the database (oldest first)
+	 *
+	 * They must contain every message with `floor` <= time < `until`, with `until`
+	 * unset when they reach up to the newest message.
+	 */
+	merge(
+		key: string,
+		stamp: string,
+		messages: Message[],
+		sizes: number[],
+		floor: number,
+		until?: number
+	) {
+		if (stamp !== this.stamp(key)) {
+			return;
+		}
+
+		const ring = this.rings.get(key);
+
+		if (until === undefined) {
+			if (ring && ring.floor <= floor) {
+				return;
+			}
+
+			this.remove(key);
+			this.insert(key, {
+				messages: messages.slice(),
+				sizes: sizes.slice(),
+				bytes: sum(sizes),
+				floor,
+			});
+			return;
+		}
+
+		// Only extends an existing ring downwards, and only if there is no gap in between
+		if (!ring || until < ring.floor || floor >= ring.floor) {
+			return;
+		}
+
+		let end = 0;
+
+		while (end < messages.length && messages[end].time.getTime() < ring.floor) {
+			end++;
+		}
+
+		ring.messages = messages.slice(0, end).concat(ring.messages);
+		ring.sizes = sizes.slice(0, end).concat(ring.sizes);
+		ring.bytes += sum(sizes.slice(0, end));
+		ring.floor = floor;
+		this.bytes += sum(sizes.slice(0, end));
+
+		this.trim(ring);
+		this.evict();
+	}
+
+	/**
+	 * Add a newly stored message to the channel, `msg` is only called if the channel is resident
+	 */
+	append(key: string, time: number, size: number, msg: () => Message) {
+		this.bump(key);
+
+		const ring = this.rings.get(key);
+
+		if (!ring || time < ring.floor) {
+			return;
+		}
+
+		// Usually the newest message, keep the ring sorted by time anyway
+		let i = ring.messages.length;
+
+		while (i > 0 && ring.messages[i - 1].time.getTime() > time) {
+			i--;
+		}
+
+		ring.messages.splice(i, 0, msg());
+		ring.sizes.splice(i, 0, size);
+		ring.bytes += size;
+		this.bytes += size;
+
+		this.trim(ring);
+		this.evict();
+	}
+
+	delete(key: string) {
+		this.bump(key);
+		this.remove(key);
+	}
+
+	clear() {
+		this.generation++;
+		this.versions.clear();
+		this.rings.clear();
+		this.bytes = 0;
+	}
+
+	private bump(key: string) {
+		this.versions.set(key, (this.versions.get(key) || 0) + 1);
+	}
+
+	private insert(key: string, ring: ChannelRing) {
+		this.rings.set(key, ring);
+		this.bytes += ring.bytes;
+
+		this.trim(ring);
+		this.evict();
+	}
+
+	private remove(key: string) {
+		const ring = this.rings.get(key);
+
+		if (ring) {
+			this.bytes -= ring.bytes;
+			this.rings.delete(key);
+		}
+	}
+
+	/**
+	 * Drop the oldest messages of a channel over its budget, all messages with the same time
+	 * go together so the floor stays exact
+	 */
+	private trim(ring: ChannelRing) {
+		let start = 0;
+		let dropped = 0;
+
+		while (start < ring.messages.length && ring.bytes - dropped > this.maxChannelBytes) {
+			const time = ring.messages[start].time.getTime();
+
+			while (start < ring.messages.length && ring.messages[start].time.getTime() === time) {
+				dropped += ring.sizes[start];
+				start++;
+			}
+
+			ring.floor = time + 1;
+		}
+
+		if (start > 0) {
+			ring.messages = ring.messages.slice(start);
+			ring.sizes = ring.sizes.slice(start);
+			ring.bytes -= dropped;
+			this.bytes -= dropped;
+		}
+	}
+
+	/**
+	 * Drop least recently used channels until the cache is within budget
+	 */
+	private evict() {
+		for (const key of this.rings.keys()) {
+			if (this.bytes <= this.maxBytes) {
+				break;
+			}
+
+			this.remove(key);
+		}
+	}
+}
+
+/**
+ * Index of the first message with time >= `time`
+ */
+function lowerBound(ring: ChannelRing, time: number) {
+	let low = 0;
+	let high = ring.messages.length;
+
+	while (low < high) {
+		const mid = (low + high) >>> 1;
+
+		if (ring.messages[mid].time.getTime() < time) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+function sum(values: number[]) {
+	return values.reduce((total, value) => total + value, 0);
+}
+
+export default HistoryCache;
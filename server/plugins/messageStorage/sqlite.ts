@@ -1,4 +1,4 @@
-import type {Database} from "sqlite3";
+import type {Database, Statement} from "sqlite3";
 
 import log from "../../log";
 import path from "path";
@@ -7,9 +7,32 @@ import Config from "../../config";
 import Msg, {Message} from "../../models/msg";
 import Chan, {Channel} from "../../models/chan";
 import Helper from "../../helper";
-import type {SearchableMessageStorage, DeletionRequest} from "./types";
+import type {
+	SearchableMessageStorage,
+	DeletionRequest,
+	ChannelRef,
+	ChannelHistory,
+	NewMessagesRef,
+} from "./types";
 import Network from "../../models/network";
 import {SearchQuery, SearchResponse} from "../../../shared/types/storage";
+import WriteBatcher from "./writeBatcher";
+import {
+	lastMessagesBatchSize,
+	lastMessagesQuery,
+	lastMessagesBatchQuery,
+	newMessagesBatchQuery,
+	groupLastMessagesBatch,
+} from "./historyBatch";
+import {
+	channelStatsTable,
+	channelStatsBackfill,
+	channelStatsUpsert,
+	channelStatsRows,
+	deletedMessagesTable,
+	channelStatsAfterDelete,
+} from "./channelStats";
+import {applyProfile, openReader, closeReader, fetchAll, fetchOne} from "./connection";
 
 // TODO; type
 let sqlite3: any;
@@ -27,7 +50,7 @@ try {
 type Migration = {version: number; stmts: string[]};
 type Rollback = {version: number; rollback_forbidden?: boolean; stmts: string[]};
 
-export const currentSchemaVersion = 1703322560448; // use `new Date().getTime()`
+export const currentSchemaVersion = 1761609600000; // use `new Date().getTime()`
 
 // Desired schema, adapt to the newest version and add migrations to the array below
 const schema = [
@@ -44,9 +67,11 @@ const schema = [
 		step INTEGER NOT NULL,
 		statement TEXT NOT NULL
 	)`,
-	"CREATE INDEX network_channel ON messages (network, channel)",
+	// history pages and keyset search cursors walk this one, the id is part of every index
+	"CREATE INDEX network_channel_time ON messages (network, channel, time)",
 	"CREATE INDEX time ON messages (time)",
 	"CREATE INDEX msg_type_idx on messages (type)", // needed for efficient storageCleaner queries
+	channelStatsTable,
 ];
 
 // the migrations will be executed in an exclusive transaction as a whole
@@ -84,6 +109,17 @@ export const migrations: Migration[] = [
 		version: 1703322560448,
 		stmts: ["CREATE INDEX msg_type_idx on messages (type)"],
 	},
+	{
+		version: 1761523200000,
+		stmts: [channelStatsTable, channelStatsBackfill],
+	},
+	{
+		version: 1761609600000,
+		stmts: [
+			"CREATE INDEX network_channel_time ON messages (network, channel, time)",
+			"DROP INDEX network_channel", // a prefix of the new one
+		],
+	},
 ];
 
 // down migrations need to restore the state of the prior version.
@@ -101,6 +137,17 @@ export const rollbacks: Rollback[] = [
 		version: 1703322560448,
 		stmts: ["drop INDEX msg_type_idx"],
 	},
+	{
+		version: 1761523200000,
+		stmts: ["DROP TABLE channel_stats"],
+	},
+	{
+		version: 1761609600000,
+		stmts: [
+			"CREATE INDEX network_channel ON messages (network, channel)",
+			"DROP INDEX network_channel_time",
+		],
+	},
 ];
 
 class Deferred {
@@ -114,16 +161,32 @@ class Deferred {
 	}
 }
 
+type PendingRow = {
+	network: string;
+	channel: string;
+	time: number;
+	type: string;
+	msg: string;
+};
+
 class SqliteMessageStorage implements SearchableMessageStorage {
 	isEnabled: boolean;
 	database!: Database;
+	reader: Database | null = null; // read only connection in WAL mode, see ./connection
 	initDone: Deferred;
 	userName: string;
+	writes: WriteBatcher<PendingRow>;
+	private insertStmt: Statement | null;
+	private statsStmt: Statement | null;
+	private journalMode = "";
 
 	constructor(userName: string) {
 		this.userName = userName;
 		this.isEnabled = false;
 		this.initDone = new Deferred();
+		this.insertStmt = null;
+		this.statsStmt = null;
+		this.writes = new WriteBatcher((rows) => this.writeRows(rows));
 	}
 
 	async _enable(connection_string: string) {
@@ -137,6 +200,7 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			throw Helper.catch_to_error("Migration failed", e);
 		}
 
+		this.reader = await openReader(sqlite3, connection_string, this.journalMode);
 		this.isEnabled = true;
 	}
 
@@ -214,6 +278,7 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 
 	async run_pragmas() {
 		await this.serialize_run("PRAGMA foreign_keys = ON;");
+		this.journalMode = await applyProfile(this.database);
 	}
 
 	async run_migrations() {
@@ -254,8 +319,24 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return;
 		}
 
+		// write out whatever is still queued before the handle goes away
+		await this.writes.flush();
+
 		this.isEnabled = false;
 
+		for (const stmt of [this.insertStmt, this.statsStmt]) {
+			if (stmt) {
+				await new Promise<void>((resolve) => stmt.finalize(() => resolve()));
+			}
+		}
+
+		this.insertStmt = null;
+		this.statsStmt = null;
+
+		// the writer checkpoints the WAL when the last connection closes
+		await closeReader(this.reader);
+		this.reader = null;
+
 		return new Promise<void>((resolve, reject) => {
 			this.database.close((err) => {
 				if (err) {
@@ -398,15 +479,57 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return newMsg;
 		}, {});
 
-		await this.serialize_run(
-			"INSERT INTO messages(network, channel, time, type, msg) VALUES(?, ?, ?, ?, ?)",
+		// queued, written in a batch together with other messages; reads flush the queue first
+		return this.writes.push({
+			network: network.uuid,
+			channel: channel.name.toLowerCase(),
+			time: msg.time.getTime(),
+			type: msg.type,
+			msg: JSON.stringify(clonedMsg),
+		});
+	}
 
-			network.uuid,
-			channel.name.toLowerCase(),
-			msg.time.getTime(),
-			msg.type,
-			JSON.stringify(clonedMsg)
-		);
+	/**
+	 * Write a batch of queued messages in one transaction
+	 */
+	private async writeRows(rows: PendingRow[]) {
+		if (!this.insertStmt) {
+			this.insertStmt = this.database.prepare(
+				"INSERT INTO messages(network, channel, time, type, msg) VALUES(?, ?, ?, ?, ?)"
+			);
+		}
+
+		if (!this.statsStmt) {
+			this.statsStmt = this.database.prepare(channelStatsUpsert);
+		}
+
+		await this.serialize_run("BEGIN TRANSACTION");
+
+		try {
+			const ids: number[] = [];
+
+			for (const row of rows) {
+				ids.push(
+					await statement_run(
+						this.insertStmt,
+						row.network,
+						row.channel,
+						row.time,
+						row.type,
+						row.msg
+					)
+				);
+			}
+
+			for (const stats of channelStatsRows(rows, ids)) {
+				await statement_run(this.statsStmt, ...stats);
+			}
+		} catch (err) {
+			await this.serialize_run("ROLLBACK");
+			throw err;
+		}
+
+		await this.serialize_run("COMMIT");
 	}
 
 	async deleteChannel(network: Network, channel: Channel) {
@@ -416,11 +539,24 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return;
 		}
 
-		await this.serialize_run(
-			"DELETE FROM messages WHERE network = ? AND channel = ?",
-			network.uuid,
-			channel.name.toLowerCase()
-		);
+		await this.writes.exclusive(async () => {
+			await this.serialize_run("BEGIN TRANSACTION");
+
+			try {
+				for (const table of ["messages", "channel_stats"]) {
+					await this.serialize_run(
+						`DELETE FROM ${table} WHERE network = ? AND channel = ?`,
+						network.uuid,
+						channel.name.toLowerCase()
+					);
+				}
+			} catch (err) {
+				await this.serialize_run("ROLLBACK");
+				throw err;
+			}
+
+			await this.serialize_run("COMMIT");
+		});
 	}
 
 	async getMessages(
@@ -434,10 +570,12 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
+		await this.writes.flush();
+
 		// If unlimited history is specified, load 100k messages
 		const limit = Config.values.maxHistory < 0 ? 100000 : Config.values.maxHistory;
 
-		const rows = await this.serialize_fetchall(
+		const rows = await this.read_fetchall(
 			"SELECT msg, type, time FROM messages WHERE network = ? AND channel = ? ORDER BY time DESC LIMIT ?",
 			network.uuid,
 			channel.name.toLowerCase(),
@@ -466,11 +604,13 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			);
 		}
 
+		await this.writes.flush();
+
 		// Using the '@' character to escape '%' and '_' in patterns.
 		const escapedSearchTerm = query.searchTerm.replace(/([%_@])/g, "@$1");
 
 		let select =
-			'SELECT msg, type, time, network, channel FROM messages WHERE type = "message" AND json_extract(msg, "$.text") LIKE ? ESCAPE \'@\'';
+			'SELECT id, msg, type, time, network, channel FROM messages WHERE type = "message" AND json_extract(msg, "$.text") LIKE ? ESCAPE \'@\'';
 		const params: any[] = [`%${escapedSearchTerm}%`];
 
 		if (query.networkUuid) {
@@ -483,22 +623,36 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			params.push(query.channelName.toLowerCase());
 		}
 
+		// Keyset pagination, the offset is only still used by older clients
+		if (query.cursor) {
+			select += " AND (time, id) < (?, ?) ";
+			params.push(query.cursor.time, query.cursor.id);
+		}
+
 		const maxResults = 100;
 
-		select += " ORDER BY time DESC LIMIT ? OFFSET ? ";
+		select += " ORDER BY time DESC, id DESC LIMIT ? ";
 		params.push(maxResults);
-		params.push(query.offset);
 
-		const rows = await this.serialize_fetchall(select, ...params);
+		if (!query.cursor) {
+			select += "OFFSET ? ";
+			params.push(query.offset);
+		}
+
+		const rows = await this.read_fetchall(select, ...params);
+		const last = rows[rows.length - 1];
+
 		return {
 			...query,
 			results: parseSearchRowsToMessages(query.offset, rows).reverse(),
+			nextCursor: rows.length < maxResults ? null : {time: last.time, id: last.id},
 		};
 	}
 
 	async deleteMessages(req: DeletionRequest): Promise<number> {
 		await this.initDone.promise;
-		let sql = "delete from messages where id in (select id from messages where\n";
+		let sql =
+			"insert into temp.deleted_messages select id, network, channel, time from messages where\n";
 
 		// We roughly get a timestamp from N days before.
 		// We don't adjust for daylight savings time or other weird time jumps
@@ -518,9 +672,34 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 
 		sql += "order by time asc\n";
 		sql += `limit ${req.limit}\n`;
-		sql += ")";
 
-		return this.serialize_run(sql);
+		// channel_stats is adjusted in the same transaction
+		return this.writes.exclusive(async () => {
+			let changes: number;
+
+			await this.serialize_run("BEGIN TRANSACTION");
+
+			try {
+				for (const stmt of deletedMessagesTable) {
+					await this.serialize_run(stmt);
+				}
+
+				await this.serialize_run(sql);
+				changes = await this.serialize_run(
+					"DELETE FROM messages WHERE id IN (SELECT id FROM temp.deleted_messages)"
+				);
+
+				for (const stmt of channelStatsAfterDelete) {
+					await this.serialize_run(stmt);
+				}
+			} catch (err) {
+				await this.serialize_run("ROLLBACK");
+				throw err;
+			}
+
+			await this.serialize_run("COMMIT");
+			return changes;
+		});
 	}
 
 	/**
@@ -537,14 +716,12 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
-		const rows = await this.serialize_fetchall(
-			"SELECT msg, type, time FROM messages WHERE network = ? AND channel = ? ORDER BY time DESC LIMIT ?",
-			networkUuid,
-			channelName.toLowerCase(),
-			limit
-		);
+		await this.writes.flush();
 
-		return rows.reverse().map((row: any): Message => {
+		const query = lastMessagesQuery("msg, type, time", networkUuid, channelName, limit);
+		const rows = await this.read_fetchall(query.sql, ...query.params);
+
+		return rows.map((row: any): Message => {
 			const msg = JSON.parse(row.msg);
 			msg.time = row.time;
 			msg.type = row.type;
@@ -552,6 +729,78 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 		});
 	}
 
+	/**
+	 * Get last N messages and total count of many channels, one query per chunk of channels
+	 */
+	async getLastMessagesBatch(
+		channels: ChannelRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return channels.map(() => ({messages: [], totalMessages: 0}));
+		}
+
+		await this.writes.flush();
+
+		const results: ChannelHistory[] = [];
+
+		for (let i = 0; i < channels.length; i += lastMessagesBatchSize) {
+			const chunk = channels.slice(i, i + lastMessagesBatchSize);
+			const query = lastMessagesBatchQuery("msg, type, time", chunk, limit, beforeTime);
+			const rows = await this.read_fetchall(query.sql, ...query.params);
+
+			const histories = groupLastMessagesBatch(chunk, rows, (row): Message => {
+				const msg = JSON.parse(row.msg);
+				msg.time = row.time;
+				msg.type = row.type;
+				return new Msg(msg);
+			});
+
+			results.push(...histories);
+		}
+
+		return results;
+	}
+
+	/**
+	 * Get the messages of many channels that are newer than what a browser already has
+	 */
+	async getNewMessagesBatch(
+		channels: NewMessagesRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]> {
+		await this.initDone.promise;
+
+		if (!this.isEnabled) {
+			return channels.map(() => ({messages: [], totalMessages: 0}));
+		}
+
+		await this.writes.flush();
+
+		const results: ChannelHistory[] = [];
+
+		for (let i = 0; i < channels.length; i += lastMessagesBatchSize) {
+			const chunk = channels.slice(i, i + lastMessagesBatchSize);
+			const query = newMessagesBatchQuery("msg, type, time", chunk, limit, beforeTime);
+			const rows = await this.read_fetchall(query.sql, ...query.params);
+
+			const histories = groupLastMessagesBatch(chunk, rows, (row): Message => {
+				const msg = JSON.parse(row.msg);
+				msg.time = row.time;
+				msg.type = row.type;
+				return new Msg(msg);
+			});
+
+			results.push(...histories);
+		}
+
+		return results;
+	}
+
 	/**
 	 * Get messages before a specific timestamp (for lazy loading)
 	 */
@@ -567,15 +816,18 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return [];
 		}
 
-		const rows = await this.serialize_fetchall(
-			"SELECT msg, type, time FROM messages WHERE network = ? AND channel = ? AND time < ? ORDER BY time DESC LIMIT ?",
+		await this.writes.flush();
+
+		const query = lastMessagesQuery(
+			"msg, type, time",
 			networkUuid,
-			channelName.toLowerCase(),
-			beforeTime,
-			limit
+			channelName,
+			limit,
+			beforeTime
 		);
+		const rows = await this.read_fetchall(query.sql, ...query.params);
 
-		return rows.reverse().map((row: any): Message => {
+		return rows.map((row: any): Message => {
 			const msg = JSON.parse(row.msg);
 			msg.time = row.time;
 			msg.type = row.type;
@@ -593,8 +845,10 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 			return 0;
 		}
 
-		const row = await this.serialize_get(
-			"SELECT COUNT(*) as count FROM messages WHERE network = ? AND channel = ?",
+		await this.writes.flush();
+
+		const row = await this.read_get(
+			"SELECT count FROM channel_stats WHERE network = ? AND channel = ?",
 			networkUuid,
 			channelName.toLowerCase()
 		);
@@ -636,6 +890,22 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 		});
 	}
 
+	/**
+	 * Like serialize_fetchall, on the read only connection if there is one
+	 * Only for reads outside of transactions, after flushing the writes they have to see
+	 */
+	private read_fetchall(stmt: string, ...params: any[]): Promise<any[]> {
+		return this.reader
+			? fetchAll(this.reader, stmt, params)
+			: this.serialize_fetchall(stmt, ...params);
+	}
+
+	private read_get(stmt: string, ...params: any[]): Promise<any> {
+		return this.reader
+			? fetchOne(this.reader, stmt, params)
+			: this.serialize_get(stmt, ...params);
+	}
+
 	private serialize_get(stmt: string, ...params: any[]): Promise<any> {
 		return new Promise((resolve, reject) => {
 			this.database.serialize(() => {
@@ -652,6 +922,19 @@ class SqliteMessageStorage implements SearchableMessageStorage {
 	}
 }
 
+function statement_run(stmt: Statement, ...params: any[]): Promise<number> {
+	return new Promise((resolve, reject) => {
+		stmt.run(params, function (err) {
+			if (err) {
+				reject(err);
+				return;
+			}
+
+			resolve(this.lastID); // `this` is re-bound by sqlite3
+		});
+	});
+}
+
 // TODO: type any
 function parseSearchRowsToMessages(id: number, rows: any[]) {
 	const messages: Msg[] = [];
@@ -7,6 +7,21 @@ import Client from "../../client";
 import {SearchQuery, SearchResponse} from "../../../shared/types/storage";
 import type {MessageType} from "../../../shared/types/msg";
 
+export type ChannelRef = {
+	networkUuid: string;
+	channelName: string;
+};
+
+// A channel and the time of the newest message a browser already has of it
+export type NewMessagesRef = ChannelRef & {
+	afterTime: number;
+};
+
+export type ChannelHistory = {
+	messages: Message[];
+	totalMessages: number;
+};
+
 export type DeletionRequest = {
 	olderThanDays: number;
 	messageTypes: MessageType[] | null; // null means no restriction
@@ -20,6 +35,9 @@ interface MessageStorage {
 
 	close(): Promise<void>;
 
+	/**
+	 * Queue a message for writing, resolves once queued (reads flush pending writes first)
+	 */
 	index(network: Network, channel: Channel, msg: Message): Promise<void>;
 
 	deleteChannel(network: Network, channel: Channel): Promise<void>;
@@ -32,9 +50,31 @@ interface MessageStorage {
 	 */
 	getLastMessages(networkUuid: string, channelName: string, limit: number): Promise<Message[]>;
 
+	/**
+	 * Get last N messages and the total count of many channels at once, in the given order
+	 * Only messages older than beforeTime are considered when it is set
+	 */
+	getLastMessagesBatch(
+		channels: ChannelRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]>;
+
+	/**
+	 * Get the newest messages of many channels that are newer than their afterTime, in the
+	 * given order. Only messages older than beforeTime are considered when it is set
+	 */
+	getNewMessagesBatch(
+		channels: NewMessagesRef[],
+		limit: number,
+		beforeTime?: number
+	): Promise<ChannelHistory[]>;
+
 	/**
 	 * Get messages before a specific timestamp (for lazy loading)
 	 * Used when user scrolls up and clicks "Show older messages"
+	 * Like the other history reads, the page also has every other message sharing the time
+	 * of its oldest one, so the next page can use that time as its cursor
 	 */
 	getMessagesBefore(
 		networkUuid: string,
@@ -55,4 +95,15 @@ type SearchFunction = (query: SearchQuery) => Promise<SearchResponse>;
 
 export interface SearchableMessageStorage extends MessageStorage {
 	search: SearchFunction;
+
+	/**
+	 * Delete messages by age and type, oldest first, returns how many were deleted
+	 */
+	deleteMessages(req: DeletionRequest): Promise<number>;
+
+	/**
+	 * Give some of the space freed by deletes back to the file system
+	 * Resolves true if there is more to give back
+	 */
+	reclaimSpace?(): Promise<boolean>;
 }
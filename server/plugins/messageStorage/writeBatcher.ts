@@ -0,0 +1,106 @@
+import log from "../../log";
+
+type Waiter = {resolve: () => void; reject: (err: unknown) => void};
+
+/**
+ * Write-behind queue for message storage
+ *
+ * Collects rows and hands them to `write` in batches, either once `maxSize` rows are
+ * queued or `maxDelay` ms after the first queued row, whichever happens first.
+ * Batches (and any work passed to `exclusive`) never overlap, so `write` can wrap
+ * the batch in a single transaction.
+ *
+ * Each pushed item gets a promise that settles with the batch it was written in, a failed
+ * batch rejects the promises of its items while `flush` still resolves.
+ */
+export class WriteBatcher<T> {
+	private queue: T[];
+	private waiters: Waiter[];
+	private timer: ReturnType<typeof setTimeout> | null;
+	private pending: Promise<void>;
+	private write: (items: T[]) => Promise<void>;
+	private maxSize: number;
+	private maxDelay: number;
+
+	constructor(write: (items: T[]) => Promise<void>, maxSize = 100, maxDelay = 50) {
+		this.queue = [];
+		this.waiters = [];
+		this.timer = null;
+		this.pending = Promise.resolve();
+		this.write = write;
+		this.maxSize = maxSize;
+		this.maxDelay = maxDelay;
+	}
+
+	get size() {
+		return this.queue.length;
+	}
+
+	/**
+	 * Queue an item, resolves once it has been committed
+	 */
+	push(item: T): Promise<void> {
+		const written = new Promise<void>((resolve, reject) => {
+			this.waiters.push({resolve, reject});
+		});
+
+		this.queue.push(item);
+
+		if (this.queue.length >= this.maxSize) {
+			void this.flush();
+		} else if (!this.timer) {
+			this.timer = setTimeout(() => void this.flush(), this.maxDelay);
+		}
+
+		return written;
+	}
+
+	/**
+	 * Write out everything queued so far, resolves once it has been committed
+	 */
+	flush(): Promise<void> {
+		if (this.timer) {
+			clearTimeout(this.timer);
+			this.timer = null;
+		}
+
+		const items = this.queue;
+		const waiters = this.waiters;
+		this.queue = [];
+		this.waiters = [];
+
+		if (items.length === 0) {
+			return this.pending;
+		}
+
+		this.pending = this.pending.then(async () => {
+			try {
+				await this.write(items);
+			} catch (err: any) {
+				log.error(`Failed to write ${items.length} messages to storage: ${err}`);
+				waiters.forEach((waiter) => waiter.reject(err));
+				return;
+			}
+
+			waiters.forEach((waiter) => waiter.resolve());
+		});
+
+		return this.pending;
+	}
+
+	/**
+	 * Run `fn` once queued batches are written, without any batch running alongside it
+	 */
+	exclusive<R>(fn: () => Promise<R>): Promise<R> {
+		const result = this.flush().then(fn);
+
+		this.pending = result.then(
+			() => undefined,
+			() => undefined
+		);
+
+		return result;
+	}
+}
+
+export default WriteBatcher;
@@ -0,0 +1,255 @@
+import Config from "../config";
+import metrics, {single, stageSamples} from "../metrics";
+import {StageStats, traceBuckets} from "../trace";
+
+type Job = {
+	host: string;
+	open: boolean;
+	owners: Set<object>;
+	queuedAt: number;
+	start: () => void;
+	cancel: () => void;
+	abort: (() => void) | null; // set by the task once it runs
+	running: boolean;
+};
+
+export type PrefetchJob<T> = {
+	promise: Promise<T>;
+	/** Another message waits for the same fetch */
+	join(owner: object, open: boolean): void;
+};
+
+export class PrefetchCancelledError extends Error {
+	constructor() {
+		super("Prefetch cancelled");
+	}
+}
+
+/**
+ * Outgoing link prefetch requests of every user
+ *
+ * At most `prefetchMaxConcurrency` requests run at once, and `prefetchMaxHostConcurrency` to
+ * the same host, the others wait in order. Requests for a channel that is open in a browser
+ * go first. Each request is owned by the messages that wait for it, once they all fall out
+ * of history it's dropped from the queue, or aborted if it already runs.
+ */
+class PrefetchQueue {
+	// Requests for open channels, then the others
+	private queues: [Job[], Job[]] = [[], []];
+	private running = new Set<Job>();
+	private hosts = new Map<string, number>();
+	private jobsOf = new WeakMap<object, Set<Job>>();
+	private dropped = new WeakSet<object>();
+
+	private cancelled = 0;
+	private wait: StageStats = {
+		count: 0,
+		totalMs: 0,
+		maxMs: 0,
+		buckets: new Array(traceBuckets.length + 1).fill(0),
+	};
+
+	constructor() {
+		metrics.collect(() => {
+			const stats = this.stats();
+
+			return [
+				single("thelounge_prefetch_queued", "Prefetches waiting", "gauge", stats.queued),
+				single("thelounge_prefetch_running", "Prefetches running", "gauge", stats.running),
+				single(
+					"thelounge_prefetch_cancelled_total",
+					"Prefetches dropped with the messages they were for",
+					"counter",
+					stats.cancelled
+				),
+				{
+					name: "thelounge_prefetch_wait_seconds",
+					help: "Time link prefetches waited for a free slot",
+					type: "histogram",
+					samples: stageSamples("thelounge_prefetch_wait_seconds", {}, stats.wait),
+				},
+			];
+		});
+	}
+
+	/**
+	 * Run `task` once there is a free slot
+	 *
+	 * @param owner - message the request is for
+	 * @param open - whether the message is in a channel that is open in a browser
+	 * @param task - the request, which passes how to abort it to `onAbort`
+	 */
+	run<T>(
+		host: string,
+		owner: object,
+		open: boolean,
+		task: (onAbort: (abort: () => void) => void) => Promise<T>
+	): PrefetchJob<T> {
+		let job!: Job;
+
+		const promise = new Promise<T>((resolve, reject) => {
+			job = {
+				host,
+				open,
+				owners: new Set(),
+				queuedAt: Date.now(),
+				abort: null,
+				running: false,
+				start: () => {
+					void task((abort) => (job.abort = abort))
+						.then(resolve, reject)
+						.finally(() => this.finish(job));
+				},
+				cancel: () => reject(new PrefetchCancelledError()),
+			};
+		});
+
+		this.addOwner(job, owner);
+		this.queues[open ? 0 : 1].push(job);
+		this.dispatch();
+
+		return {
+			promise,
+			join: (other, otherIsOpen) => {
+				this.addOwner(job, other);
+
+				if (otherIsOpen && !job.open) {
+					job.open = true;
+
+					if (!job.running) {
+						this.remove(job);
+						this.queues[0].push(job);
+						this.dispatch();
+					}
+				}
+			},
+		};
+	}
+
+	/**
+	 * Drop the requests of messages that are no longer kept
+	 */
+	cancel(owners: object[]) {
+		for (const owner of owners) {
+			const jobs = this.jobsOf.get(owner);
+
+			this.dropped.add(owner);
+
+			if (!jobs) {
+				continue;
+			}
+
+			this.jobsOf.delete(owner);
+
+			for (const job of jobs) {
+				job.owners.delete(owner);
+
+				if (job.owners.size > 0) {
+					continue;
+				}
+
+				this.cancelled++;
+
+				if (job.running) {
+					job.abort?.();
+				} else {
+					this.remove(job);
+					job.cancel();
+				}
+			}
+		}
+	}
+
+	/**
+	 * Whether the requests of a message were dropped, shared ones may still finish
+	 */
+	isCancelled(owner: object) {
+		return this.dropped.has(owner);
+	}
+
+	stats() {
+		return {
+			queued: this.queues[0].length + this.queues[1].length,
+			running: this.running.size,
+			cancelled: this.cancelled,
+			wait: this.wait,
+		};
+	}
+
+	private addOwner(job: Job, owner: object) {
+		job.owners.add(owner);
+
+		let jobs = this.jobsOf.get(owner);
+
+		if (!jobs) {
+			jobs = new Set();
+			this.jobsOf.set(owner, jobs);
+		}
+
+		jobs.add(job);
+	}
+
+	private remove(job: Job) {
+		const queue = this.queues[job.open ? 0 : 1];
+		const index = queue.indexOf(job);
+
+		if (index > -1) {
+			queue.splice(index, 1);
+		}
+	}
+
+	private dispatch() {
+		const maxRunning = Config.values.prefetchMaxConcurrency || Infinity;
+		const maxPerHost = Config.values.prefetchMaxHostConcurrency || Infinity;
+
+		for (const queue of this.queues) {
+			// Requests to a busy host are skipped, so they don't hold up the others
+			for (let i = 0; i < queue.length && this.running.size < maxRunning; ) {
+				const job = queue[i];
+				const hostRunning = this.hosts.get(job.host) || 0;
+
+				if (hostRunning >= maxPerHost) {
+					i++;
+					continue;
+				}
+
+				queue.splice(i, 1);
+				this.hosts.set(job.host, hostRunning + 1);
+				this.running.add(job);
+				this.recordWait(Date.now() - job.queuedAt);
+
+				job.running = true;
+				job.start();
+			}
+		}
+	}
+
+	private finish(job: Job) {
+		const hostRunning = (this.hosts.get(job.host) || 1) - 1;
+
+		if (hostRunning > 0) {
+			this.hosts.set(job.host, hostRunning);
+		} else {
+			this.hosts.delete(job.host);
+		}
+
+		this.running.delete(job);
+
+		for (const owner of job.owners) {
+			this.jobsOf.get(owner)?.delete(job);
+		}
+
+		this.dispatch();
+	}
+
+	private recordWait(ms: number) {
+		this.wait.count++;
+		this.wait.totalMs += ms;
+		this.wait.maxMs = Math.max(this.wait.maxMs, ms);
+
+		const bucket = traceBuckets.findIndex((bound) => ms <= bound);
+		this.wait.buckets[bucket === -1 ? traceBuckets.length : bucket]++;
+	}
+}
+
+export default new PrefetchQueue();
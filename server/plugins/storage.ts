@@ -4,8 +4,92 @@ import path from "path";
 import crypto from "crypto";
 import Config from "../config";
 
+// Stored files that no message refers to yet are deleted after this long (ms)
+const orphanAge = 60 * 1000;
+
+/**
+ * A file being downloaded into storage, hashed while it's written to a temporary file
+ */
+export class StorageUpload {
+	size = 0;
+	private hash = crypto.createHash("sha256");
+	private file: fs.WriteStream;
+	private failed = false;
+
+	constructor(private storage: Storage, private tempPath: string) {
+		this.file = fs.createWriteStream(tempPath);
+		this.file.on("error", (err) => {
+			if (!this.failed) {
+				this.failed = true;
+				log.error("Failed to store a file", err.message);
+			}
+		});
+	}
+
+	/**
+	 * @returns false once the file is behind, pause the source until `drain` calls back
+	 */
+	write(chunk: Buffer): boolean {
+		this.size += chunk.length;
+		this.hash.update(chunk);
+		return this.file.write(chunk) || this.failed;
+	}
+
+	/**
+	 * Call back when the file takes more data, or failed and won't take anything anymore
+	 */
+	drain(callback: () => void) {
+		if (this.failed) {
+			return callback();
+		}
+
+		const done = () => {
+			this.file.off("drain", done);
+			this.file.off("error", done);
+			callback();
+		};
+
+		this.file.once("drain", done);
+		this.file.once("error", done);
+	}
+
+	/**
+	 * Move the file to its content addressed place in storage
+	 *
+	 * No message refers to it until a reference is taken with `claim`.
+	 *
+	 * @returns its storage url, or "" if it could not be stored
+	 */
+	commit(extension: string): Promise<string> {
+		return new Promise((resolve) => {
+			this.file.end(() => {
+				if (this.failed) {
+					this.discard();
+					return resolve("");
+				}
+
+				const hash = this.hash.digest("hex");
+				const name = `${hash.substring(0, 2)}/${hash.substring(2, 4)}/${hash.substring(4)}`;
+
+				this.storage.place(this.tempPath, `storage/${name}.${extension}`, resolve);
+			});
+		});
+	}
+
+	discard() {
+		this.file.destroy();
+		fs.unlink(this.tempPath, () => {
+			// Already gone along with the storage folder
+		});
+	}
+}
+
 class Storage {
 	references: Map<string, number>;
+	// Stored files without references, with the time they were stored
+	private orphans = new Map<string, number>();
+	private orphanTimer: NodeJS.Timeout | null = null;
+
 	constructor() {
 		this.references = new Map();
 	}
@@ -29,6 +113,40 @@ class Storage {
 		items.forEach((item) => deleteFolder(path.join(dir, item)));
 	}
 
+	/**
+	 * Start downloading a file into storage
+	 */
+	upload() {
+		const dir = path.join(Config.getStoragePath(), "tmp");
+		fs.mkdirSync(dir, {recursive: true});
+
+		return new StorageUpload(this, path.join(dir, crypto.randomBytes(16).toString("hex")));
+	}
+
+	/**
+	 * Take the first reference to a file stored by an upload
+	 */
+	claim(url: string) {
+		this.orphans.delete(url);
+		this.references.set(url, 1 + (this.references.get(url) || 0));
+	}
+
+	/**
+	 * Take another reference to a stored file
+	 *
+	 * @returns false if the file is no longer stored
+	 */
+	reference(url: string) {
+		const references = this.references.get(url);
+
+		if (!references) {
+			return false;
+		}
+
+		this.references.set(url, references + 1);
+		return true;
+	}
+
 	dereference(url) {
 		const references = (this.references.get(url) || 0) - 1;
 
@@ -52,39 +170,80 @@ class Storage {
 		});
 	}
 
-	store(data, extension: string, callback: (url: string) => void) {
-		const hash = crypto.createHash("sha256").update(data).digest("hex");
-		const a = hash.substring(0, 2);
-		const b = hash.substring(2, 4);
-		const folder = path.join(Config.getStoragePath(), a, b);
-		const filePath = path.join(folder, `${hash.substring(4)}.${extension}`);
-		const url = `storage/${a}/${b}/${hash.substring(4)}.${extension}`;
+	/**
+	 * Move a finished upload to `url`, or drop it if the same file is stored already
+	 */
+	place(tempPath: string, url: string, callback: (url: string) => void) {
+		// Drop "storage/" from url and join it with full storage path
+		const filePath = path.join(Config.getStoragePath(), url.substring(8));
+		const stored = () => {
+			if (!this.references.has(url)) {
+				this.orphans.set(url, Date.now());
+				this.scheduleOrphanCleanup();
+			}
 
-		this.references.set(url, 1 + (this.references.get(url) || 0));
+			callback(url);
+		};
 
 		// If file with this name already exists, we don't need to write it again
 		if (fs.existsSync(filePath)) {
-			return callback(url);
+			fs.unlink(tempPath, () => stored());
+			return;
 		}
 
-		fs.mkdir(folder, {recursive: true}, (mkdirErr) => {
+		fs.mkdir(path.dirname(filePath), {recursive: true}, (mkdirErr) => {
 			if (mkdirErr) {
 				log.error("Failed to create storage folder", mkdirErr.message);
-
-				return callback("");
+				fs.unlink(tempPath, () => callback(""));
+				return;
 			}
 
-			fs.writeFile(filePath, data, (err) => {
+			fs.rename(tempPath, filePath, (err) => {
 				if (err) {
 					log.error("Failed to store a file", err.message);
-
-					return callback("");
+					fs.unlink(tempPath, () => callback(""));
+					return;
 				}
 
-				callback(url);
+				stored();
 			});
 		});
 	}
+
+	/**
+	 * Delete stored files that are still not referenced by any message
+	 */
+	removeOrphans(now = Date.now()) {
+		for (const [url, storedAt] of this.orphans) {
+			if (now - storedAt < orphanAge) {
+				continue;
+			}
+
+			this.orphans.delete(url);
+
+			if (!this.references.has(url)) {
+				fs.unlink(path.join(Config.getStoragePath(), url.substring(8)), () => {
+					// Already gone along with the storage folder
+				});
+			}
+		}
+
+		if (this.orphans.size > 0) {
+			this.scheduleOrphanCleanup();
+		}
+	}
+
+	private scheduleOrphanCleanup() {
+		if (this.orphanTimer) {
+			return;
+		}
+
+		this.orphanTimer = setTimeout(() => {
+			this.orphanTimer = null;
+			this.removeOrphans();
+		}, orphanAge);
+		this.orphanTimer.unref();
+	}
 }
 
 export default new Storage();
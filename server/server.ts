@@ -16,6 +16,10 @@ import Uploader from "./plugins/uploader";
 import Helper from "./helper";
 import Config, {ConfigType} from "./config";
 import Identification from "./identification";
+import shard from "./shard";
+import metrics from "./metrics";
+import {applyClientSetting} from "./clientSettings";
+import WebPush from "./plugins/webpush";
 import changelog from "./plugins/changelog";
 import inputs from "./plugins/inputs";
 import Auth from "./plugins/auth";
@@ -33,7 +37,7 @@ import type {
 	SocketData,
 	AuthPerformData,
 } from "../shared/types/socket-events";
-import {ChanType} from "../shared/types/chan";
+import {ChanType, HistoryMarks} from "../shared/types/chan";
 import {
 	LockedSharedConfiguration,
 	SharedConfiguration,
@@ -62,7 +66,8 @@ export type Server = ioServer<
 >;
 
 // A random number that will force clients to reload the page if it differs
-const serverHash = Math.floor(Date.now() * Math.random());
+// Shards use the one of their router, so moving between them doesn't reload
+const serverHash = shard.serverHash ?? Math.floor(Date.now() * Math.random());
 
 let manager: ClientManager | null = null;
 
@@ -77,6 +82,39 @@ export default async function (
 	})`);
 	log.info(`Configuration file: ${colors.green(Config.getConfigPath())}`);
 
+	const router =
+		Config.values.shards > 1 && !shard.isShard
+			? (await import("./shardRouter")).default
+			: null;
+
+	if (shard.isShard) {
+		// The router handles TLS and sets X-Forwarded-* on every request
+		Config.values.https.enable = false;
+		Config.values.reverseProxy = true;
+		// Would only know the connections of this shard
+		Config.values.identd.enable = false;
+		Config.values.oidentd = undefined;
+
+		log.info(`Shard ${shard.index + 1} of ${shard.count}`);
+	} else if (router && (Config.values.identd.enable || Config.values.oidentd)) {
+		log.warn("Identd and oidentd are not available with more than one shard.");
+	}
+
+	if (!shard.isShard) {
+		// Storage is emptied on start and previews are a cache, nothing in them is lost
+		const stale = shard.removeStale(
+			Config.getHomePath(),
+			["storage", "link-previews.json"],
+			router ? Config.values.shards : 0
+		);
+
+		if (stale.length > 0) {
+			log.info(`Removed files of shards that no longer exist: ${stale.join(", ")}`);
+		}
+	}
+
+	metrics.start();
+
 	const staticOptions = {
 		redirect: false,
 		maxAge: 86400 * 1000,
@@ -93,6 +131,7 @@ export default async function (
 		.use(allRequests)
 		.use(addSecurityHeaders)
 		.get("/", indexRequest)
+		.get("/metrics", metrics.request)
 		.get("/service-worker.js", forceNoCacheRequest)
 		.get("/js/bundle.js.map", forceNoCacheRequest)
 		.get("/css/style.css.map", forceNoCacheRequest)
@@ -157,10 +196,11 @@ export default async function (
 	}
 
 	let server: import("http").Server | import("https").Server;
+	const handler = router ? router.request : app;
 
 	if (!Config.values.https.enable) {
 		const createServer = (await import("http")).createServer;
-		server = createServer(app);
+		server = createServer(handler);
 	} else {
 		const keyPath = Helper.expandHome(Config.values.https.key);
 		const certPath = Helper.expandHome(Config.values.https.certificate);
@@ -188,7 +228,7 @@ export default async function (
 				cert: fs.readFileSync(certPath),
 				ca: caPath ? fs.readFileSync(caPath) : undefined,
 			},
-			app
+			handler
 		);
 	}
 
@@ -199,7 +239,9 @@ export default async function (
 				host: string | undefined;
 		  };
 
-	if (typeof Config.values.host === "string" && Config.values.host.startsWith("unix:")) {
+	if (shard.isShard) {
+		listenParams = shard.socketPath;
+	} else if (typeof Config.values.host === "string" && Config.values.host.startsWith("unix:")) {
 		listenParams = Config.values.host.replace(/^unix:/, "");
 	} else {
 		listenParams = {
@@ -238,6 +280,20 @@ export default async function (
 			return;
 		}
 
+		// Users are served by the shards
+		if (router) {
+			server.on("upgrade", router.upgrade);
+
+			// Creates the push keys once, instead of every shard racing to
+			new WebPush();
+			router.start(Config.values.shards, serverHash);
+
+			const stopShards = () => void router.stop().then(() => process.exit(0));
+			process.on("SIGINT", stopShards);
+			process.on("SIGTERM", stopShards);
+			return;
+		}
+
 		const sockets: Server = new ioServer(server, {
 			wsEngine: wsServer,
 			cookie: false,
@@ -246,6 +302,11 @@ export default async function (
 			// TODO: type as Server.Transport[]
 			transports: Config.values.transports as any,
 			pingTimeout: 60000,
+
+			// Most frames are single chat lines, not worth the compression overhead
+			perMessageDeflate: Config.values.perMessageDeflate
+				? {threshold: 1024, zlibDeflateOptions: {level: 1}}
+				: false,
 		});
 
 		sockets.on("connect", (socket) => {
@@ -309,6 +370,10 @@ export default async function (
 				manager.clients.forEach((client) => client.quit());
 			}
 
+			if (Config.values.prefetch) {
+				(await import("./plugins/linkPreviewCache")).default.saveSync();
+			}
+
 			if (Config.values.prefetchStorage) {
 				log.info("Clearing prefetch storage folder, this might take a while...");
 
@@ -739,42 +804,7 @@ function initializeClient(
 	socket.on("sessions:get", sendSessionList);
 
 	if (!Config.values.public) {
-		socket.on("setting:set", (newSetting) => {
-			if (!_.isPlainObject(newSetting)) {
-				return;
-			}
-
-			if (
-				typeof newSetting.value === "object" ||
-				typeof newSetting.name !== "string" ||
-				newSetting.name[0] === "_"
-			) {
-				return;
-			}
-
-			// We do not need to do write operations and emit events if nothing changed.
-			if (client.config.clientSettings[newSetting.name] !== newSetting.value) {
-				client.config.clientSettings[newSetting.name] = newSetting.value;
-
-				// Pass the setting to all clients.
-				client.emit("setting:new", {
-					name: newSetting.name,
-					value: newSetting.value,
-				});
-
-				client.save();
-
-				if (newSetting.name === "highlights" || newSetting.name === "highlightExceptions") {
-					client.compileCustomHighlights();
-				} else if (newSetting.name === "awayMessage") {
-					if (typeof newSetting.value !== "string") {
-						newSetting.value = "";
-					}
-
-					client.awayMessage = newSetting.value;
-				}
-			}
-		});
+		socket.on("setting:set", (newSetting) => applyClientSetting(client, newSetting));
 
 		socket.on("setting:get", () => {
 			if (!Object.prototype.hasOwnProperty.call(client.config, "clientSettings")) {
@@ -1112,7 +1142,8 @@ function initializeIrssiClient(
 	client: IrssiClient,
 	token: string,
 	lastMessage: number,
-	openChannel: number
+	openChannel: number,
+	historyMarks?: HistoryMarks
 ) {
 	socket.off("auth:perform", performAuthentication);
 	socket.emit("auth:success");
@@ -1123,7 +1154,7 @@ function initializeIrssiClient(
 	const continueInit = (tokenToSend?: string) => {
 		// Attach browser to IrssiClient
 		// Pass token so it's included in init event payload
-		client.attachBrowser(socket, openChannel, tokenToSend);
+		client.attachBrowser(socket, openChannel, tokenToSend, historyMarks);
 
 		// Send commands list
 		socket.emit("commands", inputs.getCommands());
@@ -1170,7 +1201,7 @@ function initializeIrssiClient(
 			const history = await client.more(data);
 
 			if (history !== null) {
-				socket.emit("more", history);
+				client.sendMore(socket, history);
 			}
 		}
 	});
@@ -1213,7 +1244,32 @@ function initializeIrssiClient(
 		client.handlePartChannel(socket.id, data);
 	});
 
+	socket.on("mentions:get", async () => {
+		socket.emit("mentions:list", await client.getMentions());
+	});
+
+	// Older pages of mentions, before the oldest one the browser has
+	socket.on("mentions:more", async (before) => {
+		if (typeof before === "number") {
+			socket.emit("mentions:more", await client.getMentions(before));
+		}
+	});
+
+	socket.on("mentions:dismiss", (msgId) => {
+		if (typeof msgId === "number") {
+			client.dismissMentions(msgId);
+		}
+	});
+
+	socket.on("mentions:dismiss_all", () => {
+		client.dismissMentions();
+	});
+
 	// Handle settings
+	if (!Config.values.public) {
+		socket.on("setting:set", (newSetting) => applyClientSetting(client, newSetting));
+	}
+
 	socket.on("setting:get", () => {
 		if (!Object.prototype.hasOwnProperty.call(client.config, "clientSettings")) {
 			socket.emit("setting:all", {});
@@ -1335,16 +1391,26 @@ function initializeIrssiClient(
 				client.config.irssiConnection.port
 			);
 
-			// Derive message storage encryption key
+			// Derive message storage encryption key, the same way as login() does
 			const crypto = await import("crypto");
-			client.encryptionKey = crypto.pbkdf2Sync(
-				client.userPassword!,
+			const encryptionKey = crypto.pbkdf2Sync(
 				client.irssiPassword,
+				"irssi-message-storage-v1",
 				10000,
 				32,
 				"sha256"
 			);
 
+			// It only wraps the data key of message storage, the messages stay as they are
+			if (client.messageStorage && client.encryptionKey) {
+				await client.messageStorage.changeEncryptionKey(
+					client.encryptionKey,
+					encryptionKey
+				);
+			}
+
+			client.encryptionKey = encryptionKey;
+
 			log.info(`Encryption keys re-derived for user ${client.name}`);
 
 			// Reconnect to irssi with new settings
@@ -1553,6 +1619,13 @@ function performAuthentication(this: Socket, data: AuthPerformData) {
 			openChannel = data.openChannel;
 		}
 
+		// Newest cached message of each channel, so init only has to send newer ones
+		let historyMarks: HistoryMarks | undefined;
+
+		if (data && "historyMarks" in data && _.isPlainObject(data.historyMarks)) {
+			historyMarks = data.historyMarks;
+		}
+
 		// TODO: remove this once the logic is cleaned up
 		if (!client) {
 			throw new Error("finalInit called with undefined client, this is a bug");
@@ -1564,7 +1637,8 @@ function performAuthentication(this: Socket, data: AuthPerformData) {
 			client as unknown as IrssiClient,
 			token,
 			lastMessage,
-			openChannel
+			openChannel,
+			historyMarks
 		);
 	};
 
@@ -1625,6 +1699,17 @@ function performAuthentication(this: Socket, data: AuthPerformData) {
 		return;
 	}
 
+	// Routed by a stale cookie, the client signs in again
+	if (!shard.ownsUser(data.user)) {
+		log.warn(
+			`Authentication for ${colors.bold(data.user)}, a user of another shard, from ${colors.bold(
+				getClientIp(socket)
+			)}`
+		);
+		socket.emit("auth:failed");
+		return;
+	}
+
 	const authCallback = async (success: boolean) => {
 		// Authorization failed
 		if (!success) {
@@ -1665,6 +1750,13 @@ function performAuthentication(this: Socket, data: AuthPerformData) {
 				socket.emit("auth:failed");
 				return;
 			}
+		} else {
+			// Lazily loaded or hibernated users come back on sign in with a token too
+			try {
+				await (client as unknown as IrssiClient).activate();
+			} catch (error) {
+				log.error(`Failed to activate irssi user ${colors.bold(data.user)}: ${error}`);
+			}
 		}
 
 		initClient();
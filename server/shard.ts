@@ -0,0 +1,105 @@
+import crypto from "crypto";
+import fs from "fs";
+import path from "path";
+import escapeRegExp from "lodash/escapeRegExp";
+
+/**
+ * Which users this process serves, when they are spread over `shards` processes
+ *
+ * The process that is started routes requests to the ones it forks and serves no users
+ * itself, see shardRouter.ts. Each user belongs to one shard, picked by a hash of the
+ * lowercased name, so its config file, message storage and irssi connection are only ever
+ * used by one process. Shards are told their place through THELOUNGE_SHARD ("index/count").
+ */
+
+class Shard {
+	index = 0;
+	count = 0; // 0 unless this process is a shard
+	socketPath = "";
+	serverHash: number | null = null;
+
+	constructor() {
+		const [index, count] = (process.env.THELOUNGE_SHARD || "").split("/").map(Number);
+
+		if (count > 1 && index >= 0 && index < count) {
+			this.index = index;
+			this.count = count;
+			this.socketPath = process.env.THELOUNGE_SHARD_SOCKET || "";
+			this.serverHash = Number(process.env.THELOUNGE_SERVER_HASH) || null;
+		}
+	}
+
+	get isShard() {
+		return this.count > 1;
+	}
+
+	/**
+	 * Shard a user belongs to, out of `count`
+	 */
+	indexOf(name: string, count = this.count) {
+		const hash = crypto.createHash("sha1").update(name.toLowerCase()).digest();
+		return hash.readUInt32BE(0) % count;
+	}
+
+	ownsUser(name: string) {
+		return !this.isShard || this.indexOf(name) === this.index;
+	}
+
+	/**
+	 * Name of a file or folder in the home directory that each shard keeps for itself
+	 */
+	own(name: string) {
+		if (!this.isShard) {
+			return name;
+		}
+
+		const ext = path.extname(name);
+		return `${name.slice(0, name.length - ext.length)}-${this.index}${ext}`;
+	}
+
+	/**
+	 * Remove what `own` named in `dir` for shards beyond `count`, left behind when `shards`
+	 * was lowered or sharding turned off
+	 *
+	 * @returns the removed names
+	 */
+	removeStale(dir: string, names: string[], count: number) {
+		const patterns = names.map((name) => {
+			const ext = path.extname(name);
+			const base = name.slice(0, name.length - ext.length);
+			return new RegExp(`^${escapeRegExp(base)}-(\\d+)${escapeRegExp(ext)}$`);
+		});
+		const removed: string[] = [];
+		let entries: string[];
+
+		try {
+			entries = fs.readdirSync(dir);
+		} catch {
+			return removed;
+		}
+
+		for (const entry of entries) {
+			const index = patterns.map((pattern) => pattern.exec(entry)).find(Boolean)?.[1];
+
+			if (index !== undefined && Number(index) >= count) {
+				fs.rmSync(path.join(dir, entry), {recursive: true, force: true});
+				removed.push(entry);
+			}
+		}
+
+		return removed;
+	}
+
+	/**
+	 * Environment of a forked shard
+	 */
+	env(index: number, count: number, socketPath: string, serverHash: number) {
+		return {
+			THELOUNGE_SHARD: `${index}/${count}`,
+			THELOUNGE_SHARD_SOCKET: socketPath,
+			THELOUNGE_SERVER_HASH: String(serverHash),
+		};
+	}
+}
+
+export default new Shard();
@@ -0,0 +1,279 @@
+import http, {IncomingHttpHeaders, IncomingMessage, ServerResponse} from "http";
+import net from "net";
+import os from "os";
+import path from "path";
+import fs from "fs";
+import {Duplex} from "stream";
+import {fork, ChildProcess} from "child_process";
+import colors from "chalk";
+
+import log from "./log";
+import Config from "./config";
+import shard from "./shard";
+import metrics, {Family} from "./metrics";
+import {shardCookie} from "../shared/shard";
+
+// A shard that exits is started again after this long (ms)
+const restartDelay = 5000;
+
+// Only meant for the next hop, not passed on
+const hopByHopHeaders = [
+	"connection",
+	"keep-alive",
+	"proxy-authenticate",
+	"proxy-authorization",
+	"te",
+	"trailer",
+	"transfer-encoding",
+	"upgrade",
+];
+
+type ShardProcess = {
+	index: number;
+	socketPath: string;
+	child: ChildProcess | null;
+};
+
+/**
+ * User a request is for, from the cookie the client sets when signing in
+ */
+export function requestUser(cookieHeader: string | undefined): string | null {
+	for (const cookie of (cookieHeader || "").split(";")) {
+		const [name, ...value] = cookie.trim().split("=");
+
+		if (name === shardCookie) {
+			try {
+				return decodeURIComponent(value.join("=")) || null;
+			} catch (e) {
+				return null;
+			}
+		}
+	}
+
+	return null;
+}
+
+/**
+ * Runs in the process that is started when `shards` is set, instead of serving users
+ *
+ * Forks the shards with the same command line, each listening on its own local socket,
+ * and proxies every request and socket.io upgrade to the shard of the user in its cookie.
+ * Requests without one, like the sign in page, go to the first shard. Shards trust the
+ * X-Forwarded-* headers set here for the client address.
+ */
+class ShardRouter {
+	private shards: ShardProcess[] = [];
+	private stopping = false;
+
+	start(count: number, serverHash: number) {
+		for (let index = 0; index < count; index++) {
+			const socketPath =
+				process.platform === "win32"
+					? path.join("\\\\?\\pipe", `thelounge-${process.pid}-${index}`)
+					: path.join(os.tmpdir(), `thelounge-${process.pid}-${index}.sock`);
+
+			const target: ShardProcess = {index, socketPath, child: null};
+			this.shards.push(target);
+			this.fork(target, count, serverHash);
+		}
+
+		log.info(`Serving users from ${colors.bold(count.toString())} shards`);
+	}
+
+	/**
+	 * Stop the shards, resolves once all of them exited
+	 */
+	stop(): Promise<void> {
+		this.stopping = true;
+
+		return Promise.all(
+			this.shards.map(
+				({child}) =>
+					new Promise<void>((resolve) => {
+						if (!child || child.exitCode !== null) {
+							resolve();
+							return;
+						}
+
+						child.once("exit", () => resolve());
+						child.kill("SIGTERM");
+					})
+			)
+		).then(() => undefined);
+	}
+
+	request = (req: IncomingMessage, res: ServerResponse) => {
+		if ((req.url || "").split("?")[0] === "/metrics") {
+			this.metrics(req, res);
+			return;
+		}
+
+		const target = this.target(req);
+		const proxied = http.request(
+			{
+				socketPath: target.socketPath,
+				method: req.method,
+				path: req.url,
+				headers: this.forwardedHeaders(req, false),
+			},
+			(shardRes) => {
+				res.writeHead(shardRes.statusCode || 502, stripHopByHop(shardRes.headers));
+				shardRes.pipe(res);
+			}
+		);
+
+		proxied.on("error", (err) => {
+			log.debug(`Request to shard ${target.index} failed: ${err.message}`);
+
+			if (!res.headersSent) {
+				res.writeHead(502);
+			}
+
+			res.end();
+		});
+
+		req.pipe(proxied);
+	};
+
+	upgrade = (req: IncomingMessage, socket: Duplex, head: Buffer) => {
+		const target = this.target(req);
+		const upstream = net.connect(target.socketPath);
+		const close = () => {
+			upstream.destroy();
+			socket.destroy();
+		};
+
+		upstream.on("error", close);
+		upstream.on("close", close);
+		socket.on("error", close);
+		socket.on("close", close);
+
+		upstream.on("connect", () => {
+			let request = `${req.method || "GET"} ${req.url || "/"} HTTP/${req.httpVersion}\r\n`;
+
+			for (const [name, value] of Object.entries(this.forwardedHeaders(req, true))) {
+				for (const line of Array.isArray(value) ? value : [value]) {
+					request += `${name}: ${line}\r\n`;
+				}
+			}
+
+			upstream.write(request + "\r\n");
+
+			if (head.length > 0) {
+				upstream.write(head);
+			}
+
+			upstream.pipe(socket);
+			socket.pipe(upstream);
+		});
+	};
+
+	/**
+	 * Metrics of the router and every shard in one response, labeled with where they are from
+	 */
+	private metrics(req: IncomingMessage, res: ServerResponse) {
+		if (!metrics.allowed(req, res)) {
+			return;
+		}
+
+		void Promise.all(
+			this.shards.map((target) =>
+				this.shardMetrics(target).then(
+					(families) => ({labels: {shard: String(target.index)}, families}),
+					(err: Error) => {
+						log.debug(`Metrics of shard ${target.index} failed: ${err.message}`);
+						return {labels: {}, families: []};
+					}
+				)
+			)
+		).then((sources) => {
+			const own = {labels: {shard: "router"}, families: metrics.families()};
+			metrics.respond(res, metrics.merge([own, ...sources]));
+		});
+	}
+
+	private shardMetrics(target: ShardProcess): Promise<Family[]> {
+		return new Promise((resolve, reject) => {
+			http.get({socketPath: target.socketPath, path: "/metrics"}, (shardRes) => {
+				let body = "";
+
+				shardRes.setEncoding("utf8");
+				shardRes.on("data", (chunk: string) => (body += chunk));
+				shardRes.on("end", () => {
+					try {
+						resolve(JSON.parse(body));
+					} catch (e: any) {
+						reject(e);
+					}
+				});
+			}).on("error", reject);
+		});
+	}
+
+	private target(req: IncomingMessage) {
+		const user = requestUser(req.headers.cookie);
+		return this.shards[user ? shard.indexOf(user, this.shards.length) : 0];
+	}
+
+	private forwardedHeaders(req: IncomingMessage, upgrade: boolean): IncomingHttpHeaders {
+		const headers = upgrade ? {...req.headers} : stripHopByHop(req.headers);
+		const address = req.socket.remoteAddress || "";
+		const secure = (req.socket as {encrypted?: boolean}).encrypted === true;
+
+		// Only kept when coming from a trusted proxy, shards always trust them
+		if (Config.values.reverseProxy && headers["x-forwarded-for"]) {
+			headers["x-forwarded-for"] = `${String(headers["x-forwarded-for"])}, ${address}`;
+		} else {
+			headers["x-forwarded-for"] = address;
+		}
+
+		if (!Config.values.reverseProxy || !headers["x-forwarded-proto"]) {
+			headers["x-forwarded-proto"] = secure ? "https" : "http";
+		}
+
+		return headers;
+	}
+
+	private fork(target: ShardProcess, count: number, serverHash: number) {
+		if (process.platform !== "win32") {
+			fs.rmSync(target.socketPath, {force: true});
+		}
+
+		const child = fork(process.argv[1], process.argv.slice(2), {
+			env: {
+				...process.env,
+				...shard.env(target.index, count, target.socketPath, serverHash),
+			},
+		});
+
+		target.child = child;
+
+		child.on("exit", (code, signal) => {
+			target.child = null;
+
+			if (this.stopping) {
+				return;
+			}
+
+			log.error(
+				`Shard ${target.index} exited (${String(code ?? signal)}), restarting in ${
+					restartDelay / 1000
+				} seconds`
+			);
+
+			setTimeout(() => this.fork(target, count, serverHash), restartDelay);
+		});
+	}
+}
+
+function stripHopByHop(headers: IncomingHttpHeaders): IncomingHttpHeaders {
+	const stripped = {...headers};
+
+	for (const name of hopByHopHeaders) {
+		delete stripped[name];
+	}
+
+	return stripped;
+}
+
+export default new ShardRouter();
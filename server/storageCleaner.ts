@@ -1,6 +1,5 @@
-import SqliteMessageStorage from "./plugins/messageStorage/sqlite";
 import Config from "./config";
-import {DeletionRequest} from "./plugins/messageStorage/types";
+import {DeletionRequest, SearchableMessageStorage} from "./plugins/messageStorage/types";
 import log from "./log";
 import {MessageType} from "../shared/types/msg";
 
@@ -24,7 +23,7 @@ const status_types = [
 ];
 
 export class StorageCleaner {
-	db: SqliteMessageStorage;
+	db: SearchableMessageStorage;
 	olderThanDays: number;
 	messageTypes: MessageType[] | null;
 	limit: number;
@@ -32,7 +31,7 @@ export class StorageCleaner {
 	errCount: number;
 	isStopped: boolean;
 
-	constructor(db: SqliteMessageStorage) {
+	constructor(db: SearchableMessageStorage) {
 		this.errCount = 0;
 		this.isStopped = true;
 		this.db = db;
@@ -107,13 +106,37 @@ export class StorageCleaner {
 			return;
 		}
 
-		if (num_deleted < req.limit) {
+		const reclaiming = await this.reclaimSpace();
+
+		if (this.isStopped) {
+			return;
+		}
+
+		if (num_deleted < req.limit && !reclaiming) {
 			this.schedule(5 * 60 * 1000);
 		} else {
 			this.schedule(5000); // give others a chance to execute queries
 		}
 	}
 
+	/**
+	 * Shrink the database file a step at a time, instead of one long VACUUM
+	 *
+	 * @returns whether there is more space to reclaim
+	 */
+	private async reclaimSpace(): Promise<boolean> {
+		if (!this.db.reclaimSpace) {
+			return false;
+		}
+
+		try {
+			return await this.db.reclaimSpace();
+		} catch (err: any) {
+			log.error("can't reclaim storage space", err.message);
+			return false;
+		}
+	}
+
 	private schedule(ms: number) {
 		const self = this;
 
@@ -0,0 +1,122 @@
+/**
+ * Sampled latency traces of the fe-web message path
+ *
+ * One in `sampleRate` frames gets a span when it's received. Each stage it reaches
+ * (decrypted, adapted, stored, broadcast) records the time since then, and the stats of
+ * every stage are logged once a minute. Objects that are not sampled cost a map lookup.
+ */
+
+import log from "./log";
+
+type Span = {start: bigint};
+
+export type StageStats = {
+	count: number;
+	totalMs: number;
+	maxMs: number;
+	buckets: number[]; // counts per `traceBuckets` bound
+};
+
+// Upper bounds (ms) of the latency buckets, the last bucket has no bound
+export const traceBuckets = [1, 5, 10, 50, 100, 500, 1000];
+
+const spans = new WeakMap<object, Span>();
+const stages = new Map<string, StageStats>();
+let sampleRate = 0;
+let frames = 0;
+let reportTimer: NodeJS.Timeout | null = null;
+
+const trace = {
+	/**
+	 * @param rate - trace one in `rate` frames, 0 disables tracing
+	 */
+	configure(rate: number) {
+		sampleRate = rate > 0 ? Math.floor(rate) : 0;
+
+		if (reportTimer) {
+			clearInterval(reportTimer);
+			reportTimer = null;
+		}
+
+		if (sampleRate > 0) {
+			reportTimer = setInterval(() => trace.report(), 60 * 1000);
+			reportTimer.unref();
+		}
+	},
+
+	/**
+	 * Start a span for a received frame, if it's sampled
+	 */
+	start(subject: object) {
+		if (sampleRate === 0 || ++frames % sampleRate !== 0) {
+			return;
+		}
+
+		spans.set(subject, {start: process.hrtime.bigint()});
+	},
+
+	/**
+	 * Carry the span of `from` over to what it was turned into
+	 */
+	link(from: object, to: object) {
+		const span = spans.get(from);
+
+		if (span && typeof to === "object" && to !== null) {
+			spans.set(to, span);
+		}
+	},
+
+	/**
+	 * Record that a traced object reached a stage
+	 */
+	mark(subject: object, stage: string) {
+		const span = spans.get(subject);
+
+		if (!span) {
+			return;
+		}
+
+		const ms = Number(process.hrtime.bigint() - span.start) / 1e6;
+		let stats = stages.get(stage);
+
+		if (!stats) {
+			stats = {
+				count: 0,
+				totalMs: 0,
+				maxMs: 0,
+				buckets: new Array(traceBuckets.length + 1).fill(0),
+			};
+			stages.set(stage, stats);
+		}
+
+		stats.count++;
+		stats.totalMs += ms;
+		stats.maxMs = Math.max(stats.maxMs, ms);
+
+		const bucket = traceBuckets.findIndex((bound) => ms <= bound);
+		stats.buckets[bucket === -1 ? traceBuckets.length : bucket]++;
+	},
+
+	/**
+	 * Stats per stage since tracing started
+	 */
+	stats(): Map<string, StageStats> {
+		return stages;
+	},
+
+	report() {
+		for (const [stage, stats] of stages) {
+			if (stats.count === 0) {
+				continue;
+			}
+
+			log.info(
+				`[trace] ${stage}: ${stats.count} samples, mean ${(
+					stats.totalMs / stats.count
+				).toFixed(2)}ms, max ${stats.maxMs.toFixed(2)}ms`
+			);
+		}
+	},
+};
+
+export default trace;
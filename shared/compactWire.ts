@@ -0,0 +1,249 @@
+/**
+ * Compact encoding of the message and user lists sent in init and "more"
+ *
+ * It's still JSON for Socket.IO, but stored column by column: repeated strings (nicks,
+ * modes, message types) are interned into a table, ids and timestamps are deltas, and
+ * only fields that are not common to every message are kept as objects. Clients that
+ * announce `compactWire` in their handshake get it, older ones keep getting plain objects.
+ */
+
+import type {SharedMsg, UserInMessage} from "./types/msg";
+import type {SharedUser} from "./types/user";
+import type {SharedChan} from "./types/chan";
+
+export const compactWireVersion = 1;
+
+export type CompactMessages = {
+	strings: string[];
+	id: number[]; // delta from the previous message
+	time: number[]; // ms, delta from the previous message
+	type: number[]; // the indexes below are into `strings`, -1 when unset
+	from: number[];
+	mode: number[];
+	text: string[];
+	flags: number[]; // 1: self, 2: highlight
+	extra: {[index: number]: Record<string, unknown>}; // any other fields, by message
+};
+
+export type CompactUsers = {
+	strings: string[];
+	nick: number[];
+	modes: number[]; // modes joined with ","
+	lastMessage: number[];
+	away: {[index: number]: string};
+};
+
+export type CompactChannel = {
+	messages?: CompactMessages;
+	users?: CompactUsers;
+};
+
+// Fields stored in the columns of CompactMessages
+const messageColumns = new Set(["id", "time", "type", "from", "text", "self", "highlight"]);
+
+class Interner {
+	strings: string[] = [];
+	private index = new Map<string, number>();
+
+	intern(value?: string): number {
+		if (value === undefined || value === null) {
+			return -1;
+		}
+
+		let i = this.index.get(value);
+
+		if (i === undefined) {
+			i = this.strings.length;
+			this.strings.push(value);
+			this.index.set(value, i);
+		}
+
+		return i;
+	}
+}
+
+export function encodeMessages(messages: SharedMsg[]): CompactMessages {
+	const table = new Interner();
+	const compact: CompactMessages = {
+		strings: table.strings,
+		id: [],
+		time: [],
+		type: [],
+		from: [],
+		mode: [],
+		text: [],
+		flags: [],
+		extra: {},
+	};
+	let lastId = 0;
+	let lastTime = 0;
+
+	messages.forEach((msg, i) => {
+		const time = new Date(msg.time).getTime();
+
+		compact.id.push(msg.id - lastId);
+		compact.time.push(time - lastTime);
+		compact.type.push(table.intern(msg.type));
+		compact.from.push(table.intern(msg.from?.nick));
+		compact.mode.push(table.intern(msg.from?.mode));
+		compact.text.push(msg.text || "");
+		compact.flags.push((msg.self ? 1 : 0) | (msg.highlight ? 2 : 0));
+		lastId = msg.id;
+		lastTime = time;
+
+		const extra = extraFields(msg);
+
+		if (extra) {
+			compact.extra[i] = extra;
+		}
+	});
+
+	return compact;
+}
+
+export function decodeMessages(compact: CompactMessages): SharedMsg[] {
+	const strings = compact.strings;
+	let id = 0;
+	let time = 0;
+
+	return compact.id.map((idDelta, i) => {
+		id += idDelta;
+		time += compact.time[i];
+
+		const from = {} as UserInMessage;
+
+		if (compact.from[i] !== -1) {
+			from.nick = strings[compact.from[i]];
+		}
+
+		if (compact.mode[i] !== -1) {
+			from.mode = strings[compact.mode[i]];
+		}
+
+		const msg = {
+			from,
+			id,
+			previews: [],
+			text: compact.text[i],
+			type: compact.type[i] === -1 ? undefined : strings[compact.type[i]],
+			self: (compact.flags[i] & 1) !== 0,
+			// Same as a message sent as JSON
+			time: new Date(time).toISOString(),
+			...compact.extra[i],
+		} as unknown as SharedMsg;
+
+		if (compact.flags[i] & 2) {
+			msg.highlight = true;
+		}
+
+		return msg;
+	});
+}
+
+export function encodeUsers(users: SharedUser[]): CompactUsers {
+	const table = new Interner();
+	const compact: CompactUsers = {
+		strings: table.strings,
+		nick: [],
+		modes: [],
+		lastMessage: [],
+		away: {},
+	};
+
+	users.forEach((user, i) => {
+		compact.nick.push(table.intern(user.nick));
+		compact.modes.push(table.intern((user.modes || []).join(",")));
+		compact.lastMessage.push(user.lastMessage || 0);
+
+		if (user.away) {
+			compact.away[i] = user.away;
+		}
+	});
+
+	return compact;
+}
+
+export function decodeUsers(compact: CompactUsers): SharedUser[] {
+	const strings = compact.strings;
+
+	return compact.nick.map((nick, i) => {
+		const modesString = strings[compact.modes[i]];
+		const modes = modesString ? modesString.split(",") : [];
+
+		return {
+			nick: strings[nick],
+			modes,
+			mode: modes[0] || "",
+			away: compact.away[i] || "",
+			lastMessage: compact.lastMessage[i],
+		};
+	});
+}
+
+/**
+ * Move the messages and users of a channel into `compact`, leaving the lists empty
+ */
+export function compactChannel(chan: SharedChan & {compact?: CompactChannel}) {
+	const compact: CompactChannel = {};
+
+	if (chan.messages.length > 0) {
+		compact.messages = encodeMessages(chan.messages);
+		chan.messages = [];
+	}
+
+	if (chan.users && chan.users.length > 0) {
+		compact.users = encodeUsers(chan.users);
+		chan.users = [];
+	}
+
+	if (compact.messages || compact.users) {
+		chan.compact = compact;
+	}
+}
+
+/**
+ * Undo `compactChannel`
+ */
+export function expandChannel(chan: SharedChan & {compact?: CompactChannel}) {
+	if (!chan.compact) {
+		return;
+	}
+
+	if (chan.compact.messages) {
+		chan.messages = decodeMessages(chan.compact.messages);
+	}
+
+	if (chan.compact.users) {
+		chan.users = decodeUsers(chan.compact.users);
+	}
+
+	delete chan.compact;
+}
+
+function extraFields(msg: SharedMsg): Record<string, unknown> | null {
+	let extra: Record<string, unknown> | null = null;
+
+	for (const [key, value] of Object.entries(msg)) {
+		if (value === undefined || messageColumns.has(key)) {
+			continue;
+		}
+
+		// Empty previews are restored by the decoder
+		if (key === "previews" && Array.isArray(value) && value.length === 0) {
+			continue;
+		}
+
+		extra = extra || {};
+		extra[key] = value;
+	}
+
+	// Anything on `from` besides the nick and mode
+	const from = msg.from as Record<string, unknown> | undefined;
+
+	if (from && Object.keys(from).some((key) => key !== "nick" && key !== "mode")) {
+		extra = extra || {};
+		extra.from = from;
+	}
+
+	return extra;
+}
@@ -0,0 +1,6 @@
+/**
+ * With more than one shard, every request is routed to the process of the user in this
+ * cookie, which the client sets when signing in. It's only used for routing, the shard
+ * still authenticates the user.
+ */
+export const shardCookie = "thelounge-user";
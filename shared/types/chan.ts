@@ -1,6 +1,7 @@
 import {SharedMsg} from "./msg";
 import {SharedUser} from "./user";
 import {SharedNetworkChan} from "./network";
+import type {CompactChannel} from "../compactWire";
 
 export enum ChanType {
 	CHANNEL = "channel",
@@ -21,6 +22,9 @@ export enum ChanState {
 	JOINED = 1,
 }
 
+// Time (ms) of the newest message a browser has cached, by network uuid and lowercase channel name
+export type HistoryMarks = {[networkUuid: string]: {[channelName: string]: number}};
+
 export type SharedChan = {
 	// TODO: don't force existence, figure out how to make TS infer it.
 	id: number;
@@ -40,4 +44,6 @@ export type SharedChan = {
 	closed?: boolean;
 	num_users?: number;
 	users?: SharedUser[]; // User list (for irssi proxy mode)
+	compact?: CompactChannel; // messages and users, for clients using the compact wire format
+	cachedUntil?: number; // `messages` continue the browser's cached history up to this time
 };
@@ -8,3 +8,6 @@ export type SharedMention = {
 	text: string;
 	from: UserInMessage;
 };
+
+// Mentions sent at once, older ones are loaded with mentions:more
+export const mentionsPageSize = 50;
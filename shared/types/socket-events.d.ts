@@ -1,11 +1,12 @@
 import {SharedMention} from "./mention";
-import {ChanState, SharedChan} from "./chan";
+import {ChanState, HistoryMarks, SharedChan} from "./chan";
 import {SharedNetwork, SharedServerOptions} from "./network";
 import {SharedMsg, LinkPreview} from "./msg";
 import {SharedUser} from "./user";
 import {SharedChangelogData} from "./changelog";
 import {SharedConfiguration, LockedSharedConfiguration} from "./config";
 import {SearchResponse, SearchQuery} from "./storage";
+import {CompactMessages} from "../compactWire";
 
 type Session = {
 	current: boolean;
@@ -43,6 +44,7 @@ interface ServerToClientEvents {
 	"sessions:list": EventHandler<Session[]>;
 
 	"mentions:list": EventHandler<SharedMention[]>;
+	"mentions:more": EventHandler<SharedMention[]>;
 
 	"setting:new": EventHandler<{name: string; value: any}>;
 	"setting:all": EventHandler<{[key: string]: any}>;
@@ -77,7 +79,16 @@ interface ServerToClientEvents {
 
 	users: EventHandler<{chan: number}>;
 
-	more: EventHandler<{chan: number; messages: SharedMsg[]; totalMessages: number}>;
+	more: EventHandler<{
+		chan: number;
+		messages: SharedMsg[];
+		// Replaces `messages` for clients using the compact wire format
+		compactMessages?: CompactMessages;
+		totalMessages: number;
+		firstUnread?: number;
+		// Set when `messages` are only the ones newer than the browser's cached history
+		cachedUntil?: number;
+	}>;
 
 	"msg:preview": EventHandler<{id: number; chan: number; preview: LinkPreview}>;
 	"msg:special": EventHandler<{chan: number; data?: Record<string, any>}>;
@@ -97,7 +108,8 @@ interface ServerToClientEvents {
 	token: (token: string) => void;
 
 	// irssi WebSocket connection status (broadcasted to all browsers)
-	"irssi:status": EventHandler<{connected: boolean; error?: string}>;
+	// resuming: the networks are kept, the reconnect replays only the missed events
+	"irssi:status": EventHandler<{connected: boolean; error?: string; resuming?: boolean}>;
 
 	"search:results": (response: SearchResponse) => void;
 
@@ -124,6 +136,7 @@ type AuthPerformData =
 			lastMessage: number;
 			openChannel: number | null;
 			hasConfig: boolean;
+			historyMarks?: HistoryMarks;
 	  };
 
 interface ClientToServerEvents {
@@ -165,6 +178,7 @@ interface ClientToServerEvents {
 	"mentions:dismiss": (msgId: number) => void;
 	"mentions:dismiss_all": NoPayloadEventHandler;
 	"mentions:get": NoPayloadEventHandler;
+	"mentions:more": (before: number) => void;
 
 	more: EventHandler<{target: number; lastTime: number; condensed: boolean}>;
 
@@ -1,12 +1,20 @@
 import {SharedMsg} from "./msg";
 
+// Position of the oldest result of a search page, the next page starts right after it
+export type SearchCursor = {
+	time: number;
+	id: number;
+};
+
 export type SearchQuery = {
 	searchTerm: string;
 	networkUuid: string;
 	channelName: string;
 	offset: number;
+	cursor?: SearchCursor; // takes precedence over offset
 };
 
 export type SearchResponse = SearchQuery & {
 	results: SharedMsg[];
+	nextCursor?: SearchCursor | null; // null when there are no more results
 };
@@ -0,0 +1,115 @@
+import https from "https";
+import crypto from "crypto";
+import {AddressInfo} from "net";
+import {performance} from "perf_hooks";
+import {md, pki} from "node-forge";
+import WebSocket, {WebSocketServer} from "ws";
+
+import {FeWebEncryption} from "../../server/feWebClient/feWebEncryption";
+import type {FeWebMessage} from "../../server/feWebClient/feWebSocket";
+
+// Frames sent at once while replaying as fast as possible
+const burstSize = 500;
+
+function certificate() {
+	const keys = pki.rsa.generateKeyPair(2048);
+	const cert = pki.createCertificate();
+	const attrs = [{name: "commonName", value: "localhost"}];
+
+	cert.publicKey = keys.publicKey;
+	cert.serialNumber = crypto.randomBytes(16).toString("hex").toUpperCase();
+	cert.validity.notBefore = new Date();
+	cert.validity.notAfter = new Date(Date.now() + 24 * 60 * 60 * 1000);
+	cert.setSubject(attrs);
+	cert.setIssuer(attrs);
+	cert.sign(keys.privateKey, md.sha256.create());
+
+	return {key: pki.privateKeyToPem(keys.privateKey), cert: pki.certificateToPem(cert)};
+}
+
+/**
+ * Stands in for irssi's fe-web module, with TLS and encrypted frames like the real one
+ *
+ * Accepts one client, authenticates it right away and ignores what it sends. Frames are
+ * encrypted before the replay, so that doesn't count towards the measured time.
+ */
+export class FeWebServer {
+	private server: https.Server;
+	private wss: WebSocketServer;
+	private encryption: FeWebEncryption;
+	private client: WebSocket | null = null;
+
+	constructor(password: string) {
+		this.encryption = new FeWebEncryption(password);
+		this.server = https.createServer(certificate());
+		this.wss = new WebSocketServer({server: this.server});
+
+		this.wss.on("connection", (ws) => {
+			this.client = ws;
+			void this.send(ws, [{type: "auth_ok", session: "bench"}]);
+		});
+	}
+
+	async listen(): Promise<number> {
+		await this.encryption.deriveKey();
+		await new Promise<void>((resolve) => this.server.listen(0, "127.0.0.1", resolve));
+
+		return (this.server.address() as AddressInfo).port;
+	}
+
+	encrypt(frames: FeWebMessage[]): Promise<Buffer[]> {
+		return Promise.all(frames.map((frame) => this.encryption.encrypt(JSON.stringify(frame))));
+	}
+
+	/**
+	 * Send encrypted frames to the connected client
+	 *
+	 * @param rate - frames per second, 0 sends them as fast as possible
+	 * @param onSent - called with the index of each frame right before it's sent
+	 */
+	replay(frames: Buffer[], rate: number, onSent?: (index: number) => void): Promise<void> {
+		const ws = this.client;
+
+		if (!ws) {
+			return Promise.reject(new Error("No client connected"));
+		}
+
+		const started = performance.now();
+		let sent = 0;
+
+		return new Promise((resolve) => {
+			const tick = () => {
+				const due =
+					rate > 0
+						? Math.floor(((performance.now() - started) * rate) / 1000)
+						: sent + burstSize;
+
+				for (; sent < Math.min(due, frames.length); sent++) {
+					onSent?.(sent);
+					ws.send(frames[sent], {binary: true});
+				}
+
+				if (sent < frames.length) {
+					setTimeout(tick, rate > 0 ? 5 : 0);
+				} else {
+					resolve();
+				}
+			};
+
+			tick();
+		});
+	}
+
+	close(): Promise<void> {
+		this.wss.clients.forEach((ws) => ws.terminate());
+		this.wss.close();
+
+		return new Promise((resolve) => this.server.close(() => resolve()));
+	}
+
+	private async send(ws: WebSocket, frames: FeWebMessage[]) {
+		for (const frame of await this.encrypt(frames)) {
+			ws.send(frame, {binary: true});
+		}
+	}
+}
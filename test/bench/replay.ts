@@ -0,0 +1,421 @@
+/* eslint-disable no-console */
+// Usage: `npm run bench -- [options]`, see `npm run bench -- --help`
+//
+// Example, comparing a branch against master:
+//
+// ```sh
+// git checkout master && npm run bench -- --out master.json
+// git checkout my-branch && npm run bench -- --baseline master.json
+// ```
+//
+// Replays fe-web traffic from a local stand-in for irssi (feWebServer.ts) through
+// FeWebSocket, FeWebAdapter, IrssiClient and encrypted message storage to simulated
+// browsers connected over socket.io, all in this process. Run on an otherwise idle machine,
+// results of different machines or node versions can't be compared.
+
+import fs from "fs";
+import os from "os";
+import path from "path";
+import http from "http";
+import {AddressInfo} from "net";
+import {spawnSync} from "child_process";
+import {monitorEventLoopDelay, performance} from "perf_hooks";
+import {Command} from "commander";
+import {Server as ioServer} from "socket.io";
+import {io as connect, Socket} from "socket.io-client";
+
+import log from "../../server/log";
+import trace from "../../server/trace";
+import Config from "../../server/config";
+import Utils from "../../server/command-line/utils";
+import ClientManager from "../../server/clientManager";
+import {IrssiClient, IrssiUserConfig} from "../../server/irssiClient";
+import {encryptIrssiPassword} from "../../server/irssiConfigHelper";
+import {compactWireVersion} from "../../shared/compactWire";
+import {FeWebServer} from "./feWebServer";
+import {Scenario, buildScenario, loadCapture, probeOf, scenarioNames} from "./scenarios";
+
+// How long to wait for probes that have not arrived once nothing arrives anymore (ms)
+const idleTimeout = 10000;
+
+// Regressions smaller than these are noise, whatever the percentage
+const minChange = {latencyMs: 5, eventLoopLagMs: 5, rssMB: 10, dbSizeMB: 1};
+
+type Result = {
+	name: string;
+	frames: number;
+	probes: number;
+	lost: number; // probe deliveries that never arrived
+	stateDumpMs: number;
+	durationMs: number;
+	messagesPerSec: number;
+	latencyMs: {p50: number; p99: number; max: number};
+	eventLoopLagMs: {p50: number; p99: number; max: number};
+	rssMB: {peak: number; end: number};
+	dbSizeMB: number;
+	stagesMeanMs: Record<string, number>; // sampled by server/trace.ts
+};
+
+type Report = {
+	commit: string;
+	node: string;
+	cpu: string;
+	browsers: number;
+	config: Record<string, unknown>;
+	results: Result[];
+};
+
+const program = new Command("bench")
+	.description("Replay fe-web traffic through the irssi proxy path and measure it")
+	.option("-s, --scenario <names>", `comma separated, of ${scenarioNames.join(", ")}`, "all")
+	.option("-f, --file <capture>", "replay recorded traffic instead, one decoded frame per line")
+	.option("-b, --browsers <count>", "number of simulated browsers", "4")
+	.option("-r, --rate <frames>", "frames per second instead of the scenario's, 0 for no limit")
+	.option("--scale <factor>", "multiply the amount of generated traffic", "1")
+	.option("--trace-rate <n>", "trace one in n frames through the stages", "10")
+	.option("-c, --config <key=value>", "override a config entry", Utils.parseConfigOptions)
+	.option("-o, --out <file>", "write the results as JSON")
+	.option("--baseline <file>", "compare with the JSON of an earlier run, fail on regressions")
+	.option("--tolerance <percent>", "regression allowed against the baseline", "20")
+	.option("--verbose", "keep the log output of the server")
+	.parse(process.argv);
+
+const options = program.opts();
+
+function noop() {
+	// Silenced log output
+}
+
+function round(value: number) {
+	return Math.round(value * 100) / 100;
+}
+
+function percentile(sorted: number[], p: number) {
+	return sorted.length > 0
+		? sorted[Math.min(sorted.length - 1, Math.floor((sorted.length * p) / 100))]
+		: 0;
+}
+
+function megabytes(bytes: number) {
+	return round(bytes / 1024 / 1024);
+}
+
+function fileSize(file: string) {
+	return [file, `${file}-wal`].reduce(
+		(size, f) => size + (fs.existsSync(f) ? fs.statSync(f).size : 0),
+		0
+	);
+}
+
+function commit() {
+	const git = spawnSync("git", ["rev-parse", "--short", "HEAD"], {encoding: "utf8"});
+	return git.status === 0 ? git.stdout.trim() : "unknown";
+}
+
+function stageTotals() {
+	const totals = new Map<string, {count: number; totalMs: number}>();
+
+	for (const [stage, stats] of trace.stats()) {
+		totals.set(stage, {count: stats.count, totalMs: stats.totalMs});
+	}
+
+	return totals;
+}
+
+function waitFor(event: string, sockets: Socket[], accept: (data: any) => boolean) {
+	return Promise.all(
+		sockets.map(
+			(socket) =>
+				new Promise<void>((resolve) => {
+					const listener = (data: any) => {
+						if (accept(data)) {
+							socket.off(event, listener);
+							resolve();
+						}
+					};
+
+					socket.on(event, listener);
+				})
+		)
+	);
+}
+
+async function run(scenario: Scenario, browserCount: number): Promise<Result> {
+	const home = fs.mkdtempSync(path.join(os.tmpdir(), "thelounge-bench-"));
+	Config.setHome(home);
+	Config.merge(options.config || {});
+	trace.configure(parseInt(options.traceRate, 10));
+
+	const password = "bench";
+	const feWeb = new FeWebServer(password);
+	const port = await feWeb.listen();
+	const setup = await feWeb.encrypt(scenario.setup);
+	const frames = await feWeb.encrypt(scenario.frames);
+
+	const httpServer = http.createServer();
+	const sockets: ClientManager["sockets"] = new ioServer(httpServer, {
+		serveClient: false,
+		perMessageDeflate: false,
+	});
+	await new Promise<void>((resolve) => httpServer.listen(0, "127.0.0.1", resolve));
+
+	const manager = new ClientManager();
+	manager.sockets = sockets;
+
+	const config = {
+		log: true,
+		irssiConnection: {
+			host: "127.0.0.1",
+			port,
+			passwordEncrypted: await encryptIrssiPassword(password, "127.0.0.1", port),
+			encryption: true,
+			useTLS: true,
+			rejectUnauthorized: false,
+		},
+	} as IrssiUserConfig;
+	const client = new IrssiClient(manager, "bench", config);
+	sockets.on("connection", (socket) => client.attachBrowser(socket));
+	await client.autoConnectToIrssi();
+
+	const url = `http://127.0.0.1:${(httpServer.address() as AddressInfo).port}`;
+	const browsers = Array.from({length: browserCount}, () =>
+		connect(url, {
+			transports: ["websocket"],
+			forceNew: true,
+			reconnection: false,
+			auth: {compactWire: compactWireVersion},
+		})
+	);
+	await waitFor("init", browsers, () => true);
+
+	// State dump, until every browser has the networks
+	const dumpStart = performance.now();
+	const initialized = waitFor("init", browsers, (data) => data.networks?.length > 0);
+	await feWeb.replay(setup, 0);
+	await initialized;
+	const stateDumpMs = performance.now() - dumpStart;
+
+	// Let history loads and nicklist updates of the state dump settle
+	await new Promise((resolve) => setTimeout(resolve, 1000));
+
+	const probeOfFrame = scenario.frames.map((frame) =>
+		frame.type === "message" ? probeOf(frame.text) : -1
+	);
+	const probes = probeOfFrame.filter((probe) => probe !== -1).length;
+	const sentAt = new Float64Array(probes);
+	const latencies: number[] = [];
+	const received = new Array(browserCount).fill(0);
+	let lastReceived = performance.now();
+
+	browsers.forEach((browser, i) => {
+		browser.on("msg", (data: any) => {
+			const probe = probeOf(data.msg?.text);
+
+			if (probe !== -1) {
+				lastReceived = performance.now();
+				latencies.push(lastReceived - sentAt[probe]);
+				received[i]++;
+			}
+		});
+	});
+
+	let rssPeak = 0;
+	const rssTimer = setInterval(() => {
+		rssPeak = Math.max(rssPeak, process.memoryUsage().rss);
+	}, 100);
+	const lag = monitorEventLoopDelay({resolution: 10});
+	const stagesBefore = stageTotals();
+
+	const rate = options.rate !== undefined ? Number(options.rate) : scenario.rate;
+
+	lag.enable();
+	const start = performance.now();
+	await feWeb.replay(frames, rate, (i) => {
+		if (probeOfFrame[i] !== -1) {
+			sentAt[probeOfFrame[i]] = performance.now();
+		}
+	});
+	const replayed = performance.now();
+
+	while (
+		received.some((count) => count < probes) &&
+		performance.now() - lastReceived < idleTimeout
+	) {
+		await new Promise((resolve) => setTimeout(resolve, 50));
+	}
+
+	const durationMs = Math.max(lastReceived, replayed) - start;
+	lag.disable();
+	clearInterval(rssTimer);
+
+	const stagesMeanMs: Record<string, number> = {};
+
+	for (const [stage, totals] of stageTotals()) {
+		const before = stagesBefore.get(stage) || {count: 0, totalMs: 0};
+		const count = totals.count - before.count;
+
+		if (count > 0) {
+			stagesMeanMs[stage] = round((totals.totalMs - before.totalMs) / count);
+		}
+	}
+
+	const rssEnd = process.memoryUsage().rss;
+	browsers.forEach((browser) => browser.disconnect());
+	await client.quit(false);
+	await feWeb.close();
+	sockets.close();
+
+	const dbSize = fileSize(path.join(Config.getUserLogsPath(), "bench.encrypted.sqlite3"));
+	fs.rmSync(home, {recursive: true, force: true});
+
+	latencies.sort((a, b) => a - b);
+
+	return {
+		name: scenario.name,
+		frames: frames.length,
+		probes,
+		lost: probes * browserCount - latencies.length,
+		stateDumpMs: round(stateDumpMs),
+		durationMs: round(durationMs),
+		messagesPerSec: round((frames.length * 1000) / durationMs),
+		latencyMs: {
+			p50: round(percentile(latencies, 50)),
+			p99: round(percentile(latencies, 99)),
+			max: round(latencies[latencies.length - 1] || 0),
+		},
+		eventLoopLagMs: {
+			p50: round(lag.percentile(50) / 1e6),
+			p99: round(lag.percentile(99) / 1e6),
+			max: round(lag.max / 1e6),
+		},
+		rssMB: {peak: megabytes(Math.max(rssPeak, rssEnd)), end: megabytes(rssEnd)},
+		dbSizeMB: megabytes(dbSize),
+		stagesMeanMs,
+	};
+}
+
+function print(results: Result[]) {
+	const columns = ["scenario", "msg/s", "p50 ms", "p99 ms", "lag p99", "rss MB", "db MB"];
+	const rows = results.map((r) => [
+		r.name,
+		r.messagesPerSec.toFixed(0),
+		r.latencyMs.p50.toFixed(1),
+		r.latencyMs.p99.toFixed(1),
+		r.eventLoopLagMs.p99.toFixed(1),
+		r.rssMB.peak.toFixed(0),
+		r.dbSizeMB.toFixed(1),
+	]);
+
+	for (const row of [columns, ...rows]) {
+		console.log(row.map((cell, i) => (i === 0 ? cell.padEnd(16) : cell.padStart(9))).join(""));
+	}
+
+	for (const r of results.filter((result) => result.lost > 0)) {
+		console.log(`${r.name}: ${r.lost} of ${r.probes * Number(options.browsers)} probes lost`);
+	}
+}
+
+/**
+ * Print the changes against an earlier run
+ *
+ * @returns whether any of them is a regression beyond the tolerance
+ */
+function compare(results: Result[], baseline: Report) {
+	const tolerance = Number(options.tolerance) / 100;
+	let regressed = false;
+
+	const check = (name: string, metric: string, now: number, then: number, min: number) => {
+		// Lower is better for all but the throughput
+		const change = (now - then) / (then || 1);
+		const worse = metric === "msg/s" ? -change : change;
+		const regression = worse > tolerance && Math.abs(now - then) >= min;
+		const percent = `${change >= 0 ? "+" : ""}${(change * 100).toFixed(1)}%`;
+		const values = `${then.toFixed(1).padStart(9)} → ${now.toFixed(1).padStart(9)}`;
+
+		regressed = regressed || regression;
+		console.log(
+			`${name.padEnd(16)}${metric.padEnd(10)}${values} (${percent})` +
+				(regression ? "  REGRESSION" : "")
+		);
+	};
+
+	console.log(`\nCompared with ${baseline.commit}:`);
+
+	for (const r of results) {
+		const b = baseline.results.find((result) => result.name === r.name);
+
+		if (!b) {
+			continue;
+		}
+
+		check(r.name, "msg/s", r.messagesPerSec, b.messagesPerSec, 0);
+		check(r.name, "p99 ms", r.latencyMs.p99, b.latencyMs.p99, minChange.latencyMs);
+		check(
+			r.name,
+			"lag p99",
+			r.eventLoopLagMs.p99,
+			b.eventLoopLagMs.p99,
+			minChange.eventLoopLagMs
+		);
+		check(r.name, "rss MB", r.rssMB.peak, b.rssMB.peak, minChange.rssMB);
+		check(r.name, "db MB", r.dbSizeMB, b.dbSizeMB, minChange.dbSizeMB);
+	}
+
+	return regressed;
+}
+
+async function main() {
+	const browsers = parseInt(options.browsers, 10);
+	const scale = Number(options.scale);
+	const names: string[] =
+		options.scenario === "all" ? scenarioNames : options.scenario.split(",");
+	const scenarios = options.file
+		? [loadCapture(options.file, Number(options.rate || 0))]
+		: names.map((name) => buildScenario(name.trim(), scale));
+
+	const consoleLog = console.log;
+
+	if (!options.verbose) {
+		console.log = console.info = console.warn = noop;
+		log.info = log.warn = log.debug = noop;
+	}
+
+	const results: Result[] = [];
+
+	for (const scenario of scenarios) {
+		results.push(await run(scenario, browsers));
+	}
+
+	console.log = consoleLog;
+
+	const report: Report = {
+		commit: commit(),
+		node: process.version,
+		cpu: `${os.cpus()[0]?.model || "unknown"} x${os.cpus().length}`,
+		browsers,
+		config: options.config || {},
+		results,
+	};
+
+	print(results);
+
+	if (options.out) {
+		fs.writeFileSync(options.out, JSON.stringify(report, null, "\t") + "\n");
+	}
+
+	if (options.baseline) {
+		const baseline: Report = JSON.parse(fs.readFileSync(options.baseline, "utf8"));
+
+		if (compare(results, baseline)) {
+			process.exitCode = 1;
+		}
+	}
+
+	// Client sockets and crypto workers would keep the process alive
+	process.stdout.write("", () => process.exit());
+}
+
+main().catch((error) => {
+	console.error(error);
+	process.exit(1);
+});
@@ -0,0 +1,326 @@
+import fs from "fs";
+
+import type {FeWebMessage} from "../../server/feWebClient/feWebSocket";
+
+/**
+ * fe-web traffic replayed by the benchmark, see replay.ts
+ *
+ * Generated scenarios are built from a fixed seed, so every run replays the same frames and
+ * runs of different commits can be compared. Probe messages carry their number in the text,
+ * the time from sending one to each browser receiving it is the end-to-end latency.
+ */
+
+export type Scenario = {
+	name: string;
+	description: string;
+	setup: FeWebMessage[]; // state dump, replayed until every browser got init
+	frames: FeWebMessage[]; // the measured part
+	rate: number; // frames per second, 0 sends them as fast as possible
+};
+
+const server = "bench";
+const ownNick = "bencher";
+const probeTag = "probe:";
+
+// MSGLEVEL_PUBLIC from irssi/src/core/levels.h
+const levelPublic = 0x0000004;
+
+const words = [
+	"lorem",
+	"ipsum",
+	"dolor",
+	"sit",
+	"amet",
+	"consectetur",
+	"adipiscing",
+	"elit",
+	"sed",
+	"do",
+	"eiusmod",
+	"tempor",
+	"https://example.com/some/page",
+];
+
+// mulberry32, small and good enough to spread load over channels and users
+function random(seed: number) {
+	return () => {
+		seed = (seed + 0x6d2b79f5) | 0;
+		let t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+		t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+		return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+	};
+}
+
+function pick<T>(rand: () => number, items: T[]): T {
+	return items[Math.floor(rand() * items.length)];
+}
+
+function sentence(rand: () => number) {
+	const length = 4 + Math.floor(rand() * 12);
+	return Array.from({length}, () => pick(rand, words)).join(" ");
+}
+
+/**
+ * Number of the probe a message is, -1 for other messages
+ */
+export function probeOf(text: unknown): number {
+	if (typeof text !== "string" || !text.startsWith(probeTag)) {
+		return -1;
+	}
+
+	return parseInt(text.slice(probeTag.length), 10);
+}
+
+class Builder {
+	frames: FeWebMessage[] = [];
+	probes = 0;
+
+	message(channel: string, nick: string, text: string) {
+		this.frames.push({type: "message", server, channel, nick, text, level: levelPublic});
+	}
+
+	probe(channel: string, nick: string, text: string) {
+		this.message(channel, nick, `${probeTag}${this.probes++} ${text}`);
+	}
+}
+
+function channelNames(count: number) {
+	return Array.from({length: count}, (_, i) => `#channel${i}`);
+}
+
+/**
+ * Marker, then our join, topic and nicklist of each channel, like irssi on sync_server
+ */
+function stateDump(members: Map<string, string[]>, rand: () => number): FeWebMessage[] {
+	const frames: FeWebMessage[] = [
+		{type: "state_dump", server},
+		{type: "server_status", server, text: "connected"},
+	];
+
+	for (const [channel, nicks] of members) {
+		const nicklist = [ownNick, ...nicks].map((nick) => {
+			const mode = rand();
+			return {nick, prefix: mode < 0.05 ? "@" : mode < 0.15 ? "+" : ""};
+		});
+
+		frames.push(
+			{type: "channel_join", server, channel, nick: ownNick},
+			{type: "topic", server, channel, nick: "ChanServ", text: sentence(rand)},
+			{type: "nicklist", server, channel, text: JSON.stringify(nicklist)}
+		);
+	}
+
+	return frames;
+}
+
+// Members of each channel, drawn from a pool of `users` nicks shared by the channels
+function populate(channels: number, perChannel: number, users: number, rand: () => number) {
+	const members = new Map<string, string[]>();
+
+	for (const channel of channelNames(channels)) {
+		const nicks = new Set<string>();
+
+		while (nicks.size < Math.min(perChannel, users)) {
+			nicks.add(`user${Math.floor(rand() * users)}`);
+		}
+
+		members.set(channel, [...nicks]);
+	}
+
+	return members;
+}
+
+function scaled(value: number, scale: number) {
+	return Math.max(1, Math.round(value * scale));
+}
+
+type Generator = {
+	description: string;
+	build: (scale: number) => Omit<Scenario, "name" | "description">;
+};
+
+const generators: Record<string, Generator> = {
+	"state-dump": {
+		description: "a large state dump, then a short burst of messages",
+		build(scale) {
+			const rand = random(1);
+			const members = populate(scaled(200, scale), 500, scaled(20000, scale), rand);
+			const setup = stateDump(members, rand);
+			const b = new Builder();
+			const channels = [...members.keys()];
+
+			for (let i = 0; i < scaled(1000, scale); i++) {
+				const channel = pick(rand, channels);
+				b.probe(channel, pick(rand, members.get(channel)!), sentence(rand));
+			}
+
+			return {
+				setup,
+				frames: b.frames,
+				rate: 0,
+			};
+		},
+	},
+
+	flood: {
+		description: "a steady flood of messages over many busy channels",
+		build(scale) {
+			const rand = random(2);
+			const members = populate(20, 100, 1000, rand);
+			const setup = stateDump(members, rand);
+			const b = new Builder();
+			const channels = [...members.keys()];
+
+			for (let i = 0; i < scaled(20000, scale); i++) {
+				const channel = pick(rand, channels);
+				b.probe(channel, pick(rand, members.get(channel)!), sentence(rand));
+			}
+
+			return {
+				setup,
+				frames: b.frames,
+				rate: 2000,
+			};
+		},
+	},
+
+	"nicklist-storm": {
+		description: "joins, parts, renames and mode changes in big channels",
+		build(scale) {
+			const rand = random(3);
+			const members = populate(10, 1000, 5000, rand);
+			const setup = stateDump(members, rand);
+			const b = new Builder();
+			const channels = [...members.keys()];
+			const tasks = ["add", "remove", "change", "+o", "-o", "+v", "-v"];
+			let added = 0;
+
+			for (let i = 0; i < scaled(20000, scale); i++) {
+				const channel = pick(rand, channels);
+				const nicks = members.get(channel)!;
+
+				if (i % 20 === 0) {
+					b.probe(channel, pick(rand, nicks), sentence(rand));
+					continue;
+				}
+
+				const task = pick(rand, tasks);
+				const index = Math.floor(rand() * nicks.length);
+				const nick = nicks[index];
+
+				if (task === "add" || nicks.length < 2) {
+					const joined = `storm${added++}`;
+					nicks.push(joined);
+					b.frames.push({type: "nicklist_update", server, channel, nick: joined, task});
+				} else if (task === "remove") {
+					nicks.splice(index, 1);
+					b.frames.push({type: "nicklist_update", server, channel, nick, task});
+				} else if (task === "change") {
+					const extra = {new_nick: `${nick}_`};
+					nicks[index] = extra.new_nick;
+					b.frames.push({type: "nicklist_update", server, channel, nick, task, extra});
+				} else {
+					b.frames.push({type: "nicklist_update", server, channel, nick, task});
+				}
+			}
+
+			return {
+				setup,
+				frames: b.frames,
+				rate: 5000,
+			};
+		},
+	},
+
+	netsplit: {
+		description: "a netsplit that takes out a third of the users, who all rejoin",
+		build(scale) {
+			const rand = random(4);
+			const users = scaled(3000, scale);
+			const members = populate(30, 300, users, rand);
+			const setup = stateDump(members, rand);
+			const b = new Builder();
+			const split = new Set<string>();
+			const reason = "hub.example.net leaf.example.net";
+
+			while (split.size < users / 3) {
+				split.add(`user${Math.floor(rand() * users)}`);
+			}
+
+			const channels = [...members.keys()];
+			const probe = (i: number) => {
+				if (i % 20 === 0) {
+					b.probe(pick(rand, channels), "observer", sentence(rand));
+				}
+			};
+
+			[...split].forEach((nick, i) => {
+				b.frames.push({type: "user_quit", server, nick, text: reason});
+				probe(i);
+			});
+
+			let i = 0;
+
+			for (const [channel, nicks] of members) {
+				for (const nick of nicks.filter((n) => split.has(n))) {
+					b.frames.push({type: "channel_join", server, channel, nick});
+					probe(i++);
+				}
+			}
+
+			return {
+				setup,
+				frames: b.frames,
+				rate: 0,
+			};
+		},
+	},
+};
+
+export const scenarioNames = Object.keys(generators);
+
+/**
+ * @param scale - multiplies the amount of traffic, and the size of the state dump scenario
+ */
+export function buildScenario(name: string, scale: number): Scenario {
+	const generator = generators[name];
+
+	if (!generator) {
+		throw new Error(`Unknown scenario ${name}, expected one of ${scenarioNames.join(", ")}`);
+	}
+
+	return {name, description: generator.description, ...generator.build(scale)};
+}
+
+/**
+ * Scenario from recorded traffic, one decoded server frame per line
+ *
+ * Frames up to the first message are the setup. Every later message becomes a probe, and
+ * sequence numbers are dropped so nothing is skipped as already seen.
+ */
+export function loadCapture(file: string, rate: number): Scenario {
+	const frames: FeWebMessage[] = fs
+		.readFileSync(file, "utf8")
+		.split("\n")
+		.filter((line) => line.trim() !== "")
+		.map((line) => JSON.parse(line));
+
+	let start = frames.findIndex((frame) => frame.type === "message");
+	start = start === -1 ? frames.length : start;
+
+	let probes = 0;
+	const measured = frames.slice(start).map((frame) => {
+		const {seq, ...rest} = frame;
+		return frame.type === "message"
+			? {...rest, text: `${probeTag}${probes++} ${frame.text || ""}`}
+			: rest;
+	});
+
+	return {
+		name: file,
+		description: "recorded traffic",
+		setup: frames.slice(0, start).map(({seq, ...rest}) => rest),
+		frames: measured,
+		rate,
+	};
+}
@@ -0,0 +1,68 @@
+import {expect} from "chai";
+
+import {WordIndex, NickIndex} from "../../../../client/js/helpers/completionIndex";
+import {ClientUser} from "../../../../client/js/types";
+
+function users(...entries: [string, number][]) {
+	return entries.map(([nick, lastMessage]) => ({nick, lastMessage} as ClientUser));
+}
+
+describe("completionIndex", function () {
+	it("should find words by prefix first, then inside them", function () {
+		const index = new WordIndex(["smile", "Smiley", "grinning_smile", "cat", "sm"]);
+
+		expect(index.search("SMI", 10)).to.deep.equal([
+			["<b>smi</b>le", "smile"],
+			["<b>Smi</b>ley", "Smiley"],
+			["grinning_<b>smi</b>le", "grinning_smile"],
+		]);
+		expect(index.search("sm", 10).map(([, word]) => word)).to.deep.equal([
+			"sm",
+			"smile",
+			"Smiley",
+		]);
+		expect(index.search("", 2).map(([, word]) => word)).to.deep.equal([
+			"cat",
+			"grinning_smile",
+		]);
+	});
+
+	it("should complete nicks that spoke most recently first", function () {
+		const index = new NickIndex();
+		index.sync(users(["Alice", 0], ["alfred", 5], ["Bob", 9], ["al", 0]));
+
+		expect(index.complete("al", 10)).to.deep.equal(["alfred", "al", "Alice"]);
+		expect(index.complete("", 2)).to.deep.equal(["Bob", "alfred"]);
+
+		index.touch("alice", 20);
+		expect(index.complete("AL", 10)).to.deep.equal(["Alice", "alfred", "al"]);
+	});
+
+	it("should keep recency across names lists and drop users that left", function () {
+		const index = new NickIndex();
+		index.sync(users(["Alice", 0], ["alfred", 0]));
+		index.touch("alfred", 5);
+
+		index.sync(users(["alfred", 0], ["albert", 0]));
+		expect(index.complete("al", 10)).to.deep.equal(["alfred", "albert"]);
+
+		index.remove("alfred");
+		expect(index.complete("al", 10)).to.deep.equal(["albert"]);
+	});
+
+	it("should only rank the most recent speakers", function () {
+		const index = new NickIndex();
+		const speakers = Array.from({length: 100}, (_, i): [string, number] => [`x${i}`, 10 + i]);
+		index.sync(users(...speakers, ["b", 2], ["a", 1]));
+
+		const nicks = index.complete("", 102);
+		expect(nicks.slice(0, 2)).to.deep.equal(["x99", "x98"]);
+		expect(nicks.slice(-3)).to.deep.equal(["x0", "a", "b"]);
+
+		index.remove("x99");
+		expect(index.complete("", 101).slice(-3)).to.deep.equal(["x0", "b", "a"]);
+
+		index.touch("a", 200);
+		expect(index.complete("", 2)).to.deep.equal(["a", "x98"]);
+	});
+});
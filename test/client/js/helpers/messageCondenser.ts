@@ -0,0 +1,105 @@
+import {expect} from "chai";
+
+import MessageCondenser from "../../../../client/js/helpers/messageCondenser";
+import {ClientMessage} from "../../../../client/js/types";
+
+let nextId = 1;
+
+function msg(type: string, extra?: Partial<ClientMessage>) {
+	return {id: nextId++, type, time: new Date(), text: "", ...extra} as unknown as ClientMessage;
+}
+
+function shape(entries: any[]) {
+	return entries.map((entry) =>
+		entry.type === "condensed" ? entry.messages.map((m: ClientMessage) => m.id) : entry.id
+	);
+}
+
+describe("MessageCondenser", function () {
+	beforeEach(function () {
+		nextId = 1;
+	});
+
+	it("should group status messages and leave single ones alone", function () {
+		const messages = [msg("join"), msg("message"), msg("join"), msg("part"), msg("quit")];
+		const list = new MessageCondenser().update(messages, "condensed", 0);
+
+		expect(shape(list.entries)).to.deep.equal([1, 2, [3, 4, 5]]);
+		expect(list.keys).to.deep.equal(["1", "2", "3"]);
+	});
+
+	it("should drop status messages when hidden", function () {
+		const messages = [msg("join"), msg("message"), msg("part")];
+		const list = new MessageCondenser().update(messages, "hidden", 0);
+
+		expect(shape(list.entries)).to.deep.equal([2]);
+	});
+
+	it("should extend the last group when messages are appended", function () {
+		const condenser = new MessageCondenser();
+		const messages = [msg("message"), msg("join")];
+
+		let list = condenser.update(messages, "condensed", 0);
+		const first = list.entries[0];
+		expect(shape(list.entries)).to.deep.equal([1, 2]);
+
+		messages.push(msg("part"));
+		list = condenser.update(messages, "condensed", 0);
+		expect(shape(list.entries)).to.deep.equal([1, [2, 3]]);
+		expect(list.entries[0]).to.equal(first);
+		expect(list.keys).to.deep.equal(["1", "2"]);
+		expect((list.entries[1] as any).id).to.equal(3);
+
+		messages.push(msg("message"), msg("join"));
+		list = condenser.update(messages, "condensed", 0);
+		expect(shape(list.entries)).to.deep.equal([1, [2, 3], 4, 5]);
+	});
+
+	it("should split groups at the unread boundary", function () {
+		const messages = [msg("join"), msg("join"), msg("join"), msg("join")];
+		const condenser = new MessageCondenser();
+
+		expect(shape(condenser.update(messages, "condensed", 2).entries)).to.deep.equal([
+			[1, 2],
+			[3, 4],
+		]);
+		expect(shape(condenser.update(messages, "condensed", 3).entries)).to.deep.equal([
+			[1, 2, 3],
+			4,
+		]);
+		expect(shape(condenser.update(messages, "condensed", 0).entries)).to.deep.equal([
+			[1, 2, 3, 4],
+		]);
+	});
+
+	it("should follow messages trimmed from the start", function () {
+		const condenser = new MessageCondenser();
+		const messages = [msg("message"), msg("join"), msg("join"), msg("join"), msg("message")];
+
+		condenser.update(messages, "condensed", 0);
+
+		messages.splice(0, 2);
+		messages.push(msg("part"));
+
+		const list = condenser.update(messages, "condensed", 0);
+		expect(shape(list.entries)).to.deep.equal([[3, 4], 5, 6]);
+		expect(list.keys).to.deep.equal(["3", "5", "6"]);
+
+		messages.splice(0, 1);
+		expect(shape(condenser.update(messages, "condensed", 0).entries)).to.deep.equal([4, 5, 6]);
+	});
+
+	it("should match a full rebuild after history is loaded in front", function () {
+		const condenser = new MessageCondenser();
+		const messages = [msg("join"), msg("message")];
+
+		condenser.update(messages, "condensed", 0);
+		messages.unshift(msg("part"), msg("quit"));
+
+		const list = condenser.update(messages, "condensed", 0);
+		const rebuilt = new MessageCondenser().update(messages, "condensed", 0);
+
+		expect(shape(list.entries)).to.deep.equal(shape(rebuilt.entries));
+		expect(list.keys).to.deep.equal(rebuilt.keys);
+	});
+});
@@ -0,0 +1,39 @@
+import {expect} from "chai";
+
+import Config from "../server/config";
+import ClientManager from "../server/clientManager";
+import {IrssiClient, IrssiUserConfig} from "../server/irssiClient";
+
+describe("ClientManager", function () {
+	let userActivation: typeof Config.values.userActivation;
+
+	beforeEach(function () {
+		userActivation = Config.values.userActivation;
+	});
+
+	afterEach(function () {
+		Config.values.userActivation = userActivation;
+	});
+
+	it("should only keep always on users connected with lazy activation", function () {
+		const manager = new ClientManager();
+
+		expect(manager.isAlwaysOn("anyone")).to.be.true;
+
+		Config.values.userActivation = {lazy: true, alwaysOn: ["Bot"], hibernateAfterMinutes: 1};
+		expect(manager.isAlwaysOn("bot")).to.be.true;
+		expect(manager.isAlwaysOn("anyone")).to.be.false;
+	});
+
+	it("should leave users without irssi password inactive", async function () {
+		const config = {irssiConnection: {}} as unknown as IrssiUserConfig;
+		const client = new IrssiClient(new ClientManager(), "lazy", config);
+
+		await client.activate();
+		expect(client.isActive).to.be.false;
+
+		// Nothing to release
+		await client.hibernate();
+		expect(client.isActive).to.be.false;
+	});
+});
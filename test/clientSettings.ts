@@ -0,0 +1,67 @@
+import {expect} from "chai";
+
+import {applyClientSetting} from "../server/clientSettings";
+
+function fakeClient() {
+	const client = {
+		config: {clientSettings: {} as Record<string, any>},
+		awayMessage: "",
+		emitted: [] as Array<{name: string; value: any}>,
+		saves: 0,
+		compiles: 0,
+		emit(_event: "setting:new", data: {name: string; value: any}) {
+			client.emitted.push(data);
+		},
+		save() {
+			client.saves++;
+		},
+		compileCustomHighlights() {
+			client.compiles++;
+		},
+	};
+
+	return client;
+}
+
+describe("applyClientSetting", function () {
+	it("should store and broadcast a changed setting once", function () {
+		const client = fakeClient();
+
+		applyClientSetting(client, {name: "coloredNicks", value: false});
+		applyClientSetting(client, {name: "coloredNicks", value: false});
+
+		expect(client.config.clientSettings.coloredNicks).to.equal(false);
+		expect(client.emitted).to.deep.equal([{name: "coloredNicks", value: false}]);
+		expect(client.saves).to.equal(1);
+	});
+
+	it("should ignore objects and private names", function () {
+		const client = fakeClient();
+
+		applyClientSetting(client, "awayMessage");
+		applyClientSetting(client, {name: "theme", value: {}});
+		applyClientSetting(client, {name: "_secret", value: "x"});
+
+		expect(client.config.clientSettings).to.deep.equal({});
+		expect(client.saves).to.equal(0);
+	});
+
+	it("should apply the away message", function () {
+		const client = fakeClient();
+
+		applyClientSetting(client, {name: "awayMessage", value: "gone fishing"});
+		expect(client.awayMessage).to.equal("gone fishing");
+
+		applyClientSetting(client, {name: "awayMessage", value: 42});
+		expect(client.awayMessage).to.equal("");
+	});
+
+	it("should recompile highlights", function () {
+		const client = fakeClient();
+
+		applyClientSetting(client, {name: "highlights", value: "deploy"});
+		applyClientSetting(client, {name: "highlightExceptions", value: "dry run"});
+
+		expect(client.compiles).to.equal(2);
+	});
+});
@@ -0,0 +1,79 @@
+import {expect} from "chai";
+import {AddressInfo} from "net";
+import WebSocket, {WebSocketServer} from "ws";
+
+import {FeWebSocket, FeWebMessage} from "../../server/feWebClient/feWebSocket";
+
+describe("FeWebSocket", function () {
+	let server: WebSocketServer;
+	let socket: FeWebSocket;
+
+	function send(ws: WebSocket, ...messages: FeWebMessage[]) {
+		messages.forEach((message) => ws.send(JSON.stringify(message)));
+	}
+
+	function event(seq: number): FeWebMessage {
+		return {type: "message", server: "net", target: "#chan", text: `event ${seq}`, seq};
+	}
+
+	beforeEach(async function () {
+		server = new WebSocketServer({port: 0, host: "127.0.0.1"});
+		await new Promise((resolve) => server.once("listening", resolve));
+	});
+
+	afterEach(async function () {
+		socket.disconnect();
+		server.clients.forEach((ws) => ws.terminate());
+		await new Promise((resolve) => server.close(resolve));
+	});
+
+	it("should resume after a reconnect and drop replayed events seen already", async function () {
+		const received: number[] = [];
+		const requests: FeWebMessage[] = [];
+		let connections = 0;
+
+		server.on("connection", (ws) => {
+			connections++;
+			ws.on("message", (data) => {
+				const request = JSON.parse(data.toString()) as FeWebMessage;
+				requests.push(request);
+
+				// The replay overlaps with the events that arrived before the disconnect
+				if (request.type === "resume") {
+					send(ws, {type: "resume_ok", seq: request.seq}, event(12), event(13), event(14));
+				}
+			});
+
+			if (connections === 1) {
+				send(ws, {type: "auth_ok", session: "s1", seq: 10}, event(11), event(12));
+			} else {
+				send(ws, {type: "auth_ok", session: "s1", seq: 14});
+			}
+		});
+
+		socket = new FeWebSocket({
+			host: "127.0.0.1",
+			port: (server.address() as AddressInfo).port,
+			useTLS: false,
+			encryption: false,
+			defaultServer: "",
+			reconnectDelay: 10,
+			user: "test",
+		});
+		socket.onMessage("message", (message) => {
+			received.push(message.seq!);
+		});
+
+		await socket.connect();
+		await new Promise((resolve) => setTimeout(resolve, 50));
+		expect(received).to.deep.equal([11, 12]);
+
+		const resumed = new Promise((resolve) => socket.once("resumed", resolve));
+		server.clients.forEach((ws) => ws.terminate());
+		await resumed;
+		await new Promise((resolve) => setTimeout(resolve, 50));
+
+		expect(requests.filter((r) => r.type === "resume").map((r) => r.seq)).to.deep.equal([12]);
+		expect(received).to.deep.equal([11, 12, 13, 14]);
+	});
+});
@@ -0,0 +1,31 @@
+import {expect} from "chai";
+
+import {HighlightMatcher} from "../server/highlight";
+
+describe("HighlightMatcher", function () {
+	it("should only match the nick as a word of its own", function () {
+		const matcher = new HighlightMatcher("bencher", undefined, undefined);
+
+		expect(matcher.test("hey Bencher, look")).to.be.true;
+		expect(matcher.test("bencher: ping")).to.be.true;
+		expect(matcher.test("\x02bencher\x02 in bold")).to.be.true;
+		expect(matcher.test("benchers unite")).to.be.false;
+		expect(matcher.test("the_bencher2 is someone else")).to.be.false;
+	});
+
+	it("should match highlight words unless an exception matches", function () {
+		const matcher = new HighlightMatcher("bencher", "deploy, release notes,", "dry run");
+
+		expect(matcher.test("starting the deploy now")).to.be.true;
+		expect(matcher.test("Release notes are out")).to.be.true;
+		expect(matcher.test("redeploying")).to.be.false;
+		expect(matcher.test("bencher: deploy as a dry run")).to.be.false;
+	});
+
+	it("should escape nicks that look like regexes", function () {
+		const matcher = new HighlightMatcher("[bot]^", "", "");
+
+		expect(matcher.test("thanks [bot]^!")).to.be.true;
+		expect(matcher.test("thanks b")).to.be.false;
+	});
+});
@@ -0,0 +1,92 @@
+import {expect} from "chai";
+import type {IncomingMessage} from "http";
+
+import Config from "../server/config";
+import metrics, {single} from "../server/metrics";
+
+function request(remoteAddress: string, headers: Record<string, string> = {}) {
+	return {socket: {remoteAddress}, headers} as unknown as IncomingMessage;
+}
+
+describe("Metrics", function () {
+	let config: typeof Config.values.metrics;
+	let reverseProxy: boolean;
+
+	beforeEach(function () {
+		config = Config.values.metrics;
+		reverseProxy = Config.values.reverseProxy;
+		Config.values.metrics = {enable: true, token: "", perUser: true};
+	});
+
+	afterEach(function () {
+		Config.values.metrics = config;
+		Config.values.reverseProxy = reverseProxy;
+	});
+
+	it("should render counters and cumulative histogram buckets", function () {
+		const counter = metrics.counter("test_things_total", "Things");
+		counter.with({user: 'a"b'}).inc(2);
+
+		const histogram = metrics.histogram("test_seconds", "Seconds", [0.1, 1]);
+		const series = histogram.with();
+		[0.05, 0.5, 5].forEach((value) => series.observe(value));
+
+		const text = metrics.render([counter.collect(), histogram.collect()]);
+
+		expect(text).to.contain("# TYPE test_things_total counter\n");
+		expect(text).to.contain('test_things_total{user="a\\"b"} 2\n');
+		expect(text).to.contain('test_seconds_bucket{le="0.1"} 1\n');
+		expect(text).to.contain('test_seconds_bucket{le="1"} 2\n');
+		expect(text).to.contain('test_seconds_bucket{le="+Inf"} 3\n');
+		expect(text).to.contain("test_seconds_sum 5.55\n");
+
+		metrics.forget('a"b');
+		expect(counter.collect().samples).to.be.empty;
+	});
+
+	it("should sum user gauges without per user series", function () {
+		const values: [string, number][] = [
+			["alice", 2],
+			["bob", 3],
+		];
+
+		expect(metrics.userGauge("test_browsers", "Browsers", values).samples).to.have.length(2);
+
+		Config.values.metrics.perUser = false;
+		expect(metrics.userGauge("test_browsers", "Browsers", values).samples).to.deep.equal([
+			{name: "test_browsers", labels: {}, value: 5},
+		]);
+	});
+
+	it("should label merged families by their source", function () {
+		const merged = metrics.merge([
+			{labels: {shard: "0"}, families: [single("test_up", "Up", "gauge", 1)]},
+			{labels: {shard: "1"}, families: [single("test_up", "Up", "gauge", 1)]},
+		]);
+
+		expect(merged).to.have.length(1);
+		expect(merged[0].samples.map((s) => s.labels)).to.deep.equal([{shard: "0"}, {shard: "1"}]);
+	});
+
+	it("should only allow local requests without a token", function () {
+		expect(metrics.authorize(request("127.0.0.1"))).to.be.true;
+		expect(metrics.authorize(request("192.0.2.1"))).to.be.false;
+		expect(metrics.authorize(request("::1", {"x-forwarded-for": "192.0.2.1"}))).to.be.false;
+		expect(metrics.authorize(request("::1", {forwarded: "for=192.0.2.1"}))).to.be.false;
+		expect(metrics.authorize(request("::1", {"x-real-ip": "192.0.2.1"}))).to.be.false;
+
+		Config.values.metrics.token = "secret";
+		const authorization = "Bearer secret";
+		expect(metrics.authorize(request("192.0.2.1", {authorization}))).to.be.true;
+		expect(metrics.authorize(request("127.0.0.1"))).to.be.false;
+	});
+
+	it("should require the token behind a reverse proxy", function () {
+		Config.values.reverseProxy = true;
+		expect(metrics.authorize(request("127.0.0.1"))).to.be.false;
+
+		Config.values.metrics.token = "secret";
+		const authorization = "Bearer secret";
+		expect(metrics.authorize(request("127.0.0.1", {authorization}))).to.be.true;
+	});
+});
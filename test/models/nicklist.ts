@@ -0,0 +1,93 @@
+import {expect} from "chai";
+
+import Nicklist from "../../server/models/nicklist";
+import Prefix from "../../server/models/prefix";
+import User from "../../server/models/user";
+
+describe("Nicklist", function () {
+	const prefix = new Prefix([
+		{symbol: "~", mode: "q"},
+		{symbol: "@", mode: "o"},
+		{symbol: "+", mode: "v"},
+	]);
+
+	function user(nick: string, modes: string[] = []) {
+		return new User({nick, modes}, prefix);
+	}
+
+	function nicks(list: Nicklist) {
+		return Array.from(list.values()).map((u) => u.nick);
+	}
+
+	function fill(list: Nicklist, users: User[]) {
+		users.forEach((u) => list.set(u.nick.toLowerCase(), u));
+	}
+
+	it("should order users by mode, then nick", function () {
+		const list = new Nicklist(prefix);
+		fill(list, [
+			user("zed"),
+			user("Bob", ["v"]),
+			user("alice"),
+			user("Owner", ["q"]),
+			user("carol", ["o"]),
+			user("able", ["o"]),
+		]);
+
+		expect(nicks(list)).to.deep.equal(["Owner", "able", "carol", "Bob", "alice", "zed"]);
+		expect(Array.from(list.keys())).to.deep.equal([
+			"owner",
+			"able",
+			"carol",
+			"bob",
+			"alice",
+			"zed",
+		]);
+	});
+
+	it("should sort nicks like localeCompare", function () {
+		const list = new Nicklist(prefix);
+		fill(list, [user("zed"), user("\u00e9mile"), user("eve")]);
+
+		expect(nicks(list)).to.deep.equal(["\u00e9mile", "eve", "zed"]);
+	});
+
+	it("should sort a full load on the next read", function () {
+		const list = new Nicklist(prefix);
+		list.load([user("c"), user("b", ["o"]), user("a")]);
+
+		expect(list.size).to.equal(3);
+		expect(nicks(list)).to.deep.equal(["b", "a", "c"]);
+
+		list.set("aa", user("aa"));
+		expect(nicks(list)).to.deep.equal(["b", "a", "aa", "c"]);
+	});
+
+	it("should move a user after a mode change", function () {
+		const list = new Nicklist(prefix);
+		fill(list, [user("a"), user("b"), user("c")]);
+
+		list.get("c")!.setModes(["o"], prefix);
+		list.update("c");
+		expect(nicks(list)).to.deep.equal(["c", "a", "b"]);
+
+		list.get("c")!.setModes([], prefix);
+		list.update("c");
+		expect(nicks(list)).to.deep.equal(["a", "b", "c"]);
+	});
+
+	it("should keep the order when users leave or are renamed", function () {
+		const list = new Nicklist(prefix);
+		fill(list, [user("a"), user("b", ["v"]), user("c")]);
+
+		list.delete("a");
+		expect(nicks(list)).to.deep.equal(["b", "c"]);
+
+		const renamed = list.get("c")!;
+		list.delete("c");
+		renamed.nick = "0c";
+		list.set("0c", renamed);
+		expect(nicks(list)).to.deep.equal(["b", "0c"]);
+		expect(list.has("c")).to.be.false;
+	});
+});
@@ -0,0 +1,91 @@
+import crypto from "crypto";
+import {expect} from "chai";
+import {CryptoPool} from "../../server/plugins/crypto/pool";
+import {encrypt, encodeRecord, decodeRecord} from "../../server/plugins/crypto/tasks";
+
+describe("Crypto pool", function () {
+	const key = crypto.randomBytes(32);
+	const searchKey = crypto.randomBytes(32);
+
+	for (const size of [0, 2]) {
+		describe(size === 0 ? "inline" : "with workers", function () {
+			const pool = new CryptoPool(size);
+
+			after(async function () {
+				await pool.terminate();
+			});
+
+			it("should decrypt what it encrypted", async function () {
+				const data = await pool.encrypt(key, '{"text":"hi"}', 1);
+
+				expect(Buffer.isBuffer(data)).to.be.true;
+				expect(await pool.decrypt(key, data, 1)).to.equal('{"text":"hi"}');
+			});
+
+			it("should keep the order of large batches", async function () {
+				const items: {plaintext: string; text: string}[] = [];
+
+				for (let i = 0; i < 1000; ++i) {
+					items.push({plaintext: JSON.stringify({text: `msg ${i}`}), text: `msg ${i}`});
+				}
+
+				const sealed = await pool.seal(key, searchKey, items);
+				expect(sealed[0].tokens).to.have.lengthOf(3);
+
+				const opened = await pool.open(key, sealed.map((row) => row.data));
+				expect(opened.map((msg) => msg.text)).to.deep.equal(items.map((item) => item.text));
+			});
+
+			it("should return null for rows that fail to decrypt", async function () {
+				const [sealed] = await pool.seal(key, searchKey, [{plaintext: "{}", text: ""}]);
+				const opened = await pool.open(crypto.randomBytes(32), [sealed.data]);
+
+				expect(opened).to.deep.equal([null]);
+			});
+
+			it("should parse frames without treating them as records", async function () {
+				const frames = [
+					encrypt(key, '{"type":"message","seq":1}'),
+					encrypt(key, "\x01 not json"),
+					encrypt(crypto.randomBytes(32), "{}"),
+				];
+
+				expect(await pool.frames(key, frames)).to.deep.equal([
+					{type: "message", seq: 1},
+					null,
+					null,
+				]);
+			});
+		});
+	}
+
+	describe("records", function () {
+		const json = JSON.stringify({
+			from: {mode: "@", nick: "someone"},
+			text: "hello there, how is everyone doing today?",
+			self: false,
+			highlight: false,
+			users: [],
+		});
+
+		it("should compress messages and decode them again", function () {
+			const record = encodeRecord(json);
+
+			expect(record.length).to.be.below(Buffer.byteLength(json));
+			expect(record[0]).to.equal(1);
+			expect(decodeRecord(record)).to.equal(json);
+		});
+
+		it("should keep records that don't get smaller as they are", function () {
+			expect(encodeRecord("{}").toString()).to.equal("{}");
+			expect(decodeRecord(Buffer.from("{}"))).to.equal("{}");
+		});
+
+		it("should open rows stored as plain JSON", async function () {
+			const pool = new CryptoPool(0);
+			const [opened] = await pool.open(key, [encrypt(key, json)]);
+
+			expect(opened.from.nick).to.equal("someone");
+		});
+	});
+});
@@ -0,0 +1,392 @@
+import crypto from "crypto";
+import fs from "fs";
+import os from "os";
+import path from "path";
+import {expect} from "chai";
+import Msg from "../../server/models/msg";
+import {MessageType} from "../../shared/types/msg";
+import {
+	EncryptedMessageStorage,
+	searchTrigrams,
+} from "../../server/plugins/messageStorage/encrypted";
+
+describe("Encrypted Message Storage", function () {
+	const net = {uuid: "testnet"} as any;
+	const chan = {name: "#Channel"} as any;
+	let store: EncryptedMessageStorage;
+
+	function db_get_one(stmt: string, ...params: any[]): Promise<any> {
+		return new Promise((resolve, reject) => {
+			store.database.serialize(() => {
+				store.database.get(stmt, params, (err, row) => {
+					if (err) {
+						reject(err);
+						return;
+					}
+
+					resolve(row);
+				});
+			});
+		});
+	}
+
+	beforeEach(async function () {
+		store = new EncryptedMessageStorage("testUser", crypto.randomBytes(32));
+		await store._enable(":memory:");
+		store.initDone.resolve();
+	});
+
+	afterEach(async function () {
+		await store.close();
+	});
+
+	it("splits text into distinct lowercase trigrams", function () {
+		expect(searchTrigrams("AbcAbc")).to.have.members(["abc", "bca", "cab"]);
+		expect(searchTrigrams("ab")).to.be.empty;
+	});
+
+	it("should search messages through the index", async function () {
+		const written: Promise<void>[] = [];
+
+		// Queued together, each index() resolves once its batch is committed
+		for (let i = 0; i < 20; ++i) {
+			written.push(
+				store.index(
+					net,
+					chan,
+					new Msg({
+						time: new Date(123456789 + i),
+						text: i % 2 === 0 ? `Hello world ${i}` : `unrelated ${i}`,
+					})
+				)
+			);
+		}
+
+		await Promise.all(written);
+
+		const search = await store.search({
+			searchTerm: "hello WORLD",
+			networkUuid: "testnet",
+			channelName: "#channel",
+			offset: 0,
+		});
+
+		expect(search.results.map((m) => m.text)).to.deep.equal(
+			[0, 2, 4, 6, 8, 10, 12, 14, 16, 18].map((i) => `Hello world ${i}`)
+		);
+	});
+
+	it("should still find short search terms", async function () {
+		await store.index(net, chan, new Msg({text: "a hi there"}));
+		await store.index(net, chan, new Msg({text: "nope"}));
+
+		const search = await store.search({
+			searchTerm: "hi",
+			networkUuid: "testnet",
+			channelName: "",
+			offset: 0,
+		});
+
+		expect(search.results.map((m) => m.text)).to.deep.equal(["a hi there"]);
+	});
+
+	it("should load the last messages of many channels in one batch", async function () {
+		const other = {name: "#other"} as any;
+
+		for (let i = 0; i < 5; ++i) {
+			await store.index(net, chan, new Msg({time: new Date(1000 + i), text: `chan ${i}`}));
+			await store.index(net, other, new Msg({time: new Date(2000 + i), text: `other ${i}`}));
+		}
+
+		const histories = await store.getLastMessagesBatch(
+			[
+				{networkUuid: "testnet", channelName: "#other"},
+				{networkUuid: "testnet", channelName: "#empty"},
+				{networkUuid: "testnet", channelName: "#CHANNEL"},
+			],
+			2,
+			1004
+		);
+
+		expect(histories.map((h) => h.totalMessages)).to.deep.equal([0, 0, 4]);
+		expect(histories[2].messages.map((m) => m.text)).to.deep.equal(["chan 2", "chan 3"]);
+	});
+
+	it("should limit batch history of messages sharing a time by id", async function () {
+		const channels = [{networkUuid: "testnet", channelName: "#channel"}];
+		const written: Promise<void>[] = [];
+
+		for (let i = 0; i < 5; ++i) {
+			const time = new Date(1000 + Math.min(i, 3));
+			written.push(store.index(net, chan, new Msg({time, text: `msg ${i}`})));
+		}
+
+		await Promise.all(written);
+
+		// msg 3 and msg 4 share their time, the later one is kept
+		const newest = await store.getLastMessagesBatch(channels, 1);
+		expect(newest[0].messages.map((m) => m.text)).to.deep.equal(["msg 4"]);
+
+		// The split time was left out of the cache, a page still has all of its messages
+		const page = await store.getLastMessages("testnet", "#channel", 1);
+		expect(page.map((m) => m.text)).to.deep.equal(["msg 3", "msg 4"]);
+
+		const last = await store.getLastMessagesBatch(channels, 3);
+		expect(last[0].messages.map((m) => m.text)).to.deep.equal(["msg 2", "msg 3", "msg 4"]);
+	});
+
+	it("should only load messages newer than the browser's cache", async function () {
+		const other = {name: "#other"} as any;
+
+		for (let i = 0; i < 5; ++i) {
+			await store.index(net, chan, new Msg({time: new Date(1000 + i), text: `chan ${i}`}));
+			await store.index(net, other, new Msg({time: new Date(2000 + i), text: `other ${i}`}));
+		}
+
+		const histories = await store.getNewMessagesBatch(
+			[
+				{networkUuid: "testnet", channelName: "#other", afterTime: 2004},
+				{networkUuid: "testnet", channelName: "#CHANNEL", afterTime: 1001},
+			],
+			2
+		);
+
+		expect(histories.map((h) => h.totalMessages)).to.deep.equal([5, 5]);
+		expect(histories[0].messages).to.be.empty;
+		expect(histories[1].messages.map((m) => m.text)).to.deep.equal(["chan 3", "chan 4"]);
+
+		const before = await store.getNewMessagesBatch(
+			[{networkUuid: "testnet", channelName: "#channel", afterTime: 1001}],
+			10,
+			1004
+		);
+		expect(before[0].messages.map((m) => m.text)).to.deep.equal(["chan 2", "chan 3"]);
+	});
+
+	it("should count messages from channel_stats", async function () {
+		for (let i = 0; i < 3; ++i) {
+			await store.index(net, chan, new Msg({time: new Date(1000 + i), text: `msg ${i}`}));
+		}
+
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(3);
+
+		const histories = await store.getLastMessagesBatch(
+			[{networkUuid: "testnet", channelName: "#channel"}],
+			2
+		);
+		expect(histories[0].totalMessages).to.equal(3);
+
+		await store.deleteChannel(net, chan);
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(0);
+
+		const row = await db_get_one("SELECT COUNT(*) AS count FROM channel_stats");
+		expect(row.count).to.equal(0);
+	});
+
+	it("should serve recent history from the cache", async function () {
+		for (let i = 0; i < 10; ++i) {
+			await store.index(net, chan, new Msg({time: new Date(1000 + i), text: `msg ${i}`}));
+		}
+
+		const last = await store.getLastMessages("testnet", "#channel", 5);
+		expect(last.map((m) => m.text)).to.deep.equal(["msg 5", "msg 6", "msg 7", "msg 8", "msg 9"]);
+
+		// Appended to the cached channel, and older messages are still resident
+		await store.index(net, chan, new Msg({time: new Date(2000), text: "new"}));
+		await new Promise((resolve) => store.database.run("DELETE FROM messages", resolve));
+
+		const before = await store.getMessagesBefore("testnet", "#channel", 2000, 3);
+		expect(before.map((m) => m.text)).to.deep.equal(["msg 7", "msg 8", "msg 9"]);
+	});
+
+	it("should drop index postings with the channel", async function () {
+		await store.index(net, chan, new Msg({text: "goodbye"}));
+		await store.deleteChannel(net, chan);
+
+		const row = await db_get_one("SELECT COUNT(*) AS count FROM search_index");
+		expect(row.count).to.equal(0);
+	});
+
+	it("should page through mentions until they are dismissed", async function () {
+		for (let i = 0; i < 10; ++i) {
+			await store.index(net, chan, new Msg({text: `hey bencher ${i}`}), i % 2 === 0);
+		}
+
+		const newest = await store.getMentions(null, 3);
+		expect(newest.map((m) => m.msg.text)).to.deep.equal(
+			[4, 6, 8].map((i) => `hey bencher ${i}`)
+		);
+		expect(newest[0]).to.include({network: "testnet", channel: "#channel"});
+
+		const older = await store.getMentions(newest[0].id, 3);
+		expect(older.map((m) => m.msg.text)).to.deep.equal(["hey bencher 0", "hey bencher 2"]);
+
+		await store.dismissMentions(older[0].id);
+		expect(await store.getMentions(null, 10)).to.have.length(4);
+
+		await store.dismissMentions();
+		expect(await store.getMentions(null, 10)).to.be.empty;
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(10);
+
+		// Go away with the messages they point to
+		await store.index(net, chan, new Msg({text: "hey again"}), true);
+		await store.deleteChannel(net, chan);
+		const row = await db_get_one("SELECT COUNT(*) AS count FROM mentions");
+		expect(row.count).to.equal(0);
+	});
+
+	it("should delete old status messages and give the space back", async function () {
+		const old = new Date(Date.now() - 10 * 24 * 60 * 60 * 1000);
+
+		const written: Promise<void>[] = [];
+
+		for (let i = 0; i < 50; ++i) {
+			written.push(
+				store.index(net, chan, new Msg({time: old, type: MessageType.JOIN, text: "x"}))
+			);
+		}
+
+		await Promise.all(written);
+
+		await store.index(net, chan, new Msg({time: old, text: "old but precious"}));
+		await store.index(net, chan, new Msg({type: MessageType.JOIN, text: "recent"}));
+		await store.getLastMessages("testnet", "#channel", 100);
+
+		const deleted = await store.deleteMessages({
+			olderThanDays: 7,
+			messageTypes: [MessageType.JOIN],
+			limit: 40,
+		});
+		expect(deleted).to.equal(40);
+		expect(
+			await store.deleteMessages({
+				olderThanDays: 7,
+				messageTypes: [MessageType.JOIN],
+				limit: 40,
+			})
+		).to.equal(10);
+
+		// Neither the counters nor the cache still have the deleted ones
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(2);
+		const last = await store.getLastMessages("testnet", "#channel", 100);
+		expect(last.map((m) => m.text)).to.deep.equal(["old but precious", "recent"]);
+
+		const vacuum = await db_get_one("PRAGMA auto_vacuum");
+		expect(vacuum.auto_vacuum).to.equal(2); // incremental
+
+		while (await store.reclaimSpace()) {
+			// a step at a time
+		}
+
+		const free = await db_get_one("PRAGMA freelist_count");
+		expect(free.freelist_count).to.equal(0);
+	});
+
+	it("should only wrap the data key again when the password changes", async function () {
+		const file = path.join(os.tmpdir(), `thelounge-test-${process.pid}.encrypted.sqlite3`);
+		const oldKey = crypto.randomBytes(32);
+		const newKey = crypto.randomBytes(32);
+
+		async function open(key: Buffer) {
+			const storage = new EncryptedMessageStorage("testUser", key);
+			await storage._enable(file);
+			storage.initDone.resolve();
+			return storage;
+		}
+
+		try {
+			await store.close();
+			store = await open(oldKey);
+			await store.index(net, chan, new Msg({text: "before"}));
+			await store.writes.flush();
+
+			const before = await db_get_one("SELECT encrypted_data FROM messages");
+			await store.changeEncryptionKey(oldKey, newKey);
+
+			const after = await db_get_one("SELECT encrypted_data FROM messages");
+			expect(after.encrypted_data.equals(before.encrypted_data)).to.be.true;
+			await store.close();
+
+			let error: Error | null = null;
+			await open(oldKey).catch((e) => (error = e));
+			expect(error).to.be.an("error");
+
+			store = await open(newKey);
+			const last = await store.getLastMessages("testnet", "#channel", 5);
+			expect(last.map((m) => m.text)).to.deep.equal(["before"]);
+		} finally {
+			fs.rmSync(file, {force: true});
+		}
+	});
+
+	it("should rotate the data key and index every row again", async function () {
+		for (let i = 0; i < 3; ++i) {
+			await store.index(net, chan, new Msg({time: new Date(1000 + i), text: `hello ${i}`}));
+		}
+
+		await store.writes.flush();
+		const before = await db_get_one("SELECT encrypted_data FROM messages WHERE id = 1");
+
+		await store.rotateDataKey();
+
+		const after = await db_get_one("SELECT encrypted_data FROM messages WHERE id = 1");
+		expect(after.encrypted_data.equals(before.encrypted_data)).to.be.false;
+
+		const pending = await db_get_one(
+			"SELECT COUNT(*) AS count FROM options WHERE name = 'previous_data_key'"
+		);
+		expect(pending.count).to.equal(0);
+
+		const search = await store.search({
+			searchTerm: "hello",
+			networkUuid: "testnet",
+			channelName: "#channel",
+			offset: 0,
+		});
+		expect(search.results.map((m) => m.text)).to.deep.equal(["hello 0", "hello 1", "hello 2"]);
+	});
+
+	it("should rotate an upgraded database off the password derived key", async function () {
+		const file = path.join(os.tmpdir(), `thelounge-test-${process.pid}.legacy.sqlite3`);
+		const key = crypto.randomBytes(32);
+
+		async function open() {
+			const storage = new EncryptedMessageStorage("testUser", key);
+			await storage._enable(file);
+			storage.initDone.resolve();
+			return storage;
+		}
+
+		try {
+			// Written like before data keys existed, with the password derived key
+			await store.close();
+			store = await open();
+			(store as any).useDataKey(key);
+			await store.index(net, chan, new Msg({text: "legacy"}));
+			await new Promise((resolve) =>
+				store.database.run("DELETE FROM options WHERE name = 'data_key'", resolve)
+			);
+			const before = await db_get_one("SELECT encrypted_data FROM messages");
+			await store.close();
+
+			// Flagged when opened, the rotation clears the flag and finishes on its own
+			store = await open();
+			const pending =
+				"SELECT COUNT(*) AS count FROM options WHERE name IN ('legacy_data_key', 'previous_data_key')";
+
+			for (let i = 0; i < 100 && (await db_get_one(pending)).count > 0; ++i) {
+				await new Promise((resolve) => setTimeout(resolve, 10));
+			}
+
+			expect((await db_get_one(pending)).count).to.equal(0);
+
+			const after = await db_get_one("SELECT encrypted_data FROM messages");
+			expect(after.encrypted_data.equals(before.encrypted_data)).to.be.false;
+
+			const last = await store.getLastMessages("testnet", "#channel", 1);
+			expect(last.map((m) => m.text)).to.deep.equal(["legacy"]);
+		} finally {
+			fs.rmSync(file, {force: true});
+		}
+	});
+});
@@ -0,0 +1,76 @@
+import {expect} from "chai";
+import Msg from "../../server/models/msg";
+import HistoryCache from "../../server/plugins/messageStorage/historyCache";
+
+describe("History cache", function () {
+	const messages = (times: number[]) => times.map((time) => new Msg({time: new Date(time)}));
+	const times = (msgs?: Msg[]) => msgs && msgs.map((msg) => msg.time.getTime());
+
+	it("should only serve windows that are fully resident", function () {
+		const cache = new HistoryCache();
+		cache.merge("chan", cache.stamp("chan"), messages([3, 4, 5, 6]), [1, 1, 1, 1], 3);
+
+		expect(times(cache.window("chan", 2))).to.deep.equal([5, 6]);
+		expect(times(cache.window("chan", 2, 6))).to.deep.equal([4, 5]);
+		expect(cache.window("chan", 5)).to.be.undefined;
+		expect(cache.window("other", 1)).to.be.undefined;
+	});
+
+	it("should serve anything from a complete channel", function () {
+		const cache = new HistoryCache();
+		cache.merge("chan", cache.stamp("chan"), messages([3, 4]), [1, 1], -Infinity);
+
+		expect(times(cache.window("chan", 100))).to.deep.equal([3, 4]);
+		expect(times(cache.window("chan", 100, 3))).to.deep.equal([]);
+	});
+
+	it("should append new messages and extend downwards without gaps", function () {
+		const cache = new HistoryCache();
+		cache.merge("chan", cache.stamp("chan"), messages([5, 6]), [1, 1], 5);
+		cache.append("chan", 7, 1, () => new Msg({time: new Date(7)}));
+
+		// Gap between 3 and 5 (until < floor), not merged
+		cache.merge("chan", cache.stamp("chan"), messages([1, 2]), [1, 1], 1, 3);
+		expect(cache.window("chan", 4)).to.be.undefined;
+
+		cache.merge("chan", cache.stamp("chan"), messages([3, 4]), [1, 1], 3, 5);
+		expect(times(cache.window("chan", 5))).to.deep.equal([3, 4, 5, 6, 7]);
+	});
+
+	it("should serve messages newer than a time only if all of them are resident", function () {
+		const cache = new HistoryCache();
+		cache.merge("chan", cache.stamp("chan"), messages([3, 4, 5, 6]), [1, 1, 1, 1], 3);
+
+		expect(times(cache.since("chan", 4, 10))).to.deep.equal([5, 6]);
+		expect(times(cache.since("chan", 3, 1))).to.deep.equal([6]);
+		expect(times(cache.since("chan", 3, 10, 6))).to.deep.equal([4, 5]);
+		expect(times(cache.since("chan", 6, 10))).to.deep.equal([]);
+		expect(cache.since("chan", 2, 10)).to.be.undefined;
+		expect(cache.since("other", 2, 10)).to.be.undefined;
+	});
+
+	it("should drop loads that raced a write", function () {
+		const cache = new HistoryCache();
+		const stamp = cache.stamp("chan");
+
+		cache.append("chan", 7, 1, () => new Msg({time: new Date(7)}));
+		cache.merge("chan", stamp, messages([5, 6]), [1, 1], 5);
+
+		expect(cache.window("chan", 1)).to.be.undefined;
+	});
+
+	it("should stay within its byte budgets", function () {
+		const cache = new HistoryCache(9, 4);
+		cache.merge("a", cache.stamp("a"), messages([1, 2, 2, 3]), [2, 2, 2, 2], -Infinity);
+
+		// Both messages at time 2 are dropped together
+		expect(times(cache.window("a", 1))).to.deep.equal([3]);
+		expect(cache.window("a", 2)).to.be.undefined;
+
+		cache.merge("b", cache.stamp("b"), messages([1, 2]), [4, 4], -Infinity);
+		cache.merge("c", cache.stamp("c"), messages([1]), [4], -Infinity);
+
+		expect(cache.size).to.be.at.most(9);
+		expect(cache.window("a", 1)).to.be.undefined;
+	});
+});
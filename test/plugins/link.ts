@@ -3,6 +3,7 @@ import {expect} from "chai";
 import util from "../util";
 import Config from "../../server/config";
 import link from "../../server/plugins/irc-events/link";
+import linkPreviewCache, {previewCacheKey} from "../../server/plugins/linkPreviewCache";
 import {LinkPreview} from "../../shared/types/msg";
 
 describe("Link plugin", function () {
@@ -39,6 +40,7 @@ Vivamus bibendum vulputate tincidunt. Sed vitae ligula felis.`;
 		this.network = util.createNetwork();
 
 		Config.values.prefetchStorage = false;
+		linkPreviewCache.clear();
 	});
 
 	afterEach(function (done) {
@@ -719,4 +721,73 @@ Vivamus bibendum vulputate tincidunt. Sed vitae ligula felis.`;
 
 		this.irc.on("msg:preview", cb);
 	});
+
+	it("should show a link posted again from the cache", function (done) {
+		const url = this._makeUrl("cached-og");
+		const first = this.irc.createMessage({text: url});
+		let requests = 0;
+
+		app.get("/cached-og", function (req, res) {
+			requests++;
+			res.set("Cache-Control", "max-age=600");
+			res.send("<title>cached title</title>");
+		});
+
+		link(this.irc, this.network.channels[0], first, first.text);
+
+		this.irc.once("msg:preview", (data) => {
+			expect(data.preview.head).to.equal("cached title");
+
+			const second = this.irc.createMessage({text: url});
+			link(this.irc, this.network.channels[0], second, second.text);
+
+			expect(second.previews).to.deep.equal([{...data.preview, shown: null}]);
+			expect(second.previews[0]).to.not.equal(data.preview);
+			expect(requests).to.equal(1);
+			done();
+		});
+	});
+
+	it("should use a cached preview without fetching", function () {
+		const url = this._makeUrl("never-fetched");
+		const message = this.irc.createMessage({text: url});
+		let requests = 0;
+
+		app.get("/never-fetched", function (req, res) {
+			requests++;
+			res.send("<title>fetched</title>");
+		});
+
+		const cached = {type: "link", head: "from cache", body: "", thumb: "", size: -1};
+		linkPreviewCache.set(previewCacheKey(url, ""), cached, 60000);
+
+		link(this.irc, this.network.channels[0], message, message.text);
+
+		expect(message.previews).to.deep.equal([{...cached, link: url, shown: null}]);
+		expect(requests).to.equal(0);
+	});
+
+	it("should remember links without a preview", function (done) {
+		const url = this._makeUrl("cached-none.css");
+		const first = this.irc.createMessage({text: url});
+		let requests = 0;
+
+		app.get("/cached-none.css", (req, res) => {
+			requests++;
+			res.type("text/css").send("body {}");
+
+			setTimeout(() => {
+				expect(first.previews).to.be.empty;
+
+				const second = this.irc.createMessage({text: url});
+				link(this.irc, this.network.channels[0], second, second.text);
+
+				expect(second.previews).to.be.empty;
+				expect(requests).to.equal(1);
+				done();
+			}, 100);
+		});
+
+		link(this.irc, this.network.channels[0], first, first.text);
+	});
 });
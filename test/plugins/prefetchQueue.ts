@@ -0,0 +1,96 @@
+import {expect} from "chai";
+
+import Config from "../../server/config";
+import prefetchQueue, {PrefetchCancelledError} from "../../server/plugins/prefetchQueue";
+
+describe("Prefetch queue", function () {
+	const started: string[] = [];
+	const finishers: (() => void)[] = [];
+
+	// Task that records when it starts and runs until it's finished by the test
+	function task(name: string) {
+		return () =>
+			new Promise<string>((resolve) => {
+				started.push(name);
+				finishers.push(() => resolve(name));
+			});
+	}
+
+	function finishAll() {
+		finishers.splice(0).forEach((finish) => finish());
+		return new Promise((resolve) => setImmediate(resolve));
+	}
+
+	let maxRunning: number;
+	let maxPerHost: number;
+
+	beforeEach(function () {
+		maxRunning = Config.values.prefetchMaxConcurrency;
+		maxPerHost = Config.values.prefetchMaxHostConcurrency;
+		Config.values.prefetchMaxConcurrency = 2;
+		Config.values.prefetchMaxHostConcurrency = 1;
+		started.length = 0;
+	});
+
+	afterEach(async function () {
+		// Queued requests start as others finish
+		while (finishers.length > 0) {
+			await finishAll();
+		}
+
+		Config.values.prefetchMaxConcurrency = maxRunning;
+		Config.values.prefetchMaxHostConcurrency = maxPerHost;
+	});
+
+	it("should limit requests at once and to the same host", async function () {
+		void prefetchQueue.run("a", {}, false, task("a1")).promise;
+		void prefetchQueue.run("a", {}, false, task("a2")).promise;
+		void prefetchQueue.run("b", {}, false, task("b1")).promise;
+		void prefetchQueue.run("c", {}, false, task("c1")).promise;
+
+		expect(started).to.deep.equal(["a1", "b1"]);
+		expect(prefetchQueue.stats()).to.include({queued: 2, running: 2});
+
+		await finishAll();
+		expect(started).to.deep.equal(["a1", "b1", "a2", "c1"]);
+	});
+
+	it("should run requests for open channels first", async function () {
+		void prefetchQueue.run("a", {}, false, task("busy1")).promise;
+		void prefetchQueue.run("b", {}, false, task("busy2")).promise;
+
+		const later = {};
+		void prefetchQueue.run("c", {}, false, task("closed")).promise;
+		const joined = prefetchQueue.run("d", later, false, task("joined"));
+		void prefetchQueue.run("e", {}, true, task("open")).promise;
+		joined.join({}, true);
+
+		await finishAll();
+		expect(started.slice(2)).to.deep.equal(["open", "joined"]);
+	});
+
+	it("should drop requests of messages that fell out of history", async function () {
+		void prefetchQueue.run("a", {}, false, task("busy1")).promise;
+		void prefetchQueue.run("b", {}, false, task("busy2")).promise;
+
+		const msg = {};
+		const shared = {};
+		const dropped = prefetchQueue.run("c", msg, false, task("dropped"));
+		const kept = prefetchQueue.run("d", msg, false, task("kept"));
+		kept.join(shared, false);
+
+		prefetchQueue.cancel([msg]);
+
+		let error: unknown;
+		await dropped.promise.catch((e) => (error = e));
+		expect(error).to.be.instanceOf(PrefetchCancelledError);
+		expect(prefetchQueue.isCancelled(msg)).to.be.true;
+		expect(prefetchQueue.isCancelled(shared)).to.be.false;
+
+		await finishAll();
+		expect(started).to.deep.equal(["busy1", "busy2", "kept"]);
+
+		await finishAll();
+		expect(await kept.promise).to.equal("kept");
+	});
+});
@@ -232,6 +232,48 @@ describe("SQLite unit tests", function () {
 		messages = await store.getMessages(net, chan, () => id++);
 		expect(messages.map((m) => m.type)).to.have.ordered.members([MessageType.AWAY]);
 	});
+
+	it("keeps channel_stats in sync with the messages", async function () {
+		const baseDate = new Date();
+
+		const net = {uuid: "testnet"} as any;
+		const chan = {name: "#Channel"} as any;
+		const other = {name: "#other"} as any;
+
+		for (let i = 0; i < 5; ++i) {
+			await store.index(net, chan, new Msg({time: dateAddDays(baseDate, -i), text: `${i}`}));
+		}
+
+		await store.index(net, other, new Msg({time: baseDate, text: "other"}));
+
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(5);
+		expect(await store.getMessageCount("testnet", "#other")).to.equal(1);
+
+		const deleted = await store.deleteMessages({
+			messageTypes: null,
+			limit: 100,
+			olderThanDays: 2,
+		});
+		expect(deleted).to.equal(3);
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(2);
+
+		const stats = await new Promise((resolve, reject) =>
+			store.database.get(
+				"SELECT count, min_time, max_time FROM channel_stats WHERE channel = ?",
+				["#channel"],
+				(err, row) => (err ? reject(err) : resolve(row))
+			)
+		);
+		expect(stats).to.deep.equal({
+			count: 2,
+			min_time: dateAddDays(baseDate, -1).getTime(),
+			max_time: baseDate.getTime(),
+		});
+
+		await store.deleteChannel(net, other);
+		expect(await store.getMessageCount("testnet", "#other")).to.equal(0);
+		expect(await store.getMessageCount("testnet", "#channel")).to.equal(2);
+	});
 });
 
 describe("SQLite Message Storage", function () {
@@ -351,23 +393,39 @@ describe("SQLite Message Storage", function () {
 		expect(msg.time.getTime()).to.equal(123456789);
 	});
 
+	it("should read history through a read only connection", async function () {
+		const row = await db_get_one("PRAGMA journal_mode");
+		expect(row.journal_mode).to.equal("wal");
+		expect(store.reader).to.not.be.null;
+
+		const err = await new Promise((resolve) => store.reader!.run("DELETE FROM messages", resolve));
+		expect(err).to.be.an("error");
+	});
+
 	it("should retrieve latest LIMIT messages in order", async function () {
 		const originalMaxHistory = Config.values.maxHistory;
 
 		try {
 			Config.values.maxHistory = 2;
 
+			const written: Promise<void>[] = [];
+
+			// Queued together, each index() resolves once its batch is committed
 			for (let i = 0; i < 200; ++i) {
-				await store.index(
-					{uuid: "retrieval-order-test-network"} as any,
-					{name: "#channel"} as any,
-					new Msg({
-						time: 123456789 + i,
-						text: `msg ${i}`,
-					} as any)
+				written.push(
+					store.index(
+						{uuid: "retrieval-order-test-network"} as any,
+						{name: "#channel"} as any,
+						new Msg({
+							time: 123456789 + i,
+							text: `msg ${i}`,
+						} as any)
+					)
 				);
 			}
 
+			await Promise.all(written);
+
 			let msgId = 0;
 			const messages = await store.getMessages(
 				{uuid: "retrieval-order-test-network"} as any,
@@ -406,6 +464,60 @@ describe("SQLite Message Storage", function () {
 		}
 	});
 
+	it("should page search results with a cursor", async function () {
+		const query = {
+			searchTerm: "msg",
+			networkUuid: "retrieval-order-test-network",
+			channelName: "",
+			offset: 0,
+		};
+
+		const first = await store.search(query);
+		expect(first.nextCursor).to.not.be.null;
+
+		const second = await store.search({...query, offset: 100, cursor: first.nextCursor!});
+		expect(second.results.map((msg) => msg.text)).to.deep.equal(
+			Array.from({length: 100}, (_, i) => `msg ${i}`)
+		);
+
+		const last = await store.search({...query, offset: 200, cursor: second.nextCursor!});
+		expect(last.results).to.be.empty;
+		expect(last.nextCursor).to.be.null;
+	});
+
+	it("should not split messages sharing a time between history pages", async function () {
+		const net = {uuid: "same-time-network"} as any;
+		const chan = {name: "#channel"} as any;
+
+		for (let i = 0; i < 5; ++i) {
+			await store.index(net, chan, new Msg({time: 1000 + Math.min(i, 3), text: `${i}`} as any));
+		}
+
+		// messages 3 and 4 share their time
+		const last = await store.getLastMessages("same-time-network", "#channel", 1);
+		expect(last.map((msg) => msg.text)).to.deep.equal(["3", "4"]);
+
+		const before = await store.getMessagesBefore("same-time-network", "#channel", 1003, 2);
+		expect(before.map((msg) => msg.text)).to.deep.equal(["1", "2"]);
+	});
+
+	it("should limit batch history of messages sharing a time by id", async function () {
+		const net = {uuid: "same-time-batch-network"} as any;
+		const chan = {name: "#channel"} as any;
+		const channels = [{networkUuid: "same-time-batch-network", channelName: "#channel"}];
+
+		for (let i = 0; i < 5; ++i) {
+			await store.index(net, chan, new Msg({time: 1000 + Math.min(i, 3), text: `${i}`} as any));
+		}
+
+		// messages 3 and 4 share their time, the later one is kept
+		const last = await store.getLastMessagesBatch(channels, 1);
+		expect(last[0].messages.map((msg) => msg.text)).to.deep.equal(["4"]);
+
+		const newer = await store.getNewMessagesBatch([{...channels[0], afterTime: 1000}], 3);
+		expect(newer[0].messages.map((msg) => msg.text)).to.deep.equal(["2", "3", "4"]);
+	});
+
 	it("should search messages with escaped wildcards", async function () {
 		async function assertResults(query: string, expected: string[]) {
 			const search = await store.search({
@@ -131,6 +131,47 @@ describe("Image storage", function () {
 		});
 	});
 
+	it("should not leave a temporary file after storing an image", function (done) {
+		const real_test_img_url = this._makeUrl("real-test-image.png");
+		const message = this.irc.createMessage({
+			text: `${real_test_img_url}?again`,
+		});
+
+		link(this.irc, this.network.channels[0], message, message.text);
+
+		this.irc.once("msg:preview", function (data) {
+			expect(data.preview.thumb).to.equal(correctImageURL);
+			expect(fs.readdirSync(path.join(Config.getStoragePath(), "tmp"))).to.be.empty;
+			done();
+		});
+	});
+
+	it("should delete stored files that no message refers to", async function () {
+		const upload = storage.upload();
+		upload.write(Buffer.from("orphan"));
+
+		const url = await upload.commit("txt");
+		const filePath = path.join(Config.getStoragePath(), url.substring(8));
+		expect(fs.existsSync(filePath)).to.be.true;
+
+		storage.removeOrphans(Date.now() + 2 * 60 * 1000);
+		await new Promise((resolve) => setTimeout(resolve, 50));
+		expect(fs.existsSync(filePath)).to.be.false;
+	});
+
+	it("should ask for a pause while the file is behind", async function () {
+		const upload = storage.upload();
+		const chunk = Buffer.alloc(64 * 1024, "a");
+
+		expect(upload.write(chunk)).to.be.false;
+		await new Promise<void>((resolve) => upload.drain(resolve));
+		expect(upload.write(Buffer.from("b"))).to.be.true;
+
+		const url = await upload.commit("txt");
+		const filePath = path.join(Config.getStoragePath(), url.substring(8));
+		expect(fs.statSync(filePath).size).to.equal(chunk.length + 1);
+	});
+
 	it("should clear storage folder", function () {
 		const dir = Config.getStoragePath();
 
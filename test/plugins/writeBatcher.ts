@@ -0,0 +1,75 @@
+import {expect} from "chai";
+import WriteBatcher from "../../server/plugins/messageStorage/writeBatcher";
+
+describe("WriteBatcher", function () {
+	it("should write a full batch at once", async function () {
+		const batches: number[][] = [];
+		const batcher = new WriteBatcher<number>(async (items) => {
+			batches.push(items);
+		}, 3);
+
+		for (let i = 0; i < 7; ++i) {
+			void batcher.push(i);
+		}
+
+		await batcher.flush();
+
+		expect(batches).to.deep.equal([[0, 1, 2], [3, 4, 5], [6]]);
+	});
+
+	it("should write queued items after the delay", async function () {
+		const batches: number[][] = [];
+		const batcher = new WriteBatcher<number>(
+			async (items) => {
+				batches.push(items);
+			},
+			100,
+			5
+		);
+
+		void batcher.push(1);
+		void batcher.push(2);
+		expect(batches).to.be.empty;
+
+		await new Promise((resolve) => setTimeout(resolve, 20));
+		expect(batches).to.deep.equal([[1, 2]]);
+		expect(batcher.size).to.equal(0);
+	});
+
+	it("should not run exclusive work alongside a batch", async function () {
+		const events: string[] = [];
+		const batcher = new WriteBatcher<number>(async (items) => {
+			events.push(`start ${items.join()}`);
+			await new Promise((resolve) => setTimeout(resolve, 5));
+			events.push(`end ${items.join()}`);
+		});
+
+		void batcher.push(1);
+		await batcher.exclusive(async () => {
+			events.push("exclusive");
+		});
+
+		expect(events).to.deep.equal(["start 1", "end 1", "exclusive"]);
+	});
+
+	it("should settle items with the batch they were written in", async function () {
+		let fail = true;
+		const batcher = new WriteBatcher<number>(async (items) => {
+			if (fail) {
+				throw new Error(`cannot write ${items.join()}`);
+			}
+		});
+
+		const failed = batcher.push(1).then(
+			() => "written",
+			(err: Error) => err.message
+		);
+		await batcher.flush();
+		expect(await failed).to.equal("cannot write 1");
+
+		fail = false;
+		const written = batcher.push(2);
+		await batcher.flush();
+		await written;
+	});
+});
@@ -0,0 +1,61 @@
+import fs from "fs";
+import os from "os";
+import path from "path";
+import {expect} from "chai";
+
+import shard from "../server/shard";
+import {requestUser} from "../server/shardRouter";
+
+describe("Shard router", function () {
+	it("should read the user from the routing cookie", function () {
+		expect(requestUser("a=b; thelounge-user=J%C3%BCrgen; c=d")).to.equal("Jürgen");
+		expect(requestUser("thelounge-user=")).to.be.null;
+		expect(requestUser("thelounge-user=%E0%A4%A")).to.be.null;
+		expect(requestUser(undefined)).to.be.null;
+	});
+
+	it("should spread users over the shards by their lowercased name", function () {
+		const counts = [0, 0, 0, 0];
+
+		for (let i = 0; i < 400; i++) {
+			const index = shard.indexOf(`user${i}`, counts.length);
+			expect(shard.indexOf(`USER${i}`, counts.length)).to.equal(index);
+			counts[index]++;
+		}
+
+		for (const count of counts) {
+			expect(count).to.be.within(60, 140);
+		}
+
+		// Not sharded, this process serves everyone
+		expect(shard.ownsUser("anyone")).to.be.true;
+		expect(shard.own("storage")).to.equal("storage");
+	});
+
+	it("should remove the files of shards beyond the shard count", function () {
+		const dir = fs.mkdtempSync(path.join(os.tmpdir(), "thelounge-shards-"));
+
+		try {
+			for (const name of ["storage", "storage-0", "storage-1", "storage-2"]) {
+				fs.mkdirSync(path.join(dir, name, "ab"), {recursive: true});
+			}
+
+			for (const name of ["link-previews-0.json", "link-previews-3.json", "users"]) {
+				fs.writeFileSync(path.join(dir, name), "");
+			}
+
+			const removed = shard.removeStale(dir, ["storage", "link-previews.json"], 2);
+
+			expect(removed.sort()).to.deep.equal(["link-previews-3.json", "storage-2"]);
+			expect(fs.readdirSync(dir).sort()).to.deep.equal([
+				"link-previews-0.json",
+				"storage",
+				"storage-0",
+				"storage-1",
+				"users",
+			]);
+		} finally {
+			fs.rmSync(dir, {recursive: true, force: true});
+		}
+	});
+});
@@ -0,0 +1,80 @@
+import {expect} from "chai";
+
+import Msg from "../../server/models/msg";
+import Prefix from "../../server/models/prefix";
+import User from "../../server/models/user";
+import {MessageType} from "../../shared/types/msg";
+import {
+	compactChannel,
+	decodeMessages,
+	decodeUsers,
+	encodeMessages,
+	encodeUsers,
+	expandChannel,
+} from "../../shared/compactWire";
+
+describe("compactWire", function () {
+	// What a client gets without the compact format
+	const json = (value: any) => JSON.parse(JSON.stringify(value));
+
+	const messages = [
+		new Msg({
+			id: 10,
+			time: new Date(1700000000000),
+			from: {nick: "alice", mode: "@"},
+			text: "hello",
+			highlight: true,
+		}),
+		new Msg({
+			id: 11,
+			time: new Date(1700000001500),
+			type: MessageType.JOIN,
+			from: {nick: "bob", mode: ""},
+			hostmask: "bob@example.com",
+			self: true,
+		}),
+		new Msg({
+			id: 15,
+			time: new Date(1700000001500),
+			from: {nick: "alice", mode: "@"},
+			text: "https://example.com",
+			previews: [{link: "https://example.com", type: "link"} as any],
+		}),
+	];
+
+	it("should decode messages to what JSON would send", function () {
+		const compact = json(encodeMessages(messages));
+
+		expect(compact.strings).to.deep.equal(["message", "alice", "@", "join", "bob", ""]);
+		expect(compact.id).to.deep.equal([10, 1, 4]);
+		expect(compact.time).to.deep.equal([1700000000000, 1500, 0]);
+		expect(decodeMessages(compact)).to.deep.equal(json(messages));
+	});
+
+	it("should decode users to what JSON would send", function () {
+		const prefix = new Prefix([
+			{symbol: "@", mode: "o"},
+			{symbol: "+", mode: "v"},
+		]);
+		const users = [
+			new User({nick: "alice", modes: ["o", "v"], away: "lunch"}, prefix),
+			new User({nick: "bob", lastMessage: 1700000000000}, prefix),
+		];
+
+		expect(decodeUsers(json(encodeUsers(users)))).to.deep.equal(json(users));
+	});
+
+	it("should compact and expand a channel", function () {
+		const chan: any = {id: 1, messages: json(messages), users: [], name: "#chan"};
+		compactChannel(chan);
+
+		expect(chan.messages).to.be.empty;
+		expect(chan.compact.messages).to.exist;
+		expect(chan.compact.users).to.not.exist;
+
+		expandChannel(chan);
+
+		expect(chan.compact).to.not.exist;
+		expect(chan.messages).to.deep.equal(json(messages));
+	});
+});